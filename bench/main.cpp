@@ -0,0 +1,413 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Opcodes.hpp"
+#include "SynacorVM.hpp"
+#include "Walkthrough.hpp"
+
+// Synacor VM benchmark suite.
+// Runs a fixed set of deterministic workloads under every engine and reports the results as JSON.
+
+namespace
+{
+    const ushort R0 = 0x8000, R1 = 0x8001, R2 = 0x8002, R3 = 0x8003, R4 = 0x8004, R5 = 0x8005, R6 = 0x8006, R7 = 0x8007;
+
+    // A program image plus the input fed to it. Runs until it halts or runs out of input.
+    struct Workload
+    {
+        std::string name;
+        std::shared_ptr<MemoryImage> image;
+        std::vector<std::string> input;
+    };
+
+    struct Result
+    {
+        std::string workload;
+        std::string engine;
+        unsigned long long instructions;
+        unsigned long long outputHash;
+        std::vector<double> seconds;
+        long peakRssKb;
+    };
+
+    std::shared_ptr<MemoryImage> makeImage(const std::vector<ushort> &program)
+    {
+        std::vector<ushort> memory(MemoryImage::words, 0);
+        std::copy(program.begin(), program.begin() + std::min(program.size(), memory.size()), memory.begin());
+
+        return std::make_shared<MemoryImage>(memory.data());
+    }
+
+    // Builds a workload from a walkthrough: the patched binary plus all game input.
+    Workload scriptedWorkload(const std::string &name, const std::string &filename, const std::string &resourceDir)
+    {
+        Walkthrough walkthrough = Walkthrough::read(filename, resourceDir);
+
+        SynacorVM vm;
+        walkthrough.prepare(vm);
+
+        return { name, std::make_shared<MemoryImage>(vm.memory()), walkthrough.input };
+    }
+
+    // Boots a binary up to its first prompt.
+    Workload bootWorkload(const std::string &name, const std::string &binary)
+    {
+        return { name, std::make_shared<MemoryImage>(binary), {} };
+    }
+
+    // Tight loop over the arithmetic and logic opcodes.
+    Workload arithmeticWorkload()
+    {
+        std::vector<ushort> p;
+        auto emit = [&p](std::initializer_list<ushort> words)
+        {
+            ushort at = static_cast<ushort>(p.size());
+            p.insert(p.end(), words);
+            return at;
+        };
+
+        emit({ Set, R7, 16 });
+        ushort outer = emit({ Set, R0, 32767 });
+        ushort loop = emit({ Add, R1, R1, R0 });
+        emit({ Mult, R2, R1, 3 });
+        emit({ Mod, R3, R2, 12345 });
+        emit({ And, R4, R2, R3 });
+        emit({ Or, R5, R4, R1 });
+        emit({ Not, R6, R5 });
+        emit({ Add, R0, R0, 32767 });
+        emit({ Jt, R0, loop });
+        emit({ Add, R7, R7, 32767 });
+        emit({ Jt, R7, outer });
+        emit({ Halt });
+
+        return { "synthetic-arithmetic", makeImage(p), {} };
+    }
+
+    // Naive recursive Fibonacci, dominated by CALL, RET, PUSH and POP.
+    Workload recursionWorkload()
+    {
+        std::vector<ushort> p;
+        auto emit = [&p](std::initializer_list<ushort> words)
+        {
+            ushort at = static_cast<ushort>(p.size());
+            p.insert(p.end(), words);
+            return at;
+        };
+
+        emit({ Set, R0, 25 });
+        ushort callFib = emit({ Call, 0 });
+        emit({ Halt });
+
+        ushort fib = emit({ Gt, R1, R0, 1 });
+        ushort jumpRec = emit({ Jt, R1, 0 });
+        emit({ Ret });
+        ushort rec = emit({ Push, R0 });
+        emit({ Add, R0, R0, 32767 });
+        emit({ Call, fib });
+        emit({ Pop, R1 });
+        emit({ Push, R0 });
+        emit({ Add, R0, R1, 32766 });
+        emit({ Call, fib });
+        emit({ Pop, R1 });
+        emit({ Add, R0, R0, R1 });
+        emit({ Ret });
+
+        p[callFib + 1] = fib;
+        p[jumpRec + 2] = rec;
+
+        return { "synthetic-recursion", makeImage(p), {} };
+    }
+
+    // Resets the peak resident set size of the process to its current size, so that peakRssKb() reports the peak of
+    //  whatever runs in between. Returns false if the platform does not support this.
+    bool resetPeakRss()
+    {
+#ifdef __linux__
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        return clearRefs && (clearRefs << "5").flush();
+#else
+        return false;
+#endif
+    }
+
+    // Returns the peak resident set size since the last resetPeakRss(), in KiB, or 0 if unknown.
+    long peakRssKb()
+    {
+#ifdef __linux__
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 6, "VmHWM:") == 0)
+                return std::stol(line.substr(6));
+        }
+#endif
+        return 0;
+    }
+
+    // FNV-1a
+    unsigned long long hashOutput(const std::string &output)
+    {
+        unsigned long long hash = 14695981039346656037ull;
+        for (unsigned char ch : output)
+            hash = (hash ^ ch) * 1099511628211ull;
+
+        return hash;
+    }
+
+    Result runWorkload(const Workload &workload, SynacorVM::Engine engine, unsigned repetitions)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        Result result = { workload.name, SynacorVM::engineName(engine), 0, 0, {}, 0 };
+        bool measureRss = resetPeakRss();
+
+        for (unsigned rep = 0; rep != repetitions; ++rep)
+        {
+            BufferedIO io;
+            SynacorVM vm;
+            vm.setIO(io);
+            vm.setEngine(engine);
+            vm.mapImage(*workload.image);
+
+            for (const auto &line : workload.input)
+                io.feedLine(line);
+
+            auto start = Clock::now();
+            vm.run();
+            auto end = Clock::now();
+
+            result.seconds.push_back(std::chrono::duration<double>(end - start).count());
+
+            unsigned long long hash = hashOutput(io.output());
+            if (rep != 0 && (vm.instructionCount() != result.instructions || hash != result.outputHash))
+                throw std::runtime_error("Workload " + workload.name + " is not deterministic");
+
+            result.instructions = vm.instructionCount();
+            result.outputHash = hash;
+        }
+
+        result.peakRssKb = measureRss ? peakRssKb() : 0;
+        return result;
+    }
+
+    double mean(const std::vector<double> &values)
+    {
+        double sum = 0;
+        for (double value : values)
+            sum += value;
+
+        return values.empty() ? 0 : sum / values.size();
+    }
+
+    double stddev(const std::vector<double> &values)
+    {
+        if (values.size() < 2)
+            return 0;
+
+        double avg = mean(values), sum = 0;
+        for (double value : values)
+            sum += (value - avg) * (value - avg);
+
+        return std::sqrt(sum / (values.size() - 1));
+    }
+
+    std::string jsonString(const std::string &value)
+    {
+        std::string out = "\"";
+        for (char ch : value)
+        {
+            if (ch == '"' || ch == '\\')
+                out += '\\';
+            out += ch;
+        }
+
+        return out + '"';
+    }
+
+    // Writes one result object per line, so results can be compared with a simple line scan.
+    void writeJson(std::ostream &os, const std::string &label, unsigned repetitions, const std::vector<Result> &results)
+    {
+        os << "{\n";
+        os << "  \"label\": " << jsonString(label) << ",\n";
+        os << "  \"repetitions\": " << repetitions << ",\n";
+        os << "  \"results\": [\n";
+
+        for (size_t i = 0; i != results.size(); ++i)
+        {
+            const auto &r = results[i];
+            double seconds = mean(r.seconds);
+
+            std::vector<double> nsPerInstruction;
+            for (double s : r.seconds)
+                nsPerInstruction.push_back(s * 1e9 / r.instructions);
+
+            os << "    { \"workload\": " << jsonString(r.workload)
+                << ", \"engine\": " << jsonString(r.engine)
+                << ", \"instructions\": " << r.instructions
+                << ", \"output_hash\": \"" << std::hex << std::setw(16) << std::setfill('0') << r.outputHash << std::dec << std::setfill(' ') << '"'
+                << ", \"mean_seconds\": " << seconds
+                << ", \"min_seconds\": " << *std::min_element(r.seconds.begin(), r.seconds.end())
+                << ", \"stddev_seconds\": " << stddev(r.seconds)
+                << ", \"instructions_per_second\": " << r.instructions / seconds
+                << ", \"ns_per_instruction\": " << mean(nsPerInstruction)
+                << ", \"ns_per_instruction_variance\": " << stddev(nsPerInstruction) * stddev(nsPerInstruction)
+                << ", \"peak_rss_kb\": " << r.peakRssKb
+                << " }" << (i + 1 == results.size() ? "" : ",") << '\n';
+        }
+
+        os << "  ]\n}\n";
+    }
+
+    // Extracts "key": <number or string> from a result line.
+    std::string jsonField(const std::string &line, const std::string &key)
+    {
+        size_t pos = line.find('"' + key + "\":");
+        if (pos == std::string::npos)
+            return "";
+
+        pos = line.find_first_not_of(' ', pos + key.size() + 3);
+        if (pos == std::string::npos)
+            return "";
+
+        if (line[pos] == '"')
+            return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+
+        return line.substr(pos, line.find_first_of(",}", pos) - pos);
+    }
+
+    // Reads ns/instruction per (workload, engine) from an earlier run.
+    std::map<std::string, double> readBaseline(const std::string &filename)
+    {
+        std::ifstream ifs(filename);
+        if (!ifs)
+            throw std::runtime_error("Could not open baseline " + filename);
+
+        std::map<std::string, double> baseline;
+        for (std::string line; getline(ifs, line); )
+        {
+            std::string workload = jsonField(line, "workload");
+            if (workload.empty())
+                continue;
+
+            std::string nsPerInstruction = jsonField(line, "ns_per_instruction");
+            if (nsPerInstruction.empty())
+                throw std::runtime_error("Baseline " + filename + " has no ns_per_instruction for " + workload);
+
+            baseline[workload + '/' + jsonField(line, "engine")] = std::stod(nsPerInstruction);
+        }
+
+        return baseline;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string root = ".";
+    std::string output;
+    std::string baselineFile;
+    std::string label;
+    std::string filter;
+    unsigned repetitions = 10;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--root")
+            root = argv[i + 1];
+        else if (arg == "--output")
+            output = argv[i + 1];
+        else if (arg == "--baseline")
+            baselineFile = argv[i + 1];
+        else if (arg == "--label")
+            label = argv[i + 1];
+        else if (arg == "--filter")
+            filter = argv[i + 1];
+        else if (arg == "--repetitions")
+            repetitions = std::max(1, std::stoi(argv[i + 1]));
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--root <source dir>] [--output <json file>] [--baseline <json file>] [--label <name>] [--filter <workload>] [--repetitions <count>]" << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        std::vector<Workload> workloads =
+        {
+            bootWorkload("boot-challenge", root + "/resources/challenge.bin"),
+            scriptedWorkload("walkthrough", root + "/spoilers/walkthrough", root + "/resources"),
+            scriptedWorkload("patched-walkthrough", root + "/spoilers/patchedWalkthrough", root + "/resources"),
+            arithmeticWorkload(),
+            recursionWorkload(),
+        };
+
+        std::map<std::string, double> baseline;
+        if (!baselineFile.empty())
+            baseline = readBaseline(baselineFile);
+
+        std::vector<Result> results;
+
+        std::cerr << std::left << std::setw(22) << "workload" << std::setw(8) << "engine" << std::right
+            << std::setw(12) << "instrs" << std::setw(12) << "ns/instr" << std::setw(10) << "stddev" << std::setw(12) << "Minstr/s";
+        if (!baseline.empty())
+            std::cerr << std::setw(10) << "change";
+        std::cerr << std::endl << std::fixed << std::setprecision(2);
+
+        for (const auto &workload : workloads)
+        {
+            if (!filter.empty() && workload.name.find(filter) == std::string::npos)
+                continue;
+
+            for (auto engine : SynacorVM::engines())
+            {
+                results.push_back(runWorkload(workload, engine, repetitions));
+                const auto &r = results.back();
+
+                std::vector<double> nsPerInstruction;
+                for (double s : r.seconds)
+                    nsPerInstruction.push_back(s * 1e9 / r.instructions);
+
+                double ns = mean(nsPerInstruction);
+
+                std::cerr << std::left << std::setw(22) << r.workload << std::setw(8) << r.engine << std::right
+                    << std::setw(12) << r.instructions << std::setw(12) << ns << std::setw(10) << stddev(nsPerInstruction)
+                    << std::setw(12) << 1e3 / ns;
+
+                auto it = baseline.find(r.workload + '/' + r.engine);
+                if (it != baseline.end())
+                    std::cerr << std::setw(9) << (ns / it->second - 1) * 100 << '%';
+
+                std::cerr << std::endl;
+            }
+        }
+
+        if (output.empty())
+            writeJson(std::cout, label, repetitions, results);
+        else
+        {
+            std::ofstream ofs(output);
+            if (!ofs)
+                throw std::runtime_error("Could not open " + output);
+
+            writeJson(ofs, label, repetitions, results);
+            std::cerr << "Results written to " << output << std::endl;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,519 @@
+#include "GameServer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t maxLineLength = 4096;
+    const int maxEvents = 256;
+
+    // Marks the end of an output batch.
+    const char batchTerminator = '\0';
+
+    // Instructions a worker executes for a session before moving on to the next queued one, so that sessions running
+    //  long computations (e.g. the teleporter confirmation) cannot hold up the others.
+    const unsigned long long sliceInstructions = 1 << 20;
+
+    std::system_error socketError(const char *what)
+    {
+        return std::system_error(errno, std::generic_category(), what);
+    }
+}
+
+GameServer::GameServer(const BootSnapshot &snapshot, const Options &options)
+    : m_snapshot(snapshot), m_options(options), m_epollFd(-1), m_wakeFd(-1), m_running(false), m_sessionsServed(0)
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0)
+        throw socketError("epoll_create1");
+
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0)
+        throw socketError("eventfd");
+
+    addToEpoll(m_wakeFd, EPOLLIN);
+
+    if (!m_options.socketPath.empty())
+        listenUnix(m_options.socketPath);
+
+    if (m_options.tcpPort)
+        listenTcp(m_options.tcpPort);
+
+    if (m_listenFds.empty())
+        throw std::runtime_error("No socket to listen on");
+}
+
+GameServer::~GameServer()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_workMutex);
+        m_running = false;
+    }
+
+    m_workAvailable.notify_all();
+    for (auto &worker : m_workers)
+        worker.join();
+
+    for (auto &entry : m_sessions)
+        close(entry.first);
+
+    for (int fd : m_listenFds)
+        close(fd);
+
+    if (!m_options.socketPath.empty())
+        unlink(m_options.socketPath.c_str());
+
+    close(m_wakeFd);
+    close(m_epollFd);
+}
+
+void GameServer::listenUnix(const std::string &path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long");
+
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw socketError("socket");
+
+    m_listenFds.push_back(fd);
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+        throw socketError("bind");
+
+    if (listen(fd, SOMAXCONN) < 0)
+        throw socketError("listen");
+
+    addToEpoll(fd, EPOLLIN);
+}
+
+void GameServer::listenTcp(unsigned short port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw socketError("socket");
+
+    m_listenFds.push_back(fd);
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+        throw socketError("bind");
+
+    if (listen(fd, SOMAXCONN) < 0)
+        throw socketError("listen");
+
+    addToEpoll(fd, EPOLLIN);
+}
+
+void GameServer::addToEpoll(int fd, unsigned events)
+{
+    epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+        throw socketError("epoll_ctl");
+}
+
+void GameServer::run()
+{
+    m_running = true;
+
+    for (unsigned i = 0, n = m_options.workers ? m_options.workers : 1; i != n; ++i)
+        m_workers.emplace_back(&GameServer::workerLoop, this);
+
+    epoll_event events[maxEvents];
+
+    while (m_running)
+    {
+        int count = epoll_wait(m_epollFd, events, maxEvents, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            throw socketError("epoll_wait");
+        }
+
+        for (int i = 0; i != count; ++i)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == m_wakeFd)
+            {
+                uint64_t value;
+                while (::read(m_wakeFd, &value, sizeof(value)) > 0);
+
+                collectCompleted();
+                continue;
+            }
+
+            if (std::find(m_listenFds.begin(), m_listenFds.end(), fd) != m_listenFds.end())
+            {
+                acceptConnections(fd);
+                continue;
+            }
+
+            auto it = m_sessions.find(fd);
+            if (it == m_sessions.end())
+                continue;
+
+            SessionPtr session = it->second;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                closeSession(session);
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN)
+                receive(session);
+
+            if (!session->closed && (events[i].events & EPOLLOUT))
+                flush(session);
+        }
+    }
+}
+
+void GameServer::stop()
+{
+    m_running = false;
+
+    uint64_t one = 1;
+    ssize_t result = ::write(m_wakeFd, &one, sizeof(one));
+    (void)result;
+}
+
+size_t GameServer::sessionsServed() const
+{
+    return m_sessionsServed;
+}
+
+void GameServer::acceptConnections(int listenFd)
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+
+            if (errno == EMFILE || errno == ENFILE)
+                return;     // Leave the connection in the backlog until descriptors free up.
+
+            throw socketError("accept4");
+        }
+
+        auto session = std::make_shared<Session>();
+        session->fd = fd;
+        session->vm.mapImage(m_snapshot.image);
+        session->vm.setCpuState(m_snapshot.cpuState);
+        session->vm.setIO(session->io);
+        session->outgoing = m_snapshot.greeting;
+        session->outgoing += batchTerminator;
+
+        m_sessions.emplace(fd, session);
+        ++m_sessionsServed;
+
+        addToEpoll(fd, EPOLLIN | EPOLLRDHUP);
+        flush(session);
+    }
+}
+
+void GameServer::receive(const SessionPtr &session)
+{
+    char buffer[4096];
+
+    while (true)
+    {
+        ssize_t count = ::recv(session->fd, buffer, sizeof(buffer), 0);
+        if (count == 0)
+        {
+            // Finish the lines already received, then close.
+            session->inputClosed = true;
+            break;
+        }
+
+        if (count < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            if (errno == EINTR)
+                continue;
+
+            closeSession(session);
+            return;
+        }
+
+        session->received.append(buffer, count);
+    }
+
+    std::vector<std::string> lines;
+    size_t start = 0;
+
+    for (size_t pos; (pos = session->received.find('\n', start)) != std::string::npos; start = pos + 1)
+    {
+        size_t end = pos;
+        if (end > start && session->received[end - 1] == '\r')
+            --end;
+
+        lines.emplace_back(session->received, start, end - start);
+    }
+
+    session->received.erase(0, start);
+
+    if (session->received.size() > maxLineLength)
+    {
+        closeSession(session);
+        return;
+    }
+
+    if (lines.empty())
+    {
+        if (session->inputClosed)
+            flush(session);
+
+        return;
+    }
+
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> guard(session->mutex);
+        if (session->halted)
+            return;
+
+        for (auto &line : lines)
+            session->pendingLines.push_back(std::move(line));
+
+        schedule = !session->scheduled;
+        session->scheduled = true;
+    }
+
+    if (schedule)
+        this->schedule(session);
+
+    if (session->inputClosed)
+        updateEvents(session);
+}
+
+void GameServer::flush(const SessionPtr &session)
+{
+    while (!session->outgoing.empty())
+    {
+        ssize_t count = ::send(session->fd, session->outgoing.data(), session->outgoing.size(), MSG_NOSIGNAL);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            closeSession(session);
+            return;
+        }
+
+        session->outgoing.erase(0, count);
+    }
+
+    updateEvents(session);
+
+    if (!session->outgoing.empty())
+        return;
+
+    bool finished;
+    {
+        std::lock_guard<std::mutex> guard(session->mutex);
+        finished = (session->halted || session->inputClosed) && !session->scheduled && session->produced.empty() && session->pendingLines.empty();
+    }
+
+    if (finished)
+        closeSession(session);
+}
+
+void GameServer::updateEvents(const SessionPtr &session)
+{
+    bool wantWrite = !session->outgoing.empty();
+    if (wantWrite == session->writing && !session->inputClosed)
+        return;
+
+    epoll_event event = {};
+    event.events = (session->inputClosed ? uint32_t(0) : uint32_t(EPOLLIN | EPOLLRDHUP)) | (wantWrite ? uint32_t(EPOLLOUT) : uint32_t(0));
+    event.data.fd = session->fd;
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, session->fd, &event);
+    session->writing = wantWrite;
+}
+
+void GameServer::closeSession(const SessionPtr &session)
+{
+    if (session->closed)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(session->mutex);
+        session->closed = true;
+        session->pendingLines.clear();
+    }
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, session->fd, nullptr);
+    m_sessions.erase(session->fd);
+    close(session->fd);
+}
+
+void GameServer::collectCompleted()
+{
+    std::vector<SessionPtr> completed;
+    {
+        std::lock_guard<std::mutex> guard(m_completedMutex);
+        completed.swap(m_completed);
+    }
+
+    for (const auto &session : completed)
+    {
+        if (session->closed)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> guard(session->mutex);
+            session->outgoing += session->produced;
+            session->produced.clear();
+        }
+
+        flush(session);
+    }
+}
+
+void GameServer::schedule(const SessionPtr &session)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_workMutex);
+        m_workQueue.push_back(session);
+    }
+
+    m_workAvailable.notify_one();
+}
+
+void GameServer::workerLoop()
+{
+    while (true)
+    {
+        SessionPtr session;
+        {
+            std::unique_lock<std::mutex> lock(m_workMutex);
+            m_workAvailable.wait(lock, [this]() { return !m_running || !m_workQueue.empty(); });
+
+            if (!m_running)
+                return;
+
+            session = std::move(m_workQueue.front());
+            m_workQueue.pop_front();
+        }
+
+        bool requeue = execute(session);
+
+        if (requeue)
+            schedule(session);
+
+        {
+            std::lock_guard<std::mutex> guard(m_completedMutex);
+            m_completed.push_back(std::move(session));
+        }
+
+        uint64_t one = 1;
+        ssize_t result = ::write(m_wakeFd, &one, sizeof(one));
+        (void)result;
+    }
+}
+
+bool GameServer::execute(const SessionPtr &session)
+{
+    // Feed one line at a time, so every command gets its own output batch.
+    while (true)
+    {
+        if (!session->running)
+        {
+            std::string line;
+            {
+                std::lock_guard<std::mutex> guard(session->mutex);
+                if (session->closed || session->halted || session->pendingLines.empty())
+                {
+                    session->scheduled = false;
+                    return false;
+                }
+
+                line = std::move(session->pendingLines.front());
+                session->pendingLines.pop_front();
+            }
+
+            session->io.feedLine(line);
+            session->running = true;
+        }
+
+        bool halted = false;
+        bool sliceUsed = false;
+        std::string output;
+        try
+        {
+            sliceUsed = session->vm.runFor(sliceInstructions);
+
+            halted = !sliceUsed && !session->vm.waitingForInput();
+            output = session->io.takeOutput();
+        }
+        catch (const std::exception &e)
+        {
+            halted = true;
+            output = session->io.takeOutput() + "\n --- EXCEPTION ---\n" + e.what() + '\n';
+        }
+
+        std::lock_guard<std::mutex> guard(session->mutex);
+        session->produced += output;
+
+        // Out of budget: let other sessions have the worker, and continue once requeued. The batch is not finished
+        //  until the VM waits for input or halts.
+        if (sliceUsed)
+        {
+            if (!session->closed)
+                return true;
+
+            session->scheduled = false;
+            return false;
+        }
+
+        session->running = false;
+        session->produced += batchTerminator;
+
+        if (halted)
+        {
+            session->halted = true;
+            session->scheduled = false;
+            session->pendingLines.clear();
+            return false;
+        }
+    }
+}
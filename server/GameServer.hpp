@@ -0,0 +1,104 @@
+#pragma once
+#include "SynacorVM.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Serves one VM per client connection, all started from the same pre-booted snapshot.
+//
+// Protocol: every line received from a client is fed to its VM as one line of input. Once the VM waits for input again
+//  (or halts), all output it produced is sent as one batch, terminated by a NUL byte. The connection is closed when the VM halts.
+class GameServer
+{
+public:
+    struct Options
+    {
+        std::string socketPath;     // Unix domain socket to listen on. Empty to disable.
+        unsigned short tcpPort;     // TCP port to listen on (loopback only). 0 to disable.
+        unsigned workers;           // Number of worker threads executing VMs.
+    };
+
+    // State every session starts from: the memory image, CPU state and output of a VM booted up to its first IN.
+    struct BootSnapshot
+    {
+        const MemoryImage &image;
+        SynacorVM::CpuState cpuState;
+        std::string greeting;
+    };
+
+    GameServer(const BootSnapshot &snapshot, const Options &options);
+    ~GameServer();
+
+    // Runs the event loop until stop() is called.
+    void run();
+
+    // Stops the event loop. Safe to call from a signal handler.
+    void stop();
+
+    // Returns the number of sessions served so far.
+    size_t sessionsServed() const;
+
+private:
+    struct Session
+    {
+        int fd;
+        SynacorVM vm;
+        BufferedIO io;
+
+        std::string received;                   // Bytes received that do not form a complete line yet (event loop only).
+        std::string outgoing;                   // Output not yet written to the socket (event loop only).
+        bool writing = false;                   // Registered for EPOLLOUT (event loop only).
+        bool inputClosed = false;               // The client shut down its side of the connection (event loop only).
+        bool running = false;                   // A line was fed and the VM has not finished with it (worker only).
+
+        std::mutex mutex;                       // Guards the members below.
+        std::deque<std::string> pendingLines;   // Lines waiting to be fed to the VM.
+        std::string produced;                   // Output batches produced by the worker, not yet picked up by the event loop.
+        bool scheduled = false;                 // Queued on, or being executed by, a worker.
+        bool halted = false;                    // The VM halted or failed; close once the output is flushed.
+        bool closed = false;                    // The connection was closed by the event loop.
+    };
+
+    using SessionPtr = std::shared_ptr<Session>;
+
+    const BootSnapshot &m_snapshot;
+    Options m_options;
+
+    int m_epollFd;
+    int m_wakeFd;
+    std::vector<int> m_listenFds;
+    std::atomic<bool> m_running;
+    std::atomic<size_t> m_sessionsServed;
+
+    std::unordered_map<int, SessionPtr> m_sessions;
+
+    std::mutex m_workMutex;
+    std::condition_variable m_workAvailable;
+    std::deque<SessionPtr> m_workQueue;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_completedMutex;
+    std::vector<SessionPtr> m_completed;
+
+    void listenUnix(const std::string &path);
+    void listenTcp(unsigned short port);
+    void addToEpoll(int fd, unsigned events);
+
+    void acceptConnections(int listenFd);
+    void receive(const SessionPtr &session);
+    void flush(const SessionPtr &session);
+    void updateEvents(const SessionPtr &session);
+    void closeSession(const SessionPtr &session);
+    void collectCompleted();
+
+    void schedule(const SessionPtr &session);
+    void workerLoop();
+    // Executes the session's pending lines. Returns true if it ran out of its slice and has to be requeued.
+    bool execute(const SessionPtr &session);
+};
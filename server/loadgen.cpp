@@ -0,0 +1,323 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Walkthrough.hpp"
+
+// Load generator for synacor-server.
+// Replays a walkthrough over many concurrent connections and reports latency percentiles per command.
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Target
+    {
+        std::string socketPath;
+        unsigned short tcpPort;
+    };
+
+    struct Client
+    {
+        int fd;
+        int command;                // Index of the command awaiting a response, -1 while waiting for the greeting.
+        Clock::time_point sent;
+    };
+
+    // Latencies in nanoseconds, indexed by command.
+    using LatencyTable = std::vector<std::vector<unsigned long long>>;
+
+    std::system_error socketError(const char *what)
+    {
+        return std::system_error(errno, std::generic_category(), what);
+    }
+
+    int connectTo(const Target &target)
+    {
+        int fd;
+        if (!target.socketPath.empty())
+        {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, target.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+                throw socketError("socket");
+
+            if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+                throw socketError("connect");
+        }
+        else
+        {
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(target.tcpPort);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+                throw socketError("socket");
+
+            if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+                throw socketError("connect");
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        return fd;
+    }
+
+    void sendLine(int fd, const std::string &line)
+    {
+        std::string data = line + '\n';
+        size_t sent = 0;
+
+        while (sent != data.size())
+        {
+            ssize_t count = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (count < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                throw socketError("send");
+            }
+
+            sent += count;
+        }
+    }
+
+    // Drives a group of connections through the whole walkthrough.
+    void runClients(const Target &target, const std::vector<std::string> &commands, size_t connections, LatencyTable &latencies)
+    {
+        latencies.assign(commands.size(), {});
+        for (auto &samples : latencies)
+            samples.reserve(connections);
+
+        int epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0)
+            throw socketError("epoll_create1");
+
+        std::vector<Client> clients(connections);
+        for (size_t i = 0; i != connections; ++i)
+        {
+            clients[i] = { connectTo(target), -1, Clock::now() };
+
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &event) < 0)
+                throw socketError("epoll_ctl");
+        }
+
+        size_t active = connections;
+        epoll_event events[256];
+        char buffer[16384];
+
+        while (active)
+        {
+            int count = epoll_wait(epollFd, events, 256, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                throw socketError("epoll_wait");
+            }
+
+            for (int e = 0; e != count; ++e)
+            {
+                Client &client = clients[events[e].data.u64];
+                if (client.fd < 0)
+                    continue;
+
+                bool closed = false;
+                size_t batches = 0;
+
+                while (true)
+                {
+                    ssize_t received = ::recv(client.fd, buffer, sizeof(buffer), 0);
+                    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                    {
+                        closed = true;
+                        break;
+                    }
+
+                    if (received < 0)
+                        break;
+
+                    batches += std::count(buffer, buffer + received, '\0');
+                }
+
+                // Every batch completes the command in flight.
+                for (; batches && !closed; --batches)
+                {
+                    auto now = Clock::now();
+                    if (client.command >= 0)
+                        latencies[client.command].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - client.sent).count());
+
+                    if (++client.command == static_cast<int>(commands.size()))
+                    {
+                        closed = true;
+                        break;
+                    }
+
+                    client.sent = Clock::now();
+                    sendLine(client.fd, commands[client.command]);
+                }
+
+                if (closed)
+                {
+                    if (client.command < static_cast<int>(commands.size()))
+                        std::cerr << "Connection closed by server after " << client.command << " commands" << std::endl;
+
+                    close(client.fd);
+                    client.fd = -1;
+                    --active;
+                }
+            }
+        }
+
+        close(epollFd);
+    }
+
+    unsigned long long percentile(std::vector<unsigned long long> &samples, double p)
+    {
+        if (samples.empty())
+            return 0;
+
+        auto nth = samples.begin() + static_cast<size_t>(p * (samples.size() - 1));
+        std::nth_element(samples.begin(), nth, samples.end());
+
+        return *nth;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Synacor VM game server load generator." << std::endl;
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <walkthrough> [--socket <path>] [--tcp <port>] [--connections <count>] [--threads <count>]" << std::endl;
+        return 1;
+    }
+
+    Target target = { "synacor.sock", 0 };
+    size_t connections = 1000;
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--socket")
+            target.socketPath = argv[i + 1];
+        else if (arg == "--tcp")
+            target.tcpPort = std::stoi(argv[i + 1], nullptr, 0), target.socketPath.clear();
+        else if (arg == "--connections")
+            connections = std::stoul(argv[i + 1], nullptr, 0);
+        else if (arg == "--threads")
+            threadCount = std::max<size_t>(1, std::stoul(argv[i + 1], nullptr, 0));
+        else
+        {
+            std::cout << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        Walkthrough walkthrough = Walkthrough::read(argv[1]);
+        const auto &commands = walkthrough.input;
+
+        // Sessions start from the server's boot image, so memory patches have to be applied when the server boots.
+        if (!walkthrough.patches.empty())
+            std::cout << "The walkthrough patches memory before 'run'. Start the server with --patches " << argv[1]
+                << ", or the replayed games diverge." << std::endl;
+        threadCount = std::min(threadCount, connections);
+
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        std::cout << "Replaying " << commands.size() << " commands over " << connections << " connections using " << threadCount << " threads..." << std::endl;
+
+        std::vector<LatencyTable> results(threadCount);
+        std::vector<std::thread> threads;
+
+        auto start = Clock::now();
+
+        for (size_t i = 0; i != threadCount; ++i)
+        {
+            size_t share = connections / threadCount + (i < connections % threadCount ? 1 : 0);
+            threads.emplace_back([&, i, share]()
+            {
+                try
+                {
+                    runClients(target, commands, share, results[i]);
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Client thread failed: " << e.what() << std::endl;
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+
+        auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // Merge the per-thread samples.
+        LatencyTable latencies(commands.size());
+        std::vector<unsigned long long> all;
+        for (auto &result : results)
+            for (size_t c = 0; c != result.size(); ++c)
+            {
+                latencies[c].insert(latencies[c].end(), result[c].begin(), result[c].end());
+                all.insert(all.end(), result[c].begin(), result[c].end());
+            }
+
+        std::cout << std::endl << "  #   p50 (us)   p99 (us)  command" << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+
+        for (size_t c = 0; c != commands.size(); ++c)
+        {
+            std::cout << std::setw(3) << c << ' '
+                << std::setw(10) << percentile(latencies[c], 0.50) / 1000.0 << ' '
+                << std::setw(10) << percentile(latencies[c], 0.99) / 1000.0 << "  "
+                << commands[c] << std::endl;
+        }
+
+        std::cout << std::endl << "All commands: p50 " << percentile(all, 0.50) / 1000.0 << " us, p99 " << percentile(all, 0.99) / 1000.0 << " us" << std::endl;
+        std::cout << all.size() << " responses in " << elapsed << " s (" << all.size() / elapsed << " commands/s)" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
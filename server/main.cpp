@@ -0,0 +1,126 @@
+#include <iostream>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <sys/resource.h>
+#include "GameServer.hpp"
+#include "Walkthrough.hpp"
+
+namespace
+{
+    GameServer *activeServer = nullptr;
+
+    void handleSignal(int)
+    {
+        if (activeServer)
+            activeServer->stop();
+    }
+
+    // Allow as many connections as the hard limit permits.
+    void raiseDescriptorLimit()
+    {
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Synacor VM multi-session game server." << std::endl;
+
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <binary> [--patches <walkthrough>] [--socket <path>] [--tcp <port>] [--workers <count>]" << std::endl;
+        return 1;
+    }
+
+    GameServer::Options options = { "synacor.sock", 0, std::max(1u, std::thread::hardware_concurrency()) };
+    std::string patches;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 == argc)
+        {
+            std::cout << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+
+        if (arg == "--patches")
+            patches = argv[++i];
+        else if (arg == "--socket")
+            options.socketPath = argv[++i];
+        else if (arg == "--tcp")
+            options.tcpPort = std::stoi(argv[++i], nullptr, 0);
+        else if (arg == "--workers")
+            options.workers = std::stoi(argv[++i], nullptr, 0);
+        else
+        {
+            std::cout << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        // Boot the binary once up to its first IN. All sessions start from this state.
+        BufferedIO io;
+        SynacorVM vm;
+        vm.setIO(io);
+
+        std::cout << "Booting " << argv[1] << "... ";
+        vm.loadBinary(argv[1]);
+
+        // Apply the memory patches a walkthrough makes before its 'run', so that replaying it gives the same game.
+        if (!patches.empty())
+        {
+            for (const auto &patch : Walkthrough::read(patches).patches)
+                vm.writeMemory(patch.first, patch.second);
+        }
+
+        vm.run();
+
+        if (!vm.waitingForInput())
+        {
+            std::cout << "binary halted before requesting input." << std::endl;
+            return 1;
+        }
+
+        MemoryImage image(vm.memory());
+        GameServer::BootSnapshot snapshot = { image, vm.cpuState(), io.takeOutput() };
+
+        std::cout << "waiting for input at 0x" << std::hex << vm.instructionPointer() << std::dec << std::endl;
+
+        raiseDescriptorLimit();
+
+        GameServer server(snapshot, options);
+        activeServer = &server;
+
+        std::signal(SIGINT, handleSignal);
+        std::signal(SIGTERM, handleSignal);
+
+        if (!options.socketPath.empty())
+            std::cout << "Listening on " << options.socketPath << std::endl;
+        if (options.tcpPort)
+            std::cout << "Listening on 127.0.0.1:" << options.tcpPort << std::endl;
+        std::cout << "Using " << options.workers << " worker threads." << std::endl;
+
+        server.run();
+        activeServer = nullptr;
+
+        std::cout << "Server stopped after " << server.sessionsServed() << " sessions." << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << std::endl << " --- EXCEPTION ---" << std::endl << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "BackgroundRunner.hpp"
+#include <iostream>
+#include <string>
+
+namespace
+{
+    // The worker writes straight to the stream buffer, so it never sees (or races on) the formatting state the shell
+    //  sets on std::cout.
+    void writeRaw(const std::string &text)
+    {
+        std::streambuf *buffer = std::cout.rdbuf();
+        buffer->sputn(text.data(), static_cast<std::streamsize>(text.size()));
+        buffer->pubsync();
+    }
+}
+
+BackgroundRunner::QueuedIO::QueuedIO(BackgroundRunner &runner)
+    : m_runner(runner)
+{
+}
+
+int BackgroundRunner::QueuedIO::read()
+{
+    std::lock_guard<std::mutex> lock(m_runner.m_mutex);
+    if (m_runner.m_input.empty())
+        return -1;
+
+    char ch = m_runner.m_input.front();
+    m_runner.m_input.pop_front();
+
+    return static_cast<unsigned char>(ch);
+}
+
+void BackgroundRunner::QueuedIO::write(char ch)
+{
+    std::cout.rdbuf()->sputc(ch);
+}
+
+void BackgroundRunner::QueuedIO::discardLine()
+{
+    std::lock_guard<std::mutex> lock(m_runner.m_mutex);
+    while (!m_runner.m_input.empty())
+    {
+        char ch = m_runner.m_input.front();
+        m_runner.m_input.pop_front();
+
+        if (ch == '\n')
+            break;
+    }
+}
+
+BackgroundRunner::BackgroundRunner(SynacorVM &vm)
+    : m_vm(vm), m_io(*this), m_previousIO(nullptr), m_previousEscapeChar(0), m_stopRequested(false),
+      m_safepointRequested(false), m_finished(false), m_parked(false), m_sequence(0), m_instructionPointer(0),
+      m_stackDepth(0), m_instructionCount(0), m_state(State::Stopped)
+{
+    for (auto &reg : m_registers)
+        reg.store(0, std::memory_order_relaxed);
+}
+
+BackgroundRunner::~BackgroundRunner()
+{
+    stop();
+}
+
+void BackgroundRunner::start()
+{
+    if (m_thread.joinable())
+        return;
+
+    m_previousIO = &m_vm.io();
+    m_previousEscapeChar = m_vm.escapeChar();
+    m_vm.setIO(m_io);
+    m_vm.setEscapeChar(0);
+
+    m_stopRequested = false;
+    m_safepointRequested = false;
+    m_finished = false;
+    m_parked = false;
+
+    publish(State::Running);
+    m_thread = std::thread(&BackgroundRunner::workerLoop, this);
+}
+
+void BackgroundRunner::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+
+    m_changed.notify_all();
+    m_thread.join();
+
+    m_vm.setIO(*m_previousIO);
+    m_vm.setEscapeChar(m_previousEscapeChar);
+
+    if (!m_finished)
+        publish(State::Stopped);
+}
+
+bool BackgroundRunner::active() const
+{
+    return m_thread.joinable();
+}
+
+bool BackgroundRunner::finished() const
+{
+    return m_finished;
+}
+
+void BackgroundRunner::feed(const std::string &line)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_input.insert(m_input.end(), line.begin(), line.end());
+        m_input.push_back('\n');
+    }
+
+    m_changed.notify_all();
+}
+
+BackgroundRunner::Snapshot BackgroundRunner::snapshot() const
+{
+    Snapshot snapshot;
+    unsigned before, after;
+    do
+    {
+        before = m_sequence.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i != 8; ++i)
+            snapshot.registers[i] = m_registers[i].load(std::memory_order_relaxed);
+        snapshot.instructionPointer = m_instructionPointer.load(std::memory_order_relaxed);
+        snapshot.stackDepth = m_stackDepth.load(std::memory_order_relaxed);
+        snapshot.instructionCount = m_instructionCount.load(std::memory_order_relaxed);
+        snapshot.state = m_state.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = m_sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    return snapshot;
+}
+
+BackgroundRunner::Safepoint::Safepoint(BackgroundRunner &runner)
+    : m_runner(runner), m_engaged(runner.active())
+{
+    if (!m_engaged)
+        return;
+
+    std::unique_lock<std::mutex> lock(runner.m_mutex);
+    runner.m_safepointRequested = true;
+    runner.m_changed.notify_all();
+    runner.m_changed.wait(lock, [&runner] { return runner.m_parked || runner.m_finished; });
+}
+
+BackgroundRunner::Safepoint::~Safepoint()
+{
+    if (!m_engaged)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_runner.m_mutex);
+        m_runner.m_safepointRequested = false;
+    }
+
+    m_runner.m_changed.notify_all();
+}
+
+void BackgroundRunner::workerLoop()
+{
+    try
+    {
+        while (!m_stopRequested.load(std::memory_order_acquire))
+        {
+            // Checking the flags is all a slice costs on top of the VM itself.
+            if (m_safepointRequested.load(std::memory_order_acquire))
+            {
+                park();
+                continue;
+            }
+
+            if (m_vm.runFor(sliceInstructions))
+            {
+                publish(State::Running);
+                continue;
+            }
+
+            if (!m_vm.waitingForInput())
+            {
+                publish(State::Halted);
+                writeRaw("\nProgram halted\n");
+                break;
+            }
+
+            publish(State::WaitingForInput);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return !m_input.empty() || m_safepointRequested || m_stopRequested; });
+        }
+    }
+    catch (const std::exception &e)
+    {
+        publish(State::Failed);
+        writeRaw(std::string("\nError: ") + e.what() + '\n');
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = !m_stopRequested;
+    }
+
+    m_changed.notify_all();
+}
+
+void BackgroundRunner::park()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_parked = true;
+    m_changed.notify_all();
+    m_changed.wait(lock, [this] { return !m_safepointRequested || m_stopRequested; });
+    m_parked = false;
+}
+
+void BackgroundRunner::publish(State state)
+{
+    unsigned sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (ushort i = 0; i != 8; ++i)
+        m_registers[i].store(m_vm.readRegister(i), std::memory_order_relaxed);
+    m_instructionPointer.store(m_vm.instructionPointer(), std::memory_order_relaxed);
+    m_stackDepth.store(m_vm.getStack().size(), std::memory_order_relaxed);
+    m_instructionCount.store(m_vm.instructionCount(), std::memory_order_relaxed);
+    m_state.store(state, std::memory_order_relaxed);
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "SynacorVM.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Runs a VM on a worker thread, so that the debugger shell stays responsive while the program runs.
+//
+// The worker executes the program at full speed in slices of sliceInstructions. Between slices it is at a safepoint:
+//  it publishes the registers, instruction pointer and instruction count through a seqlock, which the shell reads at
+//  any time without stopping it, and checks an atomic flag through which the shell asks it to park. While parked (see
+//  Safepoint) the shell has the VM to itself, e.g. to read memory in a consistent state or to change it.
+//
+// While running in the background, the VM reads lines queued by feed() and writes to std::cout. Breakpoints and the
+//  escape character do not apply.
+class BackgroundRunner
+{
+public:
+    enum class State
+    {
+        Stopped,
+        Running,
+        WaitingForInput,
+        Halted,
+        Failed
+    };
+
+    struct Snapshot
+    {
+        std::array<ushort, 8> registers;
+        ushort instructionPointer;
+        size_t stackDepth;
+        unsigned long long instructionCount;
+        State state;
+    };
+
+    // About a millisecond of execution, which bounds how long the shell waits for a safepoint.
+    static const unsigned long long sliceInstructions = 1 << 16;
+
+    explicit BackgroundRunner(SynacorVM &vm);
+    ~BackgroundRunner();
+
+    BackgroundRunner(const BackgroundRunner &) = delete;
+    BackgroundRunner &operator=(const BackgroundRunner &) = delete;
+
+    // Starts running the VM on the worker thread. Does nothing if it is active already.
+    void start();
+
+    // Stops the worker at its next safepoint and waits for it, giving the VM back with its own I/O.
+    void stop();
+
+    // Returns whether the worker was started and not stopped, even if the program has halted since.
+    bool active() const;
+
+    // Returns whether the worker has finished on its own, because the program halted or failed.
+    bool finished() const;
+
+    // Queues a line of input (appending a newline). Input is kept until the VM reads it, also while stopped.
+    void feed(const std::string &line);
+
+    // Returns the state published at the last safepoint. Lock-free, and never waits for the worker.
+    Snapshot snapshot() const;
+
+    // Parks the worker at a safepoint for the lifetime of the object, so that the VM can be used by the calling
+    //  thread. Does nothing if the worker is not active.
+    class Safepoint
+    {
+        BackgroundRunner &m_runner;
+        bool m_engaged;
+
+    public:
+        explicit Safepoint(BackgroundRunner &runner);
+        ~Safepoint();
+
+        Safepoint(const Safepoint &) = delete;
+        Safepoint &operator=(const Safepoint &) = delete;
+    };
+
+private:
+    // Reads the queued input, writes to std::cout.
+    class QueuedIO final : public VMIO
+    {
+        BackgroundRunner &m_runner;
+
+    public:
+        explicit QueuedIO(BackgroundRunner &runner);
+
+        int read() override;
+        void write(char ch) override;
+        void discardLine() override;
+    };
+
+    SynacorVM &m_vm;
+    QueuedIO m_io;
+    VMIO *m_previousIO;
+    char m_previousEscapeChar;
+    std::thread m_thread;
+
+    std::atomic<bool> m_stopRequested;
+    std::atomic<bool> m_safepointRequested;
+    std::atomic<bool> m_finished;
+
+    std::mutex m_mutex;                 // Guards the members below, and the waits on m_changed.
+    std::condition_variable m_changed;  // Signalled on input, requests, and when the worker parks or finishes.
+    std::deque<char> m_input;
+    bool m_parked;
+
+    // Seqlock: odd while the worker is publishing.
+    std::atomic<unsigned> m_sequence;
+    std::array<std::atomic<ushort>, 8> m_registers;
+    std::atomic<ushort> m_instructionPointer;
+    std::atomic<size_t> m_stackDepth;
+    std::atomic<unsigned long long> m_instructionCount;
+    std::atomic<State> m_state;
+
+    void workerLoop();
+    void park();
+    void publish(State state);
+};
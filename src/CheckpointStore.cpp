@@ -0,0 +1,549 @@
+#include "CheckpointStore.hpp"
+#include "FileMapping.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    const char checkpointMagic[8] = { 'S', 'Y', 'N', 'C', 'K', 'P', 'T', '1' };
+
+    const size_t pageBytes = CheckpointStore::pageWords * sizeof(ushort);
+
+    // LZ compression in the style of LZ4, small enough for a page: a sequence of literals followed by a match with an
+    //  earlier part of the page. Each sequence starts with a token holding the number of literals (high nibble) and the
+    //  match length minus minMatch (low nibble), where 15 means that more length bytes follow, each adding up to 255.
+    //  The literals and the 16-bit offset of the match follow. The last sequence only has literals.
+    const size_t minMatch = 4;
+    const unsigned hashBits = 9;
+
+    uint32_t read32(const unsigned char *data)
+    {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    void writeLength(std::vector<unsigned char> &out, size_t length)
+    {
+        for (length -= 15; length >= 255; length -= 255)
+            out.push_back(255);
+
+        out.push_back(static_cast<unsigned char>(length));
+    }
+
+    bool readLength(const unsigned char *in, size_t size, size_t &position, size_t &length)
+    {
+        unsigned char byte;
+        do
+        {
+            if (position == size)
+                return false;
+
+            byte = in[position++];
+            length += byte;
+        } while (byte == 255);
+
+        return true;
+    }
+
+    void writeSequence(std::vector<unsigned char> &out, const unsigned char *literals, size_t literalCount, size_t offset, size_t length)
+    {
+        size_t extraLength = length ? length - minMatch : 0;
+        out.push_back(static_cast<unsigned char>(std::min<size_t>(literalCount, 15) << 4 | std::min<size_t>(extraLength, 15)));
+        if (literalCount >= 15)
+            writeLength(out, literalCount);
+
+        out.insert(out.end(), literals, literals + literalCount);
+
+        if (length)
+        {
+            out.push_back(static_cast<unsigned char>(offset));
+            out.push_back(static_cast<unsigned char>(offset >> 8));
+            if (extraLength >= 15)
+                writeLength(out, extraLength);
+        }
+    }
+
+    // Appends the compressed data to out.
+    void compress(const unsigned char *in, size_t size, std::vector<unsigned char> &out)
+    {
+        int table[1 << hashBits];
+        std::fill(std::begin(table), std::end(table), -1);
+
+        size_t anchor = 0, i = 0;
+        while (i + minMatch <= size)
+        {
+            uint32_t sequence = read32(in + i);
+            unsigned hash = (sequence * 2654435761u) >> (32 - hashBits);
+            int candidate = table[hash];
+            table[hash] = static_cast<int>(i);
+
+            if (candidate < 0 || read32(in + candidate) != sequence)
+            {
+                ++i;
+                continue;
+            }
+
+            size_t length = minMatch;
+            while (i + length < size && in[candidate + length] == in[i + length])
+                ++length;
+
+            writeSequence(out, in + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+        }
+
+        writeSequence(out, in + anchor, size - anchor, 0, 0);
+    }
+
+    // Returns false if in is not valid compressed data of exactly outSize bytes.
+    bool decompress(const unsigned char *in, size_t size, unsigned char *out, size_t outSize)
+    {
+        size_t i = 0, o = 0;
+        while (i != size)
+        {
+            unsigned token = in[i++];
+
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(in, size, i, literals))
+                return false;
+            if (literals > size - i || literals > outSize - o)
+                return false;
+
+            std::memcpy(out + o, in + i, literals);
+            i += literals;
+            o += literals;
+
+            if (i == size)
+                break;
+            if (size - i < 2)
+                return false;
+
+            size_t offset = in[i] | in[i + 1] << 8;
+            i += 2;
+
+            size_t length = token & 15;
+            if (length == 15 && !readLength(in, size, i, length))
+                return false;
+
+            length += minMatch;
+            if (offset == 0 || offset > o || length > outSize - o)
+                return false;
+
+            // Byte by byte, as matches may overlap what they produce.
+            for (size_t end = o + length; o != end; ++o)
+                out[o] = out[o - offset];
+        }
+
+        return o == outSize;
+    }
+
+    uint64_t hashBytes(const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t chunk;
+            std::memcpy(&chunk, bytes + i, sizeof(chunk));
+            hash = (hash ^ chunk) * 0x100000001b3ull;
+            hash ^= hash >> 29;
+        }
+
+        return hash;
+    }
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint64_t pages;
+        uint64_t directories;
+        uint64_t checkpoints;
+        uint64_t stackWords;
+        uint64_t pageBytes;
+    };
+
+    template <typename T>
+    void writeVector(std::ofstream &ofs, const std::vector<T> &data)
+    {
+        ofs.write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(T));
+    }
+
+    template <typename T>
+    void readVector(const unsigned char *&data, const unsigned char *end, std::vector<T> &out, uint64_t count)
+    {
+        if (count > static_cast<uint64_t>(end - data) / sizeof(T))
+            throw std::runtime_error("Checkpoint file is truncated");
+
+        out.resize(static_cast<size_t>(count));
+        std::memcpy(out.data(), data, out.size() * sizeof(T));
+        data += out.size() * sizeof(T);
+    }
+}
+
+CheckpointStore::CheckpointStore(size_t cachePages)
+    : m_cachePages(std::max<size_t>(cachePages, 2))
+{
+    static_assert(32768 % (pageWords * pagesPerDirectory) == 0, "Pages must split memory evenly");
+    static_assert(pageWords * sizeof(ushort) % sizeof(uint64_t) == 0, "Pages are hashed 64 bits at a time");
+}
+
+size_t CheckpointStore::add(const ushort *memory, const SynacorVM::CpuState &state)
+{
+    Record record = {};
+    for (size_t d = 0; d != directories; ++d)
+    {
+        Directory directory;
+        for (size_t p = 0; p != pagesPerDirectory; ++p)
+        {
+            // The page this one replaces is the best base: pages tend to change a few words at a time.
+            size_t index = d * pagesPerDirectory + p;
+            uint32_t base = m_records.empty() ? noBase : pageId(m_records.size() - 1, index);
+            directory[p] = addPage(memory + index * pageWords, base);
+        }
+
+        record.directories[d] = addDirectory(directory);
+    }
+
+    std::copy(state.registers.begin(), state.registers.end(), record.registers);
+    record.instructionPointer = state.instructionPointer;
+
+    // Consecutive checkpoints often share their stack.
+    record.stackSize = static_cast<uint32_t>(state.stack.size());
+    if (!m_records.empty() && m_records.back().stackSize == record.stackSize
+        && std::equal(state.stack.begin(), state.stack.end(), m_stackWords.begin() + m_records.back().stackOffset))
+        record.stackOffset = m_records.back().stackOffset;
+    else
+    {
+        record.stackOffset = static_cast<uint32_t>(m_stackWords.size());
+        m_stackWords.insert(m_stackWords.end(), state.stack.begin(), state.stack.end());
+    }
+
+    m_records.push_back(record);
+    return m_records.size() - 1;
+}
+
+size_t CheckpointStore::add(const SynacorVM &vm)
+{
+    // Store the original instructions at hooked addresses, so that restoring never brings back a stale hook patch.
+    std::vector<ushort> memory(MemoryImage::words);
+    vm.readMemory(0, memory.data(), memory.size());
+
+    return add(memory.data(), vm.cpuState());
+}
+
+size_t CheckpointStore::size() const
+{
+    return m_records.size();
+}
+
+void CheckpointStore::readMemory(size_t id, ushort *memory)
+{
+    for (size_t index = 0; index != pages; ++index)
+    {
+        const Page &words = page(pageId(id, index));
+        std::copy(words.begin(), words.end(), memory + index * pageWords);
+    }
+}
+
+SynacorVM::CpuState CheckpointStore::cpuState(size_t id) const
+{
+    const Record &record = m_records.at(id);
+
+    SynacorVM::CpuState state;
+    std::copy(record.registers, record.registers + 8, state.registers.begin());
+    state.instructionPointer = record.instructionPointer;
+    state.stack.assign(m_stackWords.begin() + record.stackOffset, m_stackWords.begin() + record.stackOffset + record.stackSize);
+
+    return state;
+}
+
+void CheckpointStore::restore(size_t id, SynacorVM &vm)
+{
+    SynacorVM::CpuState state = cpuState(id);
+
+    std::vector<ushort> memory(MemoryImage::words);
+    vm.readMemory(0, memory.data(), memory.size());
+
+    for (size_t index = 0; index != pages; ++index)
+    {
+        const Page &words = page(pageId(id, index));
+        ushort address = static_cast<ushort>(index * pageWords);
+        if (!std::equal(words.begin(), words.end(), memory.begin() + address))
+            vm.writeMemory(address, words.data(), pageWords);
+    }
+
+    vm.setCpuState(state);
+}
+
+size_t CheckpointStore::difference(size_t a, size_t b)
+{
+    m_records.at(a);
+    m_records.at(b);
+
+    size_t count = 0;
+    for (size_t index = 0; index != pages; ++index)
+    {
+        uint32_t pageA = pageId(a, index), pageB = pageId(b, index);
+        if (pageA == pageB)
+            continue;
+
+        Page wordsA = page(pageA);
+        const Page &wordsB = page(pageB);
+        for (size_t i = 0; i != pageWords; ++i)
+            count += wordsA[i] != wordsB[i];
+    }
+
+    return count;
+}
+
+CheckpointStore::Statistics CheckpointStore::statistics() const
+{
+    // Hash table nodes hold the entry and a link, buckets a pointer.
+    auto indexBytes = [](const std::unordered_multimap<uint64_t, uint32_t> &index) {
+        return index.size() * (sizeof(std::pair<uint64_t, uint32_t>) + sizeof(void *)) + index.bucket_count() * sizeof(void *);
+    };
+
+    Statistics statistics;
+    statistics.checkpoints = m_records.size();
+    statistics.pages = m_pageHashes.size();
+    statistics.directories = m_directories.size();
+    statistics.compressedBytes = m_pageData.size();
+    statistics.totalBytes = m_pageData.capacity() + (m_pageEnds.capacity() + m_pageHashes.capacity()) * sizeof(uint64_t)
+        + m_pageBases.capacity() * sizeof(uint32_t) + m_pageDepths.capacity()
+        + indexBytes(m_pageIndex) + m_directories.capacity() * sizeof(Directory) + indexBytes(m_directoryIndex)
+        + m_records.capacity() * sizeof(Record) + m_stackWords.capacity() * sizeof(ushort);
+
+    return statistics;
+}
+
+void CheckpointStore::clear()
+{
+    m_pageData.clear();
+    m_pageEnds.clear();
+    m_pageHashes.clear();
+    m_pageBases.clear();
+    m_pageDepths.clear();
+    m_pageIndex.clear();
+    m_directories.clear();
+    m_directoryIndex.clear();
+    m_records.clear();
+    m_stackWords.clear();
+    m_cache.clear();
+    m_cached.clear();
+}
+
+void CheckpointStore::save(const std::string &filename) const
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs)
+        throw std::runtime_error("Could not open " + filename);
+
+    FileHeader header;
+    std::copy(checkpointMagic, checkpointMagic + 8, header.magic);
+    header.pages = m_pageHashes.size();
+    header.directories = m_directories.size();
+    header.checkpoints = m_records.size();
+    header.stackWords = m_stackWords.size();
+    header.pageBytes = m_pageData.size();
+
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeVector(ofs, m_pageHashes);
+    writeVector(ofs, m_pageEnds);
+    writeVector(ofs, m_pageBases);
+    writeVector(ofs, m_pageData);
+    writeVector(ofs, m_directories);
+    writeVector(ofs, m_records);
+    writeVector(ofs, m_stackWords);
+
+    if (!ofs.flush())
+        throw std::runtime_error("Could not write " + filename);
+}
+
+void CheckpointStore::load(const std::string &filename)
+{
+    FileMapping file(filename);
+    const unsigned char *data = file.data(), *end = file.data() + file.size();
+
+    FileHeader header;
+    if (file.size() < sizeof(header))
+        throw std::runtime_error(filename + " is not a checkpoint file");
+
+    std::memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    if (!std::equal(checkpointMagic, checkpointMagic + 8, header.magic))
+        throw std::runtime_error(filename + " is not a checkpoint file");
+
+    CheckpointStore store(m_cachePages);
+    readVector(data, end, store.m_pageHashes, header.pages);
+    readVector(data, end, store.m_pageEnds, header.pages);
+    readVector(data, end, store.m_pageBases, header.pages);
+    readVector(data, end, store.m_pageData, header.pageBytes);
+    readVector(data, end, store.m_directories, header.directories);
+    readVector(data, end, store.m_records, header.checkpoints);
+    readVector(data, end, store.m_stackWords, header.stackWords);
+
+    if (data != end)
+        throw std::runtime_error(filename + " has trailing data");
+
+    // Pages are only checked when decompressed, but every id and range must be valid up front.
+    uint64_t previousEnd = 0;
+    store.m_pageDepths.resize(store.m_pageBases.size());
+    for (uint32_t id = 0; id != store.m_pageBases.size(); ++id)
+    {
+        uint64_t pageEnd = store.m_pageEnds[id];
+        uint32_t base = store.m_pageBases[id];
+        if (pageEnd < previousEnd || pageEnd > store.m_pageData.size() || (base != noBase && (base >= id || store.m_pageDepths[base] >= maxDepth)))
+            throw std::runtime_error(filename + " holds an invalid page");
+
+        store.m_pageDepths[id] = base == noBase ? 0 : store.m_pageDepths[base] + 1;
+        previousEnd = pageEnd;
+    }
+
+    for (const Directory &directory : store.m_directories)
+        if (std::any_of(directory.begin(), directory.end(), [&](uint32_t id) { return id >= header.pages; }))
+            throw std::runtime_error(filename + " holds an invalid directory");
+
+    for (const Record &record : store.m_records)
+    {
+        if (std::any_of(std::begin(record.directories), std::end(record.directories), [&](uint32_t id) { return id >= header.directories; })
+            || static_cast<uint64_t>(record.stackOffset) + record.stackSize > header.stackWords)
+            throw std::runtime_error(filename + " holds an invalid checkpoint");
+    }
+
+    store.rebuildIndices();
+    *this = std::move(store);
+}
+
+const CheckpointStore::Page &CheckpointStore::page(uint32_t id)
+{
+    auto cached = m_cached.find(id);
+    if (cached != m_cached.end())
+    {
+        m_cache.splice(m_cache.begin(), m_cache, cached->second);
+        return cached->second->second;
+    }
+
+    uint64_t begin = id ? m_pageEnds[id - 1] : 0, size = m_pageEnds[id] - begin;
+
+    Page words;
+    if (size == pageBytes)
+        std::memcpy(words.data(), m_pageData.data() + begin, pageBytes);
+    else if (!decompress(m_pageData.data() + begin, static_cast<size_t>(size), reinterpret_cast<unsigned char *>(words.data()), pageBytes))
+        throw std::runtime_error("Checkpoint page " + std::to_string(id) + " is corrupt");
+
+    if (m_pageBases[id] != noBase)
+    {
+        const Page &base = page(m_pageBases[id]);
+        for (size_t i = 0; i != pageWords; ++i)
+            words[i] ^= base[i];
+    }
+
+    return cache(id, words);
+}
+
+uint32_t CheckpointStore::addPage(const ushort *words, uint32_t base)
+{
+    uint64_t hash = hashBytes(words, pageBytes);
+
+    auto range = m_pageIndex.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const Page &existing = page(it->second);
+        if (std::equal(existing.begin(), existing.end(), words))
+            return it->second;
+    }
+
+    uint32_t id = static_cast<uint32_t>(m_pageHashes.size());
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(words);
+
+    std::vector<unsigned char> compressed;
+    compress(bytes, pageBytes, compressed);
+
+    // The difference with the base page is mostly zeroes, unless the page was replaced as a whole.
+    if (base != noBase && m_pageDepths[base] < maxDepth)
+    {
+        Page difference = page(base);
+        for (size_t i = 0; i != pageWords; ++i)
+            difference[i] ^= words[i];
+
+        std::vector<unsigned char> compressedDifference;
+        compress(reinterpret_cast<const unsigned char *>(difference.data()), pageBytes, compressedDifference);
+        if (compressedDifference.size() < compressed.size())
+            compressed.swap(compressedDifference);
+        else
+            base = noBase;
+    }
+    else
+        base = noBase;
+
+    // Pages that do not compress are stored as is, which is what a size of pageBytes signals.
+    if (compressed.size() >= pageBytes)
+    {
+        compressed.assign(bytes, bytes + pageBytes);
+        base = noBase;
+    }
+
+    m_pageData.insert(m_pageData.end(), compressed.begin(), compressed.end());
+    m_pageEnds.push_back(m_pageData.size());
+    m_pageHashes.push_back(hash);
+    m_pageBases.push_back(base);
+    m_pageDepths.push_back(base == noBase ? 0 : m_pageDepths[base] + 1);
+    m_pageIndex.emplace(hash, id);
+
+    // A new page is likely to be restored soon.
+    Page copy;
+    std::copy(words, words + pageWords, copy.begin());
+    cache(id, copy);
+
+    return id;
+}
+
+uint32_t CheckpointStore::addDirectory(const Directory &directory)
+{
+    uint64_t hash = hashBytes(directory.data(), sizeof(Directory));
+
+    auto range = m_directoryIndex.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+        if (m_directories[it->second] == directory)
+            return it->second;
+
+    uint32_t id = static_cast<uint32_t>(m_directories.size());
+    m_directories.push_back(directory);
+    m_directoryIndex.emplace(hash, id);
+    return id;
+}
+
+uint32_t CheckpointStore::pageId(size_t id, size_t index) const
+{
+    return m_directories[m_records[id].directories[index / pagesPerDirectory]][index % pagesPerDirectory];
+}
+
+const CheckpointStore::Page &CheckpointStore::cache(uint32_t id, const Page &page)
+{
+    // Once full, the least recently used entry is reused for the new page.
+    if (m_cache.size() >= m_cachePages)
+    {
+        m_cached.erase(m_cache.back().first);
+        m_cache.splice(m_cache.begin(), m_cache, std::prev(m_cache.end()));
+        m_cache.front() = { id, page };
+    }
+    else
+        m_cache.emplace_front(id, page);
+
+    m_cached[id] = m_cache.begin();
+    return m_cache.front().second;
+}
+
+void CheckpointStore::rebuildIndices()
+{
+    m_pageIndex.clear();
+    for (uint32_t id = 0; id != m_pageHashes.size(); ++id)
+        m_pageIndex.emplace(m_pageHashes[id], id);
+
+    m_directoryIndex.clear();
+    for (uint32_t id = 0; id != m_directories.size(); ++id)
+        m_directoryIndex.emplace(hashBytes(m_directories[id].data(), sizeof(Directory)), id);
+}
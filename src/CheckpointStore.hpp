@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SynacorVM.hpp"
+
+// Stores many snapshots (checkpoints) of a VM that mostly share their memory, e.g. one after every command of a
+//  session, for stepping back in time, exploring from earlier states or fuzzing.
+//
+// Memory is split into pages, and every distinct page is stored once and found again by its hash. A new page is
+//  compressed with a small LZ compressor, either as is or as the difference (XOR) with the page it replaces, a base
+//  page, which usually differs in a few words only and so compresses to a few bytes. A checkpoint only holds the
+//  registers, instruction pointer and stack, plus the ids of its directories: groups of page ids that are shared
+//  between checkpoints as well. A checkpoint that changes a few words thus costs about a hundred bytes. Recently used
+//  pages are kept decompressed in an LRU cache, so restoring a checkpoint close to recent ones takes microseconds.
+//
+// Hooks are captured as patched, and restoring memory leaves the hooks of the VM in place (see
+//  SynacorVM::writeMemory()).
+//
+// File layout:
+//   header:        magic "SYNCKPT1", then page, directory and checkpoint counts, stack words and compressed page bytes
+//                  (all 64-bit).
+//   pages:         the hash of every page, then the end offset of every page's data (both 64-bit), then the id of
+//                  every page's base page (32-bit, 0xFFFFFFFF if none), then the data. Data of exactly pageWords * 2
+//                  bytes is stored uncompressed.
+//   directories:   pagesPerDirectory page ids (32-bit) each.
+//   checkpoints:   directory ids (32-bit), registers, instruction pointer and padding (16-bit), then the offset and
+//                  size of the stack (32-bit) each.
+//   stack:         the stack words of all checkpoints, top first.
+//  All integers are in native byte order (little-endian on all supported platforms).
+class CheckpointStore
+{
+public:
+    static const size_t pageWords = 256;
+    static const size_t pages = 32768 / pageWords;
+    static const size_t pagesPerDirectory = 8;
+    static const size_t directories = pages / pagesPerDirectory;
+
+    // Longest chain of base pages. Restoring a page decompresses its base pages that are not cached.
+    static const unsigned maxDepth = 8;
+
+    using Page = std::array<ushort, pageWords>;
+
+    struct Statistics
+    {
+        size_t checkpoints;
+        size_t pages;               // Distinct pages.
+        size_t directories;         // Distinct directories.
+        size_t compressedBytes;     // Compressed data of all pages.
+        size_t totalBytes;          // Everything held in memory, excluding the cache.
+    };
+
+    // Keeps up to cachePages decompressed pages in the cache.
+    explicit CheckpointStore(size_t cachePages = 4096);
+
+    // Adds a checkpoint of memory (32K words) and CPU state. Returns its id; ids count up from 0.
+    size_t add(const ushort *memory, const SynacorVM::CpuState &state);
+
+    // Adds a checkpoint of vm.
+    size_t add(const SynacorVM &vm);
+
+    // Returns the number of checkpoints.
+    size_t size() const;
+
+    // Copies the memory of checkpoint id into memory (32K words).
+    void readMemory(size_t id, ushort *memory);
+
+    // Returns the registers, instruction pointer and stack of checkpoint id.
+    SynacorVM::CpuState cpuState(size_t id) const;
+
+    // Restores memory and CPU state of checkpoint id into vm. Only the words that differ are written.
+    void restore(size_t id, SynacorVM &vm);
+
+    // Returns the number of words in which the memory of checkpoints a and b differ.
+    size_t difference(size_t a, size_t b);
+
+    Statistics statistics() const;
+
+    // Removes all checkpoints and pages.
+    void clear();
+
+    // Writes all checkpoints to filename (see the file layout above). Throws std::runtime_error on failure.
+    void save(const std::string &filename) const;
+
+    // Replaces the contents of the store with those of filename. Throws std::runtime_error if it is not valid.
+    void load(const std::string &filename);
+
+private:
+    struct Record
+    {
+        uint32_t directories[CheckpointStore::directories];
+        ushort registers[8];
+        ushort instructionPointer;
+        ushort unused;
+        uint32_t stackOffset;
+        uint32_t stackSize;
+    };
+
+    using Directory = std::array<uint32_t, pagesPerDirectory>;
+
+    static const uint32_t noBase = 0xFFFFFFFF;
+
+    // Compressed pages, one after another.
+    std::vector<unsigned char> m_pageData;
+    std::vector<uint64_t> m_pageEnds;
+    std::vector<uint64_t> m_pageHashes;
+    std::vector<uint32_t> m_pageBases;
+    std::vector<unsigned char> m_pageDepths;
+    std::unordered_multimap<uint64_t, uint32_t> m_pageIndex;
+
+    std::vector<Directory> m_directories;
+    std::unordered_multimap<uint64_t, uint32_t> m_directoryIndex;
+
+    std::vector<Record> m_records;
+    std::vector<ushort> m_stackWords;
+
+    // Decompressed pages, most recently used first.
+    size_t m_cachePages;
+    std::list<std::pair<uint32_t, Page>> m_cache;
+    std::unordered_map<uint32_t, std::list<std::pair<uint32_t, Page>>::iterator> m_cached;
+
+    // Returns page id, decompressed.
+    const Page &page(uint32_t id);
+
+    // Returns the id of the page holding words, adding it if it is new, as a difference with base if possible.
+    uint32_t addPage(const ushort *words, uint32_t base);
+
+    // Returns the id of the directory, adding it if it is new.
+    uint32_t addDirectory(const Directory &directory);
+
+    // Returns the id of the page at index within the memory of checkpoint id.
+    uint32_t pageId(size_t id, size_t index) const;
+
+    const Page &cache(uint32_t id, const Page &page);
+    void rebuildIndices();
+};
@@ -0,0 +1,194 @@
+#include "ConfirmationTable.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct ConfirmationTable::Header
+{
+    char magic[8];
+    unsigned short r0;
+    unsigned short r1;
+    unsigned modulus;
+    unsigned char done[chunks];
+};
+
+namespace
+{
+    const char tableMagic[8] = { 'S', 'Y', 'N', 'C', 'O', 'N', 'F', '1' };
+
+    // The results start on their own page.
+    const size_t headerBytes = 4096;
+    const size_t fileBytes = headerBytes + ConfirmationTable::entries * sizeof(ushort);
+}
+
+ConfirmationTable::ConfirmationTable(const std::string &filename, bool writable)
+    : m_filename(filename), m_writable(writable)
+{
+    static_assert(sizeof(Header) <= headerBytes, "Header does not fit");
+
+#ifdef __linux__
+    m_fd = ::open(filename.c_str(), writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Could not open " + filename);
+
+    struct stat info;
+    if (fstat(m_fd, &info) < 0 || (writable && info.st_size == 0 && ftruncate(m_fd, fileBytes) < 0))
+    {
+        close(m_fd);
+        throw std::runtime_error("Could not size " + filename);
+    }
+
+    if (info.st_size != 0 && static_cast<size_t>(info.st_size) != fileBytes)
+    {
+        close(m_fd);
+        throw std::runtime_error(filename + " is not a confirmation table");
+    }
+
+    void *data = mmap(nullptr, fileBytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(m_fd);
+        throw std::runtime_error("Could not map " + filename);
+    }
+
+    m_data = static_cast<unsigned char *>(data);
+#else
+    m_buffer.resize(fileBytes);
+
+    std::ifstream is(filename, std::ios::in | std::ios::binary);
+    if (is)
+        is.read(reinterpret_cast<char *>(m_buffer.data()), fileBytes);
+    else if (!writable)
+        throw std::runtime_error("Could not open " + filename);
+
+    m_data = m_buffer.data();
+#endif
+
+    m_header = reinterpret_cast<Header *>(m_data);
+    m_results = reinterpret_cast<ushort *>(m_data + headerBytes);
+}
+
+ConfirmationTable::ConfirmationTable(ConfirmationTable &&other)
+    : m_filename(std::move(other.m_filename)), m_writable(other.m_writable), m_data(other.m_data), m_header(other.m_header),
+      m_results(other.m_results), m_pending(std::move(other.m_pending))
+#ifdef __linux__
+    , m_fd(other.m_fd)
+#else
+    , m_buffer(std::move(other.m_buffer))
+#endif
+{
+    other.m_data = nullptr;
+#ifdef __linux__
+    other.m_fd = -1;
+#endif
+}
+
+ConfirmationTable::~ConfirmationTable()
+{
+#ifdef __linux__
+    if (m_data)
+        munmap(m_data, fileBytes);
+    if (m_fd >= 0)
+        close(m_fd);
+#endif
+}
+
+ConfirmationTable ConfirmationTable::open(const std::string &filename)
+{
+    ConfirmationTable table(filename, false);
+
+    if (memcmp(table.m_header->magic, tableMagic, sizeof(tableMagic)) != 0)
+        throw std::runtime_error(filename + " is not a confirmation table");
+
+    if (!table.complete())
+        throw std::runtime_error(filename + " is incomplete");
+
+    return table;
+}
+
+ConfirmationTable ConfirmationTable::create(const std::string &filename, const Parameters &parameters)
+{
+    ConfirmationTable table(filename, true);
+    Header &header = *table.m_header;
+
+    if (std::all_of(header.magic, header.magic + sizeof(header.magic), [](char c) { return c == 0; }))
+    {
+        memcpy(header.magic, tableMagic, sizeof(tableMagic));
+        header.r0 = parameters.r0;
+        header.r1 = parameters.r1;
+        header.modulus = parameters.modulus;
+        table.flush(0, headerBytes);
+    }
+    else if (memcmp(header.magic, tableMagic, sizeof(tableMagic)) != 0)
+        throw std::runtime_error(filename + " is not a confirmation table");
+    else if (header.r0 != parameters.r0 || header.r1 != parameters.r1 || header.modulus != parameters.modulus)
+        throw std::runtime_error(filename + " holds a table for other parameters");
+
+    return table;
+}
+
+ConfirmationTable::Parameters ConfirmationTable::parameters() const
+{
+    return { m_header->r0, m_header->r1, m_header->modulus };
+}
+
+bool ConfirmationTable::chunkComplete(size_t chunk) const
+{
+    return m_header->done[chunk] != 0;
+}
+
+size_t ConfirmationTable::completedChunks() const
+{
+    return std::count_if(m_header->done, m_header->done + chunks, [](unsigned char done) { return done != 0; });
+}
+
+void ConfirmationTable::storeChunk(size_t chunk, const ushort *results)
+{
+    if (!m_writable)
+        throw std::logic_error("Table is read-only");
+
+    std::copy(results, results + chunkSize, m_results + chunk * chunkSize);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.push_back(chunk);
+}
+
+void ConfirmationTable::checkpoint()
+{
+    std::vector<size_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending.swap(m_pending);
+    }
+
+    if (pending.empty())
+        return;
+
+    // Results must be on disk before the chunks are marked complete.
+    flush(headerBytes, fileBytes - headerBytes);
+
+    for (size_t chunk : pending)
+        m_header->done[chunk] = 1;
+
+    flush(0, headerBytes);
+}
+
+void ConfirmationTable::flush(size_t offset, size_t size)
+{
+#ifdef __linux__
+    if (msync(m_data + offset, size, MS_SYNC) < 0)
+        throw std::runtime_error("Could not write " + m_filename);
+#else
+    std::ofstream os(m_filename, std::ios::out | std::ios::binary);
+    if (!os.write(reinterpret_cast<const char *>(m_buffer.data()), fileBytes))
+        throw std::runtime_error("Could not write " + m_filename);
+#endif
+}
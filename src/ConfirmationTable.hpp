@@ -0,0 +1,88 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+using ushort = unsigned short;
+
+// Results of the teleporter confirmation routine (0x178b, see tools/teleporter) for every value of R7, for one choice
+//  of the initial R0 and R1 and of the arithmetic modulus.
+//
+// Stored in a file that is memory-mapped as is:
+//   header (4096 bytes): magic "SYNCONF1", r0 and r1 (16-bit), modulus (32-bit), then one byte per chunk of
+//                        chunkSize entries, non-zero once the chunk has been computed.
+//   results:             32768 16-bit entries, indexed by R7.
+//  All integers are in native byte order (little-endian on all supported platforms).
+class ConfirmationTable
+{
+public:
+    struct Parameters
+    {
+        ushort r0;
+        ushort r1;
+        unsigned modulus;
+    };
+
+    static const size_t entries = 32768;
+    static const size_t chunkSize = 64;
+    static const size_t chunks = entries / chunkSize;
+
+    // Maps an existing, complete table read-only.
+    static ConfirmationTable open(const std::string &filename);
+
+    // Maps a table for writing, creating it if needed. Chunks completed by an earlier run are kept, so that an
+    //  interrupted sweep can resume. Throws if the file holds a table for other parameters.
+    static ConfirmationTable create(const std::string &filename, const Parameters &parameters);
+
+    ~ConfirmationTable();
+
+    ConfirmationTable(ConfirmationTable &&other);
+    ConfirmationTable(const ConfirmationTable &) = delete;
+    ConfirmationTable &operator=(const ConfirmationTable &) = delete;
+
+    Parameters parameters() const;
+
+    // Returns the result of the routine for r7.
+    ushort result(ushort r7) const
+    {
+        return m_results[r7 & 0x7FFF];
+    }
+
+    bool chunkComplete(size_t chunk) const;
+    size_t completedChunks() const;
+
+    bool complete() const
+    {
+        return completedChunks() == chunks;
+    }
+
+    // Stores the results for the entries of chunk. Safe to call concurrently for different chunks.
+    //  The chunk is only marked complete by the next checkpoint().
+    void storeChunk(size_t chunk, const ushort *results);
+
+    // Flushes all stored results to disk, then marks their chunks complete.
+    void checkpoint();
+
+private:
+    struct Header;
+
+    std::string m_filename;
+    bool m_writable;
+    unsigned char *m_data;
+    Header *m_header;
+    ushort *m_results;
+
+    std::mutex m_mutex;
+    std::vector<size_t> m_pending;
+
+#ifdef __linux__
+    int m_fd;
+#else
+    std::vector<unsigned char> m_buffer;
+#endif
+
+    ConfirmationTable(const std::string &filename, bool writable);
+
+    void flush(size_t offset, size_t size);
+};
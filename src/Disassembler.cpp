@@ -0,0 +1,117 @@
+#include "Disassembler.hpp"
+#include <algorithm>
+#include <iomanip>
+#include "Opcodes.hpp"
+#include "StringTable.hpp"
+
+namespace
+{
+    // Annotations are cut down to the start of the string.
+    const size_t maxAnnotationLength = 48;
+}
+
+Disassembler::Disassembler(const ushort *memory, const StringTable *strings)
+    : m_memory(memory), m_strings(strings)
+{
+}
+
+ushort Disassembler::disassemble(std::ostream &ss, ushort ip) const
+{
+    if (ip > 32767)
+    {
+        ss << "err";
+        return ip;
+    }
+
+    ushort opcode = m_memory[ip++];
+    if (opcode >= OpcodeCount)
+    {
+        ss << "dw ";
+        disassembleOperand(ss, opcode);
+    }
+    else
+    {
+        const OpcodeInfo &info = opcodeTable[opcode];
+        ss << info.name;
+
+        const StringTable::Entry *string = nullptr;
+        for (unsigned i = 0; i != info.operandCount && ip < 32768; ++i)
+        {
+            ss << ' '; 
+            disassembleOperand(ss, m_memory[ip]);
+
+            if (m_strings && !string && m_memory[ip] < 0x8000)
+                string = m_strings->find(m_memory[ip]);
+            ++ip;
+        }   
+
+        if (string)
+        {
+            bool cut = string->text.size() > maxAnnotationLength;
+            ss << "  ; " << StringTable::quote(string->text.substr(0, maxAnnotationLength)) << (cut ? "..." : "");
+        }
+    }
+
+    return ip;
+}
+
+ushort Disassembler::nextInstruction(ushort ip) const
+{
+    if (ip > 32767)
+        return ip;
+
+    ushort opcode = m_memory[ip];
+    return static_cast<ushort>(std::min<size_t>(32768, ip + 1 + operandCount(opcode)));
+}
+
+void Disassembler::dump(std::ostream &ss, ushort start, ushort end) const
+{
+    ss << "Synacor VM Disassembly" << std::endl << std::endl;
+    ss << std::hex << std::setfill('0');
+
+    for (ushort ip = start; ip < end; )
+    {
+        ss << std::setw(4) << ip << ": ";
+        ip = disassemble(ss, ip);
+        ss << std::endl;
+    }
+}
+
+void Disassembler::disassembleOperand(std::ostream &ss, ushort operand)
+{
+    if (operand < 0x8000)
+    {
+        ss << operand;
+        if (operand < 256)
+        {
+            ss << " '";
+            
+            if (operand < 0x20)
+                switch (operand)
+                {
+                case '\n':
+                    ss << "\\n";
+                    break;
+                case '\r':
+                    ss << "\\r";
+                    break;
+                case '\t':
+                    ss << "\\t";
+                    break;
+                default:
+                    ss << ' ';
+                    break;
+                }
+            else
+                ss << static_cast<char>(operand);
+
+
+            ss << "'";
+        }
+            
+    }
+    else if ((operand & 0x7FFF) < 8)
+        ss << "R" << (operand & 0x7FFF);
+    else
+        ss << "Err(" << operand << ')';
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+using ushort = unsigned short;
+
+class StringTable;
+
+// Disassembles instructions from 32K words of VM memory.
+class Disassembler
+{
+    const ushort *m_memory;
+    const StringTable *m_strings;
+
+public:
+    // If strings is given, instructions with an operand pointing at a string are annotated with a comment holding it.
+    explicit Disassembler(const ushort *memory, const StringTable *strings = nullptr);
+
+    // Writes the instruction at ip to ss. Returns the address of the next instruction.
+    ushort disassemble(std::ostream &ss, ushort ip) const;
+
+    // Returns the address of the instruction following the one at ip.
+    ushort nextInstruction(ushort ip) const;
+
+    // Writes the disassembly of [start, end) to ss, one instruction per line, after a header of dumpHeaderLines lines.
+    void dump(std::ostream &ss, ushort start, ushort end) const;
+
+    // Number of lines written by dump() before the first instruction.
+    static const size_t dumpHeaderLines = 2;
+
+    // Writes a single operand to ss (a literal, register or invalid value).
+    static void disassembleOperand(std::ostream &ss, ushort operand);
+};
@@ -0,0 +1,88 @@
+#include "FileMapping.hpp"
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+#ifdef __linux__
+
+FileMapping::FileMapping(const std::string &filename)
+    : m_data(nullptr), m_size(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + filename);
+
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Could not read " + filename);
+    }
+
+    m_size = static_cast<size_t>(info.st_size);
+
+    // Empty files cannot be mapped, but there is nothing to map either.
+    if (m_size)
+    {
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Could not map " + filename);
+        }
+
+        m_data = static_cast<const unsigned char *>(data);
+    }
+
+    // The mapping stays valid without the descriptor.
+    close(fd);
+}
+
+FileMapping::~FileMapping()
+{
+    if (m_data)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+}
+
+FileMapping::FileMapping(FileMapping &&other)
+    : m_data(other.m_data), m_size(other.m_size)
+{
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+#else
+
+FileMapping::FileMapping(const std::string &filename)
+{
+    std::ifstream is(filename, std::ios::in | std::ios::binary);
+    if (!is)
+        throw std::runtime_error("Could not open " + filename);
+
+    m_buffer.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+FileMapping::~FileMapping()
+{
+}
+
+FileMapping::FileMapping(FileMapping &&other)
+    : m_buffer(std::move(other.m_buffer))
+{
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Read-only view of the contents of a whole file.
+// On Linux the file is mapped, so nothing is read until it is accessed. Elsewhere it is read into memory.
+class FileMapping
+{
+    const unsigned char *m_data;
+    size_t m_size;
+
+#ifndef __linux__
+    std::vector<unsigned char> m_buffer;
+#endif
+
+public:
+    // Throws std::runtime_error if the file cannot be opened.
+    explicit FileMapping(const std::string &filename);
+    ~FileMapping();
+
+    FileMapping(FileMapping &&other);
+    FileMapping(const FileMapping &) = delete;
+    FileMapping &operator=(const FileMapping &) = delete;
+
+    const unsigned char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
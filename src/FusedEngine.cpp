@@ -0,0 +1,515 @@
+#include "FusedEngine.hpp"
+#include "Opcodes.hpp"
+#include "SynacorVM.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+    using Handler = void (*)(FusedEngine::Context &context, const FusedEngine::Decoded &entry, ushort ip,
+        unsigned long long count);
+}
+
+struct FusedEngine::Decoded
+{
+    Handler handler;            // Null if not decoded yet.
+    unsigned char instructions; // Number of instructions covered.
+    unsigned char fusion;       // Superinstruction index plus one, or 0 for a single instruction.
+    ushort operands[6];         // Of all instructions covered, registers by index.
+};
+
+struct FusedEngine::Context
+{
+    ushort *registers;
+    std::deque<ushort> &stack;
+    SynacorVM &vm;
+    unsigned long long &instructionCount;   // The VM's, brought up to date before handlers call into it.
+    const Decoded *cache;
+    unsigned long long *fusionCounts;
+    unsigned long long stopAt;              // Handlers return rather than go past this instruction count.
+
+    // Where the handlers stopped: at ip, after count instructions. If refused, the handler at ip left its instruction
+    //  to SynacorVM::step() without changing any state (e.g. POP on an empty stack).
+    ushort ip;
+    unsigned long long count;
+    bool refused;
+};
+
+namespace
+{
+    using Context = FusedEngine::Context;
+    using Decoded = FusedEngine::Decoded;
+
+    // The operands of an instruction, and the state it executes on. Bit i of Kinds is set if operand i is a register,
+    //  which is known when the handler is generated.
+    template <unsigned Kinds>
+    struct Operands
+    {
+        Context &context;
+        const ushort *words;
+        ushort next;                    // Address of the instruction following the (super)instruction.
+        unsigned long long count;       // Instruction count once the (super)instruction has executed.
+
+        ushort value(unsigned i) const
+        {
+            return (Kinds >> i & 1) ? context.registers[words[i]] : words[i];
+        }
+
+        void store(unsigned i, ushort value) const
+        {
+            if (Kinds >> i & 1)
+            {
+                context.registers[words[i]] = value;
+            }
+            else
+            {
+                sync();
+                context.vm.writeMemory(words[i], value);
+            }
+        }
+
+        void push(ushort value) const
+        {
+            context.stack.push_front(value);
+        }
+
+        ushort pop() const
+        {
+            ushort top = context.stack.front();
+            context.stack.pop_front();
+            return top;
+        }
+
+        // Leaves the VM as step() would, before calling into it: memory accesses may throw.
+        void sync() const
+        {
+            context.vm.setInstructionPointer(next);
+            context.instructionCount = count;
+        }
+    };
+
+    // HALT and IN stop execution, IN may also block or suspend: leave them to step().
+    constexpr bool executable(ushort opcode)
+    {
+        return opcode != Halt && opcode != In;
+    }
+
+    // Executes opcode Op. Returns the address to continue at. Matches SynacorVM::execute(), which remains the
+    //  reference.
+    template <ushort Op, typename O>
+    inline ushort perform(const O &o)
+    {
+        switch (Op)
+        {
+        case Set:
+            o.store(0, o.value(1));
+            break;
+        case Push:
+            o.push(o.value(0));
+            break;
+        case Pop:
+            o.store(0, o.pop());
+            break;
+        case Eq:
+            o.store(0, o.value(1) == o.value(2) ? 1 : 0);
+            break;
+        case Gt:
+            o.store(0, o.value(1) > o.value(2) ? 1 : 0);
+            break;
+        case Jmp:
+            return o.value(0);
+        case Jt:
+            return o.value(0) ? o.value(1) : o.next;
+        case Jf:
+            return !o.value(0) ? o.value(1) : o.next;
+        case Add:
+            o.store(0, (o.value(1) + o.value(2)) % 32768);
+            break;
+        case Mult:
+            o.store(0, (o.value(1) * o.value(2)) % 32768);
+            break;
+        case Mod:
+            o.store(0, o.value(1) % o.value(2));
+            break;
+        case And:
+            o.store(0, o.value(1) & o.value(2));
+            break;
+        case Or:
+            o.store(0, o.value(1) | o.value(2));
+            break;
+        case Not:
+            o.store(0, ~o.value(1) & 0x7FFF);
+            break;
+        case Rmem:
+            o.sync();
+            o.store(0, o.context.vm.readMemory(o.value(1)));
+            break;
+        case Wmem:
+            o.sync();
+            o.context.vm.writeMemory(o.value(0), o.value(1));
+            break;
+        case Call:
+            o.push(o.next);
+            return o.value(0);
+        case Ret:
+            return o.pop();
+        case Out:
+            o.context.vm.io().write(static_cast<char>(o.value(0)));
+            break;
+        default:
+            break;
+        }
+
+        return o.next;
+    }
+
+    // A sequence of instructions executed as one (super)instruction, with the operands of all instructions in a row.
+    //  Only the last instruction may transfer control; the others continue with the next one in the sequence.
+    template <ushort... Ops>
+    struct Sequence;
+
+    template <ushort Op>
+    struct Sequence<Op>
+    {
+        static constexpr unsigned instructions = 1;
+        static constexpr unsigned operands = opcodeTable[Op].operandCount;
+        static constexpr unsigned length = 1 + operands;
+        static constexpr bool executable = ::executable(Op);
+        static constexpr unsigned depth = opcodeTable[Op].pops;    // Stack words needed.
+
+        template <unsigned Kinds>
+        static ushort run(Context &context, const ushort *words, ushort next, unsigned long long count)
+        {
+            return perform<Op>(Operands<Kinds>{ context, words, next, count });
+        }
+    };
+
+    template <ushort Op, ushort Second, ushort... Rest>
+    struct Sequence<Op, Second, Rest...>
+    {
+        using Head = Sequence<Op>;
+        using Tail = Sequence<Second, Rest...>;
+
+        static_assert(!opcodeTable[Op].transfersControl, "Only the last instruction may transfer control");
+
+        static constexpr unsigned instructions = 1 + Tail::instructions;
+        static constexpr unsigned operands = Head::operands + Tail::operands;
+        static constexpr unsigned length = Head::length + Tail::length;
+        static constexpr bool executable = Head::executable && Tail::executable;
+        static constexpr unsigned depth =
+            Head::depth + (Tail::depth > opcodeTable[Op].pushes ? Tail::depth - opcodeTable[Op].pushes : 0);
+
+        template <unsigned Kinds>
+        static ushort run(Context &context, const ushort *words, ushort next, unsigned long long count)
+        {
+            Head::template run<Kinds>(context, words, next, count);
+            return Tail::template run<(Kinds >> Head::operands)>(context, words + Head::operands, next, count);
+        }
+    };
+
+    void stop(Context &context, ushort ip, unsigned long long count, bool refused)
+    {
+        context.ip = ip;
+        context.count = count;
+        context.refused = refused;
+    }
+
+    // Continues with the handler of the instruction at ip, unless it has to go through FusedEngine::execute().
+    inline void dispatch(Context &context, ushort ip, unsigned long long count)
+    {
+        if (ip >= 32768)
+            return stop(context, ip, count, false);
+
+        const Decoded &entry = context.cache[ip];
+        if (!entry.handler || count + entry.instructions > context.stopAt)
+            return stop(context, ip, count, false);
+
+        entry.handler(context, entry, ip, count);
+    }
+
+    template <typename S, unsigned Kinds>
+    void execute(Context &context, const Decoded &entry, ushort ip, unsigned long long count)
+    {
+        if (!S::executable)
+            return stop(context, ip, count, true);
+
+        // A deque's size() is costlier than empty(), which is all most sequences need.
+        if (S::depth == 1 ? context.stack.empty() : S::depth && context.stack.size() < S::depth)
+            return stop(context, ip, count, true);
+
+        // Writing memory may invalidate the entry, which is not used past this point.
+        count += S::instructions;
+        if (S::instructions > 1)
+            ++context.fusionCounts[entry.fusion - 1];
+
+        ushort next = S::template run<Kinds>(context, entry.operands, static_cast<ushort>(ip + S::length), count);
+        dispatch(context, next, count);
+    }
+
+    template <typename S, size_t... Kinds>
+    constexpr std::array<Handler, sizeof...(Kinds)> makeVariants(std::index_sequence<Kinds...>)
+    {
+        return {{ &execute<S, Kinds>... }};
+    }
+
+    // The handlers of a sequence, indexed by the kinds of its operands.
+    template <typename S>
+    constexpr std::array<Handler, (1u << S::operands)> variants =
+        makeVariants<S>(std::make_index_sequence<(1u << S::operands)>());
+
+    template <size_t... Ops>
+    constexpr std::array<const Handler *, OpcodeCount> makeInstructions(std::index_sequence<Ops...>)
+    {
+        return {{ &variants<Sequence<Ops>>[0]... }};
+    }
+
+    // The handlers of every opcode, indexed by opcode and then by operand kinds.
+    constexpr std::array<const Handler *, OpcodeCount> instructions =
+        makeInstructions(std::make_index_sequence<OpcodeCount>());
+
+    void fallback(Context &context, const Decoded &, ushort ip, unsigned long long count)
+    {
+        stop(context, ip, count, true);
+    }
+
+    struct Fusion
+    {
+        const char *name;
+        unsigned char instructions;
+        ushort opcodes[3];
+        const Handler *variants;
+    };
+
+    template <ushort... Ops>
+    constexpr Fusion fusion(const char *name)
+    {
+        return { name, sizeof...(Ops), { Ops... }, &variants<Sequence<Ops...>>[0] };
+    }
+
+    // The superinstructions, in the order reported by fusionStats().
+    constexpr Fusion fusions[] =
+    {
+        fusion<Push, Push>("push push"),
+        fusion<Push, Push, Call>("push push call"),
+        fusion<Pop, Pop>("pop pop"),
+        fusion<Pop, Pop, Ret>("pop pop ret"),
+        fusion<Eq, Jt>("eq jt"),
+        fusion<Eq, Jf>("eq jf"),
+        fusion<Gt, Jt>("gt jt"),
+        fusion<Gt, Jf>("gt jf"),
+        fusion<Add, Jt>("add jt"),
+        fusion<Add, Jf>("add jf"),
+        fusion<Set, Call>("set call"),
+    };
+
+    static_assert(sizeof(fusions) / sizeof(fusions[0]) == FusedEngine::fusionCount, "Wrong number of superinstructions");
+
+    // An instruction as pre-decoded for the handlers.
+    struct Instruction
+    {
+        ushort opcode;
+        unsigned kinds;         // Bit i set if operand i is a register.
+        ushort operands[3];     // Registers by index.
+    };
+
+    // Returns whether every operand the instruction writes is a register.
+    bool writesRegisters(const Instruction &instruction)
+    {
+        const OpcodeInfo &info = opcodeTable[instruction.opcode];
+        for (unsigned i = 0; i != info.operandCount; ++i)
+        {
+            if (info.operands[i] == OperandUse::Target && !(instruction.kinds >> i & 1))
+                return false;
+        }
+
+        return true;
+    }
+}
+
+FusedEngine::FusedEngine(SynacorVM &vm)
+    : m_vm(vm), m_cache(new Decoded[32768])
+{
+    invalidateAll();
+}
+
+FusedEngine::~FusedEngine()
+{
+}
+
+void FusedEngine::invalidate(ushort address)
+{
+    for (unsigned i = 0; i != maxLength && i <= address; ++i)
+        m_cache[address - i].handler = nullptr;
+}
+
+void FusedEngine::invalidateAll()
+{
+    for (unsigned i = 0; i != 32768; ++i)
+        m_cache[i].handler = nullptr;
+
+    m_fusionCounts.fill(0);
+}
+
+std::vector<FusedEngine::FusionStat> FusedEngine::fusionStats() const
+{
+    std::vector<FusionStat> stats;
+    for (size_t i = 0; i != fusionCount; ++i)
+        stats.push_back({ fusions[i].name, m_fusionCounts[i] });
+
+    return stats;
+}
+
+void FusedEngine::decode(ushort ip)
+{
+    const ushort *memory = m_vm.m_memory.data();
+
+    // Decodes the instruction at address. Returns false if it has to be left to step(): invalid opcodes (including
+    //  hooks) and operands, which step() reports, and SET to an address, which it rejects.
+    auto decodeAt = [memory](unsigned address, Instruction &instruction)
+    {
+        if (address >= 32768 || memory[address] >= OpcodeCount)
+            return false;
+
+        instruction.opcode = memory[address];
+        instruction.kinds = 0;
+
+        unsigned count = operandCount(instruction.opcode);
+        if (address + count >= 32768)
+            return false;
+
+        for (unsigned i = 0; i != count; ++i)
+        {
+            ushort operand = memory[address + 1 + i];
+            if (operand & 0x8000)
+            {
+                if ((operand & 0x7FFF) > 7)
+                    return false;
+
+                instruction.kinds |= 1u << i;
+                operand &= 7;
+            }
+
+            instruction.operands[i] = operand;
+        }
+
+        return instruction.opcode != Set || (instruction.kinds & 1);
+    };
+
+    Instruction sequence[3];
+    unsigned decoded = 0;
+    for (unsigned address = ip; decoded != 3 && decodeAt(address, sequence[decoded]); ++decoded)
+        address += 1 + operandCount(sequence[decoded].opcode);
+
+    Decoded &entry = m_cache[ip];
+    if (!decoded)
+    {
+        entry = { fallback, 1, 0, {} };
+        return;
+    }
+
+    // Concatenates the operands of the first count instructions into the entry.
+    auto combine = [&](unsigned count, const Handler *variants, unsigned char fusion)
+    {
+        unsigned kinds = 0, operands = 0;
+        for (unsigned i = 0; i != count; ++i)
+        {
+            unsigned n = operandCount(sequence[i].opcode);
+            std::copy(sequence[i].operands, sequence[i].operands + n, entry.operands + operands);
+
+            kinds |= sequence[i].kinds << operands;
+            operands += n;
+        }
+
+        entry.handler = variants[kinds];
+        entry.instructions = static_cast<unsigned char>(count);
+        entry.fusion = fusion;
+    };
+
+    combine(1, instructions[sequence[0].opcode], 0);
+
+    // Use the longest superinstruction the sequence starts with. Only fuse when the leading instructions write
+    //  registers or the stack. A memory write could modify the instructions that follow it within the
+    //  superinstruction.
+    for (size_t f = 0; f != fusionCount; ++f)
+    {
+        const Fusion &candidate = fusions[f];
+        if (candidate.instructions > decoded || candidate.instructions <= entry.instructions)
+            continue;
+
+        bool matches = true;
+        for (unsigned i = 0; i != candidate.instructions && matches; ++i)
+        {
+            matches = sequence[i].opcode == candidate.opcodes[i] &&
+                (i + 1u == candidate.instructions || writesRegisters(sequence[i]));
+        }
+
+        if (matches)
+            combine(candidate.instructions, candidate.variants, static_cast<unsigned char>(f + 1));
+    }
+}
+
+bool FusedEngine::executeFallback(ushort &ip)
+{
+    m_vm.m_instructionPointer = ip;
+    bool running = m_vm.step();
+    ip = m_vm.m_instructionPointer;
+
+    return running;
+}
+
+void FusedEngine::run()
+{
+    execute<false>(0);
+}
+
+bool FusedEngine::runFor(unsigned long long count)
+{
+    return execute<true>(m_vm.m_instructionCount + count);
+}
+
+template <bool Bounded>
+bool FusedEngine::execute(unsigned long long limit)
+{
+    Context context = { m_vm.m_registers.data(), m_vm.m_stack, m_vm, m_vm.m_instructionCount, m_cache.get(),
+        m_fusionCounts.data(), 0, 0, 0, false };
+
+    ushort ip = m_vm.m_instructionPointer;
+    unsigned long long count = m_vm.m_instructionCount;
+
+    while (true)
+    {
+        if (Bounded && count >= limit)
+        {
+            m_vm.m_instructionCount = count;
+            m_vm.m_instructionPointer = ip;
+            return true;
+        }
+
+        if (ip < 32768)
+        {
+            if (!m_cache[ip].handler)
+                decode(ip);
+
+            const Decoded &entry = m_cache[ip];
+            context.stopAt = Bounded ? std::min(limit, count + chainLength) : count + chainLength;
+
+            // Superinstructions that would overshoot the limit are executed one instruction at a time.
+            if (count + entry.instructions <= context.stopAt)
+            {
+                entry.handler(context, entry, ip, count);
+                ip = context.ip;
+                count = context.count;
+
+                if (!context.refused)
+                    continue;
+            }
+        }
+
+        // Instructions that fall back to step() are counted there.
+        m_vm.m_instructionCount = count;
+        if (!executeFallback(ip))
+            return false;
+
+        count = m_vm.m_instructionCount;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+class SynacorVM;
+using ushort = unsigned short;
+
+// Execution engine that decodes each instruction once into a cache, and fuses common instruction sequences
+//  (e.g. 'eq' followed by 'jt', or 'pop pop ret') into superinstructions that execute with a single dispatch.
+// Produces the same results as SynacorVM::step(). Memory writes invalidate the affected cache entries.
+//
+// Handlers are generated from the opcode table (see Opcodes.hpp) for every instruction and superinstruction, in a
+//  variant for every combination of operand kinds (literal or register), so they never check at run time whether an
+//  operand is a register. Each handler dispatches straight to the handler of the next instruction.
+class FusedEngine
+{
+public:
+    // Number of superinstructions.
+    static const size_t fusionCount = 11;
+
+    // Number of times a superinstruction was executed.
+    struct FusionStat
+    {
+        const char *name;
+        unsigned long long count;
+    };
+
+    // A decoded (super)instruction, and the state handlers run on. Defined in FusedEngine.cpp.
+    struct Decoded;
+    struct Context;
+
+    explicit FusedEngine(SynacorVM &vm);
+    ~FusedEngine();
+
+    // Executes the program until a halt is encountered, or IN has to wait for input.
+    void run();
+
+    // Executes at most count instructions. Returns false if execution stopped early (see SynacorVM::runFor()).
+    bool runFor(unsigned long long count);
+
+    // Discards decoded instructions overlapping address.
+    void invalidate(ushort address);
+
+    // Discards all decoded instructions.
+    void invalidateAll();
+
+    // Returns how often each superinstruction was executed.
+    std::vector<FusionStat> fusionStats() const;
+
+private:
+    // Longest sequence of words a decoded entry may cover.
+    static const unsigned maxLength = 8;
+
+    // Most instructions handlers execute before returning to execute(). This bounds the stack depth if the compiler
+    //  does not turn the calls between handlers into jumps (e.g. in debug builds).
+    static const unsigned chainLength = 256;
+
+    SynacorVM &m_vm;
+    std::unique_ptr<Decoded[]> m_cache;
+    std::array<unsigned long long, fusionCount> m_fusionCounts;
+
+    // Executes until a halt, IN without input, or (if Bounded) until the instruction count reaches limit.
+    template <bool Bounded>
+    bool execute(unsigned long long limit);
+
+    void decode(ushort ip);
+    bool executeFallback(ushort &ip);
+};
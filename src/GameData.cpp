@@ -0,0 +1,189 @@
+#include "GameData.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include "MemoryImage.hpp"
+#include "SynacorVM.hpp"
+
+namespace
+{
+    // Far more than the self-test and decryption take.
+    const unsigned long long bootInstructionLimit = 100000000;
+
+    class TableReader
+    {
+        const ushort *m_memory;
+
+    public:
+        explicit TableReader(const ushort *memory)
+            : m_memory(memory)
+        {}
+
+        ushort read(size_t address) const
+        {
+            if (address >= MemoryImage::words)
+                throw std::runtime_error("Game data points outside memory (" + std::to_string(address) + ")");
+
+            return m_memory[address];
+        }
+
+        std::string readString(ushort address) const
+        {
+            ushort length = read(address);
+            read(static_cast<size_t>(address) + length);
+
+            std::string string;
+            string.reserve(length);
+            for (ushort i = 1; i <= length; ++i)
+                string += static_cast<char>(m_memory[address + i]);
+
+            return string;
+        }
+    };
+
+    void writeJsonString(std::ostream &os, const std::string &string)
+    {
+        os << '"';
+        for (char c : string)
+        {
+            switch (c)
+            {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7f)     // Bytes as Latin-1
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                    os << escaped;
+                }
+                else
+                    os << c;
+                break;
+            }
+        }
+        os << '"';
+    }
+}
+
+GameData GameData::read(const ushort *memory, ushort startRoom)
+{
+    TableReader reader(memory);
+
+    GameData data;
+    data.currentRoom = reader.read(currentRoomAddress);
+
+    ushort itemCount = reader.read(itemListAddress);
+    for (ushort i = 1; i <= itemCount; ++i)
+    {
+        ushort address = reader.read(itemListAddress + i);
+        data.items.push_back({ address, reader.readString(reader.read(address)), reader.readString(reader.read(address + 1)), reader.read(address + 2), reader.read(address + 3) });
+    }
+
+    std::vector<bool> seen(MemoryImage::words);
+
+    // Adds a room and its exits. Exits are explored afterwards, depth-first, with an explicit stack of (room, next exit).
+    std::vector<std::pair<size_t, size_t>> stack;
+    auto visit = [&](ushort address)
+    {
+        if (address >= MemoryImage::words || seen[address])
+            return;
+
+        seen[address] = true;
+
+        Room room = { address, reader.readString(reader.read(address)), reader.readString(reader.read(address + 1)), {}, reader.read(address + 4) };
+
+        ushort nameBase = reader.read(address + 2);
+        ushort destinationBase = reader.read(address + 3);
+        ushort n = reader.read(nameBase);
+        if (n != reader.read(destinationBase))
+            throw std::runtime_error("Could not read room exits. Number of exit names and room ids mismatch.");
+
+        for (ushort i = 1; i <= n; ++i)
+            room.exits.push_back({ reader.readString(reader.read(nameBase + i)), reader.read(destinationBase + i) });
+
+        data.rooms.push_back(std::move(room));
+        stack.emplace_back(data.rooms.size() - 1, 0);
+    };
+
+    auto trace = [&](ushort address)
+    {
+        visit(address);
+        while (!stack.empty())
+        {
+            auto &top = stack.back();
+            const Room &room = data.rooms[top.first];
+            if (top.second == room.exits.size())
+                stack.pop_back();
+            else
+                visit(room.exits[top.second++].destination);
+        }
+    };
+
+    trace(startRoom ? startRoom : data.currentRoom);
+
+    for (const Item &item : data.items)
+        if (item.location != carried && item.location != nowhere)
+            trace(item.location);
+
+    return data;
+}
+
+GameData GameData::extract(const std::string &binary, ushort startRoom)
+{
+    SynacorVM vm;
+    BufferedIO io;
+    vm.setIO(io);
+    vm.loadBinary(binary);
+
+    if (vm.runFor(bootInstructionLimit) || !vm.waitingForInput())
+        throw std::runtime_error(binary + " did not boot up to its first input");
+
+    return read(vm.memory(), startRoom);
+}
+
+size_t GameData::findRoom(ushort address) const
+{
+    return std::find_if(rooms.begin(), rooms.end(), [&](const Room &room) { return room.address == address; }) - rooms.begin();
+}
+
+void GameData::writeJson(std::ostream &os) const
+{
+    os << "{\n  \"currentRoom\": " << currentRoom << ",\n  \"rooms\": [";
+    for (size_t i = 0; i != rooms.size(); ++i)
+    {
+        const Room &room = rooms[i];
+        os << (i ? "," : "") << "\n    { \"address\": " << room.address << ", \"name\": ";
+        writeJsonString(os, room.name);
+        os << ", \"handler\": " << room.handler << ",\n      \"description\": ";
+        writeJsonString(os, room.description);
+        os << ",\n      \"exits\": [";
+        for (size_t j = 0; j != room.exits.size(); ++j)
+        {
+            os << (j ? ", " : "") << "{ \"name\": ";
+            writeJsonString(os, room.exits[j].name);
+            os << ", \"destination\": " << room.exits[j].destination << " }";
+        }
+        os << "] }";
+    }
+
+    os << "\n  ],\n  \"items\": [";
+    for (size_t i = 0; i != items.size(); ++i)
+    {
+        const Item &item = items[i];
+        os << (i ? "," : "") << "\n    { \"address\": " << item.address << ", \"name\": ";
+        writeJsonString(os, item.name);
+        os << ", \"location\": " << item.location << ", \"handler\": " << item.handler << ",\n      \"description\": ";
+        writeJsonString(os, item.description);
+        os << " }";
+    }
+
+    os << "\n  ]\n}\n";
+}
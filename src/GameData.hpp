@@ -0,0 +1,68 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+using ushort = unsigned short;
+
+// Rooms and items of the game, read from its data tables in VM memory. The game's strings are only decrypted by its
+//  self-test, so the tables are only readable once the game has booted up to its first input.
+//
+// Layout of the tables (see spoilers/decrypted.asm):
+//   0x0aac:    address of the room the player is in.
+//   room:      addresses of its name, description, exit names and exit destinations, then of its handler (or 0).
+//              Exit names and destinations are length-prefixed arrays of string and room addresses.
+//   0x6af5:    length-prefixed array of item addresses.
+//   item:      addresses of its name and description, its location, then its handler (or 0).
+//              The location is a room address, carried when in the inventory, or nowhere if it does not exist yet.
+//  All strings are length-prefixed.
+class GameData
+{
+public:
+    static const ushort currentRoomAddress = 0x0aac;
+    static const ushort itemListAddress = 0x6af5;
+    static const ushort carried = 0;
+    static const ushort nowhere = 0x7fff;
+
+    struct Exit
+    {
+        std::string name;
+        ushort destination;
+    };
+
+    struct Room
+    {
+        ushort address;
+        std::string name;
+        std::string description;
+        std::vector<Exit> exits;
+        ushort handler;
+    };
+
+    struct Item
+    {
+        ushort address;
+        std::string name;
+        std::string description;
+        ushort location;
+        ushort handler;
+    };
+
+    ushort currentRoom;
+    std::vector<Room> rooms;    // Depth-first from the start room, then rooms only reachable from item locations.
+    std::vector<Item> items;
+
+    // Reads the tables from 32K words of memory, tracing rooms from startRoom (the current room if 0).
+    //  Throws std::runtime_error if the tables are malformed.
+    static GameData read(const ushort *memory, ushort startRoom = 0);
+
+    // Boots binary in a headless VM up to its first input, and reads the tables from its memory.
+    static GameData extract(const std::string &binary, ushort startRoom = 0);
+
+    // Returns the index of the room at address, or rooms.size() if there is none.
+    size_t findRoom(ushort address) const;
+
+    // Writes all rooms and items as a JSON document.
+    void writeJson(std::ostream &os) const;
+};
@@ -0,0 +1,625 @@
+#include "LockstepVM.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include "MemoryImage.hpp"
+#include "Opcodes.hpp"
+
+namespace
+{
+    using Row = LockstepVM::Row;
+
+    const unsigned lanes = LockstepVM::lanes;
+
+    // Lane-wise helpers. They are plain loops over all lanes without branches, so that they vectorize. Masks hold
+    //  0xFFFF for the lanes they select, and 0 for the others.
+
+    Row broadcast(ushort value)
+    {
+        Row row;
+        row.fill(value);
+        return row;
+    }
+
+    template <typename Operation>
+    Row map(const Row &lhs, const Row &rhs, Operation operation)
+    {
+        Row result;
+        for (unsigned l = 0; l != lanes; ++l)
+            result[l] = static_cast<ushort>(operation(lhs[l], rhs[l]));
+
+        return result;
+    }
+
+    // Returns a mask of the lanes for which predicate holds.
+    template <typename Predicate>
+    Row select(const Row &values, Predicate predicate)
+    {
+        Row mask;
+        for (unsigned l = 0; l != lanes; ++l)
+            mask[l] = static_cast<ushort>(-static_cast<int>(predicate(values[l])));
+
+        return mask;
+    }
+
+    Row maskAnd(const Row &lhs, const Row &rhs)
+    {
+        return map(lhs, rhs, [](ushort a, ushort b) { return a & b; });
+    }
+
+    Row maskAndNot(const Row &lhs, const Row &rhs)
+    {
+        return map(lhs, rhs, [](ushort a, ushort b) { return a & ~b; });
+    }
+
+    void blend(Row &target, const Row &values, const Row &mask)
+    {
+        for (unsigned l = 0; l != lanes; ++l)
+            target[l] = static_cast<ushort>((target[l] & ~mask[l]) | (values[l] & mask[l]));
+    }
+
+    bool any(const Row &mask)
+    {
+        unsigned bits = 0;
+        for (unsigned l = 0; l != lanes; ++l)
+            bits |= mask[l];
+
+        return bits != 0;
+    }
+
+    bool all(const Row &mask)
+    {
+        unsigned bits = 0xFFFF;
+        for (unsigned l = 0; l != lanes; ++l)
+            bits &= mask[l];
+
+        return bits != 0;
+    }
+
+    // Returns whether all lanes in mask hold the same value as lane.
+    bool uniform(const Row &values, const Row &mask, unsigned lane)
+    {
+        unsigned differences = 0;
+        for (unsigned l = 0; l != lanes; ++l)
+            differences |= (values[l] ^ values[lane]) & mask[l];
+
+        return differences == 0;
+    }
+
+    unsigned firstLane(const Row &mask)
+    {
+        return static_cast<unsigned>(std::find_if(mask.begin(), mask.end(), [](ushort bits) { return bits != 0; }) - mask.begin());
+    }
+}
+
+LockstepVM::LockstepVM()
+    : m_memory(MemoryImage::words), m_image(MemoryImage::words), m_dirty(MemoryImage::words)
+{
+    for (Row &row : m_memory)
+        row.fill(0);
+
+    reset();
+}
+
+void LockstepVM::load(const ushort *memory)
+{
+    std::copy(memory, memory + MemoryImage::words, m_image.begin());
+    for (size_t address = 0; address != MemoryImage::words; ++address)
+        m_memory[address].fill(memory[address]);
+
+    std::fill(m_dirty.begin(), m_dirty.end(), 0);
+    m_dirtyWords.clear();
+    reset();
+}
+
+void LockstepVM::load(const MemoryImage &image)
+{
+    load(image.data());
+}
+
+void LockstepVM::reset()
+{
+    for (ushort address : m_dirtyWords)
+    {
+        m_memory[address].fill(m_image[address]);
+        m_dirty[address] = 0;
+    }
+
+    m_dirtyWords.clear();
+
+    for (Row &row : m_registers)
+        row.fill(0);
+
+    m_instructionPointers.fill(0);
+    m_stack.clear();
+    m_depths.fill(0);
+    m_states.fill(LaneState::Running);
+    m_instructionCounts.fill(0);
+    m_inputPositions.fill(0);
+
+    for (unsigned lane = 0; lane != lanes; ++lane)
+    {
+        m_inputs[lane].clear();
+        m_outputs[lane].clear();
+    }
+
+    m_dispatches = 0;
+    m_converged = false;
+    m_memoryDiverged = false;
+}
+
+void LockstepVM::disableLane(unsigned lane)
+{
+    m_states.at(lane) = LaneState::Disabled;
+    m_converged = false;
+}
+
+ushort LockstepVM::readRegister(unsigned lane, ushort reg) const
+{
+    if (reg > 7)
+        throw std::out_of_range("Invalid register index");
+
+    return m_registers[reg].at(lane);
+}
+
+void LockstepVM::writeRegister(unsigned lane, ushort reg, ushort value)
+{
+    if (reg > 7)
+        throw std::out_of_range("Invalid register index");
+
+    m_registers[reg].at(lane) = value;
+}
+
+ushort LockstepVM::readMemory(unsigned lane, ushort address) const
+{
+    if (address >= MemoryImage::words)
+        throw std::out_of_range("Attempted to read from invalid memory address.");
+
+    return m_memory[address].at(lane);
+}
+
+void LockstepVM::writeMemory(unsigned lane, ushort address, ushort value)
+{
+    if (address >= MemoryImage::words)
+        throw std::out_of_range("Attempted to write to invalid memory address.");
+
+    m_memory[address].at(lane) = value;
+    markDirty(address);
+    m_memoryDiverged = true;
+}
+
+ushort LockstepVM::instructionPointer(unsigned lane) const
+{
+    return m_instructionPointers.at(lane);
+}
+
+void LockstepVM::setInstructionPointer(unsigned lane, ushort address)
+{
+    m_instructionPointers.at(lane) = address;
+    m_converged = false;
+}
+
+void LockstepVM::push(unsigned lane, ushort value)
+{
+    unsigned &depth = m_depths.at(lane);
+    if (depth == m_stack.size())
+        m_stack.emplace_back();
+
+    m_stack[depth++][lane] = value;
+    m_converged = false;
+}
+
+void LockstepVM::setInput(unsigned lane, const std::string &input)
+{
+    m_inputs.at(lane) = input;
+    m_inputPositions[lane] = 0;
+
+    if (m_states[lane] == LaneState::WaitingForInput)
+    {
+        m_states[lane] = LaneState::Running;
+        m_converged = false;
+    }
+}
+
+const std::string &LockstepVM::output(unsigned lane) const
+{
+    return m_outputs.at(lane);
+}
+
+LockstepVM::LaneState LockstepVM::state(unsigned lane) const
+{
+    return m_states.at(lane);
+}
+
+unsigned long long LockstepVM::instructionCount(unsigned lane) const
+{
+    return m_instructionCounts.at(lane);
+}
+
+unsigned long long LockstepVM::dispatchCount() const
+{
+    return m_dispatches;
+}
+
+bool LockstepVM::run(unsigned long long maxDispatches)
+{
+    unsigned leader = 0;
+    Row group = {};
+    m_converged = false;
+
+    for (unsigned long long n = 0; n != maxDispatches; ++n)
+    {
+        if (!m_converged)
+        {
+            Row running;
+            for (unsigned l = 0; l != lanes; ++l)
+                running[l] = m_states[l] == LaneState::Running ? 0xFFFF : 0;
+
+            if (!any(running))
+                return false;
+
+            // Deepest stack first, then lowest address.
+            leader = firstLane(running);
+            for (unsigned l = leader + 1; l != lanes; ++l)
+                if (running[l] && (m_depths[l] > m_depths[leader] || (m_depths[l] == m_depths[leader] && m_instructionPointers[l] < m_instructionPointers[leader])))
+                    leader = l;
+
+            group = maskAnd(running, select(m_instructionPointers, [&](ushort ip) { return ip == m_instructionPointers[leader]; }));
+            m_converged = group == running;
+        }
+
+        if (dispatch(leader, group))
+            m_converged = false;
+    }
+
+    return std::find(m_states.begin(), m_states.end(), LaneState::Running) != m_states.end();
+}
+
+bool LockstepVM::dispatch(unsigned leader, Row group)
+{
+    size_t ip = m_instructionPointers[leader];
+    size_t opcode = ip < MemoryImage::words ? m_memory[ip][leader] : static_cast<size_t>(OpcodeCount);
+    if (opcode >= OpcodeCount || ip + 1 + operandCount(opcode) > MemoryImage::words)
+    {
+        stop(group, LaneState::Fault);
+        return true;
+    }
+
+    size_t operands = operandCount(opcode);
+    std::array<ushort, 4> words = {};
+    for (size_t i = 0; i <= operands; ++i)
+        words[i] = m_memory[ip + i][leader];
+
+    // Lanes whose code differs from the leader's wait for a group of their own.
+    if (m_memoryDiverged)
+    {
+        Row same = group;
+        for (size_t i = 0; i <= operands; ++i)
+            same = maskAnd(same, select(m_memory[ip + i], [&](ushort word) { return word == words[i]; }));
+
+        if (same != group)
+        {
+            group = same;
+            m_converged = false;
+        }
+    }
+
+    for (unsigned l = 0; l != lanes; ++l)
+        m_instructionCounts[l] += group[l] & 1;
+
+    ++m_dispatches;
+
+    Row next = broadcast(static_cast<ushort>(ip + 1 + operands));
+    Row literal1, literal2;
+    const Row *a, *b;
+
+    switch (opcode)
+    {
+    case Halt:
+        stop(group, LaneState::Halted);
+        return true;
+    case Set:
+        if (!(words[1] & 0x8000) || !(a = value(words[2], literal1, group)))
+        {
+            stop(group, LaneState::Fault);
+            return true;
+        }
+
+        store(words[1], *a, group);
+        break;
+    case Push:
+        if (!(a = value(words[1], literal1, group)))
+            return true;
+
+        for (unsigned l = 0; l != lanes; ++l)
+            if (group[l])
+            {
+                if (m_depths[l] == m_stack.size())
+                    m_stack.emplace_back();
+
+                m_stack[m_depths[l]++][l] = (*a)[l];
+            }
+        break;
+    case Pop:
+    {
+        Row values = {}, underflow = {};
+        for (unsigned l = 0; l != lanes; ++l)
+            if (group[l])
+            {
+                if (m_depths[l])
+                    values[l] = m_stack[--m_depths[l]][l];
+                else
+                    underflow[l] = 0xFFFF;
+            }
+
+        if (any(underflow))
+        {
+            stop(underflow, LaneState::Fault);
+            group = maskAndNot(group, underflow);
+        }
+
+        store(words[1], values, group);
+        break;
+    }
+    case Eq:
+    case Gt:
+    case Add:
+    case Mult:
+    case Mod:
+    case And:
+    case Or:
+    {
+        if (!(a = value(words[2], literal1, group)) || !(b = value(words[3], literal2, group)))
+            return true;
+
+        Row result;
+        switch (opcode)
+        {
+        case Eq:
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return lhs == rhs; });
+            break;
+        case Gt:
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return lhs > rhs; });
+            break;
+        case Add:
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return (lhs + rhs) % 32768; });
+            break;
+        case Mult:
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return (lhs * rhs) % 32768; });
+            break;
+        case Mod:
+        {
+            Row zero = maskAnd(group, select(*b, [](ushort rhs) { return rhs == 0; }));
+            if (any(zero))
+            {
+                stop(zero, LaneState::Fault);
+                group = maskAndNot(group, zero);
+            }
+
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return rhs ? lhs % rhs : 0; });
+            break;
+        }
+        case And:
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return lhs & rhs; });
+            break;
+        default:
+            result = map(*a, *b, [](ushort lhs, ushort rhs) { return lhs | rhs; });
+            break;
+        }
+
+        store(words[1], result, group);
+        break;
+    }
+    case Jmp:
+        if (!(a = value(words[1], literal1, group)))
+            return true;
+
+        blend(m_instructionPointers, *a, group);
+        return !uniform(*a, group, leader);
+    case Jt:
+    case Jf:
+    {
+        if (!(a = value(words[1], literal1, group)) || !(b = value(words[2], literal2, group)))
+            return true;
+
+        Row taken = select(*a, [&](ushort condition) { return (condition != 0) == (opcode == Jt); });
+        Row targets = next;
+        blend(targets, *b, taken);
+        blend(m_instructionPointers, targets, group);
+        return !uniform(targets, group, leader);
+    }
+    case Not:
+        if (!(a = value(words[2], literal1, group)))
+            return true;
+
+        store(words[1], map(*a, *a, [](ushort rhs, ushort) { return ~rhs & 0x7FFF; }), group);
+        break;
+    case Rmem:
+    {
+        if (!(a = value(words[2], literal1, group)))
+            return true;
+
+        Row values = {}, invalid = {};
+        for (unsigned l = 0; l != lanes; ++l)
+        {
+            ushort address = (*a)[l];
+            if (!group[l])
+                continue;
+            else if (address < MemoryImage::words)
+                values[l] = m_memory[address][l];
+            else if ((address & 0x7FFF) < 8)
+                values[l] = m_registers[address & 0x7FFF][l];
+            else
+                invalid[l] = 0xFFFF;
+        }
+
+        if (any(invalid))
+        {
+            stop(invalid, LaneState::Fault);
+            group = maskAndNot(group, invalid);
+        }
+
+        store(words[1], values, group);
+        break;
+    }
+    case Wmem:
+        if (!(a = value(words[1], literal1, group)) || !(b = value(words[2], literal2, group)))
+            return true;
+
+        storeAt(*a, *b, group);
+        break;
+    case Call:
+        if (!(a = value(words[1], literal1, group)))
+            return true;
+
+        for (unsigned l = 0; l != lanes; ++l)
+            if (group[l])
+            {
+                if (m_depths[l] == m_stack.size())
+                    m_stack.emplace_back();
+
+                m_stack[m_depths[l]++][l] = next[l];
+            }
+
+        blend(m_instructionPointers, *a, group);
+        return !uniform(*a, group, leader);
+    case Ret:
+    {
+        Row targets = {}, returned = {};
+        for (unsigned l = 0; l != lanes; ++l)
+            if (group[l])
+            {
+                if (m_depths[l])
+                    targets[l] = m_stack[--m_depths[l]][l];
+                else
+                    returned[l] = 0xFFFF;
+            }
+
+        if (any(returned))
+            stop(returned, LaneState::Returned);
+
+        group = maskAndNot(group, returned);
+        blend(m_instructionPointers, targets, group);
+        return true;
+    }
+    case Out:
+        if (!(a = value(words[1], literal1, group)))
+            return true;
+
+        for (unsigned l = 0; l != lanes; ++l)
+            if (group[l])
+                m_outputs[l] += static_cast<char>((*a)[l]);
+        break;
+    case In:
+    {
+        Row values = {}, waiting = {};
+        for (unsigned l = 0; l != lanes; ++l)
+            if (group[l])
+            {
+                if (m_inputPositions[l] != m_inputs[l].size())
+                    values[l] = static_cast<unsigned char>(m_inputs[l][m_inputPositions[l]++]);
+                else
+                    waiting[l] = 0xFFFF;
+            }
+
+        if (any(waiting))
+        {
+            stop(waiting, LaneState::WaitingForInput);
+            group = maskAndNot(group, waiting);
+        }
+
+        store(words[1], values, group);
+        break;
+    }
+    default: /* Noop */
+        break;
+    }
+
+    blend(m_instructionPointers, next, group);
+    return false;
+}
+
+const LockstepVM::Row *LockstepVM::value(ushort operand, Row &literal, const Row &group)
+{
+    if (!(operand & 0x8000))
+    {
+        literal.fill(operand);
+        return &literal;
+    }
+
+    if ((operand & 0x7FFF) > 7)
+    {
+        stop(group, LaneState::Fault);
+        return nullptr;
+    }
+
+    return &m_registers[operand & 0x7FFF];
+}
+
+void LockstepVM::store(ushort operand, const Row &values, const Row &group)
+{
+    if (operand < MemoryImage::words)
+    {
+        // The lanes' memory only stays identical if all of them write the same value.
+        if (!all(group) || !uniform(values, group, 0))
+            m_memoryDiverged = true;
+
+        blend(m_memory[operand], values, group);
+        markDirty(operand);
+    }
+    else if ((operand & 0x7FFF) < 8)
+        blend(m_registers[operand & 0x7FFF], values, group);
+    else
+        stop(group, LaneState::Fault);
+}
+
+void LockstepVM::storeAt(const Row &addresses, const Row &values, const Row &group)
+{
+    if (all(group) && uniform(addresses, group, 0))
+    {
+        store(addresses[0], values, group);
+        return;
+    }
+
+    m_memoryDiverged = true;
+
+    Row invalid = {};
+    for (unsigned l = 0; l != lanes; ++l)
+        if (group[l] && !writeWord(addresses[l], l, values[l]))
+            invalid[l] = 0xFFFF;
+
+    if (any(invalid))
+        stop(invalid, LaneState::Fault);
+}
+
+bool LockstepVM::writeWord(ushort address, unsigned lane, ushort value)
+{
+    if (address < MemoryImage::words)
+    {
+        m_memory[address][lane] = value;
+        markDirty(address);
+    }
+    else if ((address & 0x7FFF) < 8)
+        m_registers[address & 0x7FFF][lane] = value;
+    else
+        return false;
+
+    return true;
+}
+
+void LockstepVM::markDirty(ushort address)
+{
+    if (!m_dirty[address])
+    {
+        m_dirty[address] = 1;
+        m_dirtyWords.push_back(address);
+    }
+}
+
+void LockstepVM::stop(const Row &group, LaneState state)
+{
+    for (unsigned l = 0; l != lanes; ++l)
+        if (group[l])
+            m_states[l] = state;
+
+    m_converged = false;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+using ushort = unsigned short;
+
+class MemoryImage;
+
+// Runs several VM instances (lanes) in lockstep, e.g. the same code with different initial registers or input.
+//
+// All state is stored as structure of arrays: for every register, memory word and stack slot, one value per lane.
+//  Lanes that share an instruction pointer form a group, which executes each instruction with a single dispatch and
+//  computes it for all of its lanes at once, in loops over the lanes that the compiler vectorizes. When lanes branch
+//  differently they are masked off and executed as separate groups, the group with the deepest stack (then the lowest
+//  address) first, so that they meet again at the same address and merge.
+//
+// Semantics follow SynacorVM::step(), except that errors do not throw: they stop the lanes hitting them. A lane
+//  returning with an empty stack stops as well, so that a lane can run a single call. Each lane has its own input and
+//  output buffers; a lane that runs out of input stops waiting for it. Hooks and profiling are not supported.
+class LockstepVM
+{
+public:
+    static const unsigned lanes = 16;
+
+    using Row = std::array<ushort, lanes>;
+
+    enum class LaneState
+    {
+        Running,
+        Halted,             // Executed HALT.
+        Returned,           // Executed RET with an empty stack.
+        WaitingForInput,    // Executed IN without input left. The instruction pointer is left on the IN.
+        Fault,              // Invalid opcode or operand, stack underflow, division by zero or execution outside memory.
+        Disabled
+    };
+
+    LockstepVM();
+
+    // Loads 32K words of memory into every lane and resets all lanes.
+    void load(const ushort *memory);
+    void load(const MemoryImage &image);
+
+    // Restores the loaded memory, clears registers, stacks, input and output, and sets all lanes running from address 0.
+    //  Only the memory written since the last load or reset is restored.
+    void reset();
+
+    // Excludes a lane from running (until the next reset), e.g. when there are fewer instances than lanes.
+    void disableLane(unsigned lane);
+
+    ushort readRegister(unsigned lane, ushort reg) const;
+    void writeRegister(unsigned lane, ushort reg, ushort value);
+
+    ushort readMemory(unsigned lane, ushort address) const;
+    void writeMemory(unsigned lane, ushort address, ushort value);
+
+    ushort instructionPointer(unsigned lane) const;
+    void setInstructionPointer(unsigned lane, ushort address);
+
+    void push(unsigned lane, ushort value);
+
+    void setInput(unsigned lane, const std::string &input);
+    const std::string &output(unsigned lane) const;
+
+    LaneState state(unsigned lane) const;
+
+    // Number of instructions the lane executed since the last reset.
+    unsigned long long instructionCount(unsigned lane) const;
+
+    // Number of dispatches (instructions executed by a group) since the last reset.
+    unsigned long long dispatchCount() const;
+
+    // Runs until no lane is running, or for at most maxDispatches dispatches. Returns whether any lane is still running.
+    bool run(unsigned long long maxDispatches = ~0ull);
+
+private:
+    std::vector<Row> m_memory;              // 32K words.
+    std::vector<ushort> m_image;            // Memory as loaded, restored by reset().
+    std::vector<unsigned char> m_dirty;     // 1 for every word written since the last load or reset.
+    std::vector<ushort> m_dirtyWords;
+    std::array<Row, 8> m_registers;
+    Row m_instructionPointers;
+    std::vector<Row> m_stack;               // Slot by slot.
+    std::array<unsigned, lanes> m_depths;
+    std::array<LaneState, lanes> m_states;
+    std::array<unsigned long long, lanes> m_instructionCounts;
+    std::array<std::string, lanes> m_inputs;
+    std::array<size_t, lanes> m_inputPositions;
+    std::array<std::string, lanes> m_outputs;
+    unsigned long long m_dispatches;
+    bool m_converged;                       // Whether all running lanes are known to share one instruction pointer.
+    bool m_memoryDiverged;                  // Whether the memory of the lanes may differ, and so may their code.
+
+    // Executes the instruction at the leader's instruction pointer for the lanes in group (0xFFFF for every lane in
+    //  it). Returns whether the lanes' instruction pointers may have split up, or lanes stopped.
+    bool dispatch(unsigned leader, Row group);
+
+    // Returns the values of a value operand (a literal, or a register), or null after stopping group if invalid.
+    const Row *value(ushort operand, Row &literal, const Row &group);
+
+    // Stores values into the destination operand (a register or an address) for the lanes in group.
+    void store(ushort operand, const Row &values, const Row &group);
+
+    // Stores values into an address per lane, for the lanes in group.
+    void storeAt(const Row &addresses, const Row &values, const Row &group);
+
+    // Writes one lane's word at address (or register). Returns false if the address is invalid.
+    bool writeWord(ushort address, unsigned lane, ushort value);
+    void markDirty(ushort address);
+
+    void stop(const Row &group, LaneState state);
+};
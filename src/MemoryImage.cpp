@@ -0,0 +1,228 @@
+#include "MemoryImage.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const ushort maxWord = 32775;   // Highest register.
+
+    void checkSize(size_t size, const std::string &filename)
+    {
+        if (size > MemoryImage::bytes)
+            throw std::runtime_error(filename + " is larger than the VM's memory");
+        if (size % sizeof(ushort))
+            throw std::runtime_error(filename + " does not hold a whole number of words");
+    }
+
+    // Throws if any word is neither a number nor a register. The check is branch-free, so the loop vectorizes.
+    void validate(const ushort *words, size_t count, const std::string &filename)
+    {
+        unsigned invalid = 0;
+        for (size_t i = 0; i != count; ++i)
+            invalid |= words[i] > maxWord;
+
+        if (invalid)
+        {
+            size_t address = std::find_if(words, words + count, [](ushort word) { return word > maxWord; }) - words;
+            throw std::runtime_error(filename + " holds an invalid value at address " + std::to_string(address));
+        }
+    }
+
+    // Reads the words of a binary into words (32K, zero-filled past the end of the file), and validates them. Returns
+    //  the number read. The file is read rather than mapped: the words are validated once, and stay as validated even
+    //  if the file is rewritten while the image is in use.
+    size_t readWords(const std::string &filename, ushort *words)
+    {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file)
+            throw std::runtime_error("Could not open " + filename);
+
+        size_t size = static_cast<size_t>(file.tellg());
+        checkSize(size, filename);
+
+        std::vector<unsigned char> data(size);
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char *>(data.data()), size))
+            throw std::runtime_error("Could not read " + filename);
+
+        size_t count = size / sizeof(ushort);
+        for (size_t i = 0; i != count; ++i)
+            words[i] = static_cast<ushort>(data[2 * i] | data[2 * i + 1] << 8);
+
+        std::fill(words + count, words + MemoryImage::words, 0);
+        validate(words, count, filename);
+        return count;
+    }
+
+#ifdef __linux__
+    // Maps the whole memory file fd privately.
+    ushort *mapPrivate(int fd, int protection)
+    {
+        void *data = mmap(nullptr, MemoryImage::bytes, protection, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Could not map memory image");
+
+        return static_cast<ushort *>(data);
+    }
+
+    int createMemoryFile(const ushort *memory)
+    {
+        int fd = memfd_create("synacor-image", MFD_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Could not create memory image");
+
+        const char *data = reinterpret_cast<const char *>(memory);
+        size_t written = 0;
+
+        while (written != MemoryImage::bytes)
+        {
+            ssize_t result = pwrite(fd, data + written, MemoryImage::bytes - written, written);
+            if (result <= 0)
+            {
+                close(fd);
+                throw std::runtime_error("Could not write memory image");
+            }
+
+            written += result;
+        }
+
+        return fd;
+    }
+#endif
+}
+
+#ifdef __linux__
+
+MemoryImage::MemoryImage(const ushort *memory)
+    : m_fd(createMemoryFile(memory)), m_view(nullptr), m_loadedWords(words)
+{
+    try
+    {
+        m_view = mapPrivate(m_fd, PROT_READ);
+    }
+    catch (...)
+    {
+        close(m_fd);
+        throw;
+    }
+}
+
+MemoryImage::MemoryImage(const std::string &filename)
+    : m_fd(-1), m_view(nullptr)
+{
+    std::unique_ptr<ushort[]> memory(new ushort[words]);
+    m_loadedWords = readWords(filename, memory.get());
+    m_fd = createMemoryFile(memory.get());
+
+    try
+    {
+        m_view = mapPrivate(m_fd, PROT_READ);
+    }
+    catch (...)
+    {
+        close(m_fd);
+        throw;
+    }
+}
+
+MemoryImage::~MemoryImage()
+{
+    munmap(const_cast<ushort *>(m_view), bytes);
+    close(m_fd);
+}
+
+const ushort *MemoryImage::data() const
+{
+    return m_view;
+}
+
+MemoryMapping::MemoryMapping()
+{
+    void *data = mmap(nullptr, MemoryImage::bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        throw std::bad_alloc();
+
+    m_data = static_cast<ushort *>(data);
+}
+
+MemoryMapping::MemoryMapping(const MemoryImage &image)
+    : m_data(mapPrivate(image.m_fd, PROT_READ | PROT_WRITE))
+{
+}
+
+void MemoryMapping::release()
+{
+    if (m_data)
+        munmap(m_data, MemoryImage::bytes);
+}
+
+#else
+
+MemoryImage::MemoryImage(const ushort *memory)
+    : m_words(new ushort[words]), m_loadedWords(words)
+{
+    std::copy(memory, memory + words, m_words.get());
+}
+
+MemoryImage::MemoryImage(const std::string &filename)
+    : m_words(new ushort[words])
+{
+    m_loadedWords = readWords(filename, m_words.get());
+}
+
+MemoryImage::~MemoryImage()
+{
+}
+
+const ushort *MemoryImage::data() const
+{
+    return m_words.get();
+}
+
+MemoryMapping::MemoryMapping()
+    : m_data(new ushort[MemoryImage::words]())
+{
+}
+
+MemoryMapping::MemoryMapping(const MemoryImage &image)
+    : m_data(new ushort[MemoryImage::words])
+{
+    std::copy(image.m_words.get(), image.m_words.get() + MemoryImage::words, m_data);
+}
+
+void MemoryMapping::release()
+{
+    delete[] m_data;
+}
+
+#endif
+
+MemoryMapping::~MemoryMapping()
+{
+    release();
+}
+
+MemoryMapping::MemoryMapping(MemoryMapping &&other)
+    : m_data(other.m_data)
+{
+    other.m_data = nullptr;
+}
+
+MemoryMapping &MemoryMapping::operator=(MemoryMapping &&other)
+{
+    if (this != &other)
+    {
+        release();
+        m_data = other.m_data;
+        other.m_data = nullptr;
+    }
+
+    return *this;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+using ushort = unsigned short;
+
+// Immutable 32K word memory image that can be shared by many VMs.
+// On Linux the image lives in an anonymous memory file, so views of it are real copy-on-write mappings. Binaries are
+//  copied into it once loaded, so VMs never map the file they were loaded from.
+class MemoryImage
+{
+    friend class MemoryMapping;
+
+#ifdef __linux__
+    int m_fd;
+    const ushort *m_view;
+#else
+    std::unique_ptr<ushort[]> m_words;
+#endif
+    size_t m_loadedWords;
+
+public:
+    static const size_t words = 32768;
+    static const size_t bytes = words * sizeof(ushort);
+
+    // Creates an image holding a copy of the specified 32K words.
+    explicit MemoryImage(const ushort *memory);
+
+    // Loads a binary or memory snapshot: up to 32K little-endian words, followed by zeroes.
+    //  The file is read and validated once. On Linux VMs mapping the image share its pages until they write to them.
+    //  Throws std::runtime_error if the file cannot be read, is larger than memory, has an odd size, or holds a word
+    //  that is neither a number nor a register.
+    explicit MemoryImage(const std::string &filename);
+
+    ~MemoryImage();
+
+    // Read-only view of all 32K words.
+    const ushort *data() const;
+
+    // Number of words loaded from the file, or 32K for images created from memory.
+    size_t loadedWords() const
+    {
+        return m_loadedWords;
+    }
+
+    MemoryImage(const MemoryImage &) = delete;
+    MemoryImage &operator=(const MemoryImage &) = delete;
+};
+
+// Private, writable view of 32K words of VM memory.
+// Either zero-initialized, or a copy-on-write view of a MemoryImage where pages are only copied once written to.
+class MemoryMapping
+{
+    ushort *m_data;
+
+public:
+    // Creates zero-initialized memory.
+    MemoryMapping();
+
+    // Creates a copy-on-write view of image.
+    explicit MemoryMapping(const MemoryImage &image);
+
+    ~MemoryMapping();
+
+    MemoryMapping(MemoryMapping &&other);
+    MemoryMapping &operator=(MemoryMapping &&other);
+
+    MemoryMapping(const MemoryMapping &) = delete;
+    MemoryMapping &operator=(const MemoryMapping &) = delete;
+
+    ushort *data() { return m_data; }
+    const ushort *data() const { return m_data; }
+
+    ushort &operator[](ushort address) { return m_data[address]; }
+    ushort operator[](ushort address) const { return m_data[address]; }
+
+private:
+    void release();
+};
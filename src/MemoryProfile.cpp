@@ -0,0 +1,248 @@
+#include "MemoryProfile.hpp"
+#include "Disassembler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    const char profileMagic[8] = { 'S', 'Y', 'N', 'P', 'R', 'O', 'F', '1' };
+
+    const size_t heatmapWidth = 256;
+    const size_t heatmapHeight = MemoryProfile::words / heatmapWidth;
+
+    void writeCounters(std::ostream &os, const std::vector<unsigned long long> &counters)
+    {
+        std::vector<unsigned char> bytes(counters.size() * 8);
+        for (size_t i = 0; i != counters.size(); ++i)
+            for (size_t b = 0; b != 8; ++b)
+                bytes[i * 8 + b] = static_cast<unsigned char>(counters[i] >> (8 * b));
+
+        os.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    }
+
+    void readCounters(std::istream &is, std::vector<unsigned long long> &counters)
+    {
+        std::vector<unsigned char> bytes(counters.size() * 8);
+        if (!is.read(reinterpret_cast<char *>(bytes.data()), bytes.size()))
+            throw std::runtime_error("Truncated profile");
+
+        for (size_t i = 0; i != counters.size(); ++i)
+        {
+            counters[i] = 0;
+            for (size_t b = 0; b != 8; ++b)
+                counters[i] |= static_cast<unsigned long long>(bytes[i * 8 + b]) << (8 * b);
+        }
+    }
+
+    // -- Minimal PNG writer (uncompressed deflate blocks) --
+
+    unsigned long crc32(const unsigned char *data, size_t size, unsigned long crc = 0)
+    {
+        static unsigned long table[256];
+        if (!table[1])
+            for (unsigned long n = 0; n != 256; ++n)
+            {
+                unsigned long c = n;
+                for (int k = 0; k != 8; ++k)
+                    c = c & 1 ? 0xEDB88320ul ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+
+        crc ^= 0xFFFFFFFFul;
+        for (size_t i = 0; i != size; ++i)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+        return crc ^ 0xFFFFFFFFul;
+    }
+
+    void appendBigEndian(std::vector<unsigned char> &out, unsigned long value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+
+    void writeChunk(std::ostream &os, const char *type, const std::vector<unsigned char> &data)
+    {
+        std::vector<unsigned char> chunk;
+        appendBigEndian(chunk, data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        appendBigEndian(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+
+        os.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    }
+
+    // Wraps raw bytes in a zlib stream made of stored (uncompressed) deflate blocks.
+    std::vector<unsigned char> zlibStore(const std::vector<unsigned char> &raw)
+    {
+        std::vector<unsigned char> out = { 0x78, 0x01 };
+
+        size_t offset = 0;
+        do
+        {
+            size_t size = std::min<size_t>(raw.size() - offset, 65535);
+            bool last = offset + size == raw.size();
+
+            out.push_back(last ? 1 : 0);
+            out.push_back(static_cast<unsigned char>(size));
+            out.push_back(static_cast<unsigned char>(size >> 8));
+            out.push_back(static_cast<unsigned char>(~size));
+            out.push_back(static_cast<unsigned char>(~size >> 8));
+            out.insert(out.end(), raw.begin() + offset, raw.begin() + offset + size);
+
+            offset += size;
+        }
+        while (offset != raw.size());
+
+        unsigned long a = 1, b = 0;
+        for (unsigned char byte : raw)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        appendBigEndian(out, (b << 16) | a);
+
+        return out;
+    }
+
+    void writePng(const std::string &filename, size_t width, size_t height, const std::vector<unsigned char> &rgb)
+    {
+        std::ofstream os(filename, std::ios::out | std::ios::binary);
+        if (!os)
+            throw std::runtime_error("Could not open " + filename + " for writing");
+
+        static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        os.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+
+        std::vector<unsigned char> header;
+        appendBigEndian(header, width);
+        appendBigEndian(header, height);
+        header.insert(header.end(), { 8, 2, 0, 0, 0 });     // 8-bit RGB, no interlacing
+        writeChunk(os, "IHDR", header);
+
+        // Every scanline starts with filter type 0 (none).
+        std::vector<unsigned char> raw;
+        raw.reserve(height * (1 + width * 3));
+        for (size_t y = 0; y != height; ++y)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), rgb.begin() + y * width * 3, rgb.begin() + (y + 1) * width * 3);
+        }
+
+        writeChunk(os, "IDAT", zlibStore(raw));
+        writeChunk(os, "IEND", {});
+    }
+
+    // Maps a counter onto 0 (untouched) or 64-255, logarithmically relative to the largest counter.
+    unsigned char intensity(unsigned long long count, unsigned long long max)
+    {
+        if (!count)
+            return 0;
+
+        return static_cast<unsigned char>(64 + 191 * std::log1p(static_cast<double>(count)) / std::log1p(static_cast<double>(max)));
+    }
+}
+
+MemoryProfile::MemoryProfile()
+    : m_executes(words), m_reads(words), m_writes(words)
+{
+}
+
+void MemoryProfile::clear()
+{
+    std::fill(m_executes.begin(), m_executes.end(), 0);
+    std::fill(m_reads.begin(), m_reads.end(), 0);
+    std::fill(m_writes.begin(), m_writes.end(), 0);
+}
+
+const unsigned long long *MemoryProfile::executes() const
+{
+    return m_executes.data();
+}
+
+const unsigned long long *MemoryProfile::reads() const
+{
+    return m_reads.data();
+}
+
+const unsigned long long *MemoryProfile::writes() const
+{
+    return m_writes.data();
+}
+
+void MemoryProfile::save(const std::string &filename) const
+{
+    std::ofstream os(filename, std::ios::out | std::ios::binary);
+    if (!os)
+        throw std::runtime_error("Could not open " + filename + " for writing");
+
+    os.write(profileMagic, sizeof(profileMagic));
+    writeCounters(os, m_executes);
+    writeCounters(os, m_reads);
+    writeCounters(os, m_writes);
+}
+
+MemoryProfile MemoryProfile::load(const std::string &filename)
+{
+    std::ifstream is(filename, std::ios::in | std::ios::binary);
+    if (!is)
+        throw std::runtime_error("Could not open profile");
+
+    char magic[sizeof(profileMagic)];
+    if (!is.read(magic, sizeof(magic)) || memcmp(magic, profileMagic, sizeof(magic)) != 0)
+        throw std::runtime_error("Not a profile");
+
+    MemoryProfile profile;
+    readCounters(is, profile.m_executes);
+    readCounters(is, profile.m_reads);
+    readCounters(is, profile.m_writes);
+
+    return profile;
+}
+
+void MemoryProfile::writeLcov(const std::string &filename, const ushort *memory, const std::string &sourceFile) const
+{
+    std::ofstream os(filename, std::ios::out);
+    if (!os)
+        throw std::runtime_error("Could not open " + filename + " for writing");
+
+    os << "TN:\nSF:" << sourceFile << '\n';
+
+    Disassembler disassembler(memory);
+    size_t line = Disassembler::dumpHeaderLines + 1, found = 0, hit = 0;
+
+    for (unsigned ip = 0; ip < words; ip = disassembler.nextInstruction(ip), ++line)
+    {
+        os << "DA:" << line << ',' << m_executes[ip] << '\n';
+
+        ++found;
+        if (m_executes[ip])
+            ++hit;
+    }
+
+    os << "LF:" << found << "\nLH:" << hit << "\nend_of_record\n";
+}
+
+void MemoryProfile::writeHeatmap(const std::string &filename, const ushort *memory) const
+{
+    unsigned long long maxExecutes = *std::max_element(m_executes.begin(), m_executes.end());
+    unsigned long long maxReads = *std::max_element(m_reads.begin(), m_reads.end());
+    unsigned long long maxWrites = *std::max_element(m_writes.begin(), m_writes.end());
+
+    std::vector<unsigned char> rgb(heatmapWidth * heatmapHeight * 3);
+    for (size_t address = 0; address != words; ++address)
+    {
+        unsigned char *pixel = &rgb[address * 3];
+        pixel[0] = intensity(m_writes[address], maxWrites);
+        pixel[1] = intensity(m_executes[address], maxExecutes);
+        pixel[2] = intensity(m_reads[address], maxReads);
+
+        if (!pixel[0] && !pixel[1] && !pixel[2] && memory[address])
+            pixel[0] = pixel[1] = pixel[2] = 40;
+    }
+
+    writePng(filename, heatmapWidth, heatmapHeight, rgb);
+}
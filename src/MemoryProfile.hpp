@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+using ushort = unsigned short;
+
+// Per-address execute, read and write counters, recorded by SynacorVM while profiling (see SynacorVM::setProfile()).
+//  An executed word is any word fetched as part of an instruction, i.e. both opcodes and operands.
+//  Reads are RMEM loads, writes are any store to memory (WMEM, POP, IN, and arithmetic with a memory target).
+class MemoryProfile
+{
+    std::vector<unsigned long long> m_executes;
+    std::vector<unsigned long long> m_reads;
+    std::vector<unsigned long long> m_writes;
+
+public:
+    static const size_t words = 32768;
+
+    MemoryProfile();
+
+    // Resets all counters to zero.
+    void clear();
+
+    void recordExecute(ushort address)
+    {
+        ++m_executes[address];
+    }
+
+    void recordRead(ushort address)
+    {
+        ++m_reads[address];
+    }
+
+    void recordWrite(ushort address)
+    {
+        ++m_writes[address];
+    }
+
+    const unsigned long long *executes() const;
+    const unsigned long long *reads() const;
+    const unsigned long long *writes() const;
+
+    // Writes the counters to filename: the magic "SYNPROF1", followed by the execute, read and write counters,
+    //  each as 32768 little-endian 64-bit integers.
+    void save(const std::string &filename) const;
+
+    // Reads counters written by save().
+    static MemoryProfile load(const std::string &filename);
+
+    // Writes an lcov tracefile covering a disassembly of memory as produced by Disassembler::dump(), so that
+    //  instruction line numbers match. sourceFile is the name of the disassembly recorded in the tracefile.
+    void writeLcov(const std::string &filename, const ushort *memory, const std::string &sourceFile) const;
+
+    // Writes a 256x128 PNG with one pixel per word, row by row. Executes are shown in green, reads in blue and
+    //  writes in red, on a logarithmic scale. Untouched non-zero words are dark grey, zero words are black.
+    void writeHeatmap(const std::string &filename, const ushort *memory) const;
+};
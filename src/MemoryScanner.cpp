@@ -0,0 +1,106 @@
+#include "MemoryScanner.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+MemoryScanner::MemoryScanner()
+    : m_candidates(words, 1), m_snapshot(words), m_hasSnapshot(false)
+{
+}
+
+void MemoryScanner::reset(const ushort *memory)
+{
+    std::fill(m_candidates.begin(), m_candidates.end(), 1);
+    std::copy(memory, memory + words, m_snapshot.begin());
+    m_hasSnapshot = true;
+}
+
+bool MemoryScanner::hasSnapshot() const
+{
+    return m_hasSnapshot;
+}
+
+// The predicates are branch-free, so that every scan is a single pass over memory that the compiler vectorizes.
+template <typename Predicate>
+size_t MemoryScanner::narrow(const ushort *memory, Predicate predicate)
+{
+    for (size_t i = 0; i != words; ++i)
+        m_candidates[i] &= predicate(memory[i], m_snapshot[i]);
+
+    std::copy(memory, memory + words, m_snapshot.begin());
+    m_hasSnapshot = true;
+
+    return candidateCount();
+}
+
+size_t MemoryScanner::scanEqual(const ushort *memory, ushort value)
+{
+    return narrow(memory, [value](ushort word, ushort) { return word == value; });
+}
+
+size_t MemoryScanner::scanRange(const ushort *memory, ushort minimum, ushort maximum)
+{
+    return narrow(memory, [minimum, maximum](ushort word, ushort) { return (word >= minimum) & (word <= maximum); });
+}
+
+size_t MemoryScanner::scanRelative(const ushort *memory, Comparison comparison)
+{
+    if (!m_hasSnapshot)
+        throw std::logic_error("There is no snapshot to compare against");
+
+    switch (comparison)
+    {
+    case Comparison::Changed:
+        return narrow(memory, [](ushort word, ushort previous) { return word != previous; });
+    case Comparison::Unchanged:
+        return narrow(memory, [](ushort word, ushort previous) { return word == previous; });
+    case Comparison::Increased:
+        return narrow(memory, [](ushort word, ushort previous) { return word > previous; });
+    case Comparison::Decreased:
+        return narrow(memory, [](ushort word, ushort previous) { return word < previous; });
+    }
+
+    return candidateCount();
+}
+
+size_t MemoryScanner::candidateCount() const
+{
+    return std::accumulate(m_candidates.begin(), m_candidates.end(), size_t(0));
+}
+
+std::vector<ushort> MemoryScanner::candidates(size_t limit) const
+{
+    std::vector<ushort> addresses;
+    for (size_t i = 0; i != words && addresses.size() != limit; ++i)
+        if (m_candidates[i])
+            addresses.push_back(static_cast<ushort>(i));
+
+    return addresses;
+}
+
+std::vector<ushort> MemoryScanner::findPattern(const ushort *memory, const std::vector<ushort> &pattern, const std::vector<bool> &wildcards)
+{
+    if (pattern.empty() || pattern.size() > words)
+        return {};
+
+    // One vectorizable pass per pattern word, instead of comparing word by word at every start.
+    size_t starts = words - pattern.size() + 1;
+    std::vector<unsigned char> matches(starts, 1);
+    for (size_t j = 0; j != pattern.size(); ++j)
+    {
+        if (j < wildcards.size() && wildcards[j])
+            continue;
+
+        ushort value = pattern[j];
+        const ushort *shifted = memory + j;
+        for (size_t i = 0; i != starts; ++i)
+            matches[i] &= shifted[i] == value;
+    }
+
+    std::vector<ushort> addresses;
+    for (size_t i = 0; i != starts; ++i)
+        if (matches[i])
+            addresses.push_back(static_cast<ushort>(i));
+
+    return addresses;
+}
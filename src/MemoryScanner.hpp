@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+using ushort = unsigned short;
+
+// Narrows down the addresses holding a value by repeated scans of memory, e.g. to find the counter behind a value the
+//  game shows. Every scan keeps the candidates that pass it and takes a snapshot of memory, which the next relative
+//  scan (changed, increased, ...) compares against.
+class MemoryScanner
+{
+public:
+    enum class Comparison
+    {
+        Changed,
+        Unchanged,
+        Increased,
+        Decreased
+    };
+
+    static const size_t words = 32768;
+
+    MemoryScanner();
+
+    // Makes every address a candidate again and takes a snapshot of memory.
+    void reset(const ushort *memory);
+
+    // Returns whether a snapshot was taken, i.e. whether relative scans are possible.
+    bool hasSnapshot() const;
+
+    // Keeps the candidates holding value. Returns the number left.
+    size_t scanEqual(const ushort *memory, ushort value);
+
+    // Keeps the candidates holding a value in [minimum, maximum].
+    size_t scanRange(const ushort *memory, ushort minimum, ushort maximum);
+
+    // Keeps the candidates whose value compares to their value in the snapshot as specified.
+    //  Throws std::logic_error if there is no snapshot.
+    size_t scanRelative(const ushort *memory, Comparison comparison);
+
+    size_t candidateCount() const;
+
+    // Returns up to limit candidates, lowest address first.
+    std::vector<ushort> candidates(size_t limit = words) const;
+
+    // Returns the addresses where pattern starts. Words flagged in wildcards (if given) match anything.
+    static std::vector<ushort> findPattern(const ushort *memory, const std::vector<ushort> &pattern, const std::vector<bool> &wildcards = {});
+
+private:
+    std::vector<unsigned char> m_candidates;    // 1 for every candidate.
+    std::vector<ushort> m_snapshot;
+    bool m_hasSnapshot;
+
+    template <typename Predicate>
+    size_t narrow(const ushort *memory, Predicate predicate);
+};
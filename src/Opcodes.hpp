@@ -0,0 +1,62 @@
+#pragma once
+
+using ushort = unsigned short;
+
+// The instruction set, described once. The disassembler, the decoders of the engines and tools, and the handlers
+//  FusedEngine generates for every combination of operand kinds all derive from opcodeTable, so adding an opcode
+//  starts here.
+enum Opcode : ushort
+{
+    Halt, Set, Push, Pop, Eq, Gt, Jmp, Jt, Jf, Add, Mult, Mod, And, Or, Not, Rmem, Wmem, Call, Ret, Out, In, Noop,
+    OpcodeCount
+};
+
+// How an instruction uses an operand.
+enum class OperandUse : unsigned char
+{
+    None,
+    Value,      // Read: a literal, or the value of a register.
+    Target      // Written: a register (or an address, which the VM allows as well).
+};
+
+struct OpcodeInfo
+{
+    const char *name;
+    unsigned char operandCount;
+    OperandUse operands[3];
+    unsigned char pops;         // Words taken from the stack.
+    unsigned char pushes;       // Words put on the stack.
+    bool transfersControl;      // May continue elsewhere than at the next instruction, or stop execution.
+};
+
+constexpr OpcodeInfo opcodeTable[OpcodeCount] =
+{
+    { "halt", 0, {},                                                             0, 0, true },
+    { "set",  2, { OperandUse::Target, OperandUse::Value },                      0, 0, false },
+    { "push", 1, { OperandUse::Value },                                          0, 1, false },
+    { "pop",  1, { OperandUse::Target },                                         1, 0, false },
+    { "eq",   3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "gt",   3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "jmp",  1, { OperandUse::Value },                                          0, 0, true },
+    { "jt",   2, { OperandUse::Value, OperandUse::Value },                       0, 0, true },
+    { "jf",   2, { OperandUse::Value, OperandUse::Value },                       0, 0, true },
+    { "add",  3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "mult", 3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "mod",  3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "and",  3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "or",   3, { OperandUse::Target, OperandUse::Value, OperandUse::Value },   0, 0, false },
+    { "not",  2, { OperandUse::Target, OperandUse::Value },                      0, 0, false },
+    { "rmem", 2, { OperandUse::Target, OperandUse::Value },                      0, 0, false },
+    { "wmem", 2, { OperandUse::Value, OperandUse::Value },                       0, 0, false },
+    { "call", 1, { OperandUse::Value },                                          0, 1, true },
+    { "ret",  0, {},                                                             1, 0, true },
+    { "out",  1, { OperandUse::Value },                                          0, 0, false },
+    { "in",   1, { OperandUse::Target },                                         0, 0, true },
+    { "noop", 0, {},                                                             0, 0, false },
+};
+
+// Returns the number of operands of opcode, or 0 for a word that is not an opcode.
+constexpr unsigned operandCount(ushort opcode)
+{
+    return opcode < OpcodeCount ? opcodeTable[opcode].operandCount : 0;
+}
@@ -0,0 +1,325 @@
+#include "ShardFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char shardMagic[8] = { 'S', 'Y', 'N', 'S', 'H', 'R', 'D', '1' };
+
+    struct Header
+    {
+        char magic[8];
+        char kind[8];
+        unsigned parameters[4];
+        unsigned recordSize;
+        unsigned index;
+        unsigned count;
+        unsigned char done[ShardFile::chunks];
+    };
+
+    const size_t headerBytes = 4096;
+
+    bool sameDescription(const ShardFile::Description &a, const ShardFile::Description &b)
+    {
+        return a.kind == b.kind && a.recordSize == b.recordSize && std::equal(a.parameters, a.parameters + 4, b.parameters);
+    }
+}
+
+ShardFile::Shard ShardFile::Shard::parse(const std::string &text)
+{
+    size_t slash = text.find('/');
+    if (slash == std::string::npos)
+        throw std::runtime_error("Shards are given as <index>/<count>");
+
+    Shard shard = { static_cast<unsigned>(std::stoul(text.substr(0, slash))), static_cast<unsigned>(std::stoul(text.substr(slash + 1))) };
+    if (shard.count == 0 || shard.count > chunks || shard.index >= shard.count)
+        throw std::runtime_error("Invalid shard " + text);
+
+    return shard;
+}
+
+unsigned ShardFile::Shard::begin() const
+{
+    return static_cast<unsigned>(chunks * index / count * chunkSize);
+}
+
+unsigned ShardFile::Shard::end() const
+{
+    return static_cast<unsigned>(chunks * (index + 1) / count * chunkSize);
+}
+
+ShardFile::ShardFile(const std::string &filename)
+    : m_filename(filename), m_description(), m_shard()
+#ifdef __linux__
+    , m_fd(-1)
+#endif
+{
+    static_assert(sizeof(Header) <= headerBytes, "Header does not fit");
+}
+
+ShardFile::ShardFile(ShardFile &&other)
+    : m_filename(std::move(other.m_filename)), m_description(std::move(other.m_description)), m_shard(other.m_shard),
+      m_done(std::move(other.m_done)), m_records(std::move(other.m_records)), m_pending(std::move(other.m_pending))
+#ifdef __linux__
+    , m_fd(other.m_fd)
+#endif
+{
+#ifdef __linux__
+    other.m_fd = -1;
+#endif
+}
+
+ShardFile::~ShardFile()
+{
+#ifdef __linux__
+    if (m_fd >= 0)
+        close(m_fd);
+#endif
+}
+
+ShardFile ShardFile::create(const std::string &filename, const Description &description, const Shard &shard)
+{
+    if (description.kind.size() > sizeof(Header::kind) || description.recordSize == 0)
+        throw std::logic_error("Invalid shard description");
+
+    ShardFile file(filename);
+
+#ifdef __linux__
+    file.m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file.m_fd < 0)
+        throw std::runtime_error("Could not open " + filename);
+#endif
+
+    file.readFile(false);
+
+    if (file.m_records.empty())
+    {
+        file.m_description = description;
+        file.m_shard = shard;
+        file.m_done.assign(chunks, 0);
+        file.m_records.resize((shard.end() - shard.begin()) * description.recordSize);
+
+        // Write out the whole file up front, so that it has its final size from the start.
+        file.writeAt(headerBytes, file.m_records.data(), file.m_records.size());
+        file.writeHeader();
+        file.sync();
+    }
+    else if (!sameDescription(file.m_description, description) || file.m_shard.index != shard.index || file.m_shard.count != shard.count)
+        throw std::runtime_error(filename + " holds another shard");
+
+    return file;
+}
+
+ShardFile ShardFile::open(const std::string &filename)
+{
+    ShardFile file(filename);
+
+#ifdef __linux__
+    file.m_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file.m_fd < 0)
+        throw std::runtime_error("Could not open " + filename);
+#endif
+
+    file.readFile(true);
+
+    if (!file.complete())
+        throw std::runtime_error(filename + " is incomplete (" + std::to_string(file.completedChunks()) + " chunks done)");
+
+    return file;
+}
+
+size_t ShardFile::completedChunks() const
+{
+    return std::count_if(m_done.begin(), m_done.end(), [](unsigned char done) { return done != 0; });
+}
+
+bool ShardFile::complete() const
+{
+    return completedChunks() == (m_shard.end() - m_shard.begin()) / chunkSize;
+}
+
+void ShardFile::storeChunk(size_t chunk, const unsigned char *records)
+{
+    size_t size = chunkSize * m_description.recordSize;
+    std::copy(records, records + size, m_records.data() + (chunk * chunkSize - m_shard.begin()) * m_description.recordSize);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.push_back(chunk);
+}
+
+void ShardFile::checkpoint()
+{
+    std::vector<size_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending.swap(m_pending);
+    }
+
+    if (pending.empty())
+        return;
+
+    // Records must be on disk before their chunks are marked complete.
+    size_t size = chunkSize * m_description.recordSize;
+    for (size_t chunk : pending)
+    {
+        size_t offset = (chunk * chunkSize - m_shard.begin()) * m_description.recordSize;
+        writeAt(headerBytes + offset, m_records.data() + offset, size);
+    }
+
+    sync();
+
+    for (size_t chunk : pending)
+        m_done[chunk] = 1;
+
+    writeHeader();
+    sync();
+}
+
+std::vector<ShardFile> ShardFile::completeSet(std::vector<ShardFile> shards)
+{
+    if (shards.empty())
+        throw std::runtime_error("No shards given");
+
+    Description description = shards.front().m_description;
+    unsigned count = shards.front().m_shard.count;
+    if (shards.size() != count)
+        throw std::runtime_error("Expected " + std::to_string(count) + " shards, got " + std::to_string(shards.size()));
+
+    for (const auto &file : shards)
+        if (file.m_shard.count != count || !sameDescription(file.m_description, description))
+            throw std::runtime_error(file.m_filename + " belongs to another sweep");
+
+    std::vector<ShardFile> ordered;
+    for (unsigned index = 0; index != count; ++index)
+    {
+        auto it = std::find_if(shards.begin(), shards.end(), [index](const ShardFile &file) { return file.m_shard.index == index; });
+        if (it == shards.end())
+            throw std::runtime_error("Shard " + std::to_string(index) + '/' + std::to_string(count) + " is missing");
+
+        ordered.push_back(std::move(*it));
+    }
+
+    return ordered;
+}
+
+void ShardFile::readFile(bool mustExist)
+{
+    std::vector<unsigned char> data;
+
+#ifdef __linux__
+    struct stat info;
+    if (fstat(m_fd, &info) < 0)
+        throw std::runtime_error("Could not read " + m_filename);
+
+    data.resize(info.st_size);
+    for (size_t offset = 0; offset != data.size(); )
+    {
+        ssize_t count = pread(m_fd, data.data() + offset, data.size() - offset, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            throw std::runtime_error("Could not read " + m_filename);
+        offset += count;
+    }
+#else
+    std::ifstream is(m_filename, std::ios::in | std::ios::binary);
+    if (is)
+        data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+#endif
+
+    if (data.empty())
+    {
+        if (mustExist)
+            throw std::runtime_error("Could not open " + m_filename);
+        return;
+    }
+
+    if (data.size() < headerBytes)
+        throw std::runtime_error(m_filename + " is not a shard");
+
+    Header header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, shardMagic, sizeof(shardMagic)) != 0)
+        throw std::runtime_error(m_filename + " is not a shard");
+
+    m_description.kind.assign(header.kind, strnlen(header.kind, sizeof(header.kind)));
+    std::copy(header.parameters, header.parameters + 4, m_description.parameters);
+    m_description.recordSize = header.recordSize;
+    m_shard = { header.index, header.count };
+    m_done.assign(header.done, header.done + chunks);
+
+    if (m_shard.count == 0 || m_shard.count > chunks || m_shard.index >= m_shard.count
+        || data.size() != headerBytes + (m_shard.end() - m_shard.begin()) * m_description.recordSize)
+        throw std::runtime_error(m_filename + " is not a shard");
+
+    m_records.assign(data.begin() + headerBytes, data.end());
+}
+
+void ShardFile::buildHeader(unsigned char *data) const
+{
+    Header header = {};
+
+    memcpy(header.magic, shardMagic, sizeof(shardMagic));
+    memcpy(header.kind, m_description.kind.data(), m_description.kind.size());
+    std::copy(m_description.parameters, m_description.parameters + 4, header.parameters);
+    header.recordSize = m_description.recordSize;
+    header.index = m_shard.index;
+    header.count = m_shard.count;
+    std::copy(m_done.begin(), m_done.end(), header.done);
+
+    memset(data, 0, headerBytes);
+    memcpy(data, &header, sizeof(header));
+}
+
+void ShardFile::writeHeader()
+{
+    unsigned char data[headerBytes];
+    buildHeader(data);
+    writeAt(0, data, headerBytes);
+}
+
+void ShardFile::writeAt(size_t offset, const unsigned char *data, size_t size)
+{
+#ifdef __linux__
+    while (size)
+    {
+        ssize_t count = pwrite(m_fd, data, size, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            throw std::runtime_error("Could not write " + m_filename);
+
+        data += count;
+        offset += count;
+        size -= count;
+    }
+#else
+    // Without positional writes, sync() rewrites the whole file.
+    static_cast<void>(offset), static_cast<void>(data), static_cast<void>(size);
+#endif
+}
+
+void ShardFile::sync()
+{
+#ifdef __linux__
+    if (fsync(m_fd) < 0)
+        throw std::runtime_error("Could not sync " + m_filename);
+#else
+    std::vector<unsigned char> data(headerBytes);
+    buildHeader(data.data());
+
+    std::ofstream os(m_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!os.write(reinterpret_cast<const char *>(data.data()), data.size()) || !os.write(reinterpret_cast<const char *>(m_records.data()), m_records.size()) || !os.flush())
+        throw std::runtime_error("Could not write " + m_filename);
+#endif
+}
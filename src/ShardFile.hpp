@@ -0,0 +1,116 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One process' share of a sweep over all 32768 values of R7, written to its own file so that shards can run as
+//  independent processes (or on different machines sharing a filesystem) and be merged afterwards.
+//
+// The range of R7 is split into chunks of chunkSize values, and shard i of n owns chunks [i * chunks / n,
+//  (i + 1) * chunks / n). Each value has a fixed-size record, whose contents are up to the producing tool.
+//
+// File layout:
+//   header (4096 bytes): magic "SYNSHRD1", kind (8 characters, identifying the producing tool), 4 parameters,
+//                        record size, shard index and count (all 32-bit), then one byte per chunk, non-zero once
+//                        the chunk's records have been written and synced.
+//   records:             one record per value of R7 in the shard's range.
+//  All integers are in native byte order (little-endian on all supported platforms).
+class ShardFile
+{
+public:
+    static const size_t entries = 32768;
+    static const size_t chunkSize = 64;
+    static const size_t chunks = entries / chunkSize;
+
+    struct Shard
+    {
+        unsigned index;
+        unsigned count;
+
+        // Parses "<index>/<count>".
+        static Shard parse(const std::string &text);
+
+        // Range of R7 values owned by the shard, always on chunk boundaries.
+        unsigned begin() const;
+        unsigned end() const;
+    };
+
+    // Identifies what a shard holds. Shards can only be resumed and merged if their descriptions match.
+    struct Description
+    {
+        std::string kind;
+        unsigned parameters[4];
+        unsigned recordSize;
+    };
+
+    // Opens a shard for writing, creating it if needed. Chunks completed by an earlier run are kept, so that an
+    //  interrupted shard can resume. Throws if the file holds another shard.
+    static ShardFile create(const std::string &filename, const Description &description, const Shard &shard);
+
+    // Reads an existing shard. Throws if it is not complete.
+    static ShardFile open(const std::string &filename);
+
+    ShardFile(ShardFile &&other);
+    ShardFile(const ShardFile &) = delete;
+    ShardFile &operator=(const ShardFile &) = delete;
+
+    ~ShardFile();
+
+    const Description &description() const
+    {
+        return m_description;
+    }
+
+    const Shard &shard() const
+    {
+        return m_shard;
+    }
+
+    // Returns the record for r7, which must be in the shard's range.
+    const unsigned char *record(unsigned r7) const
+    {
+        return m_records.data() + (r7 - m_shard.begin()) * m_description.recordSize;
+    }
+
+    bool chunkComplete(size_t chunk) const
+    {
+        return m_done[chunk] != 0;
+    }
+
+    size_t completedChunks() const;
+    bool complete() const;
+
+    // Stores the records of all values in chunk. Safe to call concurrently for different chunks.
+    //  The chunk is only marked complete by the next checkpoint().
+    void storeChunk(size_t chunk, const unsigned char *records);
+
+    // Writes all stored records and syncs them to disk, then marks their chunks complete and syncs again.
+    void checkpoint();
+
+    // Checks that shards form a complete set: the same description and shard count, and every index exactly once.
+    //  Returns the shards ordered by index.
+    static std::vector<ShardFile> completeSet(std::vector<ShardFile> shards);
+
+private:
+    std::string m_filename;
+    Description m_description;
+    Shard m_shard;
+    std::vector<unsigned char> m_done;
+    std::vector<unsigned char> m_records;
+
+    std::mutex m_mutex;
+    std::vector<size_t> m_pending;
+
+#ifdef __linux__
+    int m_fd;
+#endif
+
+    ShardFile(const std::string &filename);
+
+    void readFile(bool mustExist);
+    void buildHeader(unsigned char *data) const;
+    void writeHeader();
+    void writeAt(size_t offset, const unsigned char *data, size_t size);
+    void sync();
+};
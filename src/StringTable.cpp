@@ -0,0 +1,280 @@
+#include "StringTable.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iterator>
+#include "MemoryImage.hpp"
+
+namespace
+{
+    const ushort outOpcode = 19;
+    const size_t blockWords = 64;
+
+    // Words a string can cover: inline strings take two per character.
+    const size_t maxStringWords = 2 * StringTable::maxLength;
+
+    // Splits text into lowercase runs of letters and digits.
+    std::vector<std::string> tokenize(const std::string &text)
+    {
+        std::vector<std::string> tokens;
+        std::string token;
+        for (char c : text)
+        {
+            if (std::isalnum(static_cast<unsigned char>(c)))
+                token += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            else if (!token.empty())
+                tokens.push_back(std::move(token)), token.clear();
+        }
+
+        if (!token.empty())
+            tokens.push_back(std::move(token));
+
+        return tokens;
+    }
+}
+
+StringTable::StringTable(ushort minLength)
+    : m_minLength(std::max<ushort>(minLength, 1)), m_memory(MemoryImage::words), m_printable(MemoryImage::words),
+      m_runs(MemoryImage::words + 1)
+{
+}
+
+void StringTable::scan(const ushort *memory)
+{
+    m_entries.clear();
+    m_index.clear();
+
+    std::copy(memory, memory + MemoryImage::words, m_memory.begin());
+    updateWords(0, MemoryImage::words);
+    updateRuns(0, MemoryImage::words);
+    rescan(0, MemoryImage::words);
+}
+
+size_t StringTable::refresh(const ushort *memory)
+{
+    // Branch-free count of the words that differ in a block, which the compiler vectorizes.
+    auto differing = [&](size_t block)
+    {
+        unsigned count = 0;
+        for (size_t i = block; i != block + blockWords; ++i)
+            count += memory[i] != m_memory[i];
+
+        return count;
+    };
+
+    size_t changed = 0;
+    for (size_t block = 0; block != MemoryImage::words; )
+    {
+        unsigned count = differing(block);
+        if (!count)
+        {
+            block += blockWords;
+            continue;
+        }
+
+        // Rescan once for each run of changed blocks.
+        size_t start = block;
+        do
+        {
+            changed += count;
+            block += blockWords;
+        } while (block != MemoryImage::words && (count = differing(block)));
+
+        std::copy(memory + start, memory + block, m_memory.begin() + start);
+        updateWords(start, block);
+        updateRuns(start, block);
+        rescan(start, block);
+    }
+
+    return changed;
+}
+
+const StringTable::Entry *StringTable::find(ushort address) const
+{
+    auto it = m_entries.find(address);
+    return it == m_entries.end() ? nullptr : &it->second;
+}
+
+const StringTable::Entry *StringTable::findContaining(ushort address) const
+{
+    auto it = m_entries.upper_bound(address);
+    if (it == m_entries.begin())
+        return nullptr;
+
+    const Entry &entry = std::prev(it)->second;
+    return address < entry.address + entry.size ? &entry : nullptr;
+}
+
+std::vector<ushort> StringTable::search(const std::string &query) const
+{
+    std::vector<std::string> tokens = tokenize(query);
+    if (tokens.empty())
+        return {};
+
+    std::set<ushort> result;
+    for (size_t i = 0; i != tokens.size(); ++i)
+    {
+        std::set<ushort> matches;
+        for (auto it = m_index.lower_bound(tokens[i]); it != m_index.end(); ++it)
+        {
+            bool prefix = it->first.compare(0, tokens[i].size(), tokens[i]) == 0;
+            if (!prefix || (i + 1 != tokens.size() && it->first.size() != tokens[i].size()))
+                break;
+
+            matches.insert(it->second.begin(), it->second.end());
+        }
+
+        if (i == 0)
+            result = std::move(matches);
+        else
+        {
+            std::set<ushort> both;
+            std::set_intersection(result.begin(), result.end(), matches.begin(), matches.end(), std::inserter(both, both.end()));
+            result = std::move(both);
+        }
+    }
+
+    return std::vector<ushort>(result.begin(), result.end());
+}
+
+std::vector<std::string> StringTable::words() const
+{
+    std::vector<std::string> words;
+    words.reserve(m_index.size());
+    for (const auto &word : m_index)
+        words.push_back(word.first);
+
+    return words;
+}
+
+std::string StringTable::quote(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (c == '\n')
+            quoted += "\\n";
+        else if (c == '"' || c == '\\')
+            quoted += std::string("\\") + c;
+        else if (byte < 0x20 || byte >= 0x7f)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", byte);
+            quoted += escaped;
+        }
+        else
+            quoted += c;
+    }
+
+    return quoted + '"';
+}
+
+void StringTable::updateWords(size_t start, size_t end)
+{
+    // Branch-free, so the compiler vectorizes it.
+    for (size_t i = start; i != end; ++i)
+    {
+        ushort word = m_memory[i];
+        m_printable[i] = (word == '\n') | ((static_cast<ushort>(word - 0x20) < 0xe0) & (word != 0x7f));
+    }
+}
+
+void StringTable::updateRuns(size_t start, size_t end)
+{
+    // Runs before start only change if they reach it, so at most maxLength words back.
+    size_t first = start > maxLength ? start - maxLength : 0;
+    for (size_t i = end; i-- != first; )
+        m_runs[i] = m_printable[i] ? std::min<ushort>(maxLength, m_runs[i + 1] + 1) : 0;
+}
+
+bool StringTable::readString(size_t address, Entry &entry) const
+{
+    ushort length = m_memory[address];
+    if (length >= m_minLength && length <= maxLength && m_runs[address + 1] >= length)
+    {
+        entry = { static_cast<ushort>(address), static_cast<ushort>(length + 1), Kind::Prefixed,
+                  std::string(m_memory.begin() + address + 1, m_memory.begin() + address + 1 + length) };
+        return true;
+    }
+
+    size_t count = 0;
+    while (count != maxLength && address + 2 * count + 1 < MemoryImage::words && m_memory[address + 2 * count] == outOpcode
+        && m_printable[address + 2 * count + 1])
+        ++count;
+
+    if (count < m_minLength)
+        return false;
+
+    entry = { static_cast<ushort>(address), static_cast<ushort>(2 * count), Kind::Inline, std::string() };
+    for (size_t i = 0; i != count; ++i)
+        entry.text += static_cast<char>(m_memory[address + 2 * i + 1]);
+
+    return true;
+}
+
+void StringTable::rescan(size_t start, size_t end)
+{
+    // Strings starting up to maxStringWords before start may read the changed words. Earlier ones are unaffected.
+    size_t first = start > maxStringWords ? start - maxStringWords : 0;
+    auto before = m_entries.lower_bound(static_cast<ushort>(first));
+    if (first && before != m_entries.begin())
+    {
+        const Entry &entry = std::prev(before)->second;
+        first = std::max<size_t>(first, entry.address + entry.size);
+    }
+
+    // Returns whether the previous scan skipped address, being inside one of its strings.
+    auto skipped = [&](size_t address)
+    {
+        auto it = m_entries.lower_bound(static_cast<ushort>(address));
+        if (it == m_entries.begin())
+            return false;
+
+        const Entry &entry = std::prev(it)->second;
+        return entry.address + entry.size > address;
+    };
+
+    // Past the changed words, the new scan agrees with the previous one from the first address both look at.
+    std::vector<Entry> found;
+    size_t address = first;
+    while (address < MemoryImage::words && (address < end || skipped(address)))
+    {
+        Entry entry;
+        if (readString(address, entry))
+        {
+            address += entry.size;
+            found.push_back(std::move(entry));
+        }
+        else
+            ++address;
+    }
+
+    auto it = m_entries.lower_bound(static_cast<ushort>(first));
+    while (it != m_entries.end() && it->first < address)
+        removeEntry(it++);
+
+    for (Entry &entry : found)
+        addEntry(std::move(entry));
+}
+
+void StringTable::addEntry(Entry entry)
+{
+    for (const std::string &token : tokenize(entry.text))
+        m_index[token].insert(entry.address);
+
+    ushort address = entry.address;
+    m_entries.emplace(address, std::move(entry));
+}
+
+void StringTable::removeEntry(std::map<ushort, Entry>::iterator it)
+{
+    for (const std::string &token : tokenize(it->second.text))
+    {
+        auto word = m_index.find(token);
+        if (word != m_index.end() && word->second.erase(it->first) && word->second.empty())
+            m_index.erase(word);
+    }
+
+    m_entries.erase(it);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using ushort = unsigned short;
+
+// Index of the text found in 32K words of VM memory, by address and by word.
+//
+// Two kinds of strings are found:
+//   prefixed:  a length word followed by that many printable words (the layout the game uses for its tables).
+//   inline:    a run of 'out <literal>' instructions printing printable characters.
+// Printable words are newlines and 0x20 up to 0xff, except 0x7f. Strings are found greedily from low addresses up,
+//  so a string is never found inside another one.
+//
+// The table keeps a copy of the memory it was built from. refresh() compares against that copy and only rescans
+//  around the words that changed, e.g. after the game has decrypted its strings.
+class StringTable
+{
+public:
+    enum class Kind
+    {
+        Prefixed,
+        Inline
+    };
+
+    struct Entry
+    {
+        ushort address;
+        ushort size;        // Words covered, including the length word or the opcodes.
+        Kind kind;
+        std::string text;
+    };
+
+    // Longest string looked for, in characters.
+    static const ushort maxLength = 2048;
+
+    // Only strings of at least minLength characters are indexed. A new table is that of zeroed memory, so it can be
+    //  refreshed right away.
+    explicit StringTable(ushort minLength = 4);
+
+    // Builds the table from memory.
+    void scan(const ushort *memory);
+
+    // Updates the table to memory, rescanning only where it differs from the memory of the last scan or refresh.
+    //  Returns the number of words that changed.
+    size_t refresh(const ushort *memory);
+
+    const std::map<ushort, Entry> &entries() const
+    {
+        return m_entries;
+    }
+
+    // Returns the string starting at address, or null.
+    const Entry *find(ushort address) const;
+
+    // Returns the string covering address, or null.
+    const Entry *findContaining(ushort address) const;
+
+    // Returns the addresses of the strings holding every word of query (ignoring case), where the last word of
+    //  query may also be the start of a longer word.
+    std::vector<ushort> search(const std::string &query) const;
+
+    // Returns all distinct lowercase words in the table.
+    std::vector<std::string> words() const;
+
+    // Returns text between double quotes, with newlines, quotes and non-ASCII characters escaped.
+    static std::string quote(const std::string &text);
+
+private:
+    ushort m_minLength;
+    std::vector<ushort> m_memory;
+    std::vector<unsigned char> m_printable;     // 1 for every printable word.
+    std::vector<ushort> m_runs;                 // Printable words starting at each address, up to maxLength.
+    std::map<ushort, Entry> m_entries;
+    std::map<std::string, std::set<ushort>> m_index;
+
+    void updateWords(size_t start, size_t end);
+    void updateRuns(size_t start, size_t end);
+    bool readString(size_t address, Entry &entry) const;
+    void rescan(size_t start, size_t end);
+
+    void addEntry(Entry entry);
+    void removeEntry(std::map<ushort, Entry>::iterator it);
+};
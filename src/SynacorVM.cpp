@@ -1,32 +1,56 @@
 ﻿#include "SynacorVM.hpp"
-#include <iostream>
-#include <fstream>
-#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "Opcodes.hpp"
 
 SynacorVM::SynacorVM()
+    : m_escapeChar(0), m_io(&ConsoleIO::instance()), m_profile(nullptr)
 {
     reset();
 }
 
+SynacorVM::~SynacorVM()
+{
+}
+
 ushort SynacorVM::loadBinary(std::string filename)
 {
+    MemoryImage image(filename);
+
     clear();
+    mapImage(image);
 
-    std::ifstream fi(filename, std::ios::in | std::ios::binary);
-    if (!fi)
-        throw std::runtime_error("Could not open binary");
+    return static_cast<ushort>(image.loadedWords());
+}
 
-    ushort address = 0;
-    while (fi && address < 32768)
-        fi.read(reinterpret_cast<char *>(&m_memory[address++]), 2);
+void SynacorVM::mapImage(const MemoryImage &image)
+{
+    m_memory = MemoryMapping(image);
+    m_hooks.clear();
+
+    if (m_fusedEngine)
+        m_fusedEngine->invalidateAll();
+}
 
-    return address;
+const ushort *SynacorVM::memory() const
+{
+    return m_memory.data();
 }
 
 ushort SynacorVM::readMemory(ushort address) const
 {
     if ((address & 0x8000) == 0)
-        return m_memory[address];
+    {
+        ushort value = m_memory[address];
+        if (value == hookOpcode)
+        {
+            auto entry = m_hooks.find(address);
+            if (entry != m_hooks.end())
+                return entry->second.original;
+        }
+
+        return value;
+    }
 
     ushort reg = address & 0x7FFF;
     if (reg > 7)
@@ -35,11 +59,35 @@ ushort SynacorVM::readMemory(ushort address) const
     return m_registers[reg];
 }
 
+void SynacorVM::readMemory(ushort address, ushort *values, size_t count) const
+{
+    if (address + count > 32768)
+        throw std::out_of_range("Attempted to read past the end of memory.");
+
+    std::copy(m_memory.data() + address, m_memory.data() + address + count, values);
+
+    for (auto entry = m_hooks.lower_bound(address); entry != m_hooks.end() && entry->first < address + count; ++entry)
+        values[entry->first - address] = entry->second.original;
+}
+
 void SynacorVM::writeMemory(ushort address, ushort value)
 {
     if ((address & 0x8000) == 0)
     {
+        if (m_memory[address] == hookOpcode)
+        {
+            auto entry = m_hooks.find(address);
+            if (entry != m_hooks.end())
+            {
+                entry->second.original = value;
+                return;
+            }
+        }
+
         m_memory[address] = value;
+
+        if (m_fusedEngine)
+            m_fusedEngine->invalidate(address);
         return;
     }
 
@@ -50,6 +98,35 @@ void SynacorVM::writeMemory(ushort address, ushort value)
     m_registers[reg] = value;
 }
 
+void SynacorVM::writeMemory(ushort address, const ushort *values, size_t count)
+{
+    if (address + count > 32768)
+        throw std::out_of_range("Attempted to write past the end of memory.");
+
+    for (size_t i = 0; i != count; ++i)
+    {
+        ushort target = static_cast<ushort>(address + i);
+        ushort current = m_memory[target];
+        if (current == values[i])
+            continue;
+
+        if (current == hookOpcode)
+        {
+            auto entry = m_hooks.find(target);
+            if (entry != m_hooks.end())
+            {
+                entry->second.original = values[i];
+                continue;
+            }
+        }
+
+        m_memory[target] = values[i];
+
+        if (m_fusedEngine)
+            m_fusedEngine->invalidate(target);
+    }
+}
+
 ushort SynacorVM::readRegister(ushort reg) const
 {
     if (reg > 7)
@@ -68,8 +145,12 @@ void SynacorVM::writeRegister(ushort reg, ushort value)
 
 void SynacorVM::clear()
 {
-    m_memory.fill(0);
+    m_memory = MemoryMapping();
+    m_hooks.clear();
     reset();
+
+    if (m_fusedEngine)
+        m_fusedEngine->invalidateAll();
 }
 
 void SynacorVM::reset()
@@ -78,20 +159,24 @@ void SynacorVM::reset()
     m_stack.clear();
 
     m_instructionPointer = 0;
+    m_waitingForInput = false;
+    m_instructionCount = 0;
 }
 
-bool SynacorVM::step()
+template <bool Profiled>
+bool SynacorVM::execute()
 {
-    ushort opcode = readOpcode();
+    ushort opcode = readOpcode<Profiled>();
+    ++m_instructionCount;
 
     switch (opcode)
     {
-    case 0: /* HALT */
+    case Halt:
         return false;
-    case 1: /* SET */
+    case Set:
     {
-        ushort address = readOperand();
-        ushort value = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort value = readValueOperand<Profiled>();
 
         if (!(address & 0x8000))
             throw std::runtime_error("Operand to SET is not a register");
@@ -99,144 +184,144 @@ bool SynacorVM::step()
         writeRegister(address & 0x7FFF, value);
         return true;
     }
-    case 2: /* PUSH */
+    case Push:
     {
-        ushort value = readValueOperand();
+        ushort value = readValueOperand<Profiled>();
 
         push(value);
         return true;
     }
-    case 3: /* POP */
+    case Pop:
     {
-        ushort address = readOperand();
+        ushort address = readOperand<Profiled>();
         ushort value = pop();
 
-        writeMemory(address, value);
+        store<Profiled>(address, value);
         return true;
     }
-    case 4: /* EQ */
+    case Eq:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, lhs == rhs ? 1 : 0);
+        store<Profiled>(address, lhs == rhs ? 1 : 0);
         return true;
     }
-    case 5: /* GT */      
+    case Gt:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, lhs > rhs ? 1 : 0);
+        store<Profiled>(address, lhs > rhs ? 1 : 0);
         return true;
     }
-    case 6: /* JMP */
+    case Jmp:
     {
-        ushort address = readValueOperand();
+        ushort address = readValueOperand<Profiled>();
 
         setInstructionPointer(address);
         return true;
     }
-    case 7: /* JT */
+    case Jt:
     {
-        ushort value = readValueOperand();
-        ushort jumpAddress = readValueOperand();
+        ushort value = readValueOperand<Profiled>();
+        ushort jumpAddress = readValueOperand<Profiled>();
 
         if (value)
             setInstructionPointer(jumpAddress);
         return true;
     }
-    case 8: /* JF */ 
+    case Jf:
     {
-        ushort value = readValueOperand();
-        ushort jumpAddress = readValueOperand();
+        ushort value = readValueOperand<Profiled>();
+        ushort jumpAddress = readValueOperand<Profiled>();
 
         if (!value)
             setInstructionPointer(jumpAddress);
         return true;
     }
-    case 9: /* ADD */
+    case Add:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, (lhs + rhs) % 32768);
+        store<Profiled>(address, (lhs + rhs) % 32768);
         return true;
     }
-    case 10: /* MULT */
+    case Mult:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
         // NOTE: May need extension to int to avoid overflow weirdery
-        writeMemory(address, (lhs * rhs) % 32768);
+        store<Profiled>(address, (lhs * rhs) % 32768);
         return true;
     }
-    case 11: /* MOD */
+    case Mod:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, lhs % rhs);
+        store<Profiled>(address, lhs % rhs);
         return true;
     }
-    case 12: /* AND */
+    case And:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, lhs & rhs);
+        store<Profiled>(address, lhs & rhs);
         return true;
     }
-    case 13: /* OR */
+    case Or:
     {
-        ushort address = readOperand();
-        ushort lhs = readValueOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort lhs = readValueOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, lhs | rhs);
+        store<Profiled>(address, lhs | rhs);
         return true;
     }
-    case 14: /* NOT */
+    case Not:
     {
-        ushort address = readOperand();
-        ushort rhs = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort rhs = readValueOperand<Profiled>();
 
-        writeMemory(address, ~rhs & 0x7FFF);
+        store<Profiled>(address, ~rhs & 0x7FFF);
         return true;
     }
-    case 15: /* RMEM */
+    case Rmem:
     {
-        ushort address = readOperand();
-        ushort valueAddress = readValueOperand();
+        ushort address = readOperand<Profiled>();
+        ushort valueAddress = readValueOperand<Profiled>();
 
-        writeMemory(address, readMemory(valueAddress));
+        store<Profiled>(address, load<Profiled>(valueAddress));
         return true;
     }
-    case 16: /* WMEM */
+    case Wmem:
     {
-        ushort address = readValueOperand();
-        ushort value = readValueOperand();
+        ushort address = readValueOperand<Profiled>();
+        ushort value = readValueOperand<Profiled>();
 
-        writeMemory(address, value);
+        store<Profiled>(address, value);
         return true;
     }
-    case 17: /* CALL */
+    case Call:
     {
-        ushort address = readValueOperand();
+        ushort address = readValueOperand<Profiled>();
 
         push(instructionPointer());
         setInstructionPointer(address);
 
         return true;
     }
-    case 18: /* RET */
+    case Ret:
     {
         if (stackEmpty())
             return false;
@@ -244,39 +329,201 @@ bool SynacorVM::step()
         setInstructionPointer(pop());
         return true;
     }
-    case 19: /* OUT */
+    case Out:
     {
-        ushort ascii = readValueOperand();
+        ushort ascii = readValueOperand<Profiled>();
 
-        std::cout << static_cast<char>(ascii);
+        m_io->write(static_cast<char>(ascii));
         return true;
     }
-    case 20: /* IN */
+    case In:
     {
-        ushort address = readOperand();
+        ushort address = readOperand<Profiled>();
+
+        int ch = m_io->read();
+        if (ch < 0)
+        {
+            m_instructionPointer -= 2;
+            m_waitingForInput = true;
+            return false;
+        }
 
-        char ch = std::cin.get();
         if (m_escapeChar && ch == m_escapeChar)
         {
-            std::cin.ignore(std::numeric_limits<size_t>::max(), '\n');
+            m_io->discardLine();
             m_instructionPointer -= 2;
             throw EscapeCharacterException();
         }
 
-        writeMemory(address, ch);
+        m_waitingForInput = false;
+        store<Profiled>(address, ch);
         return true;
     }
-    case 21: /* NOOP */
+    case Noop:
         return true;
     default:
+        if (opcode == hookOpcode)
+            return executeHook<Profiled>(m_instructionPointer - 1);
+
+        throw std::runtime_error("Unknown opcode");
+    }
+
+}
+
+template <bool Profiled>
+bool SynacorVM::executeHook(ushort address)
+{
+    auto entry = m_hooks.find(address);
+    if (entry == m_hooks.end())
         throw std::runtime_error("Unknown opcode");
+
+    m_instructionPointer = address;
+    if (entry->second.hook(*this))
+        return true;
+
+    // Execute the original instruction in its place. If it overwrites its own address, the new word becomes the
+    //  instruction the hook runs in place of.
+    --m_instructionCount;
+    m_memory[address] = entry->second.original;
+
+    bool running;
+    try
+    {
+        running = execute<Profiled>();
+    }
+    catch (...)
+    {
+        entry->second.original = m_memory[address];
+        m_memory[address] = hookOpcode;
+        throw;
     }
 
+    entry->second.original = m_memory[address];
+    m_memory[address] = hookOpcode;
+    return running;
+}
+
+bool SynacorVM::step()
+{
+    return m_profile ? execute<true>() : execute<false>();
 }
 
 void SynacorVM::run()
 {
-    while (step());
+    if (m_profile)
+        while (execute<true>());
+    else if (m_fusedEngine)
+        m_fusedEngine->run();
+    else
+        while (execute<false>());
+}
+
+bool SynacorVM::runFor(unsigned long long count)
+{
+    if (m_profile)
+        return runSteps<true>(count);
+
+    if (m_fusedEngine)
+        return m_fusedEngine->runFor(count);
+
+    return runSteps<false>(count);
+}
+
+template <bool Profiled>
+bool SynacorVM::runSteps(unsigned long long count)
+{
+    for (; count; --count)
+        if (!execute<Profiled>())
+            return false;
+
+    return true;
+}
+
+SynacorVM::Engine SynacorVM::engine() const
+{
+    return m_fusedEngine ? Engine::Fused : Engine::Switch;
+}
+
+void SynacorVM::setEngine(Engine engine)
+{
+    if (engine == Engine::Fused)
+    {
+        if (!m_fusedEngine)
+            m_fusedEngine.reset(new FusedEngine(*this));
+    }
+    else
+        m_fusedEngine.reset();
+}
+
+std::vector<SynacorVM::Engine> SynacorVM::engines()
+{
+    return { Engine::Switch, Engine::Fused };
+}
+
+const char *SynacorVM::engineName(Engine engine)
+{
+    switch (engine)
+    {
+    case Engine::Switch:
+        return "switch";
+    case Engine::Fused:
+        return "fused";
+    }
+
+    return "unknown";
+}
+
+SynacorVM::Engine SynacorVM::engineFromName(const std::string &name)
+{
+    for (Engine engine : engines())
+        if (name == engineName(engine))
+            return engine;
+
+    throw std::invalid_argument("Unknown engine '" + name + "'");
+}
+
+MemoryProfile *SynacorVM::profile() const
+{
+    return m_profile;
+}
+
+void SynacorVM::setProfile(MemoryProfile *profile)
+{
+    m_profile = profile;
+}
+
+void SynacorVM::installHook(ushort address, Hook hook)
+{
+    address &= 0x7FFF;
+
+    auto entry = m_hooks.find(address);
+    ushort original = entry == m_hooks.end() ? m_memory[address] : entry->second.original;
+
+    m_hooks[address] = { original, std::move(hook) };
+    m_memory[address] = hookOpcode;
+
+    if (m_fusedEngine)
+        m_fusedEngine->invalidate(address);
+}
+
+void SynacorVM::removeHook(ushort address)
+{
+    auto entry = m_hooks.find(address & 0x7FFF);
+    if (entry == m_hooks.end())
+        return;
+
+    ushort original = entry->second.original;
+    m_hooks.erase(entry);
+
+    writeMemory(address & 0x7FFF, original);
+}
+
+std::vector<FusedEngine::FusionStat> SynacorVM::fusionStats() const
+{
+    if (m_fusedEngine)
+        return m_fusedEngine->fusionStats();
+
+    return {};
 }
 
 void SynacorVM::push(ushort value)
@@ -305,6 +552,39 @@ const std::deque<ushort>& SynacorVM::getStack() const
     return m_stack;
 }
 
+SynacorVM::CpuState SynacorVM::cpuState() const
+{
+    return { m_registers, m_instructionPointer, m_stack };
+}
+
+void SynacorVM::setCpuState(const CpuState &state)
+{
+    m_registers = state.registers;
+    m_instructionPointer = state.instructionPointer;
+    m_stack = state.stack;
+    m_waitingForInput = false;
+}
+
+VMIO &SynacorVM::io() const
+{
+    return *m_io;
+}
+
+void SynacorVM::setIO(VMIO &io)
+{
+    m_io = &io;
+}
+
+unsigned long long SynacorVM::instructionCount() const
+{
+    return m_instructionCount;
+}
+
+bool SynacorVM::waitingForInput() const
+{
+    return m_waitingForInput;
+}
+
 char SynacorVM::escapeChar() const
 {
     return m_escapeChar;
@@ -325,19 +605,34 @@ void SynacorVM::setInstructionPointer(ushort address)
     m_instructionPointer = address;
 }
 
-ushort SynacorVM::readOpcode()
+template <bool Profiled>
+inline ushort SynacorVM::readOpcode()
+{
+    if (Profiled && m_instructionPointer < 32768)
+        m_profile->recordExecute(m_instructionPointer);
+
+    return fetch();
+}
+
+template <bool Profiled>
+inline ushort SynacorVM::readOperand()
 {
-    return readMemory(m_instructionPointer++);
+    if (Profiled && m_instructionPointer < 32768)
+        m_profile->recordExecute(m_instructionPointer);
+
+    return fetch();
 }
 
-ushort SynacorVM::readOperand()
+inline ushort SynacorVM::fetch()
 {
-    return readMemory(m_instructionPointer++);
+    ushort address = m_instructionPointer++;
+    return (address & 0x8000) ? readMemory(address) : m_memory[address];
 }
 
-ushort SynacorVM::readValueOperand()
+template <bool Profiled>
+inline ushort SynacorVM::readValueOperand()
 {
-    ushort operand = readMemory(m_instructionPointer++);
+    ushort operand = readOperand<Profiled>();
 
     if (!(operand & 0x8000))
         return operand; 
@@ -348,3 +643,21 @@ ushort SynacorVM::readValueOperand()
 
     return m_registers[reg];
 }
+
+template <bool Profiled>
+inline ushort SynacorVM::load(ushort address)
+{
+    if (Profiled && address < 32768)
+        m_profile->recordRead(address);
+
+    return readMemory(address);
+}
+
+template <bool Profiled>
+inline void SynacorVM::store(ushort address, ushort value)
+{
+    if (Profiled && address < 32768)
+        m_profile->recordWrite(address);
+
+    writeMemory(address, value);
+}
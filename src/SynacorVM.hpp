@@ -2,20 +2,69 @@
 
 #include <deque>
 #include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FusedEngine.hpp"
+#include "MemoryImage.hpp"
+#include "MemoryProfile.hpp"
+#include "VMIO.hpp"
 
 using ushort = unsigned short;
 
 class SynacorVM final
 {
+    friend class FusedEngine;
 
-    std::array<ushort, 32768> m_memory;
+    MemoryMapping m_memory;
     std::array<ushort, 8> m_registers;
     unsigned short m_instructionPointer;
     std::deque<ushort> m_stack;
     char m_escapeChar;
+    VMIO *m_io;
+    bool m_waitingForInput;
+    unsigned long long m_instructionCount;
+    std::unique_ptr<FusedEngine> m_fusedEngine;
+    MemoryProfile *m_profile;
 
 public:
+    // Called in place of the instruction at a hooked address, with the instruction pointer on that address.
+    //  Returns whether the hook handled the instruction (and updated the instruction pointer). If not, the original
+    //  instruction is executed.
+    using Hook = std::function<bool(SynacorVM &)>;
+
+    // Opcode patched into hooked addresses. Not a valid opcode, so normal execution never checks for hooks.
+    static const ushort hookOpcode = 0xFFFF;
+
+private:
+    struct HookEntry
+    {
+        ushort original;
+        Hook hook;
+    };
+
+    std::map<ushort, HookEntry> m_hooks;
+
+public:
+    // Registers, instruction pointer and stack. Everything but the memory.
+    struct CpuState
+    {
+        std::array<ushort, 8> registers;
+        ushort instructionPointer;
+        std::deque<ushort> stack;
+    };
+
+    // Strategy used by run().
+    enum class Engine
+    {
+        Switch,     // Decodes and executes one instruction at a time through step().
+        Fused,      // Executes pre-decoded instructions and superinstructions (see FusedEngine).
+    };
+
     SynacorVM();
+    ~SynacorVM();
 
     // Resets the VM and wipes memory.
     void clear();
@@ -23,20 +72,75 @@ public:
     // Resets the VM without wiping the memory.
     void reset();
 
-    // Executes the next opcode. Returns whether the program should continue running (i.e. the opcode was not HALT).
+    // Executes the next opcode. Returns whether the program should continue running (i.e. the opcode was not HALT,
+    //  and IN did not have to wait for input).
     bool step();
 
-    // Executes the program until a halt is encountered.
+    // Executes the program until a halt is encountered, or IN has to wait for input.
     void run();
 
+    // Executes at most count instructions. Returns false if execution stopped early, because of a halt or because
+    //  IN has to wait for input.
+    bool runFor(unsigned long long count);
+
+    // Returns the engine used by run().
+    Engine engine() const;
+
+    // Changes the engine used by run().
+    void setEngine(Engine engine);
+
+    // Returns all engines, in order of increasing sophistication.
+    static std::vector<Engine> engines();
+
+    // Returns the name of an engine.
+    static const char *engineName(Engine engine);
+
+    // Returns the engine with the specified name. Throws if there is no such engine.
+    static Engine engineFromName(const std::string &name);
+
+    // Returns how often each superinstruction was executed. Empty unless using the fused engine.
+    std::vector<FusedEngine::FusionStat> fusionStats() const;
+
+    // Returns the profile recording memory accesses, or null if not profiling.
+    MemoryProfile *profile() const;
+
+    // Starts recording memory accesses into profile, or stops if null. The VM does not take ownership.
+    //  While profiling, all execution goes through the instrumented step(), whatever the engine.
+    void setProfile(MemoryProfile *profile);
+
+    // Replaces the instruction at address by a call to hook, by patching it with hookOpcode.
+    //  Loading a binary or memory image removes all hooks.
+    void installHook(ushort address, Hook hook);
+
+    // Restores the instruction at a hooked address.
+    void removeHook(ushort address);
+
+    // Loads a binary or memory snapshot (see MemoryImage) as a copy-on-write mapping, after clearing the VM.
+    //  Returns the number of words loaded. Throws std::runtime_error if the file is not a valid binary.
     ushort loadBinary(std::string filename);
 
-    // Reads the specified memory address.
+    // Replaces the memory with a copy-on-write view of image.
+    void mapImage(const MemoryImage &image);
+
+    // Returns the raw memory (32768 words). Hooked addresses contain hookOpcode.
+    const ushort *memory() const;
+
+    // Reads the specified memory address. Hooked addresses read as the instruction the hook runs in place of.
     ushort readMemory(ushort address) const;
 
-    // Writes to the specified memory address.
+    // Reads count words of memory starting at address into values. Like readMemory(), hooked addresses read as the
+    //  instruction the hook runs in place of. Throws std::out_of_range if the words do not fit in memory.
+    void readMemory(ushort address, ushort *values, size_t count) const;
+
+    // Writes to the specified memory address. Writing to a hooked address replaces the instruction the hook runs in
+    //  place of, and keeps the hook installed.
     void writeMemory(ushort address, ushort value);
 
+    // Writes count words of memory starting at address. Only the words that differ are written. The word at a hooked
+    //  address replaces the instruction the hook runs in place of, unless it is hookOpcode (i.e. memory read while
+    //  hooked). Throws std::out_of_range if the words do not fit in memory.
+    void writeMemory(ushort address, const ushort *values, size_t count);
+
     // Reads the specified register.
     ushort readRegister(ushort reg) const;
 
@@ -52,6 +156,25 @@ public:
     // Returns the stack.
     const std::deque<ushort> &getStack() const;
 
+    // Returns the registers, instruction pointer and stack.
+    CpuState cpuState() const;
+
+    // Restores the registers, instruction pointer and stack.
+    void setCpuState(const CpuState &state);
+
+    // Returns the I/O used by IN and OUT.
+    VMIO &io() const;
+
+    // Changes the I/O used by IN and OUT. The VM does not take ownership.
+    void setIO(VMIO &io);
+
+    // Returns the number of instructions executed since the last reset.
+    unsigned long long instructionCount() const;
+
+    // Returns whether execution stopped because IN had no input available.
+    //  The instruction pointer is left on the IN instruction, so execution resumes there once input is available.
+    bool waitingForInput() const;
+
     // Returns the escape character. Interrupts execution if typed.
     char escapeChar() const;
 
@@ -63,15 +186,43 @@ public:
     {};
 
 private:
+    // Executes the next opcode (see step()). Profiled selects the instrumented version, which records memory
+    //  accesses into m_profile. The plain version is unaffected by profiling.
+    template <bool Profiled>
+    bool execute();
+
+    // Runs the hook installed at address (see installHook()).
+    template <bool Profiled>
+    bool executeHook(ushort address);
+
+    // Executes up to count opcodes (see runFor()).
+    template <bool Profiled>
+    bool runSteps(unsigned long long count);
+
     // Reads the next opcode.
-    ushort readOpcode();    
+    template <bool Profiled>
+    ushort readOpcode();
 
     // Reads the next operand.
+    template <bool Profiled>
     ushort readOperand();
 
+    // Reads the word at the instruction pointer for execution, and advances it. Unlike readMemory(), hooked
+    //  addresses read as hookOpcode.
+    ushort fetch();
+
     // Reads the next operand and automatically read register values if necessary.
+    template <bool Profiled>
     ushort readValueOperand();
 
+    // Reads memory on behalf of the program (i.e. RMEM).
+    template <bool Profiled>
+    ushort load(ushort address);
+
+    // Writes memory on behalf of the program.
+    template <bool Profiled>
+    void store(ushort address, ushort value);
+
     // Pushes a value to the stack.
     void push(ushort value);
 
@@ -1,10 +1,15 @@
 #include "VMDebugger.hpp"
+#include "ConfirmationTable.hpp"
+#include "Disassembler.hpp"
 #include <iostream>
 #include <iomanip>
+#include <chrono>
 #include <sstream>
 #include <fstream>
 #include <string>
 #include <iterator>
+#include <algorithm>
+#include <memory>
 
 namespace
 {
@@ -16,38 +21,6 @@ namespace
 
     class VMBreakPointException
     {};
-  
-    struct OpcodeInfo
-    {
-        std::string name;
-        size_t operands;
-    };
-
-    const std::vector<OpcodeInfo> opcodeTable =
-    {
-        { "halt", 0 },
-        { "set",  2 },
-        { "push", 1 },
-        { "pop",  1 },
-        { "eq",   3 },
-        { "gt",   3 },
-        { "jmp",  1 },
-        { "jt",   2 },
-        { "jf",   2 },
-        { "add",  3 },
-        { "mult", 3 },
-        { "mod",  3 },
-        { "and",  3 },
-        { "or",   3 },
-        { "not",  3 },
-        { "rmem", 2 },
-        { "wmem", 2 },
-        { "call", 1 },
-        { "ret",  0 },
-        { "out",  1 },
-        { "in",   1 },
-        { "noop", 0 }
-    };
 }
 
 const VMDebugger::CommandList VMDebugger::commandsList =
@@ -67,10 +40,25 @@ const VMDebugger::CommandList VMDebugger::commandsList =
     { "unbreak", { "unbreak [<address>]", "Removes a breakpoint at <address>, or removes all active breakpoints.", &VMDebugger::cmdUnbreak } },
     { "dumpasm", { "dumpasm <filename> [<start>] [<end>]", "Dumps the disassembly to <filename>. Optionally starting and ending at <start> and <end>.", &VMDebugger::cmdDumpAsm } },
     { "dump",{ "dump <filename> [<start>] [<end>]", "Dumps the binary to <filename>. Optionally starting and ending at <start> and <end>.", &VMDebugger::cmdDump } },
-    { "stack", { "stack", "Shows the current stack.", &VMDebugger::cmdStack } }
+    { "stack", { "stack", "Shows the current stack.", &VMDebugger::cmdStack } },
+    { "engine", { "engine [switch|fused]", "Shows or changes the engine used by 'run' (without breakpoints).", &VMDebugger::cmdEngine } },
+    { "fusions", { "fusions", "Shows how often each superinstruction was executed by the fused engine.", &VMDebugger::cmdFusions } },
+    { "profile", { "profile [start|stop|clear|save <filename>|lcov <asm filename> <info filename>|heatmap <filename>]",
+        "Shows or changes whether memory accesses are counted, or exports the counts. 'lcov' dumps the disassembly with a matching coverage tracefile. 'heatmap' writes a PNG with one pixel per word (green = executed, blue = read, red = written).", &VMDebugger::cmdProfile } },
+    { "confirm", { "confirm <table>|off [<address>]", "Answers the teleporter confirmation routine at <address> (default 178b) from a table built by 'teleporter sweep', instead of running it. 'off' restores the routine.", &VMDebugger::cmdConfirm } },
+    { "strings", { "strings [<words>]", "Lists the strings in memory holding all <words> (the last may be the start of a word), or counts all strings. Disassembly shows the strings instructions point at.", &VMDebugger::cmdStrings } },
+    { "scan", { "scan [eq <value>|range <min> <max>|changed|unchanged|increased|decreased|list [<count>]|reset|find <word>...]",
+        "Narrows down the addresses holding a value. The first scan starts from all addresses, and every scan takes a snapshot that 'changed', 'unchanged', 'increased' and 'decreased' compare against. 'reset' starts over from all addresses, 'list' shows the candidates. 'find' lists where a sequence of words is, '*' matching any word.", &VMDebugger::cmdScan } },
+    { "checkpoint", { "checkpoint [save|restore <id>|list [<count>]|diff <id> <id>|clear|write <filename>|read <filename>]",
+        "Saves the memory, registers and stack as a checkpoint, or restores one. Checkpoints store the pages of memory they share only once, compressed. 'list' shows the last checkpoints, 'diff' counts the words in which the memory of two differs, 'write' and 'read' save all checkpoints to and load them from <filename>. Without arguments, shows how much memory the checkpoints take.", &VMDebugger::cmdCheckpoint } },
+    { "continue", { "continue", "Runs the program on a background thread, keeping the shell responsive. Commands wait for the VM to reach a safepoint (within about a millisecond) and run while it is parked there; 'reg' and 'stats' read the state it published last without stopping it. Breakpoints do not apply.", &VMDebugger::cmdContinue } },
+    { "pause", { "pause", "Stops the program running in the background.", &VMDebugger::cmdPause } },
+    { "input", { "input [<text>]", "Queues a line of input for the program running in the background.", &VMDebugger::cmdInput } },
+    { "stats", { "stats", "Shows the state of the VM and the number of instructions executed, and their rate while running in the background.", &VMDebugger::cmdStats } }
 };
 
 VMDebugger::VMDebugger()
+    : m_script(nullptr), m_runner(m_vm), m_backgroundInstructions(0)
 {
 }
 
@@ -88,44 +76,213 @@ void VMDebugger::runShell()
         getline(std::cin, command);
 
         if (checkStdin())
+        {
+            // Still at the end after reopening: stdin was not a terminal but a file or pipe that ran out.
+            if (std::cin.eof())
+                break;
+
             continue;
+        }
+
+        if (execute(command) == CommandResult::Quit)
+            break;
+    }
+}
+
+int VMDebugger::runScript(const std::string &filename, const std::string &timingsFile)
+{
+    std::ifstream ifs(filename);
+    if (!ifs)
+        throw std::runtime_error("Could not open " + filename);
+
+    std::vector<std::string> lines;
+    for (std::string line; getline(ifs, line); )
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        lines.push_back(line);
+    }
 
-        auto cmd = parseCommand(command);        
+    // Everything goes to a string buffer until the end, so flushing is free.
+    std::stringbuf output;
+    std::streambuf *console = std::cout.rdbuf(&output);
 
-        if (!cmd.empty())
+    ScriptIO io(lines, std::cout);
+    m_script = &io;
+    m_vm.setIO(io);
+    m_vm.setEscapeChar('#');
+
+    // Time and instructions are attributed to the line last read from, whether by a command or by the program.
+    struct LineTiming
+    {
+        bool command = false;
+        bool started = false;
+        double microseconds = 0;
+        unsigned long long instructions = 0;
+    };
+
+    std::vector<LineTiming> timings(lines.size());
+    size_t currentLine = lines.size();
+    auto lineStart = std::chrono::steady_clock::now();
+    unsigned long long lineInstructions = m_vm.instructionCount();
+
+    auto finishLine = [&]()
+    {
+        auto now = std::chrono::steady_clock::now();
+        unsigned long long instructions = m_vm.instructionCount();
+
+        if (currentLine != lines.size())
         {
-            auto it = commandsList.find(cmd.front());
-            if (it == commandsList.end())
-                std::cout << "Unknown command '" << cmd.front() << "'" << std::endl;
-            else try
-            {
-                (this->*(it->second.callback))(cmd);
-            }
-            catch (const VMQuitException &)
-            {
-                break;
-            }
-            catch (const SynacorVM::EscapeCharacterException &)
-            {
-                std::cout << "VM Interrupted at ";
-                printDisassembly(m_vm.instructionPointer());
-            }
-            catch (const VMInterruptException &)
-            {
-                std::cout << "VM Interrupted at ";
-                printDisassembly(m_vm.instructionPointer());
-            }
-            catch (const VMBreakPointException &)
-            {
-                std::cout << "Breakpoint hit at ";
-                printDisassembly(m_vm.instructionPointer());
-            }
-            catch (const std::exception &e)
-            {
-                std::cout << "Error: " << e.what() << std::endl;
-            }            
+            timings[currentLine].microseconds += std::chrono::duration<double, std::micro>(now - lineStart).count();
+            // Resetting the VM restarts the count.
+            timings[currentLine].instructions += instructions >= lineInstructions ? instructions - lineInstructions : instructions;
         }
+
+        lineStart = now;
+        lineInstructions = instructions;
+    };
+
+    io.setLineStarted([&](size_t line)
+    {
+        finishLine();
+        currentLine = line;
+        timings[line].started = true;
+    });
+
+    auto scriptStart = std::chrono::steady_clock::now();
+    int status = 0;
+
+    std::cout << std::hex;
+    for (std::string command; io.readLine(command); )
+    {
+        size_t line = io.line() - 1;
+        timings[line].command = true;
+
+        CommandResult result = execute(command);
+        if (result == CommandResult::Failed)
+        {
+            std::cout << "Script stopped at line " << std::dec << line + 1 << std::endl;
+            status = 1;
+        }
+
+        if (result != CommandResult::Done)
+            break;
+    }
+
+    finishLine();
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - scriptStart).count();
+
+    m_vm.setIO(ConsoleIO::instance());
+    m_script = nullptr;
+    std::cout.rdbuf(console);
+    std::cout << output.str();
+
+    size_t commands = 0, inputLines = 0;
+    unsigned long long instructions = 0;
+    for (const LineTiming &timing : timings)
+    {
+        commands += timing.started && timing.command;
+        inputLines += timing.started && !timing.command;
+        instructions += timing.instructions;
+    }
+
+    std::cout << std::endl << std::dec << "Script " << filename << ": " << commands << " commands, " << inputLines << " lines of input, "
+        << instructions << " instructions in " << elapsed << " ms" << std::endl;
+
+    if (!timingsFile.empty())
+    {
+        std::ofstream fs(timingsFile, std::ios::out);
+        if (!fs)
+            throw std::runtime_error("Could not open " + timingsFile);
+
+        fs << "line,type,instructions,microseconds,text\n";
+        for (size_t i = 0; i != lines.size(); ++i)
+        {
+            if (!timings[i].started)
+                continue;
+
+            std::string text = lines[i];
+            for (size_t quote = text.find('"'); quote != std::string::npos; quote = text.find('"', quote + 2))
+                text.insert(quote, 1, '"');
+
+            fs << i + 1 << ',' << (timings[i].command ? "command" : "input") << ',' << timings[i].instructions << ','
+                << timings[i].microseconds << ",\"" << text << "\"\n";
+        }
+
+        std::cout << "Timings written to " << timingsFile << std::endl;
+    }
+
+    return status;
+}
+
+void VMDebugger::setEngine(SynacorVM::Engine engine)
+{
+    m_vm.setEngine(engine);
+}
+
+VMDebugger::CommandResult VMDebugger::execute(const std::string &command)
+{
+    auto cmd = parseCommand(command);
+    if (cmd.empty())
+        return CommandResult::Done;
+
+    auto it = commandsList.find(cmd.front());
+    if (it == commandsList.end())
+    {
+        std::cout << "Unknown command '" << cmd.front() << "'" << std::endl;
+        return CommandResult::Failed;
+    }
+
+    // A program that halted in the background hands the VM back before the next command.
+    if (m_runner.finished())
+        m_runner.stop();
+
+    if (m_runner.active() && (cmd.front() == "step" || cmd.front() == "run"))
+    {
+        std::cout << "The program is running in the background. Use 'pause' first." << std::endl;
+        return CommandResult::Failed;
+    }
+
+    // These commands do not touch the VM, or only read what the background worker publishes. All others run while
+    //  the worker is parked at a safepoint.
+    static const std::set<std::string> liveCommands = { "quit", "help", "continue", "pause", "input", "stats" };
+    bool live = liveCommands.count(cmd.front()) || (cmd.front() == "reg" && cmd.size() < 3);
+
+    try
+    {
+        std::unique_ptr<BackgroundRunner::Safepoint> safepoint;
+        if (!live)
+            safepoint.reset(new BackgroundRunner::Safepoint(m_runner));
+
+        (this->*(it->second.callback))(cmd);
+    }
+    catch (const VMQuitException &)
+    {
+        return CommandResult::Quit;
+    }
+    catch (const SynacorVM::EscapeCharacterException &)
+    {
+        std::cout << "VM Interrupted at ";
+        printDisassembly(m_vm.instructionPointer());
+    }
+    catch (const VMInterruptException &)
+    {
+        std::cout << "VM Interrupted at ";
+        printDisassembly(m_vm.instructionPointer());
+    }
+    catch (const VMBreakPointException &)
+    {
+        std::cout << "Breakpoint hit at ";
+        printDisassembly(m_vm.instructionPointer());
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return CommandResult::Failed;
     }
+
+    return CommandResult::Done;
 }
 
 std::vector<std::string> VMDebugger::parseCommand(const std::string& command) const
@@ -147,69 +304,22 @@ ushort VMDebugger::printDisassembly(ushort ip)
 
 ushort VMDebugger::disassemble(std::ostream &ss, ushort ip) const
 {
-    if (ip > 32767)
-    {
-        ss << "err";
-        return ip;
-    }
-
-    ushort opcode = m_vm.readMemory(ip++);
-    if (opcode >= opcodeTable.size())
-    {
-        ss << "dw ";
-        disassembleOperand(ss, opcode);
-    }
-    else
-    {
-        auto info = opcodeTable[opcode];
-        ss << info.name;
-        for (int i = 0; i != info.operands && ip < 32768; ++i)
-        {
-            ss << ' '; 
-            disassembleOperand(ss, m_vm.readMemory(ip++));
-        }   
-    }
+    std::vector<ushort> memory = programMemory();
+    return Disassembler(memory.data(), &strings()).disassemble(ss, ip);
+}
 
-    return ip;
+const StringTable &VMDebugger::strings() const
+{
+    m_strings.refresh(programMemory().data());
+    return m_strings;
 }
 
-void VMDebugger::disassembleOperand(std::ostream &ss, ushort operand) const
+std::vector<ushort> VMDebugger::programMemory() const
 {
-    if (operand < 0x8000)
-    {
-        ss << operand;
-        if (operand < 256)
-        {
-            ss << " '";
-            
-            if (operand < 0x20)
-                switch (operand)
-                {
-                case '\n':
-                    ss << "\\n";
-                    break;
-                case '\r':
-                    ss << "\\r";
-                    break;
-                case '\t':
-                    ss << "\\t";
-                    break;
-                default:
-                    ss << ' ';
-                    break;
-                }
-            else
-                ss << static_cast<char>(operand);
-
-
-            ss << "'";
-        }
-            
-    }
-    else if ((operand & 0x7FFF) < 8)
-        ss << "R" << (operand & 0x7FFF);
-    else
-        ss << "Err(" << operand << ')';
+    std::vector<ushort> memory(MemoryImage::words);
+    m_vm.readMemory(0, memory.data(), memory.size());
+
+    return memory;
 }
 
 bool VMDebugger::checkStdin()
@@ -284,7 +394,7 @@ void VMDebugger::cmdStep(const ArgList& args)
         if (m_breakpoints.find(m_vm.instructionPointer()) != m_breakpoints.end())
             throw VMBreakPointException();
 
-        if (checkStdin())
+        if (!m_script && checkStdin())
             throw VMInterruptException();
     }
 
@@ -293,24 +403,38 @@ void VMDebugger::cmdStep(const ArgList& args)
 
 void VMDebugger::cmdRun(const ArgList& args)
 {
+    // Breakpoints are checked between instructions, so only single-step when there are any.
+    if (m_breakpoints.empty())
+    {
+        m_vm.run();
+        return;
+    }
+
     while (m_vm.step())
     {
         if (m_breakpoints.find(m_vm.instructionPointer()) != m_breakpoints.end())
             throw VMBreakPointException();
 
-        if (checkStdin())
+        if (!m_script && checkStdin())
             throw VMInterruptException();
     }
 }
 
 void VMDebugger::cmdReg(const ArgList& args)
 {
+    // While running in the background, registers are shown as of the last safepoint.
+    std::array<ushort, 8> registers;
+    if (m_runner.active())
+        registers = m_runner.snapshot().registers;
+    else
+        registers = m_vm.cpuState().registers;
+
     size_t argc = args.size();
     if (argc < 2)
     {
         // List all registers
         for (ushort i = 0; i != 8; ++i)
-            std::cout << "R" << i << " = 0x" << m_vm.readRegister(i) << std::endl;
+            std::cout << "R" << i << " = 0x" << registers[i] << std::endl;
     }
     else if (argc < 3)
     {
@@ -318,7 +442,7 @@ void VMDebugger::cmdReg(const ArgList& args)
         if (regId > 7)
             std::cout << "Invalid register." << std::endl;
         else
-            std::cout << "R" << regId << " = 0x" << m_vm.readRegister(regId) << std::endl;
+            std::cout << "R" << regId << " = 0x" << registers[regId] << std::endl;
     }
     else
     {
@@ -466,23 +590,14 @@ void VMDebugger::cmdDumpAsm(const ArgList& args)
             return;
         }
 
-        fs << "Synacor VM Disassembly" << std::endl << std::endl;
-
         ushort start = std::min<ushort>(32768, args.size() < 3 ? 0 : stoul(args[2], nullptr, 16) & 0xFFFF);
         ushort end = std::min<ushort>(32768, args.size() < 4 ? 32768 : stoul(args[3], nullptr, 16) & 0xFFFF);
 
         if (start > end)
             std::swap(start, end);
 
-       
-        fs << std::hex << std::setfill('0');
-
-        for (ushort ip = start; ip < end; )
-        {
-            fs << std::setw(4) << ip << ": ";
-            ip = disassemble(fs, ip);
-            fs << std::endl;
-        }
+        std::vector<ushort> memory = programMemory();
+        Disassembler(memory.data(), &strings()).dump(fs, start, end);
 
         fs.close();
 
@@ -531,3 +646,358 @@ void VMDebugger::cmdStack(const ArgList& args)
     for (ushort value : stack)
         std::cout << '[' << std::setw(4) << --pos << "] = " << value << std::endl;
 }
+
+void VMDebugger::cmdEngine(const ArgList& args)
+{
+    if (args.size() >= 2)
+        m_vm.setEngine(SynacorVM::engineFromName(args[1]));
+
+    std::cout << "Engine: " << SynacorVM::engineName(m_vm.engine()) << std::endl;
+}
+
+void VMDebugger::cmdFusions(const ArgList& args)
+{
+    auto stats = m_vm.fusionStats();
+    if (stats.empty())
+    {
+        std::cout << "Superinstructions are only used by the fused engine." << std::endl;
+        return;
+    }
+
+    std::cout << std::dec;
+    for (const auto &stat : stats)
+        std::cout << stat.name << std::string(16 - std::string(stat.name).size(), ' ') << stat.count << std::endl;
+}
+
+void VMDebugger::cmdProfile(const ArgList& args)
+{
+    std::string action = args.size() < 2 ? "" : args[1];
+
+    if (action == "start")
+        m_vm.setProfile(&m_profile);
+    else if (action == "stop")
+        m_vm.setProfile(nullptr);
+    else if (action == "clear")
+        m_profile.clear();
+    else if (action == "save" && args.size() >= 3)
+    {
+        m_profile.save(args[2]);
+        std::cout << "Profile saved to " << args[2] << std::endl;
+        return;
+    }
+    else if (action == "lcov" && args.size() >= 4)
+    {
+        std::ofstream fs(args[2], std::ios::out);
+        if (!fs)
+        {
+            std::cout << "Cannot open " << args[2] << " for writing" << std::endl;
+            return;
+        }
+
+        std::vector<ushort> memory = programMemory();
+        Disassembler(memory.data(), &strings()).dump(fs, 0, 32768);
+        fs.close();
+
+        m_profile.writeLcov(args[3], memory.data(), args[2]);
+        std::cout << "Disassembly dumped to " << args[2] << ", coverage to " << args[3] << std::endl;
+        return;
+    }
+    else if (action == "heatmap" && args.size() >= 3)
+    {
+        m_profile.writeHeatmap(args[2], programMemory().data());
+        std::cout << "Heatmap written to " << args[2] << std::endl;
+        return;
+    }
+    else if (!action.empty())
+    {
+        std::cout << "Usage: " << commandsList.at("profile").usage << std::endl;
+        return;
+    }
+
+    size_t executed = std::count_if(m_profile.executes(), m_profile.executes() + MemoryProfile::words, [](unsigned long long count) { return count != 0; });
+    size_t read = std::count_if(m_profile.reads(), m_profile.reads() + MemoryProfile::words, [](unsigned long long count) { return count != 0; });
+    size_t written = std::count_if(m_profile.writes(), m_profile.writes() + MemoryProfile::words, [](unsigned long long count) { return count != 0; });
+
+    std::cout << std::dec << "Profiling " << (m_vm.profile() ? "enabled" : "disabled") << ". Words executed: " << executed
+        << ", read: " << read << ", written: " << written << std::hex << std::endl;
+}
+
+void VMDebugger::cmdConfirm(const ArgList& args)
+{
+    if (args.size() < 2)
+    {
+        std::cout << "Missing table" << std::endl;
+        return;
+    }
+
+    ushort address = args.size() < 3 ? 0x178b : stoul(args[2], nullptr, 16) & 0x7FFF;
+
+    if (args[1] == "off")
+    {
+        m_vm.removeHook(address);
+        std::cout << "Confirmation routine at " << address << " restored" << std::endl;
+        return;
+    }
+
+    auto table = std::make_shared<ConfirmationTable>(ConfirmationTable::open(args[1]));
+    auto parameters = table->parameters();
+
+    // The VM computes modulo 32768, so tables for any other modulus give the wrong answers.
+    if (parameters.modulus != 32768)
+    {
+        std::cout << args[1] << " was built for modulus " << std::dec << parameters.modulus << ", not 32768" << std::hex << std::endl;
+        return;
+    }
+
+    m_vm.installHook(address, [table, parameters](SynacorVM &vm)
+    {
+        // Only answer calls with the parameters the table was built for. Anything else runs the routine itself.
+        if (vm.readRegister(0) != parameters.r0 || vm.readRegister(1) != parameters.r1 || vm.getStack().empty())
+            return false;
+
+        // Return the result to the caller, as the routine's 'ret' would.
+        auto state = vm.cpuState();
+        state.registers[0] = table->result(state.registers[7]);
+        state.instructionPointer = state.stack.front();
+        state.stack.pop_front();
+        vm.setCpuState(state);
+
+        return true;
+    });
+
+    std::cout << "Confirmation routine at " << address << " answered from " << args[1] << " (r0 = " << std::dec << parameters.r0
+        << ", r1 = " << parameters.r1 << ", modulus " << parameters.modulus << ')' << std::hex << std::endl;
+}
+
+void VMDebugger::cmdStrings(const ArgList& args)
+{
+    const StringTable &table = strings();
+    if (args.size() < 2)
+    {
+        std::cout << std::dec << table.entries().size() << " strings in memory" << std::hex << std::endl;
+        return;
+    }
+
+    std::string query;
+    for (size_t i = 1; i != args.size(); ++i)
+        query += args[i] + ' ';
+
+    std::vector<ushort> matches = table.search(query);
+    for (ushort address : matches)
+        std::cout << std::setfill('0') << std::setw(4) << address << ": " << StringTable::quote(table.find(address)->text) << std::endl;
+
+    std::cout << std::dec << matches.size() << " strings found" << std::hex << std::endl;
+}
+
+void VMDebugger::printScanCandidates(size_t limit) const
+{
+    for (ushort address : m_scanner.candidates(limit))
+        std::cout << "M[0x" << address << "] = 0x" << m_vm.readMemory(address) << std::endl;
+}
+
+void VMDebugger::cmdScan(const ArgList& args)
+{
+    // Candidates are listed after a scan when there are few enough to read through.
+    const size_t listedCandidates = 16;
+
+    std::string action = args.size() < 2 ? "" : args[1];
+    size_t count;
+
+    // Scan the program's own words, not the patches of installed hooks.
+    std::vector<ushort> memory = programMemory();
+
+    if (action == "eq" && args.size() >= 3)
+        count = m_scanner.scanEqual(memory.data(), stoul(args[2], nullptr, 0) & 0xFFFF);
+    else if (action == "range" && args.size() >= 4)
+        count = m_scanner.scanRange(memory.data(), stoul(args[2], nullptr, 0) & 0xFFFF, stoul(args[3], nullptr, 0) & 0xFFFF);
+    else if (action == "changed" || action == "unchanged" || action == "increased" || action == "decreased")
+    {
+        if (!m_scanner.hasSnapshot())
+        {
+            std::cout << "No snapshot to compare against yet. Use 'scan reset' or another scan first." << std::endl;
+            return;
+        }
+
+        MemoryScanner::Comparison comparison = action == "changed" ? MemoryScanner::Comparison::Changed
+            : action == "unchanged" ? MemoryScanner::Comparison::Unchanged
+            : action == "increased" ? MemoryScanner::Comparison::Increased : MemoryScanner::Comparison::Decreased;
+        count = m_scanner.scanRelative(memory.data(), comparison);
+    }
+    else if (action == "reset")
+    {
+        m_scanner.reset(memory.data());
+        std::cout << "All addresses are candidates again, snapshot taken" << std::endl;
+        return;
+    }
+    else if (action == "list")
+    {
+        printScanCandidates(args.size() < 3 ? listedCandidates : stoul(args[2], nullptr, 0));
+        std::cout << std::dec << m_scanner.candidateCount() << " candidates" << std::hex << std::endl;
+        return;
+    }
+    else if (action == "find" && args.size() >= 3)
+    {
+        std::vector<ushort> pattern;
+        std::vector<bool> wildcards;
+        for (size_t i = 2; i != args.size(); ++i)
+        {
+            wildcards.push_back(args[i] == "*");
+            pattern.push_back(wildcards.back() ? 0 : stoul(args[i], nullptr, 0) & 0xFFFF);
+        }
+
+        std::vector<ushort> matches = MemoryScanner::findPattern(memory.data(), pattern, wildcards);
+        for (ushort address : matches)
+            std::cout << std::setfill('0') << std::setw(4) << address << std::endl;
+
+        std::cout << std::dec << matches.size() << " matches" << std::hex << std::endl;
+        return;
+    }
+    else
+    {
+        std::cout << std::dec << m_scanner.candidateCount() << " candidates" << (m_scanner.hasSnapshot() ? "" : ", no snapshot") << std::hex << std::endl;
+        return;
+    }
+
+    if (count <= listedCandidates)
+        printScanCandidates(count);
+
+    std::cout << std::dec << count << " candidates left" << std::hex << std::endl;
+}
+
+void VMDebugger::cmdCheckpoint(const ArgList& args)
+{
+    const size_t listedCheckpoints = 16;
+
+    std::string action = args.size() < 2 ? "" : args[1];
+
+    if (action == "save")
+    {
+        size_t pages = m_checkpoints.statistics().pages;
+        size_t id = m_checkpoints.add(m_vm);
+        std::cout << std::dec << "Checkpoint " << id << " saved (" << m_checkpoints.statistics().pages - pages << " new pages)" << std::hex << std::endl;
+    }
+    else if (action == "restore" && args.size() >= 3)
+    {
+        size_t id = stoul(args[2], nullptr, 0);
+        if (id >= m_checkpoints.size())
+        {
+            std::cout << "No such checkpoint" << std::endl;
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        m_checkpoints.restore(id, m_vm);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::dec << "Checkpoint " << id << " restored in " << elapsed << " us" << std::hex << std::endl;
+        printDisassembly(m_vm.instructionPointer());
+    }
+    else if (action == "list")
+    {
+        size_t count = args.size() < 3 ? listedCheckpoints : stoul(args[2], nullptr, 0);
+        for (size_t id = m_checkpoints.size() - std::min(count, m_checkpoints.size()); id != m_checkpoints.size(); ++id)
+        {
+            SynacorVM::CpuState state = m_checkpoints.cpuState(id);
+            std::cout << std::dec << id << std::hex << ": pc " << std::setfill('0') << std::setw(4) << state.instructionPointer
+                << ", stack depth " << std::dec << state.stack.size() << std::hex << std::endl;
+        }
+    }
+    else if (action == "diff" && args.size() >= 4)
+    {
+        size_t a = stoul(args[2], nullptr, 0), b = stoul(args[3], nullptr, 0);
+        if (a >= m_checkpoints.size() || b >= m_checkpoints.size())
+        {
+            std::cout << "No such checkpoint" << std::endl;
+            return;
+        }
+
+        std::cout << std::dec << m_checkpoints.difference(a, b) << " words differ" << std::hex << std::endl;
+    }
+    else if (action == "clear")
+    {
+        m_checkpoints.clear();
+        std::cout << "All checkpoints removed" << std::endl;
+    }
+    else if (action == "write" && args.size() >= 3)
+    {
+        m_checkpoints.save(args[2]);
+        std::cout << std::dec << m_checkpoints.size() << " checkpoints written to " << args[2] << std::hex << std::endl;
+    }
+    else if (action == "read" && args.size() >= 3)
+    {
+        m_checkpoints.load(args[2]);
+        std::cout << std::dec << m_checkpoints.size() << " checkpoints read from " << args[2] << std::hex << std::endl;
+    }
+    else
+    {
+        CheckpointStore::Statistics statistics = m_checkpoints.statistics();
+        std::cout << std::dec << statistics.checkpoints << " checkpoints, " << statistics.pages << " distinct pages ("
+            << statistics.compressedBytes / 1024 << " KiB compressed), " << statistics.totalBytes / 1024 << " KiB in total" << std::hex << std::endl;
+    }
+}
+
+void VMDebugger::cmdContinue(const ArgList& args)
+{
+    // The worker writes to std::cout, which a script buffers without locking.
+    if (m_script)
+        throw std::runtime_error("Running in the background is not available in scripts");
+
+    if (m_runner.active())
+    {
+        std::cout << "Already running in the background" << std::endl;
+        return;
+    }
+
+    m_backgroundStart = std::chrono::steady_clock::now();
+    m_backgroundInstructions = m_vm.instructionCount();
+    m_runner.start();
+
+    std::cout << "Running in the background. Use 'input <text>' for game input, and 'pause' to stop." << std::endl;
+}
+
+void VMDebugger::cmdPause(const ArgList& args)
+{
+    if (!m_runner.active())
+    {
+        std::cout << "Not running in the background" << std::endl;
+        return;
+    }
+
+    m_runner.stop();
+    std::cout << "VM paused at ";
+    printDisassembly(m_vm.instructionPointer());
+}
+
+void VMDebugger::cmdInput(const ArgList& args)
+{
+    std::string line;
+    for (size_t i = 1; i < args.size(); ++i)
+        line += (i > 1 ? " " : "") + args[i];
+
+    m_runner.feed(line);
+    if (!m_runner.active())
+        std::cout << "Queued for when the program runs in the background" << std::endl;
+}
+
+void VMDebugger::cmdStats(const ArgList& args)
+{
+    if (!m_runner.active())
+    {
+        std::cout << std::dec << "Stopped, " << m_vm.instructionCount() << " instructions, pc " << std::hex << std::setfill('0')
+            << std::setw(4) << m_vm.instructionPointer() << ", stack depth " << std::dec << m_vm.getStack().size() << std::hex << std::endl;
+        return;
+    }
+
+    BackgroundRunner::Snapshot snapshot = m_runner.snapshot();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_backgroundStart).count();
+    double rate = (snapshot.instructionCount - m_backgroundInstructions) / seconds / 1e6;
+
+    const char *state = snapshot.state == BackgroundRunner::State::Running ? "Running"
+        : snapshot.state == BackgroundRunner::State::WaitingForInput ? "Waiting for input"
+        : snapshot.state == BackgroundRunner::State::Halted ? "Halted"
+        : snapshot.state == BackgroundRunner::State::Failed ? "Failed" : "Stopped";
+
+    std::cout << std::dec << state << " in the background, " << snapshot.instructionCount << " instructions (" << std::fixed
+        << std::setprecision(1) << rate << std::defaultfloat << "M per second), pc " << std::hex << std::setfill('0') << std::setw(4)
+        << snapshot.instructionPointer << ", stack depth " << std::dec << snapshot.stackDepth << std::hex << std::endl;
+}
@@ -1,5 +1,10 @@
 #pragma once
+#include "BackgroundRunner.hpp"
+#include "CheckpointStore.hpp"
+#include "MemoryScanner.hpp"
+#include "StringTable.hpp"
 #include "SynacorVM.hpp"
+#include <chrono>
 #include <map>
 #include <set>
 #include <vector>
@@ -9,6 +14,14 @@ class VMDebugger
 {
     SynacorVM m_vm;
     std::set<ushort> m_breakpoints;
+    MemoryProfile m_profile;
+    MemoryScanner m_scanner;
+    CheckpointStore m_checkpoints;
+    mutable StringTable m_strings;      // Refreshed from memory whenever it is used.
+    ScriptIO *m_script;                 // Input and output of the script being run, or null in the shell.
+    BackgroundRunner m_runner;          // Runs m_vm in the background after 'continue'.
+    std::chrono::steady_clock::time_point m_backgroundStart;
+    unsigned long long m_backgroundInstructions;    // Instruction count at 'continue'.
 
 
     using ArgList = std::vector<std::string>;
@@ -27,12 +40,35 @@ public:
     
     void runShell();
 
+    // Runs the commands in filename as if typed into the shell, without prompts: while the program runs, it reads
+    //  the lines that follow as game input, and a line starting with the escape character '#' returns to the
+    //  debugger. All output is buffered and written at the end, followed by the time and instructions taken. If
+    //  timingsFile is given, the time and instructions of every line are written to it as CSV.
+    //  Returns 0, or 1 if a command failed (which stops the script).
+    int runScript(const std::string &filename, const std::string &timingsFile = "");
+
+    // Changes the engine used by 'run' (without breakpoints).
+    void setEngine(SynacorVM::Engine engine);
+
 private:
+    enum class CommandResult
+    {
+        Done,
+        Failed,
+        Quit
+    };
+
+    // Runs a command line, reporting interruptions, breakpoints and errors.
+    CommandResult execute(const std::string &command);
+
     std::vector<std::string> parseCommand(const std::string &command) const;
 
     ushort printDisassembly(ushort ip);
     ushort disassemble(std::ostream &ss, ushort ip) const;
-    void disassembleOperand(std::ostream &ss, ushort operand) const;
+    const StringTable &strings() const;
+
+    // Returns a copy of memory with the original instructions at hooked addresses (see SynacorVM::readMemory()).
+    std::vector<ushort> programMemory() const;
 
     static bool checkStdin();
 
@@ -53,5 +89,18 @@ private:
     void cmdDumpAsm(const ArgList &args);
     void cmdDump(const ArgList &args);
     void cmdStack(const ArgList &args);
+    void cmdEngine(const ArgList &args);
+    void cmdFusions(const ArgList &args);
+    void cmdProfile(const ArgList &args);
+    void cmdConfirm(const ArgList &args);
+    void cmdStrings(const ArgList &args);
+    void cmdScan(const ArgList &args);
+    void cmdCheckpoint(const ArgList &args);
+    void cmdContinue(const ArgList &args);
+    void cmdPause(const ArgList &args);
+    void cmdInput(const ArgList &args);
+    void cmdStats(const ArgList &args);
+
+    void printScanCandidates(size_t limit) const;
 
 };
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "VMIO.hpp"
+#include <iostream>
+#include <limits>
+
+int ConsoleIO::read()
+{
+    int ch = std::cin.get();
+
+    return ch == std::char_traits<char>::eof() ? -1 : ch;
+}
+
+void ConsoleIO::write(char ch)
+{
+    std::cout << ch;
+}
+
+void ConsoleIO::discardLine()
+{
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+}
+
+ConsoleIO &ConsoleIO::instance()
+{
+    static ConsoleIO console;
+    return console;
+}
+
+int BufferedIO::read()
+{
+    if (m_input.empty())
+        return -1;
+
+    char ch = m_input.front();
+    m_input.pop_front();
+
+    return static_cast<unsigned char>(ch);
+}
+
+void BufferedIO::write(char ch)
+{
+    m_output += ch;
+}
+
+void BufferedIO::discardLine()
+{
+    while (!m_input.empty())
+    {
+        char ch = m_input.front();
+        m_input.pop_front();
+
+        if (ch == '\n')
+            break;
+    }
+}
+
+void BufferedIO::feed(const std::string &input)
+{
+    m_input.insert(m_input.end(), input.begin(), input.end());
+}
+
+void BufferedIO::feedLine(const std::string &line)
+{
+    feed(line);
+    m_input.push_back('\n');
+}
+
+bool BufferedIO::hasInput() const
+{
+    return !m_input.empty();
+}
+
+const std::string &BufferedIO::output() const
+{
+    return m_output;
+}
+
+std::string BufferedIO::takeOutput()
+{
+    std::string output;
+    output.swap(m_output);
+
+    return output;
+}
+
+ScriptIO::ScriptIO(std::vector<std::string> lines, std::ostream &output)
+    : m_lines(std::move(lines)), m_line(0), m_column(0), m_output(output)
+{
+}
+
+int ScriptIO::read()
+{
+    if (m_line == m_lines.size())
+        return -1;
+
+    if (m_column == 0 && m_lineStarted)
+        m_lineStarted(m_line);
+
+    const std::string &line = m_lines[m_line];
+    if (m_column != line.size())
+        return static_cast<unsigned char>(line[m_column++]);
+
+    ++m_line;
+    m_column = 0;
+    return '\n';
+}
+
+void ScriptIO::write(char ch)
+{
+    m_output.put(ch);
+}
+
+void ScriptIO::discardLine()
+{
+    if (m_line != m_lines.size())
+    {
+        ++m_line;
+        m_column = 0;
+    }
+}
+
+bool ScriptIO::readLine(std::string &line)
+{
+    if (m_line == m_lines.size())
+        return false;
+
+    if (m_column == 0 && m_lineStarted)
+        m_lineStarted(m_line);
+
+    line = m_lines[m_line].substr(m_column);
+    ++m_line;
+    m_column = 0;
+    return true;
+}
+
+size_t ScriptIO::line() const
+{
+    return m_line;
+}
+
+void ScriptIO::setLineStarted(std::function<void(size_t)> callback)
+{
+    m_lineStarted = std::move(callback);
+}
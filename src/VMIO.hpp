@@ -0,0 +1,90 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Character I/O used by the IN and OUT opcodes.
+class VMIO
+{
+public:
+    virtual ~VMIO() = default;
+
+    // Returns the next input character, or -1 if no input is available (the VM then suspends at IN).
+    virtual int read() = 0;
+
+    // Writes a character of output.
+    virtual void write(char ch) = 0;
+
+    // Discards the remainder of the current input line.
+    virtual void discardLine() = 0;
+};
+
+// I/O on stdin and stdout. Used by default.
+class ConsoleIO final : public VMIO
+{
+public:
+    int read() override;
+    void write(char ch) override;
+    void discardLine() override;
+
+    // Returns the shared console instance.
+    static ConsoleIO &instance();
+};
+
+// I/O on in-memory buffers. Input is queued up front, output is collected until taken.
+class BufferedIO final : public VMIO
+{
+    std::deque<char> m_input;
+    std::string m_output;
+
+public:
+    int read() override;
+    void write(char ch) override;
+    void discardLine() override;
+
+    // Queues input for the VM. A newline is not appended automatically.
+    void feed(const std::string &input);
+
+    // Queues a line of input for the VM, appending a newline.
+    void feedLine(const std::string &line);
+
+    // Returns whether there is queued input left.
+    bool hasInput() const;
+
+    // Returns the output collected so far.
+    const std::string &output() const;
+
+    // Returns and clears the output collected so far.
+    std::string takeOutput();
+};
+
+// I/O for a script shared by the VM and a line-based reader (the debugger's script mode): the VM reads the characters
+//  of the current line and the reader takes whole lines, both advancing through the same lines, just like both would
+//  read stdin. Output goes to a stream.
+class ScriptIO final : public VMIO
+{
+    std::vector<std::string> m_lines;
+    size_t m_line;
+    size_t m_column;
+    std::ostream &m_output;
+    std::function<void(size_t)> m_lineStarted;
+
+public:
+    ScriptIO(std::vector<std::string> lines, std::ostream &output);
+
+    int read() override;
+    void write(char ch) override;
+    void discardLine() override;
+
+    // Takes the rest of the current line. Returns false at the end of the script.
+    bool readLine(std::string &line);
+
+    // Returns the index of the current line.
+    size_t line() const;
+
+    // Calls callback with the index of every line as soon as anything reads from it.
+    void setLineStarted(std::function<void(size_t)> callback);
+};
@@ -0,0 +1,76 @@
+#include "Walkthrough.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+Walkthrough Walkthrough::read(const std::string &filename, const std::string &searchDir)
+{
+    std::ifstream ifs(filename);
+    if (!ifs)
+        throw std::runtime_error("Could not open " + filename);
+
+    std::vector<std::string> lines;
+    for (std::string line; getline(ifs, line); )
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        lines.push_back(line);
+    }
+
+    Walkthrough walkthrough;
+
+    auto run = std::find(lines.begin(), lines.end(), "run");
+    if (run == lines.end())
+    {
+        walkthrough.input = lines;
+        return walkthrough;
+    }
+
+    size_t slash = filename.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash);
+
+    for (auto it = lines.begin(); it != run; ++it)
+    {
+        std::istringstream ss(*it);
+        std::string command;
+        ss >> command;
+
+        if (command == "load")
+        {
+            std::string file;
+            ss >> file;
+
+            walkthrough.binary = directory + "/" + file;
+            if (!std::ifstream(walkthrough.binary))
+                walkthrough.binary = searchDir + "/" + file;
+        }
+        else if (command == "mem")
+        {
+            // Same number formats as the debugger: hexadecimal address, value in any base.
+            std::string address, value;
+            ss >> address >> value;
+
+            walkthrough.patches.emplace_back(std::stoul(address, nullptr, 16) & 0x7FFF, std::stoul(value, nullptr, 0) & 0xFFFF);
+        }
+    }
+
+    walkthrough.input.assign(run + 1, lines.end());
+    return walkthrough;
+}
+
+void Walkthrough::prepare(SynacorVM &vm) const
+{
+    if (!binary.empty())
+        vm.loadBinary(binary);
+
+    for (const auto &patch : patches)
+        vm.writeMemory(patch.first, patch.second);
+}
+
+void Walkthrough::feed(BufferedIO &io) const
+{
+    for (const auto &line : input)
+        io.feedLine(line);
+}
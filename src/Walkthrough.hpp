@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "SynacorVM.hpp"
+
+// A walkthrough script (see spoilers/walkthrough): debugger commands that prepare the VM ('load' and 'mem'),
+//  up to 'run', followed by game input. Without a 'run' line, every line is game input.
+struct Walkthrough
+{
+    std::string binary;                                 // Binary named by 'load'. Empty if none.
+    std::vector<std::pair<ushort, ushort>> patches;     // Memory patches from 'mem', as (address, value).
+    std::vector<std::string> input;                     // Lines of game input.
+
+    // Reads a walkthrough. Binaries named by 'load' are looked up next to the walkthrough, then in searchDir.
+    static Walkthrough read(const std::string &filename, const std::string &searchDir = ".");
+
+    // Loads the binary into vm and applies the patches.
+    void prepare(SynacorVM &vm) const;
+
+    // Queues all game input.
+    void feed(BufferedIO &io) const;
+};
@@ -1,4 +1,8 @@
 #include <iostream>
+#include <fstream>
+#include <string>
+#include "Disassembler.hpp"
+#include "StringTable.hpp"
 #include "VMDebugger.hpp"
 #include "SynacorVM.hpp"
 
@@ -6,22 +10,75 @@ int main(int argc, char ** argv)
 {
     try
     {
-        if (argc < 2)
+        // Usage: synacorvm [--engine <name>] [--profile <prefix>] [<binary>]
+        //        synacorvm [--engine <name>] --script <debugger script> [--timings <csv file>]
+        SynacorVM::Engine engine = SynacorVM::Engine::Switch;
+        std::string profilePrefix, script, timings;
+        while (argc >= 3 && std::string(argv[1]).compare(0, 2, "--") == 0)
+        {
+            std::string option = argv[1];
+            if (option == "--engine")
+                engine = SynacorVM::engineFromName(argv[2]);
+            else if (option == "--profile")
+                profilePrefix = argv[2];
+            else if (option == "--script")
+                script = argv[2];
+            else if (option == "--timings")
+                timings = argv[2];
+            else
+                throw std::invalid_argument("Unknown option " + option);
+
+            argc -= 2;
+            argv += 2;
+        }
+
+        // Without a binary, the debugger profiles on request instead (see its 'profile' command).
+        if (!profilePrefix.empty() && (argc < 2 || !script.empty()))
+            throw std::invalid_argument("--profile requires a binary");
+
+        if (!script.empty())
         {
             VMDebugger debugger;
+            debugger.setEngine(engine);
+            return debugger.runScript(script, timings);
+        }
+        else if (argc < 2)
+        {
+            VMDebugger debugger;
+            debugger.setEngine(engine);
             debugger.runShell();
         }
         else
         {
             SynacorVM vm;
+            vm.setEngine(engine);
 
             std::cout << "Loading binary... ";
             std::cout << vm.loadBinary(argv[1]) << " words" << std::endl;;
 
+            MemoryProfile profile;
+            if (!profilePrefix.empty())
+                vm.setProfile(&profile);
+
             std::cout << "Executing..." << std::endl << std::endl;
             vm.run();
 
             std::cout << std::endl << std::endl << "Execution completed..." << std::endl;
+
+            if (!profilePrefix.empty())
+            {
+                StringTable strings;
+                strings.scan(vm.memory());
+
+                std::ofstream fs(profilePrefix + ".asm", std::ios::out);
+                Disassembler(vm.memory(), &strings).dump(fs, 0, 32768);
+
+                profile.save(profilePrefix + ".prof");
+                profile.writeLcov(profilePrefix + ".info", vm.memory(), profilePrefix + ".asm");
+                profile.writeHeatmap(profilePrefix + ".png", vm.memory());
+
+                std::cout << "Profile written to " << profilePrefix << ".{prof,asm,info,png}" << std::endl;
+            }
         }
     }
     catch (const std::exception &e)
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "CheckpointStore.hpp"
+#include "Opcodes.hpp"
+#include "SynacorVM.hpp"
+
+// Checkpoints taken while a hook is installed hold the original instruction, so restoring one after the hook is
+//  removed (or while it is still installed) leaves a runnable program.
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char *description)
+    {
+        if (!condition)
+        {
+            std::cout << "FAILED: " << description << std::endl;
+            ++failures;
+        }
+    }
+}
+
+int main()
+{
+    std::vector<ushort> memory(MemoryImage::words, 0);
+    const ushort code[] = { Out, 'A', Halt };
+    std::copy(code, code + 3, memory.begin());
+
+    MemoryImage image(memory.data());
+    BufferedIO io;
+    SynacorVM vm;
+    vm.setIO(io);
+    vm.mapImage(image);
+
+    CheckpointStore checkpoints;
+    vm.installHook(0, [](SynacorVM &) { return false; });
+    size_t id = checkpoints.add(vm);
+
+    checkpoints.readMemory(id, memory.data());
+    check(memory[0] == Out, "the checkpoint holds the original instruction at a hooked address");
+
+    // Restoring while hooked keeps the hook in place.
+    checkpoints.restore(id, vm);
+    check(vm.memory()[0] == SynacorVM::hookOpcode, "restoring keeps an installed hook");
+    check(vm.readMemory(0) == Out, "a hooked address reads as the original instruction after restoring");
+
+    // Restoring after the hook is removed brings back the original instruction, not the hook patch.
+    vm.removeHook(0);
+    checkpoints.restore(id, vm);
+    check(vm.memory()[0] == Out, "restoring after removing the hook leaves the original instruction");
+
+    try
+    {
+        vm.run();
+        check(io.output() == "A", "the restored program runs");
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "FAILED: the restored program runs (" << e.what() << ")" << std::endl;
+        ++failures;
+    }
+
+    if (failures == 0)
+        std::cout << "All checks passed." << std::endl;
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+#include "ComplexityFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char complexityMagic[8] = { 'S', 'Y', 'N', 'C', 'P', 'L', 'X', '1' };
+    const size_t trailerBytes = 2 * sizeof(unsigned long long) + sizeof(complexityMagic);
+
+    enum ColumnEncoding : unsigned char
+    {
+        Constant,
+        Delta
+    };
+
+    const unsigned columnCount = 4;
+
+    unsigned long long column(const ComplexityRecord &record, unsigned index)
+    {
+        switch (index)
+        {
+        case 0:
+            return record.recursiveIterations;
+        case 1:
+            return record.memoizedIterations;
+        case 2:
+            return record.linearIterations;
+        default:
+            return record.result;
+        }
+    }
+
+    void setColumn(ComplexityRecord &record, unsigned index, unsigned long long value)
+    {
+        switch (index)
+        {
+        case 0:
+            record.recursiveIterations = value;
+            break;
+        case 1:
+            record.memoizedIterations = value;
+            break;
+        case 2:
+            record.linearIterations = value;
+            break;
+        default:
+            record.result = static_cast<unsigned short>(value);
+            break;
+        }
+    }
+
+    void putVarint(std::vector<unsigned char> &out, unsigned long long value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<unsigned char>(value));
+    }
+
+    unsigned long long getVarint(const unsigned char *&data, const unsigned char *end)
+    {
+        unsigned long long value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (data == end)
+                break;
+
+            unsigned char byte = *data++;
+            value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        throw std::runtime_error("Corrupt complexity column");
+    }
+
+    void encodeColumn(std::vector<unsigned char> &out, const std::vector<ComplexityRecord> &records, unsigned index)
+    {
+        unsigned long long first = column(records.front(), index);
+        bool constant = std::all_of(records.begin(), records.end(), [&](const ComplexityRecord &record) { return column(record, index) == first; });
+
+        out.push_back(constant ? Constant : Delta);
+        size_t lengthOffset = out.size();
+        out.resize(out.size() + sizeof(unsigned));
+
+        putVarint(out, first);
+        if (!constant)
+        {
+            for (size_t i = 1; i != records.size(); ++i)
+            {
+                long long delta = static_cast<long long>(column(records[i], index) - column(records[i - 1], index));
+                putVarint(out, static_cast<unsigned long long>(delta) << 1 ^ static_cast<unsigned long long>(delta >> 63));
+            }
+        }
+
+        unsigned length = static_cast<unsigned>(out.size() - lengthOffset - sizeof(unsigned));
+        memcpy(out.data() + lengthOffset, &length, sizeof(length));
+    }
+
+    bool blockOrder(const ComplexityBlock &a, const ComplexityBlock &b)
+    {
+        if (a.r0 != b.r0)
+            return a.r0 < b.r0;
+        if (a.r1 != b.r1)
+            return a.r1 < b.r1;
+        return a.firstR7 < b.firstR7;
+    }
+}
+
+ComplexityWriter::Buffer::Buffer(ComplexityWriter &writer)
+    : m_writer(writer)
+{
+    m_records.reserve(blockSize);
+}
+
+void ComplexityWriter::Buffer::add(const ComplexityRecord &record)
+{
+    if (!m_records.empty())
+    {
+        const auto &first = m_records.front();
+        if (m_records.size() == blockSize || record.r0 != first.r0 || record.r1 != first.r1 || record.r7 != m_records.back().r7 + 1)
+            flush();
+    }
+
+    m_records.push_back(record);
+}
+
+void ComplexityWriter::Buffer::flush()
+{
+    if (m_records.empty())
+        return;
+
+    m_encoded.clear();
+    for (unsigned i = 0; i != columnCount; ++i)
+        encodeColumn(m_encoded, m_records, i);
+
+    const auto &first = m_records.front();
+    unsigned long long offset = m_writer.append(m_encoded.data(), m_encoded.size());
+    m_blocks.push_back({ offset, static_cast<unsigned>(m_encoded.size()), static_cast<unsigned>(m_records.size()), first.r0, first.r1, first.r7, 0 });
+
+    m_records.clear();
+}
+
+ComplexityWriter::ComplexityWriter(const std::string &filename, unsigned threadCount)
+    : m_filename(filename), m_end(sizeof(complexityMagic))
+{
+#ifdef __linux__
+    m_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Could not open " + filename);
+#else
+    m_file.open(filename, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_file)
+        throw std::runtime_error("Could not open " + filename);
+#endif
+
+    writeAt(0, reinterpret_cast<const unsigned char *>(complexityMagic), sizeof(complexityMagic));
+
+    for (unsigned i = 0; i != threadCount; ++i)
+        m_buffers.emplace_back(new Buffer(*this));
+}
+
+ComplexityWriter::~ComplexityWriter()
+{
+#ifdef __linux__
+    close(m_fd);
+#endif
+}
+
+void ComplexityWriter::finish()
+{
+    std::vector<ComplexityBlock> blocks;
+    for (auto &buffer : m_buffers)
+    {
+        buffer->flush();
+        blocks.insert(blocks.end(), buffer->m_blocks.begin(), buffer->m_blocks.end());
+        buffer->m_blocks.clear();
+    }
+
+    std::sort(blocks.begin(), blocks.end(), blockOrder);
+
+    // Align the directory, so that readers can use it in place.
+    unsigned long long directoryOffset = (m_end + 7) / 8 * 8;
+    std::vector<unsigned char> tail(directoryOffset - m_end + blocks.size() * sizeof(ComplexityBlock) + trailerBytes);
+
+    unsigned char *data = tail.data() + (directoryOffset - m_end);
+    if (!blocks.empty())
+        memcpy(data, blocks.data(), blocks.size() * sizeof(ComplexityBlock));
+    data += blocks.size() * sizeof(ComplexityBlock);
+
+    unsigned long long blockCount = blocks.size();
+    memcpy(data, &directoryOffset, sizeof(directoryOffset));
+    memcpy(data + sizeof(directoryOffset), &blockCount, sizeof(blockCount));
+    memcpy(data + 2 * sizeof(unsigned long long), complexityMagic, sizeof(complexityMagic));
+
+    append(tail.data(), tail.size());
+}
+
+unsigned long long ComplexityWriter::append(const unsigned char *data, size_t size)
+{
+    unsigned long long offset = m_end.fetch_add(size);
+    writeAt(offset, data, size);
+    return offset;
+}
+
+void ComplexityWriter::writeAt(unsigned long long offset, const unsigned char *data, size_t size)
+{
+#ifdef __linux__
+    while (size)
+    {
+        ssize_t count = pwrite(m_fd, data, size, static_cast<off_t>(offset));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            throw std::runtime_error("Could not write " + m_filename);
+
+        data += count;
+        offset += count;
+        size -= count;
+    }
+#else
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.seekp(offset);
+    if (!m_file.write(reinterpret_cast<const char *>(data), size))
+        throw std::runtime_error("Could not write " + m_filename);
+#endif
+}
+
+ComplexityReader::ComplexityReader(const std::string &filename)
+    : m_file(filename), m_blocks(nullptr), m_blockCount(0)
+{
+    const unsigned char *data = m_file.data();
+    size_t size = m_file.size();
+
+    if (size < sizeof(complexityMagic) + trailerBytes || memcmp(data, complexityMagic, sizeof(complexityMagic)) != 0
+        || memcmp(data + size - sizeof(complexityMagic), complexityMagic, sizeof(complexityMagic)) != 0)
+        throw std::runtime_error(filename + " is not a complexity file");
+
+    unsigned long long directoryOffset, blockCount;
+    memcpy(&directoryOffset, data + size - trailerBytes, sizeof(directoryOffset));
+    memcpy(&blockCount, data + size - trailerBytes + sizeof(directoryOffset), sizeof(blockCount));
+
+    if (directoryOffset % 8 != 0 || directoryOffset > size - trailerBytes || (size - trailerBytes - directoryOffset) / sizeof(ComplexityBlock) != blockCount)
+        throw std::runtime_error(filename + " has a corrupt directory");
+
+    m_blocks = reinterpret_cast<const ComplexityBlock *>(data + directoryOffset);
+    m_blockCount = static_cast<size_t>(blockCount);
+
+    for (size_t i = 0; i != m_blockCount; ++i)
+        if (m_blocks[i].offset < sizeof(complexityMagic) || m_blocks[i].offset + m_blocks[i].size > directoryOffset)
+            throw std::runtime_error(filename + " has a corrupt directory");
+}
+
+size_t ComplexityReader::recordCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i != m_blockCount; ++i)
+        count += m_blocks[i].count;
+
+    return count;
+}
+
+void ComplexityReader::decode(size_t index, ComplexityRecord *records) const
+{
+    const ComplexityBlock &block = m_blocks[index];
+    const unsigned char *data = m_file.data() + block.offset;
+    const unsigned char *end = data + block.size;
+
+    for (unsigned i = 0; i != block.count; ++i)
+    {
+        records[i].r0 = block.r0;
+        records[i].r1 = block.r1;
+        records[i].r7 = static_cast<unsigned short>(block.firstR7 + i);
+    }
+
+    for (unsigned c = 0; c != columnCount; ++c)
+    {
+        unsigned length;
+        if (end - data < static_cast<ptrdiff_t>(1 + sizeof(length)))
+            throw std::runtime_error("Corrupt complexity block");
+
+        unsigned char encoding = *data++;
+        memcpy(&length, data, sizeof(length));
+        data += sizeof(length);
+
+        if (static_cast<size_t>(end - data) < length)
+            throw std::runtime_error("Corrupt complexity block");
+
+        const unsigned char *columnEnd = data + length;
+        unsigned long long value = getVarint(data, columnEnd);
+
+        for (unsigned i = 0; i != block.count; ++i)
+        {
+            if (i != 0 && encoding == Delta)
+            {
+                unsigned long long zigzag = getVarint(data, columnEnd);
+                value += (zigzag >> 1) ^ (0 - (zigzag & 1));
+            }
+
+            setColumn(records[i], c, value);
+        }
+
+        data = columnEnd;
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FileMapping.hpp"
+
+#ifndef __linux__
+#include <fstream>
+#endif
+
+// Complexity estimate of the teleporter routine for one combination of its arguments.
+struct ComplexityRecord
+{
+    unsigned short r0;
+    unsigned short r1;
+    unsigned short r7;
+    unsigned long long recursiveIterations;
+    unsigned long long memoizedIterations;
+    unsigned long long linearIterations;
+    unsigned short result;
+};
+
+// Directory entry of a block of records with the same r0 and r1, and consecutive values of r7.
+struct ComplexityBlock
+{
+    unsigned long long offset;
+    unsigned size;
+    unsigned count;
+    unsigned short r0;
+    unsigned short r1;
+    unsigned short firstR7;
+    unsigned short reserved;
+};
+
+// Complexity files store records column by column, a block at a time:
+//   magic "SYNCPLX1"
+//   blocks:    for each of the recursive, memoized and linear counts and the result: an encoding byte, the byte length
+//              of the column (32-bit), then the column. Columns are either constant (a single varint) or delta-coded
+//              (the first value as a varint, then the zigzagged differences as varints).
+//   directory: one ComplexityBlock per block, sorted by r0, r1 and r7, 8-byte aligned.
+//   trailer:   the directory offset and block count (both 64-bit), and the magic again.
+//  All integers are in native byte order (little-endian on all supported platforms).
+
+// Streams records into a complexity file from any number of threads. Every thread fills its own buffer, and full
+//  blocks are appended to the file without locking.
+class ComplexityWriter
+{
+public:
+    static const unsigned blockSize = 1024;
+
+    class Buffer
+    {
+        friend class ComplexityWriter;
+
+        ComplexityWriter &m_writer;
+        std::vector<ComplexityRecord> m_records;
+        std::vector<ComplexityBlock> m_blocks;
+        std::vector<unsigned char> m_encoded;
+
+    public:
+        explicit Buffer(ComplexityWriter &writer);
+
+        // Adds a record, appending the current block to the file first if the record does not continue it.
+        void add(const ComplexityRecord &record);
+
+        // Appends the current block to the file.
+        void flush();
+    };
+
+    // Creates (or truncates) filename, with one buffer for each of threadCount threads.
+    ComplexityWriter(const std::string &filename, unsigned threadCount);
+    ~ComplexityWriter();
+
+    ComplexityWriter(const ComplexityWriter &) = delete;
+    ComplexityWriter &operator=(const ComplexityWriter &) = delete;
+
+    Buffer &buffer(unsigned thread)
+    {
+        return *m_buffers[thread];
+    }
+
+    // Flushes all buffers and writes the directory. Must not be called while buffers are in use.
+    void finish();
+
+private:
+    std::string m_filename;
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    std::atomic<unsigned long long> m_end;
+
+#ifdef __linux__
+    int m_fd;
+#else
+    std::mutex m_mutex;
+    std::fstream m_file;
+#endif
+
+    // Reserves space at the end of the file and writes data there. Returns its offset.
+    unsigned long long append(const unsigned char *data, size_t size);
+    void writeAt(unsigned long long offset, const unsigned char *data, size_t size);
+};
+
+// Reads a complexity file in place: the directory and columns are decoded straight from the file mapping.
+class ComplexityReader
+{
+    FileMapping m_file;
+    const ComplexityBlock *m_blocks;
+    size_t m_blockCount;
+
+public:
+    // Throws std::runtime_error if the file is not a complexity file.
+    explicit ComplexityReader(const std::string &filename);
+
+    size_t blockCount() const
+    {
+        return m_blockCount;
+    }
+
+    const ComplexityBlock &block(size_t index) const
+    {
+        return m_blocks[index];
+    }
+
+    size_t recordCount() const;
+
+    // Decodes the block's records into records, which must have room for block(index).count entries.
+    void decode(size_t index, ComplexityRecord *records) const;
+
+    // Calls f for every record, ordered by r0, r1 and r7.
+    template <typename F>
+    void forEach(F f) const
+    {
+        std::vector<ComplexityRecord> records;
+        for (size_t i = 0; i != m_blockCount; ++i)
+        {
+            records.resize(m_blocks[i].count);
+            decode(i, records.data());
+
+            for (const auto &record : records)
+                f(record);
+        }
+    }
+};
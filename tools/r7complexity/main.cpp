@@ -1,33 +1,103 @@
 #include <iostream>
-#include <array>
+#include <algorithm>
 #include <atomic>
-#include <bitset>
 #include <vector>
 #include <thread>
-#include <mutex>
 #include <fstream>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "ComplexityFile.hpp"
+#include "ShardFile.hpp"
 
 namespace
 {
-    struct ComplexityData
+    // Per-thread state of the simulators, allocated once and reused for every r7.
+    //  The simulators walk the call tree with an explicit stack instead of recursing (which needed a 100 MB stack),
+    //  and remember which entries they touched, so that only those need to be cleared for the next r7.
+    //  All tables are indexed by r0 << 15 | r1, for r0 up to the largest one simulated.
+    struct Simulation
     {
-        unsigned long long recursiveIterations;
-        unsigned long long memoizedIterations;
-        unsigned long long linearIterations;
-        unsigned short result;
+        std::vector<unsigned short> table;
+        std::vector<unsigned long long> counts;
+        std::vector<unsigned char> hits;
+        std::vector<unsigned short> reach;
+        std::vector<unsigned> stack;
+        std::vector<unsigned> touched;
+
+        explicit Simulation(unsigned maxR0 = 4)
+            : table((maxR0 + 1) << 15), counts(table.size()), hits(table.size())
+        {
+            // Every entry is pushed at most twice, and touched at most twice (once per simulator).
+            stack.reserve(2 * table.size());
+            touched.reserve(2 * table.size());
+        }
+
+        void reset()
+        {
+            for (unsigned idx : touched)
+            {
+                counts[idx] = 0;
+                hits[idx] = 0;
+            }
+
+            touched.clear();
+        }
+    };
+
+    // Range of arguments covered by a surface: every r0 <= maxR0 and r1 <= maxR1.
+    struct Surface
+    {
+        unsigned maxR0;
+        unsigned maxR1;
+
+        // Number of (r0, r1) combinations, each of which forms a separate series of records over r7.
+        unsigned series() const
+        {
+            return (maxR0 + 1) * (maxR1 + 1);
+        }
     };
 
-    std::array<ComplexityData, 32768> complexityArray;
+    // Every row of the table takes about 400 KiB per thread.
+    const unsigned maxSurfaceR0 = 32;
 
-    std::mutex arrayMutex;
-    std::atomic<unsigned short> nextNumber(0);
+    // Records of a surface every thread holds before writing them out (about 80 MiB). Surfaces with many series write
+    //  shorter blocks to stay within it, down to minSurfaceRun values of r7 per block, which keeps the block directory
+    //  (held in memory until the file is finished) under 32 MiB. Larger surfaces are rejected.
+    const unsigned surfaceRecordBudget = 1 << 21;
+    const unsigned minSurfaceRun = 256;
+    const unsigned maxSurfaceSeries = surfaceRecordBudget / minSurfaceRun;
 
-    using AnswerTable = std::array<unsigned short, 32768 * 4 + 2>;
-    using RecursionTable = std::array<unsigned long long, 32768 * 4 + 2>;
-    using MemoizationTable = std::bitset<32768 * 4 + 2>;
+    // Shard records hold the three iteration counts (64-bit) followed by the result (16-bit).
+    const char shardKind[] = "r7cmplx";
+    const unsigned recordSize = 3 * sizeof(unsigned long long) + sizeof(unsigned short);
+
+    void packRecord(const ComplexityRecord &data, unsigned char *record)
+    {
+        memcpy(record, &data.recursiveIterations, 8);
+        memcpy(record + 8, &data.memoizedIterations, 8);
+        memcpy(record + 16, &data.linearIterations, 8);
+        memcpy(record + 24, &data.result, 2);
+    }
+
+    ComplexityRecord unpackRecord(unsigned short r7, const unsigned char *record)
+    {
+        ComplexityRecord data = {};
+        data.r0 = 4;
+        data.r1 = 1;
+        data.r7 = r7;
+        memcpy(&data.recursiveIterations, record, 8);
+        memcpy(&data.memoizedIterations, record + 8, 8);
+        memcpy(&data.linearIterations, record + 16, 8);
+        memcpy(&data.result, record + 24, 2);
+        return data;
+    }
 }
 
-auto buildTable(unsigned short r0, unsigned short r1, unsigned short r7, AnswerTable &table)
+void buildTable(unsigned short r0, unsigned short r1, unsigned short r7, std::vector<unsigned short> &table)
 {
     for (unsigned i = 0, n = 32768; i != n; ++i)
         table[i] = (i + 1) % 32768;
@@ -38,40 +108,101 @@ auto buildTable(unsigned short r0, unsigned short r1, unsigned short r7, AnswerT
         for (unsigned j = 1, m = i == r0 ? r1 + 1 : 32768; j != m; ++j)
             table[i << 15 | j] = table[(i - 1) << 15 | table[i << 15 | (j - 1)]];
     }
-
-    return table;
 }
 
-unsigned long long simulateRecursive(unsigned short r0, unsigned short r1, unsigned short r7, const AnswerTable &table, RecursionTable &counts)
+// Counts the calls made by the recursive routine, with counts[idx] memoizing the count for a call.
+//  A frame stays on the stack until the counts for all of its callees are known.
+unsigned long long simulateRecursive(unsigned short r0, unsigned short r1, unsigned short r7, Simulation &sim)
 {
-    size_t idx = r0 << 15 | r1;
-    if (counts[idx])
-        return counts[idx];
+    auto &counts = sim.counts;
+    auto &stack = sim.stack;
 
-    if (r0 == 0)
-        return counts[idx] = 1;
+    stack.clear();
+    stack.push_back(r0 << 15 | r1);
 
-    if (r1 == 0)
-        return counts[idx] = 1 + simulateRecursive(r0 - 1, r7, r7, table, counts);
+    while (!stack.empty())
+    {
+        unsigned idx = stack.back();
+        if (counts[idx])
+        {
+            stack.pop_back();
+            continue;
+        }
 
-    return counts[idx] = 1 + simulateRecursive(r0, r1 - 1, r7, table, counts) + simulateRecursive(r0 - 1, table[r0 << 15 | (r1 - 1)], r7, table, counts);
+        unsigned i = idx >> 15, j = idx & 0x7FFF;
+        unsigned long long count = 1;
+
+        if (i != 0 && j == 0)
+        {
+            unsigned callee = (i - 1) << 15 | r7;
+            if (!counts[callee])
+            {
+                stack.push_back(callee);
+                continue;
+            }
+
+            count += counts[callee];
+        }
+        else if (i != 0)
+        {
+            unsigned first = idx - 1, second = (i - 1) << 15 | sim.table[idx - 1];
+            if (!counts[first] || !counts[second])
+            {
+                if (!counts[second])
+                    stack.push_back(second);
+                if (!counts[first])
+                    stack.push_back(first);
+                continue;
+            }
+
+            count += counts[first] + counts[second];
+        }
+
+        counts[idx] = count;
+        sim.touched.push_back(idx);
+        stack.pop_back();
+    }
+
+    return counts[r0 << 15 | r1];
 }
 
-unsigned long long simulateMemoized(unsigned short r0, unsigned short r1, unsigned short r7, const AnswerTable &table, MemoizationTable &hits)
+// Counts the calls made by the routine if it memoized its results: every call returns immediately if the same
+//  arguments were seen before.
+unsigned long long simulateMemoized(unsigned short r0, unsigned short r1, unsigned short r7, Simulation &sim)
 {
-    size_t idx = r0 << 15 | r1;
-    if (hits[idx])
-        return 1;
+    auto &hits = sim.hits;
+    auto &stack = sim.stack;
 
-    hits[idx] = true;
+    unsigned long long calls = 0;
+    stack.clear();
+    stack.push_back(r0 << 15 | r1);
 
-    if (r0 == 0)
-        return 1;
+    while (!stack.empty())
+    {
+        unsigned idx = stack.back();
+        stack.pop_back();
+        ++calls;
+
+        if (hits[idx])
+            continue;
+
+        hits[idx] = 1;
+        sim.touched.push_back(idx);
 
-    if (r1 == 0)
-        return 1 + simulateMemoized(r0 - 1, r7, r7, table, hits);
+        unsigned i = idx >> 15, j = idx & 0x7FFF;
+        if (i == 0)
+            continue;
 
-    return 1 + simulateMemoized(r0, r1 - 1, r7, table, hits) + simulateMemoized(r0 - 1, table[r0 << 15 | (r1 - 1)], r7, table, hits);
+        if (j == 0)
+            stack.push_back((i - 1) << 15 | r7);
+        else
+        {
+            stack.push_back((i - 1) << 15 | sim.table[idx - 1]);
+            stack.push_back(idx - 1);
+        }
+    }
+
+    return calls;
 }
 
 unsigned long long simulateLinear(unsigned short r0, unsigned short r1)
@@ -79,50 +210,151 @@ unsigned long long simulateLinear(unsigned short r0, unsigned short r1)
     return r0 * 32768 + r1 + 1;
 }
 
-int main(int argc, char **argv)
+ComplexityRecord estimate(unsigned short r7, Simulation &sim)
 {
-    std::cout << "Synacor Challenge R7 (teleporter) complexity estimator" << std::endl;
+    buildTable(4, 1, r7, sim.table);
+    auto recursive = simulateRecursive(4, 1, r7, sim);
+    auto memoized = simulateMemoized(4, 1, r7, sim);
+    auto linear = simulateLinear(4, 1);
+
+    sim.reset();
 
-    if (argc < 2)
+    return { 4, 1, r7, recursive, memoized, linear, sim.table[4 << 15 | 1] };
+}
+
+// Estimates the complexity for every argument in surface for one r7, and calls emit with each record.
+//  All arguments share one table. The recursive counts are memoized per argument, so simulating from (r0, maxR1)
+//  for each r0 yields every count in the row, and lower rows are reused rather than simulated again.
+//  The memoized counts need no simulation at all: the arguments reachable from (r0, r1) are r1 and below in row r0,
+//  and in every lower row i - 1 they are those up to the largest callee of [0, b] in row i, i.e. up to
+//  reach[i][b] = max(r7, table[i][0 .. b - 1]). Every reachable argument in a row above 0 is called once by its
+//  caller and makes one call (r1 = 0) or two, so a row reaching up to b contributes 1 + 2 * b calls.
+template <typename F>
+void estimateSurface(unsigned short r7, const Surface &surface, Simulation &sim, F emit)
+{
+    buildTable(static_cast<unsigned short>(surface.maxR0), 32767, r7, sim.table);
+
+    for (unsigned r0 = 0; r0 <= surface.maxR0; ++r0)
+        simulateRecursive(static_cast<unsigned short>(r0), static_cast<unsigned short>(surface.maxR1), r7, sim);
+
+    auto &reach = sim.reach;
+    reach.resize(sim.table.size());
+    for (unsigned i = 1; i <= surface.maxR0; ++i)
     {
-        std::cout << "Usage: " << argv[0] << " <output file>" << std::endl;
+        reach[i << 15] = r7;
+        for (unsigned b = 1; b != 32768; ++b)
+            reach[i << 15 | b] = std::max(reach[i << 15 | (b - 1)], sim.table[i << 15 | (b - 1)]);
+    }
+
+    for (unsigned r0 = 0; r0 <= surface.maxR0; ++r0)
+        for (unsigned r1 = 0; r1 <= surface.maxR1; ++r1)
+        {
+            unsigned long long memoized = 1;
+            for (unsigned i = r0, b = r1; i != 0; b = reach[i << 15 | b], --i)
+                memoized += 1 + 2ull * b;
+
+            unsigned idx = r0 << 15 | r1;
+            emit(ComplexityRecord { static_cast<unsigned short>(r0), static_cast<unsigned short>(r1), r7,
+                sim.counts[idx], memoized, simulateLinear(static_cast<unsigned short>(r0), static_cast<unsigned short>(r1)), sim.table[idx] });
+        }
+
+    sim.reset();
+}
+
+int exportCsv(const std::string &input, const std::string &output)
+{
+    ComplexityReader reader(input);
+
+    std::ofstream ofs(output);
+    if (!ofs)
+    {
+        std::cout << "Could not open output file" << std::endl;
         return 1;
     }
 
-    std::cout << "Estimating complexity..." << std::endl;
+    // Files holding more than the challenge's arguments get columns for r0 and r1.
+    bool surface = false;
+    for (size_t i = 0; i != reader.blockCount(); ++i)
+        surface |= reader.block(i).r0 != 4 || reader.block(i).r1 != 1;
+
+    ofs << (surface ? "r0,r1," : "") << "r7,recursive,memoized,linear,result\n";
+
+    reader.forEach([&](const ComplexityRecord &entry)
+    {
+        if (surface)
+            ofs << entry.r0 << ',' << entry.r1 << ',';
+
+        ofs << entry.r7 << ',' << entry.recursiveIterations << ',' << entry.memoizedIterations << ',' << entry.linearIterations << ',' << entry.result << '\n';
+    });
+
+    ofs.close();
+
+    std::cout << reader.recordCount() << " records exported to " << output << std::endl;
+    return 0;
+}
+
+int finishOutput(ComplexityWriter &writer, const std::string &output, const std::string &csv)
+{
+    writer.finish();
+    std::cout << "Complexity data saved to " << output << std::endl;
+
+    return csv.empty() ? 0 : exportCsv(output, csv);
+}
+
+// Estimates the complexity for every r7 value, either for the challenge's arguments or for every argument in a
+//  surface. Every thread claims a run of values at a time and streams the results through its own buffer. For a
+//  surface, the records of a run are collected first, and then written series by series, one block per series.
+int runFull(const std::string &output, const Surface *surface, unsigned threadCount, const std::string &csv)
+{
+    unsigned series = surface ? surface->series() : 1;
+    unsigned runLength = std::min(ComplexityWriter::blockSize, surfaceRecordBudget / series);
+    ComplexityWriter writer(output, threadCount);
+
+    std::atomic<unsigned> nextRun(0);
+    std::atomic<unsigned> finished(0);
+    const unsigned runs = (32768 + runLength - 1) / runLength;
+
+    std::cout << "Estimating complexity";
+    if (surface)
+        std::cout << " for r0 up to " << surface->maxR0 << " and r1 up to " << surface->maxR1;
+    std::cout << "..." << std::endl;
+
     std::vector<std::thread> threads;
-    for (size_t i = 0, n = std::thread::hardware_concurrency(); i != n; ++i)
+    for (unsigned i = 0; i != threadCount; ++i)
     {
-        threads.emplace_back([]()
+        threads.emplace_back([&, i]()
         {
-            AnswerTable table;
-            RecursionTable counts;
-            MemoizationTable hits;
+            Simulation sim(surface ? surface->maxR0 : 4);
+            std::vector<ComplexityRecord> records(surface ? series * runLength : 0);
 
-            while (true)
+            for (unsigned run; (run = nextRun++) < runs; )
             {
-                unsigned short num = nextNumber++;
-                if (num > 32767)
-                    break;
-
-                counts.fill(0);
-                hits.reset();
-
-                buildTable(4, 1, num, table);
-                auto recursive = simulateRecursive(4, 1, num, table, counts);
-                auto memoized = simulateMemoized(4, 1, num, table, hits);
-                auto linear = simulateLinear(4, 1);
-               
-                std::lock_guard<std::mutex> guard(arrayMutex);
-                complexityArray[num] = { recursive, memoized, linear, table[4 << 15 | 1] };
+                unsigned first = run * runLength, end = std::min(first + runLength, 32768u);
+                for (unsigned r7 = first; r7 != end; ++r7, ++finished)
+                {
+                    if (!surface)
+                    {
+                        writer.buffer(i).add(estimate(static_cast<unsigned short>(r7), sim));
+                        continue;
+                    }
+
+                    estimateSurface(static_cast<unsigned short>(r7), *surface, sim, [&](const ComplexityRecord &record)
+                    {
+                        records[(record.r0 * (surface->maxR1 + 1) + record.r1) * runLength + (r7 - first)] = record;
+                    });
+                }
+
+                for (unsigned s = 0; surface && s != series; ++s)
+                    for (unsigned r7 = first; r7 != end; ++r7)
+                        writer.buffer(i).add(records[s * runLength + (r7 - first)]);
             }
         });
     }
 
-    while (nextNumber < 32768)
+    while (finished < 32768)
     {
-        std::cout << '\r' << nextNumber << " / 32767";
-        std::this_thread::yield();
+        std::cout << '\r' << finished << " / 32768" << std::flush;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
     }
 
     for (auto &thread : threads)
@@ -130,22 +362,159 @@ int main(int argc, char **argv)
 
     std::cout << "\rDone.                " << std::endl;
 
-    std::ofstream ofs(argv[1]);
-    if (!ofs)
+    return finishOutput(writer, output, csv);
+}
+
+// Estimates the complexity for one shard of the r7 values, checkpointing the records to a shard file every few seconds.
+//  An interrupted shard resumes from its last checkpoint.
+int runShard(const std::string &filename, const ShardFile::Shard &shard, unsigned threadCount)
+{
+    ShardFile file = ShardFile::create(filename, { shardKind, { 4, 1, 0, 0 }, recordSize }, shard);
+
+    const unsigned firstChunk = shard.begin() / ShardFile::chunkSize, lastChunk = shard.end() / ShardFile::chunkSize;
+    std::atomic<unsigned> nextChunk(firstChunk);
+    std::atomic<unsigned> finishedChunks(0);
+
+    std::cout << "Estimating complexity for shard " << shard.index << '/' << shard.count << " (r7 " << shard.begin() << " to " << shard.end() - 1 << ")";
+    if (file.completedChunks())
+        std::cout << ", resuming with " << file.completedChunks() << " / " << lastChunk - firstChunk << " chunks done";
+    std::cout << "..." << std::endl;
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i != threadCount; ++i)
     {
-        std::cout << "Could not open output file" << std::endl;
+        threads.emplace_back([&]()
+        {
+            Simulation sim;
+            unsigned char records[ShardFile::chunkSize * recordSize];
+
+            for (unsigned chunk; (chunk = nextChunk++) < lastChunk; ++finishedChunks)
+            {
+                if (file.chunkComplete(chunk))
+                    continue;
+
+                for (unsigned j = 0; j != ShardFile::chunkSize; ++j)
+                    packRecord(estimate(static_cast<unsigned short>(chunk * ShardFile::chunkSize + j), sim), records + j * recordSize);
+
+                file.storeChunk(chunk, records);
+            }
+        });
+    }
+
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    while (finishedChunks < lastChunk - firstChunk)
+    {
+        std::cout << '\r' << finishedChunks << " / " << lastChunk - firstChunk << " chunks" << std::flush;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        if (std::chrono::steady_clock::now() - lastCheckpoint > std::chrono::seconds(5))
+        {
+            file.checkpoint();
+            lastCheckpoint = std::chrono::steady_clock::now();
+        }
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    file.checkpoint();
+
+    std::cout << "\rDone.                " << std::endl;
+    std::cout << "Shard saved to " << filename << std::endl;
+    return 0;
+}
+
+// Combines a complete set of shards into the output file.
+int runMerge(const std::string &output, const std::vector<std::string> &filenames, const std::string &csv)
+{
+    std::vector<ShardFile> shards;
+    for (const auto &filename : filenames)
+        shards.push_back(ShardFile::open(filename));
+
+    shards = ShardFile::completeSet(std::move(shards));
+
+    const auto &description = shards.front().description();
+    if (description.kind != shardKind || description.recordSize != recordSize)
+    {
+        std::cout << "The shards do not hold complexity data" << std::endl;
         return 1;
     }
 
-    ofs << "r7,recursive,memoized,linear,result\n";
+    ComplexityWriter writer(output, 1);
+    for (const auto &shard : shards)
+        for (unsigned r7 = shard.shard().begin(); r7 != shard.shard().end(); ++r7)
+            writer.buffer(0).add(unpackRecord(static_cast<unsigned short>(r7), shard.record(r7)));
+
+    std::cout << "Merged " << shards.size() << " shards" << std::endl;
+    return finishOutput(writer, output, csv);
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Synacor Challenge R7 (teleporter) complexity estimator" << std::endl;
+
+    std::vector<std::string> args;
+    std::string csv, shard;
+    std::unique_ptr<Surface> surface;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--threads" || arg == "--surface" || arg == "--csv" || arg == "--shard") && i + 1 == argc)
+        {
+            std::cout << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+
+        if (arg == "--threads")
+            threadCount = std::max(1, atoi(argv[++i]));
+        else if (arg == "--surface")
+        {
+            unsigned maxR0, maxR1;
+            if (sscanf(argv[++i], "%u,%u", &maxR0, &maxR1) != 2 || maxR0 > maxSurfaceR0 || maxR1 > 32767)
+            {
+                std::cout << "Surfaces are given as <max r0>,<max r1>, with r0 up to " << maxSurfaceR0 << std::endl;
+                return 1;
+            }
 
-    for (size_t i = 0; i != 32768; ++i)
+            if ((maxR0 + 1) * (maxR1 + 1) > maxSurfaceSeries)
+            {
+                std::cout << "Surfaces cover at most " << maxSurfaceSeries << " combinations of r0 and r1" << std::endl;
+                return 1;
+            }
+
+            surface.reset(new Surface { maxR0, maxR1 });
+        }
+        else if (arg == "--csv")
+            csv = argv[++i];
+        else if (arg == "--shard")
+            shard = argv[++i];
+        else
+            args.push_back(arg);
+    }
+
+    if (args.empty() || (surface && !shard.empty()) || (args[0] == "merge" && args.size() < 3) || (args[0] == "export" && args.size() != 3) || (args[0] != "merge" && args[0] != "export" && args.size() != 1))
     {
-        const auto &entry = complexityArray[i];
-        ofs << i << ',' << entry.recursiveIterations << ',' << entry.memoizedIterations << ',' << entry.linearIterations << ',' << entry.result << '\n';
+        std::cout << "Usage: " << argv[0] << " <output file> [--csv <file>] [--shard <i>/<n> | --surface <max r0>,<max r1>] [--threads <count>]" << std::endl;
+        std::cout << "       " << argv[0] << " merge <output file> <shard>... [--csv <file>]" << std::endl;
+        std::cout << "       " << argv[0] << " export <complexity file> <csv file>" << std::endl;
+        return 1;
     }
 
-    ofs.close();
+    try
+    {
+        if (args[0] == "export")
+            return exportCsv(args[1], args[2]);
+        if (args[0] == "merge")
+            return runMerge(args[1], std::vector<std::string>(args.begin() + 2, args.end()), csv);
+        if (!shard.empty())
+            return runShard(args[0], ShardFile::Shard::parse(shard), threadCount);
 
-    std::cout << "Complexity data saved to " << argv[1] << std::endl;
+        return runFull(args[0], surface.get(), threadCount, csv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 }
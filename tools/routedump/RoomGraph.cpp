@@ -0,0 +1,270 @@
+#include "RoomGraph.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "FileMapping.hpp"
+
+namespace
+{
+    const char routeMagic[8] = { 'S', 'Y', 'N', 'R', 'O', 'U', 'T', '1' };
+
+    struct RouteHeader
+    {
+        char magic[8];
+        unsigned roomCount;
+        unsigned exitCount;
+        unsigned arenaSize;
+        unsigned reserved;
+    };
+
+    bool equalsIgnoreCase(const std::string &a, const char *b)
+    {
+        size_t i = 0;
+        for (; i != a.size() && b[i]; ++i)
+            if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+                return false;
+
+        return i == a.size() && !b[i];
+    }
+
+    template <typename T>
+    void writeArray(std::ofstream &os, const std::vector<T> &values)
+    {
+        os.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    void readArray(const unsigned char *&data, const unsigned char *end, std::vector<T> &values, size_t count)
+    {
+        if (static_cast<size_t>(end - data) / sizeof(T) < count)
+            throw std::runtime_error("Route file is truncated");
+
+        values.resize(count);
+        if (count)
+            memcpy(values.data(), data, count * sizeof(T));
+        data += count * sizeof(T);
+    }
+}
+
+const ushort RouteTable::noRoute;
+
+RoomGraph RoomGraph::build(const GameData &data, ushort startRoomId)
+{
+    RoomGraph graph;
+    std::unordered_map<std::string, unsigned> interned;
+    std::vector<unsigned> indices(65536, ~0u);
+    std::vector<const GameData::Room *> rooms;
+
+    auto intern = [&](const std::string &name)
+    {
+        auto it = interned.find(name);
+        if (it != interned.end())
+            return it->second;
+
+        unsigned offset = static_cast<unsigned>(graph.m_arena.size());
+        graph.m_arena.append(name.c_str(), name.size() + 1);
+        interned.emplace(name, offset);
+        return offset;
+    };
+
+    auto visit = [&](ushort roomId)
+    {
+        unsigned &index = indices[roomId];
+        if (index != ~0u)
+            return false;
+
+        size_t room = data.findRoom(roomId);
+        if (room == data.rooms.size())
+            throw std::runtime_error("There is no room at " + std::to_string(roomId));
+
+        index = static_cast<unsigned>(rooms.size());
+        rooms.push_back(&data.rooms[room]);
+        return true;
+    };
+
+    // Depth-first, in the order of the exits, with an explicit stack of (room, next exit).
+    std::vector<std::pair<unsigned, unsigned>> stack;
+    auto explore = [&](ushort roomId)
+    {
+        if (!visit(roomId))
+            return;
+
+        stack.emplace_back(static_cast<unsigned>(rooms.size() - 1), 0);
+        while (!stack.empty())
+        {
+            const GameData::Room &room = *rooms[stack.back().first];
+            unsigned &exit = stack.back().second;
+
+            if (exit == room.exits.size())
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            if (visit(room.exits[exit++].destination))
+                stack.emplace_back(static_cast<unsigned>(rooms.size() - 1), 0);
+        }
+    };
+
+    explore(startRoomId);
+    for (const auto &room : data.rooms)
+        explore(room.address);
+
+    for (const GameData::Room *room : rooms)
+    {
+        graph.m_roomIds.push_back(room->address);
+        graph.m_roomNames.push_back(intern(room->name));
+        graph.m_firstExits.push_back(static_cast<unsigned>(graph.m_exitTargets.size()));
+
+        for (const auto &exit : room->exits)
+        {
+            graph.m_exitTargets.push_back(indices[exit.destination]);
+            graph.m_exitNames.push_back(intern(exit.name));
+        }
+    }
+
+    graph.m_firstExits.push_back(static_cast<unsigned>(graph.m_exitTargets.size()));
+    return graph;
+}
+
+size_t RoomGraph::findRoom(ushort roomId) const
+{
+    return std::find(m_roomIds.begin(), m_roomIds.end(), roomId) - m_roomIds.begin();
+}
+
+std::vector<size_t> RoomGraph::findRooms(const std::string &name) const
+{
+    std::vector<size_t> rooms;
+    for (size_t room = 0; room != roomCount(); ++room)
+        if (equalsIgnoreCase(name, roomName(room)))
+            rooms.push_back(room);
+
+    return rooms;
+}
+
+RouteTable::RouteTable(RoomGraph graph)
+    : m_graph(std::move(graph))
+{
+    const size_t n = m_graph.roomCount();
+    m_nextExits.assign(n * n, noRoute);
+    m_distances.assign(n * n, noRoute);
+
+    std::vector<size_t> queue;
+    for (size_t source = 0; source != n; ++source)
+    {
+        ushort *nextExits = &m_nextExits[source * n];
+        ushort *distances = &m_distances[source * n];
+
+        distances[source] = 0;
+        queue.assign(1, source);
+
+        // Every room inherits the first exit taken towards it.
+        for (size_t i = 0; i != queue.size(); ++i)
+        {
+            size_t room = queue[i];
+            for (unsigned exit = m_graph.firstExit(room); exit != m_graph.firstExit(room + 1); ++exit)
+            {
+                size_t target = m_graph.exitTarget(exit);
+                if (distances[target] != noRoute)
+                    continue;
+
+                distances[target] = static_cast<ushort>(distances[room] + 1);
+                nextExits[target] = room == source ? static_cast<ushort>(exit - m_graph.firstExit(room)) : nextExits[room];
+                queue.push_back(target);
+            }
+        }
+    }
+}
+
+RouteTable RouteTable::load(const std::string &filename)
+{
+    FileMapping file(filename);
+    const unsigned char *data = file.data(), *end = data + file.size();
+
+    RouteHeader header;
+    if (file.size() >= sizeof(header))
+        memcpy(&header, data, sizeof(header));
+    if (file.size() < sizeof(header) || memcmp(header.magic, routeMagic, sizeof(routeMagic)) != 0)
+        throw std::runtime_error(filename + " is not a route file");
+
+    data += sizeof(header);
+
+    RouteTable table;
+    RoomGraph &graph = table.m_graph;
+    const size_t n = header.roomCount;
+
+    readArray(data, end, graph.m_roomNames, n);
+    readArray(data, end, graph.m_firstExits, n + 1);
+    readArray(data, end, graph.m_exitTargets, header.exitCount);
+    readArray(data, end, graph.m_exitNames, header.exitCount);
+    readArray(data, end, graph.m_roomIds, n);
+
+    std::vector<char> arena;
+    readArray(data, end, arena, header.arenaSize);
+    graph.m_arena.assign(arena.begin(), arena.end());
+
+    readArray(data, end, table.m_nextExits, n * n);
+    readArray(data, end, table.m_distances, n * n);
+
+    // Validate everything used as an index.
+    bool valid = n != 0 && data == end && !arena.empty() && arena.back() == '\0' && graph.m_firstExits.front() == 0 && graph.m_firstExits.back() == header.exitCount;
+    for (size_t room = 0; valid && room != n; ++room)
+        valid = graph.m_roomNames[room] < arena.size() && graph.m_firstExits[room] <= graph.m_firstExits[room + 1];
+    for (size_t exit = 0; valid && exit != header.exitCount; ++exit)
+        valid = graph.m_exitTargets[exit] < n && graph.m_exitNames[exit] < arena.size();
+    for (size_t i = 0; valid && i != n * n; ++i)
+        valid = table.m_nextExits[i] == noRoute || table.m_nextExits[i] < graph.m_firstExits[i / n + 1] - graph.m_firstExits[i / n];
+
+    if (!valid)
+        throw std::runtime_error(filename + " is corrupt");
+
+    return table;
+}
+
+void RouteTable::save(const std::string &filename) const
+{
+    std::ofstream os(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!os)
+        throw std::runtime_error("Could not open " + filename);
+
+    RouteHeader header = {};
+    memcpy(header.magic, routeMagic, sizeof(routeMagic));
+    header.roomCount = static_cast<unsigned>(m_graph.roomCount());
+    header.exitCount = static_cast<unsigned>(m_graph.exitCount());
+    header.arenaSize = static_cast<unsigned>(m_graph.m_arena.size());
+
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeArray(os, m_graph.m_roomNames);
+    writeArray(os, m_graph.m_firstExits);
+    writeArray(os, m_graph.m_exitTargets);
+    writeArray(os, m_graph.m_exitNames);
+    writeArray(os, m_graph.m_roomIds);
+    os.write(m_graph.m_arena.data(), m_graph.m_arena.size());
+    writeArray(os, m_nextExits);
+    writeArray(os, m_distances);
+
+    if (!os.flush())
+        throw std::runtime_error("Could not write " + filename);
+}
+
+std::vector<unsigned> RouteTable::route(size_t from, size_t to) const
+{
+    std::vector<unsigned> exits;
+    if (m_nextExits[from * m_graph.roomCount() + to] == noRoute)
+        return exits;
+
+    for (size_t room = from; room != to; )
+    {
+        if (exits.size() == m_graph.roomCount())
+            throw std::runtime_error("Route table is inconsistent");
+
+        unsigned exit = m_graph.firstExit(room) + m_nextExits[room * m_graph.roomCount() + to];
+        exits.push_back(exit);
+        room = m_graph.exitTarget(exit);
+    }
+
+    return exits;
+}
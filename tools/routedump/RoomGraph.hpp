@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "GameData.hpp"
+
+using ushort = unsigned short;
+
+// All rooms of the game, stored compactly: rooms in a flat array in the order they were found, exits
+//  in compressed sparse rows (the exits of room r are firstExit(r) up to firstExit(r + 1)) pointing at room indices,
+//  and all names interned in a single string arena.
+class RoomGraph
+{
+    friend class RouteTable;
+
+    std::vector<ushort> m_roomIds;          // Address of each room.
+    std::vector<unsigned> m_roomNames;      // Arena offset of each room's name.
+    std::vector<unsigned> m_firstExits;     // Room count + 1 entries.
+    std::vector<unsigned> m_exitTargets;    // Room index.
+    std::vector<unsigned> m_exitNames;      // Arena offset.
+    std::string m_arena;                    // Zero-terminated strings.
+
+public:
+    // Builds the graph of all rooms in data, in depth-first order: first the rooms reachable from startRoomId, then
+    //  those reachable from each room not found yet (e.g. rooms only reached by using an item).
+    static RoomGraph build(const GameData &data, ushort startRoomId);
+
+    size_t roomCount() const
+    {
+        return m_roomIds.size();
+    }
+
+    size_t exitCount() const
+    {
+        return m_exitTargets.size();
+    }
+
+    ushort roomId(size_t room) const
+    {
+        return m_roomIds[room];
+    }
+
+    const char *roomName(size_t room) const
+    {
+        return m_arena.c_str() + m_roomNames[room];
+    }
+
+    unsigned firstExit(size_t room) const
+    {
+        return m_firstExits[room];
+    }
+
+    size_t exitTarget(unsigned exit) const
+    {
+        return m_exitTargets[exit];
+    }
+
+    const char *exitName(unsigned exit) const
+    {
+        return m_arena.c_str() + m_exitNames[exit];
+    }
+
+    // Returns the index of the room at the specified address, or roomCount() if there is none.
+    size_t findRoom(ushort roomId) const;
+
+    // Returns the indices of all rooms with the specified name, ignoring case.
+    std::vector<size_t> findRooms(const std::string &name) const;
+};
+
+// Shortest routes between all pairs of rooms: for every room and destination, the exit to take next (as an index
+//  among the room's exits) and the number of steps left. Exits are assumed to always be passable.
+//
+// Route files hold the graph and the table:
+//   header:     magic "SYNROUT1", room count, exit count and arena size (32-bit), 4 reserved bytes
+//   graph:      room names, first exits (room count + 1), exit targets and exit names (32-bit),
+//               room ids (16-bit), then the arena
+//   table:      next exits, then distances (16-bit), both indexed by room * room count + destination.
+//               Unreachable destinations have noRoute in both.
+//  All integers are in native byte order (little-endian on all supported platforms).
+class RouteTable
+{
+    RoomGraph m_graph;
+    std::vector<ushort> m_nextExits;
+    std::vector<ushort> m_distances;
+
+public:
+    static const ushort noRoute = 0xFFFF;
+
+    // Computes the routes with a breadth-first search from every room.
+    explicit RouteTable(RoomGraph graph);
+
+    // Throws std::runtime_error if the file is not a valid route file.
+    static RouteTable load(const std::string &filename);
+
+    void save(const std::string &filename) const;
+
+    const RoomGraph &graph() const
+    {
+        return m_graph;
+    }
+
+    ushort distance(size_t from, size_t to) const
+    {
+        return m_distances[from * m_graph.roomCount() + to];
+    }
+
+    // Returns the exits along a shortest route, or nothing if from is to or there is no route.
+    std::vector<unsigned> route(size_t from, size_t to) const;
+
+private:
+    RouteTable() = default;
+};
@@ -1,173 +1,174 @@
 #include <iostream>
-#include <array>
 #include <fstream>
 #include <string>
 #include <vector>
-#include <set>
+#include "RoomGraph.hpp"
+#include "MemoryImage.hpp"
 
-class SynacorBinary
+// Finds a room by address (e.g. 2317 or 0x90d) or by name, which has to be unambiguous.
+size_t findRoom(const RoomGraph &graph, const std::string &room)
 {
-    std::array<unsigned short, 32768> m_memory;
-public:
-
-    explicit SynacorBinary(const std::string &filename)
+    size_t length = 0;
+    try
     {
-        std::ifstream fi(filename, std::ios::in | std::ios::binary);
-        if (!fi)
-            throw std::runtime_error("Could not open binary");
-
-        unsigned short address = 0;
+        unsigned long roomId = std::stoul(room, &length, 0);
+        if (length == room.size())
+        {
+            size_t index = roomId <= 0xFFFF ? graph.findRoom(static_cast<ushort>(roomId)) : graph.roomCount();
+            if (index == graph.roomCount())
+                throw std::runtime_error("There is no room at " + room);
 
-        // TODO: Endianness
-        while (fi && address < 32768)
-            fi.read(reinterpret_cast<char *>(&m_memory[address++]), 2);
+            return index;
+        }
     }
-
-    unsigned short read(unsigned short address) const
+    catch (std::invalid_argument &)
     {
-        return m_memory.at(address);
     }
-
-    std::string readString(unsigned short address) const
+    catch (std::out_of_range &)
     {
-        std::string ret;
-        unsigned short len = read(address);
-
-        ret.reserve(len);
-
-        while (len--)
-            ret += static_cast<char>(read(++address));
-        
-        return ret;
+        throw std::runtime_error("There is no room at " + room);
     }
-};
-
-class RoomTracer
-{
-public:
-    using ExitVector = std::vector<std::pair<std::string, unsigned short>>;
-    struct Room
-    {
-        unsigned short roomId;
-        std::string roomName;
-        ExitVector exits;
 
-        explicit Room(unsigned short id)
-            : roomId(id)
-        {}
-    };
+    std::vector<size_t> rooms = graph.findRooms(room);
+    if (rooms.empty())
+        throw std::runtime_error("There is no room named '" + room + "'");
 
-    explicit RoomTracer(const SynacorBinary &binary)
-        : m_binary(binary)
-    {}
-
-    std::vector<Room> traceRooms(unsigned short startRoomId) const
+    if (rooms.size() > 1)
     {
-        std::vector<Room> rooms;
-        std::set<unsigned short> visited;
-
-        traceRooms(startRoomId, rooms, visited);
+        std::string ids;
+        for (size_t index : rooms)
+            ids += " " + std::to_string(graph.roomId(index));
 
-        return rooms;
+        throw std::runtime_error("There are several rooms named '" + room + "', use one of their addresses:" + ids);
     }
 
-private:
+    return rooms.front();
+}
 
-    const SynacorBinary &m_binary;
+int dumpRoutes(const std::string &binaryFile, bool boot, ushort startAddress, const std::string &output, const std::string &routes, const std::string &database)
+{
+    GameData data = boot ? GameData::extract(binaryFile, startAddress) : GameData::read(MemoryImage(binaryFile).data(), startAddress);
+    RoomGraph graph = RoomGraph::build(data, startAddress);
 
-    std::string getRoomName(unsigned short roomId) const
+    if (!database.empty())
     {
-        return m_binary.readString(m_binary.read(roomId));
+        std::ofstream os(database, std::ios::out);
+        if (!os)
+            throw std::runtime_error("Could not open " + database);
+
+        data.writeJson(os);
+        std::cout << "Game data (" << data.rooms.size() << " rooms, " << data.items.size() << " items) written to " << database << "." << std::endl;
     }
 
-    ExitVector getRoomExits(unsigned short roomId) const
+    std::ofstream ofs(output, std::ios::out);
+    if (!ofs)
     {
-        ExitVector vec;
-        unsigned short nameBase = m_binary.read(roomId + 2);
-        unsigned short destinationBase = m_binary.read(roomId + 3);
-
-        unsigned short n = m_binary.read(nameBase);
-        if (n != m_binary.read(destinationBase))
-            throw std::runtime_error("Could not read room exits. Number of exit names and room ids mismatch.");
+        std::cout << "Could not open output file for writing." << std::endl;
+        return 1;
+    }
 
-        for (unsigned short i = 1; i <= n; ++i)
-            vec.emplace_back(m_binary.readString(m_binary.read(nameBase + i)), m_binary.read(destinationBase + i));
+    ofs << "digraph G {\n";
 
-        return vec;
+    // Add all room nodes
+    for (size_t room = 0; room != graph.roomCount(); ++room)
+    {
+        ofs << 'r' << graph.roomId(room) << " [label=<" << graph.roomName(room) << "<br/><font point-size=\"8\">" << graph.roomId(room);
+        if (graph.roomId(room) == startAddress)
+            ofs << " - Start";
+        ofs << "</font>>];\n";
     }
 
-    void traceRooms(unsigned short roomId, std::vector<Room> &rooms, std::set<unsigned short> &visited) const
-    {
-        if (visited.find(roomId) != visited.cend())
-            return;
+    ofs << '\n';
 
-        visited.insert(roomId);
+    // Add all edges
+    for (size_t room = 0; room != graph.roomCount(); ++room)
+        for (unsigned exit = graph.firstExit(room); exit != graph.firstExit(room + 1); ++exit)
+            ofs << 'r' << graph.roomId(room) << " -> r" << graph.roomId(graph.exitTarget(exit)) << " [label=\" " << graph.exitName(exit) << "\"];\n";
 
-        Room room(roomId);
+    ofs << "}\n";
 
-        room.roomName = getRoomName(roomId);
-        room.exits = getRoomExits(roomId);
+    ofs.close();
 
-        rooms.push_back(room);
+    std::cout << "Routes dumped successfully (" << graph.roomCount() << " rooms, " << graph.exitCount() << " exits)." << std::endl;
 
-        for (const auto &exit : room.exits)
-            traceRooms(exit.second, rooms, visited);
+    if (!routes.empty())
+    {
+        RouteTable table(std::move(graph));
+        table.save(routes);
+        std::cout << "Route table written to " << routes << "." << std::endl;
     }
 
-};
+    return 0;
+}
 
-int main(int argc, char **argv)
+// Prints the commands that lead from one room to another, one per line.
+int queryRoute(const std::string &routes, const std::string &from, const std::string &to)
 {
-    std::cout << "Synacor Challenge route dumper." << std::endl;
-    if (argc < 3)
+    RouteTable table = RouteTable::load(routes);
+    const RoomGraph &graph = table.graph();
+
+    size_t source = findRoom(graph, from), destination = findRoom(graph, to);
+    if (table.distance(source, destination) == RouteTable::noRoute)
     {
-        std::cout << "Usage: " << argv[0] << " <binary> <start address> [output filename]" << std::endl;
+        std::cout << "There is no route from " << graph.roomName(source) << " to " << graph.roomName(destination) << "." << std::endl;
         return 1;
     }
 
-    try
-    {
-        SynacorBinary binary(argv[1]);
-        unsigned short startAddress = std::stoi(argv[2], nullptr, 0);
-        std::ofstream ofs(argc >= 4 ? argv[3] : "output", std::ios::out);
-        if (!ofs)
-        {
-            std::cout << "Could not open output file for writing." << std::endl;
-            return 1;
-        }
-        
-        RoomTracer tracer(binary);
-        auto rooms = tracer.traceRooms(startAddress);
+    std::cout << "Route from " << graph.roomName(source) << " (" << graph.roomId(source) << ") to " << graph.roomName(destination)
+        << " (" << graph.roomId(destination) << "): " << table.distance(source, destination) << " steps" << std::endl;
+
+    for (unsigned exit : table.route(source, destination))
+        std::cout << "go " << graph.exitName(exit) << std::endl;
 
-        ofs << "digraph G {\n";
+    return 0;
+}
 
+int main(int argc, char **argv)
+{
+    std::cout << "Synacor Challenge route dumper." << std::endl;
 
-        // Add all room nodes
-        for (const auto &room : rooms)
+    std::vector<std::string> args;
+    std::string routes, database;
+    bool boot = false;
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--routes" || arg == "--database") && i + 1 == argc)
         {
-            ofs << 'r' << room.roomId << " [label=<" << room.roomName << "<br/><font point-size=\"8\">" << room.roomId;
-            if (room.roomId == startAddress)
-                ofs << " - Start";
-            ofs << "</font>>];\n";
+            std::cout << "Missing value for " << arg << std::endl;
+            return 1;
         }
 
-        ofs << '\n';
-
-        // Add all edges
-        for (const auto &room : rooms)
-            for (const auto &edge : room.exits)
-                ofs << 'r' << room.roomId << " -> r" << edge.second << " [label=\" " << edge.first << "\"];\n";
+        if (arg == "--routes")
+            routes = argv[++i];
+        else if (arg == "--database")
+            database = argv[++i];
+        else if (arg == "--boot")
+            boot = true;
+        else
+            args.push_back(arg);
+    }
 
-        ofs << "}\n";
+    bool query = !args.empty() && args[0] == "route";
+    if (query ? args.size() != 4 : args.size() < 2 || args.size() > 3)
+    {
+        std::cout << "Usage: " << argv[0] << " <binary> <start address> [output filename] [--boot] [--routes <route file>] [--database <json file>]" << std::endl;
+        std::cout << "       " << argv[0] << " route <route file> <from room> <to room>" << std::endl;
+        std::cout << "The binary has to be a memory dump taken after the game has booted, unless --boot boots it first." << std::endl;
+        std::cout << "Rooms are given by address or name." << std::endl;
+        return 1;
+    }
 
-        ofs.close();
+    try
+    {
+        if (query)
+            return queryRoute(args[1], args[2], args[3]);
 
-        std::cout << "Routes dumped successfully." << std::endl;
+        return dumpRoutes(args[0], boot, static_cast<ushort>(std::stoi(args[1], nullptr, 0)), args.size() >= 3 ? args[2] : "output", routes, database);
     }
     catch (const std::exception &e)
     {
         std::cout << "Exception occured: " << e.what() << std::endl;
+        return 1;
     }
-
-    
 }
@@ -0,0 +1,408 @@
+#include "Equation.hpp"
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <stdexcept>
+
+namespace
+{
+    unsigned long long power(unsigned long long base, long long exponent, unsigned char &invalid)
+    {
+        if (exponent < 0)
+        {
+            invalid = 1;
+            return 0;
+        }
+
+        unsigned long long result = 1;
+        for (unsigned long long e = static_cast<unsigned long long>(exponent); e; e >>= 1, base *= base)
+            if (e & 1)
+                result *= base;
+
+        return result;
+    }
+
+    unsigned long long divide(unsigned long long dividend, long long divisor, unsigned char &invalid)
+    {
+        if (divisor == 0)
+        {
+            invalid = 1;
+            return 0;
+        }
+
+        if (divisor == -1)      // Avoids overflowing on the smallest value.
+            return 0 - dividend;
+
+        return static_cast<unsigned long long>(static_cast<long long>(dividend) / divisor);
+    }
+
+    // Operands of an instruction, read per lane.
+    struct StackOperand
+    {
+        const unsigned long long *lanes;
+        unsigned long long operator()(unsigned lane) const { return lanes[lane]; }
+    };
+
+    struct VariableOperand
+    {
+        const long long *lanes;
+        unsigned long long operator()(unsigned lane) const { return static_cast<unsigned long long>(lanes[lane]); }
+    };
+
+    struct ConstantOperand
+    {
+        unsigned long long value;
+        unsigned long long operator()(unsigned) const { return value; }
+    };
+
+    const unsigned lanes = Equation::batchSize;
+
+    template <typename Operand>
+    void applyPower(unsigned long long *top, Operand operand, unsigned char *invalid)
+    {
+        for (unsigned l = 0; l != lanes; ++l)
+            top[l] = power(top[l], static_cast<long long>(operand(l)), invalid[l]);
+    }
+
+    // Constant exponents square and multiply all lanes in step.
+    void applyPower(unsigned long long *top, ConstantOperand operand, unsigned char *invalid)
+    {
+        if (static_cast<long long>(operand.value) < 0)
+        {
+            std::fill(invalid, invalid + lanes, 1);
+            return;
+        }
+
+        unsigned long long base[lanes];
+        std::copy(top, top + lanes, base);
+        std::fill(top, top + lanes, 1);
+
+        for (unsigned long long e = operand.value; e; e >>= 1)
+        {
+            if (e & 1)
+                for (unsigned l = 0; l != lanes; ++l)
+                    top[l] *= base[l];
+
+            for (unsigned l = 0; l != lanes; ++l)
+                base[l] *= base[l];
+        }
+    }
+
+    template <typename Operand>
+    void apply(Equation::Operation op, unsigned long long *top, Operand operand, unsigned char *invalid)
+    {
+        switch (op)
+        {
+        case Equation::Push:
+            for (unsigned l = 0; l != lanes; ++l)
+                top[l] = operand(l);
+            break;
+        case Equation::Add:
+            for (unsigned l = 0; l != lanes; ++l)
+                top[l] += operand(l);
+            break;
+        case Equation::Sub:
+            for (unsigned l = 0; l != lanes; ++l)
+                top[l] -= operand(l);
+            break;
+        case Equation::Mul:
+            for (unsigned l = 0; l != lanes; ++l)
+                top[l] *= operand(l);
+            break;
+        case Equation::Div:
+            for (unsigned l = 0; l != lanes; ++l)
+                top[l] = divide(top[l], static_cast<long long>(operand(l)), invalid[l]);
+            break;
+        case Equation::Pow:
+            applyPower(top, operand, invalid);
+            break;
+        default:
+            for (unsigned l = 0; l != lanes; ++l)
+                top[l] = 0 - top[l];
+            break;
+        }
+    }
+}
+
+struct Equation::Node
+{
+    enum Kind
+    {
+        ConstantNode,
+        VariableNode,
+        UnaryNode,
+        BinaryNode
+    };
+
+    Kind kind;
+    Operation op;
+    long long value;
+    std::unique_ptr<Node> left, right;
+
+    bool leaf() const
+    {
+        return kind == ConstantNode || kind == VariableNode;
+    }
+
+    static std::unique_ptr<Node> leaf(Kind kind, long long value)
+    {
+        std::unique_ptr<Node> node(new Node);
+        node->kind = kind;
+        node->op = Push;
+        node->value = value;
+        return node;
+    }
+
+    // Folds operations on constants, unless they are invalid.
+    static std::unique_ptr<Node> operation(Operation op, std::unique_ptr<Node> left, std::unique_ptr<Node> right = nullptr)
+    {
+        if (left->kind == ConstantNode && (!right || right->kind == ConstantNode))
+        {
+            unsigned long long result = static_cast<unsigned long long>(left->value);
+            unsigned char invalid[lanes] = {};
+            unsigned long long top[lanes] = { result };
+            apply(op, top, ConstantOperand{ right ? static_cast<unsigned long long>(right->value) : 0 }, invalid);
+
+            if (!invalid[0])
+                return leaf(ConstantNode, static_cast<long long>(top[0]));
+        }
+
+        std::unique_ptr<Node> node(new Node);
+        node->kind = right ? BinaryNode : UnaryNode;
+        node->op = op;
+        node->value = 0;
+        node->left = std::move(left);
+        node->right = std::move(right);
+        return node;
+    }
+};
+
+class Equation::Parser
+{
+    Equation &m_equation;
+    const std::string &m_text;
+    size_t m_position;
+
+public:
+    explicit Parser(Equation &equation)
+        : m_equation(equation), m_text(equation.m_text), m_position(0)
+    {}
+
+    std::unique_ptr<Node> parse()
+    {
+        std::unique_ptr<Node> left = expression();
+        expect('=');
+        std::unique_ptr<Node> right = expression();
+
+        if (peek() != '\0')
+            error("Expected the end of the equation");
+
+        return Node::operation(Sub, std::move(left), std::move(right));
+    }
+
+private:
+    char peek()
+    {
+        while (m_position != m_text.size() && isspace(static_cast<unsigned char>(m_text[m_position])))
+            ++m_position;
+
+        return m_position == m_text.size() ? '\0' : m_text[m_position];
+    }
+
+    void expect(char c)
+    {
+        if (peek() != c)
+            error(std::string("Expected '") + c + "'");
+
+        ++m_position;
+    }
+
+    void error(const std::string &message)
+    {
+        throw std::runtime_error(message + " at position " + std::to_string(m_position + 1) + " of '" + m_text + "'");
+    }
+
+    std::unique_ptr<Node> expression()
+    {
+        std::unique_ptr<Node> node = term();
+        for (char c; (c = peek()) == '+' || c == '-'; )
+        {
+            ++m_position;
+            node = Node::operation(c == '+' ? Add : Sub, std::move(node), term());
+        }
+
+        return node;
+    }
+
+    std::unique_ptr<Node> term()
+    {
+        std::unique_ptr<Node> node = unary();
+        for (char c; (c = peek()) == '*' || c == '/'; )
+        {
+            ++m_position;
+            node = Node::operation(c == '*' ? Mul : Div, std::move(node), unary());
+        }
+
+        return node;
+    }
+
+    std::unique_ptr<Node> unary()
+    {
+        if (peek() == '-')
+        {
+            ++m_position;
+            return Node::operation(Neg, unary());
+        }
+
+        return power();
+    }
+
+    // Right-associative: a^b^c is a^(b^c), and -a^2 is -(a^2).
+    std::unique_ptr<Node> power()
+    {
+        std::unique_ptr<Node> node = primary();
+        if (peek() == '^')
+        {
+            ++m_position;
+            node = Node::operation(Pow, std::move(node), unary());
+        }
+
+        return node;
+    }
+
+    std::unique_ptr<Node> primary()
+    {
+        char c = peek();
+        if (c == '(')
+        {
+            ++m_position;
+            std::unique_ptr<Node> node = expression();
+            expect(')');
+            return node;
+        }
+
+        size_t start = m_position;
+        if (isdigit(static_cast<unsigned char>(c)))
+        {
+            while (m_position != m_text.size() && isdigit(static_cast<unsigned char>(m_text[m_position])))
+                ++m_position;
+
+            try
+            {
+                return Node::leaf(Node::ConstantNode, std::stoll(m_text.substr(start, m_position - start)));
+            }
+            catch (std::out_of_range &)
+            {
+                m_position = start;
+                error("Constant out of range");
+            }
+        }
+
+        if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+        {
+            while (m_position != m_text.size() && (isalnum(static_cast<unsigned char>(m_text[m_position])) || m_text[m_position] == '_'))
+                ++m_position;
+
+            std::string name = m_text.substr(start, m_position - start);
+            auto &variables = m_equation.m_variables;
+            unsigned index = static_cast<unsigned>(std::find(variables.begin(), variables.end(), name) - variables.begin());
+            if (index == variables.size())
+                variables.push_back(name);
+
+            m_equation.m_occurrences.push_back({ start, m_position - start, index });
+            return Node::leaf(Node::VariableNode, index);
+        }
+
+        error("Expected a number, variable or '('");
+        return nullptr;
+    }
+};
+
+Equation::Equation(const std::string &text)
+    : m_text(text), m_stackDepth(0)
+{
+    std::unique_ptr<Node> root = Parser(*this).parse();
+    emit(*root, 0);
+}
+
+void Equation::emit(const Node &node, unsigned depth)
+{
+    switch (node.kind)
+    {
+    case Node::ConstantNode:
+    case Node::VariableNode:
+        m_program.push_back({ Push, node.kind == Node::ConstantNode ? Constant : Variable, node.value });
+        m_stackDepth = std::max(m_stackDepth, depth + 1);
+        break;
+    case Node::UnaryNode:
+        emit(*node.left, depth);
+        m_program.push_back({ node.op, Stack, 0 });
+        break;
+    default:
+        emit(*node.left, depth);
+        if (node.right->leaf())
+            m_program.push_back({ node.op, node.right->kind == Node::ConstantNode ? Constant : Variable, node.right->value });
+        else
+        {
+            emit(*node.right, depth + 1);
+            m_program.push_back({ node.op, Stack, 0 });
+        }
+        break;
+    }
+}
+
+std::string Equation::substitute(const long long *values) const
+{
+    std::string result;
+    size_t position = 0;
+    for (const auto &occurrence : m_occurrences)
+    {
+        result.append(m_text, position, occurrence.position - position);
+        result += std::to_string(values[occurrence.variable]);
+        position = occurrence.position + occurrence.length;
+    }
+
+    result.append(m_text, position, std::string::npos);
+    return result;
+}
+
+Equation::Evaluator::Evaluator(const Equation &equation)
+    : m_equation(equation), m_stack(equation.m_stackDepth * static_cast<size_t>(batchSize))
+{
+}
+
+void Equation::Evaluator::evaluate(const long long *values, bool *holds)
+{
+    std::fill(m_invalid, m_invalid + batchSize, 0);
+
+    size_t depth = 0;
+    for (const Instruction &instruction : m_equation.m_program)
+    {
+        if (instruction.op == Push)
+            ++depth;
+
+        unsigned long long *top = m_stack.data() + (depth - 1) * batchSize;
+        switch (instruction.kind)
+        {
+        case Stack:
+            if (instruction.op == Neg)
+                apply(Neg, top, ConstantOperand{ 0 }, m_invalid);
+            else
+            {
+                --depth;
+                apply(instruction.op, top - batchSize, StackOperand{ top }, m_invalid);
+            }
+            break;
+        case Variable:
+            apply(instruction.op, top, VariableOperand{ values + instruction.operand * batchSize }, m_invalid);
+            break;
+        default:
+            apply(instruction.op, top, ConstantOperand{ static_cast<unsigned long long>(instruction.operand) }, m_invalid);
+            break;
+        }
+    }
+
+    const unsigned long long *result = m_stack.data();
+    for (unsigned l = 0; l != batchSize; ++l)
+        holds[l] = result[l] == 0 && !m_invalid[l];
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// An integer equation over named variables, such as "a + b * c^2 + d^3 - e = 399".
+//  Supports + - * / ^ (integer division, non-negative exponents), unary minus, parentheses and integer constants.
+//  Variables are identifiers, numbered in order of first appearance. Arithmetic wraps around at 64 bits.
+//
+// The equation is compiled once into a postfix program computing the left-hand side minus the right-hand side.
+//  Constant subexpressions are folded, and operations whose right operand is a variable or constant take it directly
+//  instead of from the stack. Programs run on batches of assignments, one operation at a time across the whole batch,
+//  so every operation is a tight loop over lanes the compiler can vectorize.
+class Equation
+{
+public:
+    static const unsigned batchSize = 64;
+
+    enum Operation : unsigned char
+    {
+        Push,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Neg
+    };
+
+    enum OperandKind : unsigned char
+    {
+        Stack,      // Pops the operand off the stack.
+        Variable,
+        Constant
+    };
+
+    struct Instruction
+    {
+        Operation op;
+        OperandKind kind;
+        long long operand;      // Variable index or constant.
+    };
+
+    // Evaluates batches of assignments. Holds the scratch space of one thread.
+    class Evaluator
+    {
+        const Equation &m_equation;
+        std::vector<unsigned long long> m_stack;
+        unsigned char m_invalid[batchSize];
+
+    public:
+        explicit Evaluator(const Equation &equation);
+
+        // Checks batchSize assignments, where values[v * batchSize + lane] holds the value of variable v in lane.
+        //  Sets holds[lane] to whether the equation holds without dividing by zero or using a negative exponent.
+        void evaluate(const long long *values, bool *holds);
+    };
+
+    // Throws std::runtime_error on syntax errors.
+    explicit Equation(const std::string &text);
+
+    const std::string &text() const
+    {
+        return m_text;
+    }
+
+    const std::vector<std::string> &variables() const
+    {
+        return m_variables;
+    }
+
+    const std::vector<Instruction> &program() const
+    {
+        return m_program;
+    }
+
+    // Returns the text of the equation with the variables replaced by values.
+    std::string substitute(const long long *values) const;
+
+private:
+    struct Occurrence
+    {
+        size_t position;
+        size_t length;
+        unsigned variable;
+    };
+
+    struct Node;
+    class Parser;
+
+    std::string m_text;
+    std::vector<std::string> m_variables;
+    std::vector<Occurrence> m_occurrences;
+    std::vector<Instruction> m_program;
+    unsigned m_stackDepth;
+
+    void emit(const Node &node, unsigned depth);
+};
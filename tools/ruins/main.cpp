@@ -1,31 +1,203 @@
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Equation.hpp"
 
-inline int calc(int a, int b, int c, int d, int e)
+// Calls f with every distinct arrangement of count values out of the sorted multiset values, in lexicographic order.
+//  Reversing the unused tail makes next_permutation skip straight to the next arrangement of the first count values.
+template <typename F>
+void forEachArrangement(std::vector<long long> values, size_t count, F f)
 {
-    return a + b * (c * c) + (d * d * d) - e;
+    do
+    {
+        f(values.data());
+        std::reverse(values.begin() + count, values.end());
+    }
+    while (std::next_permutation(values.begin(), values.end()));
 }
 
-int main(int, char **)
+// Assigns distinct candidates to the variables of the equation in every possible way, and returns the assignments for
+//  which it holds. The arrangements are split by the values of their first few variables, which threads pick up
+//  one prefix at a time, and every thread checks its arrangements in batches.
+std::vector<std::vector<long long>> solve(const Equation &equation, std::vector<long long> candidates, unsigned threadCount, unsigned long long &checked)
 {
-    int vals[] = { 2, 3, 5, 7, 9 };
+    const size_t variableCount = equation.variables().size();
+    const unsigned batchSize = Equation::batchSize;
 
-    std::cout << "Synacor Challenge ruins equation solver." << std::endl;
-    std::cout << "Solving equation a + b * c^2 + d^3 - e = 399" << std::endl;
-    std::cout << " using 2, 3, 5, 7, 9 as candidates..." << std::endl << std::endl;
+    std::sort(candidates.begin(), candidates.end());
 
-    do
+    // Use the shortest prefixes that still give every thread plenty of them to balance the load.
+    std::vector<std::vector<long long>> prefixes(1);
+    for (size_t length = 1; length < variableCount && prefixes.size() < 16 * threadCount; ++length)
+    {
+        prefixes.clear();
+        forEachArrangement(candidates, length, [&](const long long *values) { prefixes.emplace_back(values, values + length); });
+    }
+
+    std::vector<std::vector<long long>> solutions;
+    std::mutex solutionsMutex;
+    std::atomic<size_t> nextPrefix(0);
+    std::atomic<unsigned long long> total(0);
+
+    auto worker = [&]()
     {
-        int val = calc(vals[0], vals[1], vals[2], vals[3], vals[4]);
+        Equation::Evaluator evaluator(equation);
+        std::vector<long long> batch(variableCount * batchSize);
+        bool holds[batchSize];
+        unsigned filled = 0;
+        unsigned long long count = 0;
+
+        auto flush = [&]()
+        {
+            evaluator.evaluate(batch.data(), holds);
+            for (unsigned l = 0; l != filled; ++l)
+            {
+                if (!holds[l])
+                    continue;
+
+                std::vector<long long> solution(variableCount);
+                for (size_t v = 0; v != variableCount; ++v)
+                    solution[v] = batch[v * batchSize + l];
+
+                std::lock_guard<std::mutex> lock(solutionsMutex);
+                solutions.push_back(solution);
+            }
+
+            count += filled;
+            filled = 0;
+        };
 
-        if (val == 399)
+        for (size_t p; (p = nextPrefix++) < prefixes.size(); )
         {
-            std::cout << '\r' << vals[0] << " + " << vals[1] << " * " << vals[2] << "^2 + " << vals[3] << "^3 - " << vals[4] << " = " << val << std::endl;
-            return 0;
-        }        
+            const std::vector<long long> &prefix = prefixes[p];
+
+            std::vector<long long> remaining = candidates;
+            for (long long value : prefix)
+                remaining.erase(std::find(remaining.begin(), remaining.end(), value));
+
+            forEachArrangement(remaining, variableCount - prefix.size(), [&](const long long *suffix)
+            {
+                for (size_t v = 0; v != prefix.size(); ++v)
+                    batch[v * batchSize + filled] = prefix[v];
+                for (size_t v = prefix.size(); v != variableCount; ++v)
+                    batch[v * batchSize + filled] = suffix[v - prefix.size()];
+
+                if (++filled == batchSize)
+                    flush();
+            });
+        }
+
+        if (filled)
+            flush();
+
+        total += count;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; ++i)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (auto &thread : threads)
+        thread.join();
+
+    checked = total;
+    std::sort(solutions.begin(), solutions.end());
+    return solutions;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> args;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 == argc)
+        {
+            std::cout << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+
+        if (arg == "--threads")
+            threadCount = std::max(1, atoi(argv[++i]));
+        else
+            args.push_back(arg);
+    }
+
+    std::cout << "Synacor Challenge ruins equation solver." << std::endl;
+
+    if (args.size() == 1)
+    {
+        std::cout << "Usage: " << argv[0] << " [<equation> <candidate>...] [--threads <count>]" << std::endl;
+        std::cout << "  e.g. " << argv[0] << " \"a + b * c^2 + d^3 - e = 399\" 2 3 5 7 9" << std::endl;
+        return 1;
     }
-    while (std::next_permutation(vals, vals + 5));
 
-    std::cout << "Could not solve equation :(." << std::endl;
-    return 1;
-}
\ No newline at end of file
+    if (args.empty())
+        args = { "a + b * c^2 + d^3 - e = 399", "2", "3", "5", "7", "9" };
+
+    try
+    {
+        Equation equation(args[0]);
+
+        std::vector<long long> candidates;
+        for (size_t i = 1; i != args.size(); ++i)
+        {
+            size_t length = 0;
+            try
+            {
+                candidates.push_back(std::stoll(args[i], &length));
+            }
+            catch (std::exception &)
+            {
+            }
+
+            if (length == 0 || length != args[i].size())
+                throw std::runtime_error("Invalid candidate '" + args[i] + "'");
+        }
+
+        if (candidates.size() < equation.variables().size())
+            throw std::runtime_error("The equation has " + std::to_string(equation.variables().size()) + " variables, but there are only " + std::to_string(candidates.size()) + " candidates");
+
+        std::cout << "Solving equation " << equation.text() << std::endl;
+        std::cout << " using ";
+        for (size_t i = 0; i != candidates.size(); ++i)
+            std::cout << (i ? ", " : "") << candidates[i];
+        std::cout << " as candidates..." << std::endl << std::endl;
+
+        using namespace std::chrono;
+        auto start = high_resolution_clock::now();
+
+        unsigned long long checked;
+        std::vector<std::vector<long long>> solutions = solve(equation, candidates, threadCount, checked);
+
+        auto end = high_resolution_clock::now();
+
+        for (const auto &solution : solutions)
+            std::cout << equation.substitute(solution.data()) << std::endl;
+
+        std::cout << std::endl << "Checked " << checked << " arrangements in " << duration_cast<microseconds>(end - start).count() / 1000.0 << " ms" << std::endl;
+
+        if (solutions.empty())
+        {
+            std::cout << "Could not solve equation :(." << std::endl;
+            return 1;
+        }
+
+        std::cout << solutions.size() << " solution(s) found." << std::endl;
+        return 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
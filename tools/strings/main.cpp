@@ -0,0 +1,121 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "StringTable.hpp"
+#include "SynacorVM.hpp"
+
+namespace
+{
+    // Far more than the self-test and decryption take.
+    const unsigned long long bootInstructionLimit = 100000000;
+
+    double millisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void printEntry(const StringTable::Entry &entry)
+    {
+        std::cout << std::hex << std::setfill('0') << std::setw(4) << entry.address << std::dec << std::setfill(' ')
+            << (entry.kind == StringTable::Kind::Prefixed ? "  str  " : "  out  ") << StringTable::quote(entry.text) << std::endl;
+    }
+
+    // Writes every word as a dictionary entry for AFL and libFuzzer.
+    void writeDictionary(const StringTable &table, const std::string &filename)
+    {
+        std::ofstream os(filename, std::ios::out);
+        if (!os)
+            throw std::runtime_error("Could not open " + filename);
+
+        std::vector<std::string> words = table.words();
+        for (const std::string &word : words)
+            os << StringTable::quote(word) << '\n';
+
+        std::cout << words.size() << " words written to " << filename << "." << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Synacor Challenge string finder." << std::endl;
+
+    std::vector<std::string> args;
+    std::string search, dictionary;
+    ushort minLength = 4;
+    bool boot = false;
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--min" || arg == "--search" || arg == "--dictionary") && i + 1 == argc)
+        {
+            std::cout << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+
+        if (arg == "--min")
+            minLength = static_cast<ushort>(std::max(1, atoi(argv[++i])));
+        else if (arg == "--search")
+            search = argv[++i];
+        else if (arg == "--dictionary")
+            dictionary = argv[++i];
+        else if (arg == "--boot")
+            boot = true;
+        else
+            args.push_back(arg);
+    }
+
+    if (args.size() != 1)
+    {
+        std::cout << "Usage: " << argv[0] << " <binary> [--boot] [--min <length>] [--search <words>] [--dictionary <file>]" << std::endl;
+        std::cout << "Lists the length-prefixed strings (str) and runs of out instructions (out) of at least <length> characters." << std::endl;
+        std::cout << "--boot runs the binary up to its first input and refreshes the strings, to include decrypted ones." << std::endl;
+        std::cout << "--search only lists strings holding all <words>, the last of which may be the start of a word." << std::endl;
+        std::cout << "--dictionary writes all words to <file> as a fuzzer dictionary." << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        SynacorVM vm;
+        BufferedIO io;
+        vm.setIO(io);
+        vm.loadBinary(args[0]);
+
+        StringTable table(minLength);
+        auto start = std::chrono::steady_clock::now();
+        table.scan(vm.memory());
+        std::cout << table.entries().size() << " strings found in " << millisecondsSince(start) << " ms." << std::endl;
+
+        if (boot)
+        {
+            if (vm.runFor(bootInstructionLimit) || !vm.waitingForInput())
+                throw std::runtime_error(args[0] + " did not boot up to its first input");
+
+            start = std::chrono::steady_clock::now();
+            size_t changed = table.refresh(vm.memory());
+            std::cout << "Booted: " << changed << " words changed, " << table.entries().size() << " strings after refreshing in "
+                << millisecondsSince(start) << " ms." << std::endl;
+        }
+
+        std::cout << std::endl;
+        if (search.empty())
+            for (const auto &entry : table.entries())
+                printEntry(entry.second);
+        else
+            for (ushort address : table.search(search))
+                printEntry(*table.find(address));
+
+        if (!dictionary.empty())
+            writeDictionary(table, dictionary);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "LaneKernels.hpp"
+#include <algorithm>
+
+// SSE2 is part of the x86-64 baseline; wider kernels are chosen at runtime.
+#if defined(__x86_64__) || defined(_M_X64)
+#define LANE_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+#ifdef LANE_KERNELS_X86
+namespace
+{
+    bool cpuSupports(bool avx512)
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuidex(info, 1, 0);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave)
+            return false;
+
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+
+        if (avx512)
+            return (xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) && (info[1] & (1 << 30));
+
+        return (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5));
+#else
+        __builtin_cpu_init();
+        return avx512 ? __builtin_cpu_supports("avx512bw") != 0 : __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+
+    unsigned short laneMax(const unsigned short *values, unsigned lanes)
+    {
+        return *std::max_element(values, values + lanes);
+    }
+
+    unsigned kernelSse2(unsigned first, unsigned count, unsigned short *results)
+    {
+        const unsigned lanes = 8;
+        const __m128i mask = _mm_set1_epi16(0x7FFF);
+        const __m128i one = _mm_set1_epi16(1);
+
+        unsigned done = 0;
+        for (; done + lanes <= count; done += lanes)
+        {
+            unsigned short r7s[lanes], targets[lanes];
+            for (unsigned l = 0; l != lanes; ++l)
+                r7s[l] = static_cast<unsigned short>((first + done + l) & 0x7FFF);
+
+            __m128i r7 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r7s));
+            __m128i step = _mm_add_epi16(r7, one);
+            __m128i base = _mm_add_epi16(_mm_add_epi16(r7, r7), one);
+            __m128i start = _mm_and_si128(_mm_add_epi16(base, _mm_mullo_epi16(r7, step)), mask);
+
+            // Pass 1 picks up row3[r7], pass 2 picks up row3[row3[r7]].
+            __m128i target = r7;
+            unsigned short end = laneMax(r7s, lanes);
+            for (int pass = 0; pass != 2; ++pass)
+            {
+                __m128i value = start, index = _mm_setzero_si128(), picked = _mm_setzero_si128();
+                for (unsigned j = 0; j <= end; ++j)
+                {
+                    __m128i hit = _mm_cmpeq_epi16(index, target);
+                    picked = _mm_or_si128(_mm_andnot_si128(hit, picked), _mm_and_si128(hit, value));
+                    value = _mm_and_si128(_mm_add_epi16(base, _mm_mullo_epi16(value, step)), mask);
+                    index = _mm_add_epi16(index, one);
+                }
+
+                target = picked;
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(targets), target);
+                end = laneMax(targets, lanes);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(results + done), target);
+        }
+
+        return done;
+    }
+
+    TARGET("avx2")
+    unsigned kernelAvx2(unsigned first, unsigned count, unsigned short *results)
+    {
+        const unsigned lanes = 16;
+        const __m256i mask = _mm256_set1_epi16(0x7FFF);
+        const __m256i one = _mm256_set1_epi16(1);
+
+        unsigned done = 0;
+        for (; done + lanes <= count; done += lanes)
+        {
+            unsigned short r7s[lanes], targets[lanes];
+            for (unsigned l = 0; l != lanes; ++l)
+                r7s[l] = static_cast<unsigned short>((first + done + l) & 0x7FFF);
+
+            __m256i r7 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(r7s));
+            __m256i step = _mm256_add_epi16(r7, one);
+            __m256i base = _mm256_add_epi16(_mm256_add_epi16(r7, r7), one);
+            __m256i start = _mm256_and_si256(_mm256_add_epi16(base, _mm256_mullo_epi16(r7, step)), mask);
+
+            __m256i target = r7;
+            unsigned short end = laneMax(r7s, lanes);
+            for (int pass = 0; pass != 2; ++pass)
+            {
+                __m256i value = start, index = _mm256_setzero_si256(), picked = _mm256_setzero_si256();
+                for (unsigned j = 0; j <= end; ++j)
+                {
+                    picked = _mm256_blendv_epi8(picked, value, _mm256_cmpeq_epi16(index, target));
+                    value = _mm256_and_si256(_mm256_add_epi16(base, _mm256_mullo_epi16(value, step)), mask);
+                    index = _mm256_add_epi16(index, one);
+                }
+
+                target = picked;
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(targets), target);
+                end = laneMax(targets, lanes);
+            }
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(results + done), target);
+        }
+
+        return done;
+    }
+
+    TARGET("avx512f,avx512bw")
+    unsigned kernelAvx512(unsigned first, unsigned count, unsigned short *results)
+    {
+        const unsigned lanes = 32;
+        const __m512i mask = _mm512_set1_epi16(0x7FFF);
+        const __m512i one = _mm512_set1_epi16(1);
+
+        unsigned done = 0;
+        for (; done + lanes <= count; done += lanes)
+        {
+            unsigned short r7s[lanes], targets[lanes];
+            for (unsigned l = 0; l != lanes; ++l)
+                r7s[l] = static_cast<unsigned short>((first + done + l) & 0x7FFF);
+
+            __m512i r7 = _mm512_loadu_si512(r7s);
+            __m512i step = _mm512_add_epi16(r7, one);
+            __m512i base = _mm512_add_epi16(_mm512_add_epi16(r7, r7), one);
+            __m512i start = _mm512_and_si512(_mm512_add_epi16(base, _mm512_mullo_epi16(r7, step)), mask);
+
+            __m512i target = r7;
+            unsigned short end = laneMax(r7s, lanes);
+            for (int pass = 0; pass != 2; ++pass)
+            {
+                __m512i value = start, index = _mm512_setzero_si512(), picked = _mm512_setzero_si512();
+                for (unsigned j = 0; j <= end; ++j)
+                {
+                    picked = _mm512_mask_blend_epi16(_mm512_cmpeq_epi16_mask(index, target), picked, value);
+                    value = _mm512_and_si512(_mm512_add_epi16(base, _mm512_mullo_epi16(value, step)), mask);
+                    index = _mm512_add_epi16(index, one);
+                }
+
+                target = picked;
+                _mm512_storeu_si512(targets, target);
+                end = laneMax(targets, lanes);
+            }
+
+            _mm512_storeu_si512(results + done, target);
+        }
+
+        return done;
+    }
+}
+#endif
+
+std::vector<LaneKernelInfo> supportedLaneKernels()
+{
+    std::vector<LaneKernelInfo> kernels;
+
+#ifdef LANE_KERNELS_X86
+    if (cpuSupports(true))
+        kernels.push_back({ "avx512", 32, &kernelAvx512 });
+    if (cpuSupports(false))
+        kernels.push_back({ "avx2", 16, &kernelAvx2 });
+
+    kernels.push_back({ "sse2", 8, &kernelSse2 });
+#endif
+
+    return kernels;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+// Vectorized teleporter validation, evaluating one r7 value per 16-bit lane.
+//
+// Every lane runs the row 3 recurrence of runLinear() (see main.cpp):
+//   row3[j] = 2 * r7 + 1 + row3[j - 1] * (r7 + 1)    (modulo 32768)
+//  which only needs the low 16 bits of each product, so it maps onto 16-bit SIMD multiplies.
+//  Rather than storing row 3 for every lane, the recurrence runs twice: once to pick up a = row3[r7] in each lane,
+//  and once more to pick up row3[a], the result. Nothing but registers is touched.
+
+// Computes results[i] for r7 = first + i, for a multiple of the kernel's lane count not exceeding count.
+//  Returns the number of values computed; the caller handles the rest.
+using LaneKernel = unsigned (*)(unsigned first, unsigned count, unsigned short *results);
+
+struct LaneKernelInfo
+{
+    const char *name;
+    unsigned lanes;
+    LaneKernel kernel;
+};
+
+// Returns the kernels supported by this CPU, widest first.
+std::vector<LaneKernelInfo> supportedLaneKernels();
@@ -1,8 +1,22 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
-#include <atomic>
 #include <vector>
+#include "ConfirmationTable.hpp"
+#include "LockstepVM.hpp"
+#include "MemoryImage.hpp"
+#include "ShardFile.hpp"
+#include "SynacorVM.hpp"
+#include "LaneKernels.hpp"
 
 /*
 VM Bytecode:
@@ -36,7 +50,7 @@ unsigned short runRecursive(unsigned short r0, unsigned short r1)
     // [1]
     if (r0 == 0)
         return (r1 + 1) % 32768;
-        
+
     // [2]
     if (r1 == 0)
         return runRecursive(r0 - 1, r7);
@@ -46,74 +60,778 @@ unsigned short runRecursive(unsigned short r0, unsigned short r1)
 }
 */
 
-// Linearized version of the above recursive implementation.
-// This performs the above algorithm in reverse order (starting at r0 = 0, and r1 = 0 and working its way up),
-//  thereby avoiding the need of recursion, at the cost of needing 'a lot' of memory.
-unsigned short runLinear(unsigned short r7)
+namespace
 {
-    static thread_local unsigned short table[5][32768] { 0 };
+    // Linearized version of the above recursive implementation.
+    // This performs the above algorithm in reverse order (starting at r0 = 0, and r1 = 0 and working its way up),
+    //  thereby avoiding the need of recursion, at the cost of needing 'a lot' of memory.
+    // Kept as the reference for --verify.
+    unsigned short runTable(unsigned short r7)
+    {
+        static thread_local unsigned short table[5][32768] { 0 };
 
-    r7 &= 0x7FFF;
-    
-    // [1]
-    if (table[0][0] == 0) // table[0][x] does not change depending on the input values, so only calculate it once.
-        for (unsigned i = 0, n = 32768; i != n; ++i)
-            table[0][i] = (i + 1) % 32768;
+        r7 &= 0x7FFF;
+
+        // [1]
+        if (table[0][0] == 0) // table[0][x] does not change depending on the input values, so only calculate it once.
+            for (unsigned i = 0, n = 32768; i != n; ++i)
+                table[0][i] = (i + 1) % 32768;
+
+        for (unsigned i = 1; i != 5; ++i)
+        {
+            // [2]
+            table[i][0] = table[i - 1][r7];
+
+            // [3]
+            for (unsigned j = 1, m = i == 4 ? 2 : 32768; j != m; ++j)
+                table[i][j] = table[i - 1][table[i][j - 1]];
+        }
+
+        return table[4][1];
+    }
+
+    // Rolling-row version of runTable(), only keeping the rows it needs.
+    // Rows 0 to 2 of the table are affine in j (all modulo 32768):
+    //   row0[j] = j + 1
+    //   row1[j] = row0[row1[j - 1]] = row1[j - 1] + 1,         row1[0] = r7 + 1        => row1[j] = r7 + 1 + j
+    //   row2[j] = row1[row2[j - 1]] = row2[j - 1] + r7 + 1,    row2[0] = 2 * r7 + 1    => row2[j] = 2 * r7 + 1 + j * (r7 + 1)
+    //  so they need no storage, and row 3 follows without lookups:
+    //   row3[j] = row2[row3[j - 1]] = 2 * r7 + 1 + row3[j - 1] * (r7 + 1),    row3[0] = row2[r7]
+    //  Row 4 only needs two lookups into row 3, which is the only row kept (64 KiB instead of 320 KiB).
+    unsigned short runLinear(unsigned short r7)
+    {
+        static thread_local unsigned short row[32768];
+
+        r7 &= 0x7FFF;
+        unsigned step = r7 + 1u;
+        unsigned base = 2u * r7 + 1u;
+
+        unsigned value = (base + r7 * step) & 0x7FFF;
+        row[0] = static_cast<unsigned short>(value);
+
+        for (unsigned j = 1; j != 32768; ++j)
+            row[j] = static_cast<unsigned short>(value = (base + value * step) & 0x7FFF);
+
+        return row[row[r7]];
+    }
+
+    // Generalization of runLinear() to any initial r0 and r1, with all arithmetic modulo modulus.
+    // Rows 0 to 2 use the same closed forms, row 3 and up keep at most two rows of modulus entries.
+    unsigned short runGeneral(const ConfirmationTable::Parameters &parameters, unsigned short r7)
+    {
+        static thread_local std::vector<unsigned short> previous, current;
+
+        unsigned long long m = parameters.modulus;
+        unsigned long long r = r7 % m;
+        unsigned long long r1 = parameters.r1 % m;
+
+        auto row2 = [m, r](unsigned long long j) { return static_cast<unsigned short>((2 * r + 1 + j * (r + 1)) % m); };
+
+        switch (parameters.r0)
+        {
+        case 0:
+            return static_cast<unsigned short>((r1 + 1) % m);
+        case 1:
+            return static_cast<unsigned short>((r + 1 + r1) % m);
+        case 2:
+            return row2(r1);
+        default:
+            break;
+        }
+
+        // Row 3, up to r1 if it is the last row.
+        size_t length = parameters.r0 == 3 ? r1 + 1 : m;
+        previous.resize(m);
+        current.resize(m);
+
+        previous[0] = row2(r);
+        for (size_t j = 1; j != length; ++j)
+            previous[j] = row2(previous[j - 1]);
+
+        for (unsigned i = 4; i <= parameters.r0; ++i)
+        {
+            length = i == parameters.r0 ? r1 + 1 : m;
+
+            current[0] = previous[r];
+            for (size_t j = 1; j != length; ++j)
+                current[j] = previous[current[j - 1]];
 
-    for (unsigned i = 1; i != 5; ++i)
+            previous.swap(current);
+        }
+
+        return previous[r1];
+    }
+
+    // Computes runLinear() for r7 values [begin, end) into results, using kernel (if any) for whole groups of lanes.
+    void evaluate(const LaneKernelInfo *kernel, unsigned begin, unsigned end, unsigned short *results)
     {
-        // [2]
-        table[i][0] = table[i - 1][r7];
+        unsigned done = kernel ? kernel->kernel(begin, end - begin, results) : 0;
 
-        // [3]
-        for (unsigned j = 1, m = i == 4 ? 2 : 32768; j != m; ++j)
-            table[i][j] = table[i - 1][table[i][j - 1]];
+        for (unsigned r7 = begin + done; r7 != end; ++r7)
+            results[r7 - begin] = runLinear(static_cast<unsigned short>(r7));
     }
 
-    return table[4][1];
+    // Appends every r7 value in [begin, end) that passes a test to matches.
+    using ChunkTest = std::function<void(unsigned begin, unsigned end, std::vector<unsigned short> &matches)>;
+
+    // Range of r7 values owned by a worker. Packed as begin | end << 32, so that a chunk can be claimed with a single CAS.
+    //  The owner claims chunks from the front, idle workers steal half of the remainder from the back.
+    struct alignas(64) WorkQueue
+    {
+        std::atomic<unsigned long long> range;
+
+        static unsigned long long pack(unsigned begin, unsigned end)
+        {
+            return begin | static_cast<unsigned long long>(end) << 32;
+        }
+
+        void assign(unsigned begin, unsigned end)
+        {
+            range = pack(begin, end);
+        }
+
+        // Both claim whole chunks, i.e. ranges that do not straddle a multiple of chunk.
+        bool takeFront(unsigned chunk, unsigned &begin, unsigned &end)
+        {
+            unsigned long long current = range;
+            do
+            {
+                begin = static_cast<unsigned>(current);
+                end = static_cast<unsigned>(current >> 32);
+                if (begin >= end)
+                    return false;
+
+                end = std::min(end, (begin / chunk + 1) * chunk);
+            }
+            while (!range.compare_exchange_weak(current, pack(end, static_cast<unsigned>(current >> 32))));
+
+            return true;
+        }
+
+        bool stealBack(unsigned chunk, unsigned &begin, unsigned &end)
+        {
+            unsigned long long current = range;
+            do
+            {
+                unsigned first = static_cast<unsigned>(current);
+                end = static_cast<unsigned>(current >> 32);
+                if (first >= end)
+                    return false;
+
+                begin = std::min(end, (first + (end - first) / 2 + chunk - 1) / chunk * chunk);
+                if (begin == end)
+                    begin = first;
+            }
+            while (!range.compare_exchange_weak(current, pack(static_cast<unsigned>(current), begin)));
+
+            return true;
+        }
+    };
+
+    // Runs a test over a range of r7 values on a pool of workers, reporting progress while waiting.
+    class Solver
+    {
+    public:
+        // Number of r7 values a worker claims at a time. Matches the chunks of a ConfirmationTable.
+        static const unsigned chunkSize = ConfirmationTable::chunkSize;
+
+    private:
+        ChunkTest m_test;
+        bool m_findAll;
+        unsigned m_total;
+
+        std::vector<WorkQueue> m_queues;
+        std::atomic<unsigned> m_done;
+        std::atomic<bool> m_stop;
+
+        std::mutex m_mutex;
+        std::condition_variable m_finished;
+        unsigned m_activeWorkers;
+        std::vector<unsigned short> m_matches;
+
+    public:
+        Solver(ChunkTest test, bool findAll)
+            : m_test(std::move(test)), m_findAll(findAll), m_total(0), m_done(0), m_stop(false), m_activeWorkers(0)
+        {}
+
+        // Tests [begin, end) and returns the sorted matches. Unless finding all, stops after the first match.
+        //  Chunks never straddle a multiple of chunkSize. onTick is called periodically while waiting.
+        std::vector<unsigned short> run(unsigned begin, unsigned end, unsigned threadCount, std::function<void()> onTick = nullptr)
+        {
+            m_total = end - begin;
+            m_queues = std::vector<WorkQueue>(threadCount);
+
+            auto boundary = [&](unsigned i) { return i == 0 ? begin : std::min(end, alignUp(begin + m_total * i / threadCount)); };
+            for (unsigned i = 0; i != threadCount; ++i)
+                m_queues[i].assign(boundary(i), boundary(i + 1));
+
+            m_activeWorkers = threadCount;
+
+            std::vector<std::thread> threads;
+            for (unsigned i = 0; i != threadCount; ++i)
+                threads.emplace_back(&Solver::work, this, i);
+
+            // Show progress, waking up periodically rather than spinning.
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (!m_finished.wait_for(lock, std::chrono::milliseconds(250), [this]() { return m_activeWorkers == 0; }))
+                {
+                    std::cout << '\r' << m_done << " / " << m_total << std::flush;
+
+                    if (onTick)
+                        onTick();
+                }
+            }
+
+            std::cout << '\r';
+
+            for (auto &thread : threads)
+                thread.join();
+
+            std::sort(m_matches.begin(), m_matches.end());
+            return m_matches;
+        }
+
+        static unsigned alignUp(unsigned value)
+        {
+            return (value + chunkSize - 1) / chunkSize * chunkSize;
+        }
+
+    private:
+        void work(unsigned id)
+        {
+            std::vector<unsigned short> matches;
+            unsigned begin, end;
+
+            while (!m_stop && claim(id, begin, end))
+            {
+                m_test(begin, end, matches);
+                m_done += end - begin;
+
+                if (!matches.empty())
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_matches.insert(m_matches.end(), matches.begin(), matches.end());
+                    matches.clear();
+
+                    if (!m_findAll)
+                        m_stop = true;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_activeWorkers == 0)
+                m_finished.notify_one();
+        }
+
+        // Claims a chunk from the worker's own queue, stealing from other queues once it runs dry.
+        bool claim(unsigned id, unsigned &begin, unsigned &end)
+        {
+            if (m_queues[id].takeFront(chunkSize, begin, end))
+                return true;
+
+            for (size_t i = 1; i != m_queues.size(); ++i)
+            {
+                unsigned stolenBegin, stolenEnd;
+                if (m_queues[(id + i) % m_queues.size()].stealBack(chunkSize, stolenBegin, stolenEnd))
+                {
+                    m_queues[id].assign(stolenBegin, stolenEnd);
+                    return m_queues[id].takeFront(chunkSize, begin, end);
+                }
+            }
+
+            return false;
+        }
+    };
 }
 
-int main(int argc, char ** argv)
+namespace
 {
-    static std::atomic<unsigned short> nextNumber(1);
-    static std::atomic<unsigned short> goalNumber(0xFFFF);
-    static std::atomic<bool> finished(false);
+    const ConfirmationTable::Parameters challengeParameters = { 4, 1, 32768 };
+
+    // Shards of a sweep hold one 16-bit result per r7 value, with the table's parameters in the description.
+    const char shardKind[] = "confirm";
+
+    ShardFile::Description shardDescription(const ConfirmationTable::Parameters &parameters)
+    {
+        return { shardKind, { parameters.r0, parameters.r1, parameters.modulus, 0 }, sizeof(unsigned short) };
+    }
+
+    // Parses "<a>" or "<a>-<b>" into an inclusive range.
+    std::pair<unsigned, unsigned> parseRange(const std::string &text)
+    {
+        size_t dash = text.find('-');
+        if (dash == std::string::npos)
+            return { std::stoul(text), std::stoul(text) };
+
+        return { std::stoul(text.substr(0, dash)), std::stoul(text.substr(dash + 1)) };
+    }
+
+    // Builds (or resumes) the result table for every combination of r0 and r1 in the given ranges.
+    //  With --shard, only builds this process' share of each table, to be combined by runMerge().
+    int runSweep(int argc, char **argv)
+    {
+        if (argc < 1)
+        {
+            std::cout << "Usage: teleporter sweep <directory> [--r0 <a>[-<b>]] [--r1 <a>[-<b>]] [--modulus <m>] [--target <value>] [--threads <count>] [--shard <i>/<n>]" << std::endl;
+            return 1;
+        }
 
-    nextNumber = argc > 1 ? atoi(argv[1]) : 1;
-    std::vector<std::thread> threads;
-    
-    std::cout << "Synacor Challenge R7 (teleporter) bruteforcer." << std::endl;    
-    std::cout << "Starting at " << nextNumber << " using " << std::thread::hardware_concurrency() << " threads." << std::endl;
+        std::string directory = argv[0];
+        std::pair<unsigned, unsigned> r0Range = { 4, 4 }, r1Range = { 1, 1 };
+        unsigned modulus = 32768;
+        unsigned target = 6;
+        unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::unique_ptr<ShardFile::Shard> shard;
 
-    // Spawn worker threads
-    for (unsigned i = 0; i != std::thread::hardware_concurrency(); ++i)
-        threads.emplace_back([]()
+        for (int i = 1; i < argc; i += 2)
         {
-            while (!finished)
+            std::string arg = argv[i];
+            if (i + 1 == argc)
             {
-                auto num = nextNumber++;
-                if (num > 32767)
-                    finished = true;
-                else if (runLinear(num) == 6)
-                    finished = true, goalNumber = num;
+                std::cout << "Missing value for " << arg << std::endl;
+                return 1;
             }
-        });
-    
-    // Show progress
-    while (!finished)
-        std::cout << '\r' << nextNumber, std::this_thread::yield();
 
-    std::cout << '\r';
+            if (arg == "--shard")
+                shard.reset(new ShardFile::Shard(ShardFile::Shard::parse(argv[i + 1])));
+            else if (arg == "--r0")
+                r0Range = parseRange(argv[i + 1]);
+            else if (arg == "--r1")
+                r1Range = parseRange(argv[i + 1]);
+            else if (arg == "--modulus")
+                modulus = std::stoul(argv[i + 1]);
+            else if (arg == "--target")
+                target = std::stoul(argv[i + 1]);
+            else if (arg == "--threads")
+                threadCount = std::max(1, atoi(argv[i + 1]));
+            else
+            {
+                std::cout << "Unknown option " << arg << std::endl;
+                return 1;
+            }
+        }
+
+        if (modulus < 1 || modulus > 32768)
+        {
+            std::cout << "The modulus must be between 1 and 32768." << std::endl;
+            return 1;
+        }
+
+        auto kernels = supportedLaneKernels();
+        const LaneKernelInfo *kernel = kernels.empty() ? nullptr : &kernels.front();
+
+        for (unsigned r0 = r0Range.first; r0 <= r0Range.second; ++r0)
+            for (unsigned r1 = r1Range.first; r1 <= r1Range.second; ++r1)
+            {
+                ConfirmationTable::Parameters parameters = { static_cast<unsigned short>(r0), static_cast<unsigned short>(r1), modulus };
+                std::string filename = directory + "/confirm-" + std::to_string(r0) + '-' + std::to_string(r1) + '-' + std::to_string(modulus) + ".tbl";
+
+                // Results go to the table itself, or to this process' shard of it.
+                std::unique_ptr<ConfirmationTable> table;
+                std::unique_ptr<ShardFile> shardFile;
+                unsigned begin = 0, end = ConfirmationTable::entries;
+                size_t completed;
+
+                if (shard)
+                {
+                    filename += ".shard-" + std::to_string(shard->index) + "-of-" + std::to_string(shard->count);
+                    shardFile.reset(new ShardFile(ShardFile::create(filename, shardDescription(parameters), *shard)));
+                    begin = shard->begin();
+                    end = shard->end();
+                    completed = shardFile->completedChunks();
+                }
+                else
+                {
+                    table.reset(new ConfirmationTable(ConfirmationTable::create(filename, parameters)));
+                    completed = table->completedChunks();
+                }
+
+                std::cout << "r0 = " << r0 << ", r1 = " << r1 << ": " << filename;
+                if (completed)
+                    std::cout << " (resuming, " << completed << " / " << (end - begin) / ConfirmationTable::chunkSize << " chunks done)";
+                std::cout << std::endl;
+
+                // The challenge's parameters can use the lane kernels.
+                bool challenge = r0 == challengeParameters.r0 && r1 == challengeParameters.r1 && modulus == challengeParameters.modulus;
 
-    for (auto &thread : threads)
-        thread.join();
+                Solver solver([&](unsigned begin, unsigned end, std::vector<unsigned short> &matches)
+                {
+                    size_t chunk = begin / ConfirmationTable::chunkSize;
+                    unsigned short results[ConfirmationTable::chunkSize];
+
+                    if (table ? table->chunkComplete(chunk) : shardFile->chunkComplete(chunk))
+                    {
+                        for (unsigned r7 = begin; r7 != end; ++r7)
+                        {
+                            if (table)
+                                results[r7 - begin] = table->result(static_cast<unsigned short>(r7));
+                            else
+                                memcpy(&results[r7 - begin], shardFile->record(r7), sizeof(unsigned short));
+                        }
+                    }
+                    else
+                    {
+                        if (challenge)
+                            evaluate(kernel, begin, end, results);
+                        else
+                            for (unsigned r7 = begin; r7 != end; ++r7)
+                                results[r7 - begin] = runGeneral(parameters, static_cast<unsigned short>(r7));
+
+                        if (table)
+                            table->storeChunk(chunk, results);
+                        else
+                            shardFile->storeChunk(chunk, reinterpret_cast<const unsigned char *>(results));
+                    }
+
+                    for (unsigned r7 = begin; r7 != end; ++r7)
+                        if (results[r7 - begin] == target)
+                            matches.push_back(r7);
+                }, true);
+
+                auto checkpoint = [&]()
+                {
+                    if (table)
+                        table->checkpoint();
+                    else
+                        shardFile->checkpoint();
+                };
+
+                // Checkpoint every few seconds, so an interrupted sweep loses little work.
+                auto lastCheckpoint = std::chrono::steady_clock::now();
+                auto matches = solver.run(begin, end, threadCount, [&]()
+                {
+                    if (std::chrono::steady_clock::now() - lastCheckpoint > std::chrono::seconds(5))
+                    {
+                        checkpoint();
+                        lastCheckpoint = std::chrono::steady_clock::now();
+                    }
+                });
+
+                checkpoint();
+
+                std::cout << matches.size() << " values of R7 give " << target;
+                for (size_t i = 0; i != matches.size() && i != 16; ++i)
+                    std::cout << (i ? ", " : ": ") << matches[i];
+                std::cout << (matches.size() > 16 ? ", ..." : "") << std::endl;
+            }
+
+        return 0;
+    }
+
+    // Combines the shards of one table, as built by runSweep() with --shard, into the table itself.
+    int runMerge(int argc, char **argv)
+    {
+        if (argc < 2)
+        {
+            std::cout << "Usage: teleporter merge <table> <shard>..." << std::endl;
+            return 1;
+        }
+
+        std::vector<ShardFile> shards;
+        for (int i = 1; i != argc; ++i)
+            shards.push_back(ShardFile::open(argv[i]));
+
+        shards = ShardFile::completeSet(std::move(shards));
+
+        const auto &description = shards.front().description();
+        if (description.kind != shardKind || description.recordSize != sizeof(unsigned short))
+        {
+            std::cout << "The shards do not hold confirmation results." << std::endl;
+            return 1;
+        }
+
+        ConfirmationTable::Parameters parameters = { static_cast<unsigned short>(description.parameters[0]), static_cast<unsigned short>(description.parameters[1]), description.parameters[2] };
+        ConfirmationTable table = ConfirmationTable::create(argv[0], parameters);
+
+        for (const auto &shard : shards)
+            for (unsigned begin = shard.shard().begin(); begin != shard.shard().end(); begin += ConfirmationTable::chunkSize)
+            {
+                unsigned short results[ConfirmationTable::chunkSize];
+                memcpy(results, shard.record(begin), sizeof(results));
+                table.storeChunk(begin / ConfirmationTable::chunkSize, results);
+            }
+
+        table.checkpoint();
+
+        std::cout << "Merged " << shards.size() << " shards for r0 = " << parameters.r0 << ", r1 = " << parameters.r1 << ", modulus " << parameters.modulus << " into " << argv[0] << '.' << std::endl;
+        return 0;
+    }
+
+    // Runs the confirmation routine itself (the bytecode at 178b) for a range of r7 values, once on a LockstepVM and
+    //  once on a scalar VM per value, and checks the results against runGeneral(). Real parameters take far too long,
+    //  so this is meant for small ones: with r0 = 1 all lanes stay in lockstep, with r0 = 2 they diverge.
+    int runBytecode(int argc, char **argv)
+    {
+        const unsigned short routine = 0x178b;
+
+        auto usage = []()
+        {
+            std::cout << "Usage: teleporter bytecode <binary> [--r0 <value>] [--r1 <value>] [--r7 <a>[-<b>]]" << std::endl;
+            return 1;
+        };
+
+        if (argc < 1 || argv[0][0] == '-')
+            return usage();
+
+        unsigned short r0 = 2, r1 = 1;
+        std::pair<unsigned, unsigned> r7Range(0, 1023);
+        for (int i = 1; i < argc; i += 2)
+        {
+            std::string arg = argv[i];
+            if (i + 1 == argc)
+                return usage();
+            else if (arg == "--r0")
+                r0 = static_cast<unsigned short>(std::stoul(argv[i + 1]) & 0x7FFF);
+            else if (arg == "--r1")
+                r1 = static_cast<unsigned short>(std::stoul(argv[i + 1]) & 0x7FFF);
+            else if (arg == "--r7")
+                r7Range = parseRange(argv[i + 1]);
+            else
+                return usage();
+        }
+
+        r7Range.second = std::min(r7Range.second, 32767u);
+        if (r7Range.first > r7Range.second)
+            throw std::runtime_error("Empty r7 range");
+
+        MemoryImage image(argv[0]);
+        unsigned count = r7Range.second - r7Range.first + 1;
+        std::vector<unsigned short> lockstepResults(count), scalarResults(count);
+
+        std::cout << "Running the routine at " << std::hex << routine << std::dec << " for r0 = " << r0 << ", r1 = " << r1
+            << ", r7 = " << r7Range.first << '-' << r7Range.second << '.' << std::endl;
+
+        LockstepVM lockstep;
+        lockstep.load(image);
+
+        unsigned long long instructions = 0, dispatches = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned first = 0; first < count; first += LockstepVM::lanes)
+        {
+            lockstep.reset();
+            for (unsigned lane = 0; lane != LockstepVM::lanes; ++lane)
+            {
+                if (first + lane >= count)
+                {
+                    lockstep.disableLane(lane);
+                    continue;
+                }
+
+                lockstep.writeRegister(lane, 0, r0);
+                lockstep.writeRegister(lane, 1, r1);
+                lockstep.writeRegister(lane, 7, static_cast<unsigned short>(r7Range.first + first + lane));
+                lockstep.setInstructionPointer(lane, routine);
+            }
+
+            lockstep.run();
+
+            for (unsigned lane = 0; lane != LockstepVM::lanes && first + lane < count; ++lane)
+            {
+                if (lockstep.state(lane) != LockstepVM::LaneState::Returned)
+                    throw std::runtime_error("The routine did not return for r7 = " + std::to_string(r7Range.first + first + lane));
+
+                lockstepResults[first + lane] = lockstep.readRegister(lane, 0);
+                instructions += lockstep.instructionCount(lane);
+            }
+
+            dispatches += lockstep.dispatchCount();
+        }
+
+        double lockstepTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        SynacorVM vm;
+        vm.mapImage(image);
+
+        start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i != count; ++i)
+        {
+            SynacorVM::CpuState state = {};
+            state.registers[0] = r0;
+            state.registers[1] = r1;
+            state.registers[7] = static_cast<unsigned short>(r7Range.first + i);
+            state.instructionPointer = routine;
+            vm.setCpuState(state);
+
+            vm.run();
+            scalarResults[i] = vm.readRegister(0);
+        }
+
+        double scalarTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "Lockstep (" << LockstepVM::lanes << " lanes): " << lockstepTime << " s, " << instructions << " instructions in "
+            << dispatches << " dispatches (" << 100.0 * instructions / (static_cast<double>(dispatches) * LockstepVM::lanes) << "% of lanes busy)." << std::endl;
+        std::cout << "Scalar: " << scalarTime << " s (lockstep is " << scalarTime / lockstepTime << "x as fast)." << std::endl;
+
+        ConfirmationTable::Parameters parameters = { r0, r1, 32768 };
+        unsigned mismatches = 0;
+        for (unsigned i = 0; i != count; ++i)
+        {
+            unsigned short r7 = static_cast<unsigned short>(r7Range.first + i);
+            unsigned short expected = runGeneral(parameters, r7);
+            if (lockstepResults[i] != expected || scalarResults[i] != expected)
+            {
+                std::cout << "Mismatch for R7 = " << r7 << ": lockstep " << lockstepResults[i] << ", scalar " << scalarResults[i]
+                    << ", expected " << expected << std::endl;
+                ++mismatches;
+            }
+        }
+
+        std::cout << (mismatches ? "Verification failed." : "All results match.") << std::endl;
+        return mismatches ? 1 : 0;
+    }
+
+    // Answers queries from a table built by runSweep().
+    int runLookup(int argc, char **argv)
+    {
+        if (argc < 1)
+        {
+            std::cout << "Usage: teleporter lookup <table> [<r7>] [--target <value>]" << std::endl;
+            return 1;
+        }
+
+        ConfirmationTable table = ConfirmationTable::open(argv[0]);
+        auto parameters = table.parameters();
+        std::cout << "Table for r0 = " << parameters.r0 << ", r1 = " << parameters.r1 << ", modulus " << parameters.modulus << '.' << std::endl;
+
+        if (argc >= 2 && argv[1][0] != '-')
+        {
+            unsigned short r7 = static_cast<unsigned short>(std::stoul(argv[1]) & 0x7FFF);
+            std::cout << "R7 = " << r7 << " gives " << table.result(r7) << '.' << std::endl;
+            return 0;
+        }
+
+        unsigned target = argc >= 3 && std::string(argv[argc - 2]) == "--target" ? std::stoul(argv[argc - 1]) : 6;
+
+        std::cout << "R7 values giving " << target << ':';
+        for (unsigned r7 = 0; r7 != ConfirmationTable::entries; ++r7)
+            if (table.result(static_cast<unsigned short>(r7)) == target)
+                std::cout << ' ' << r7;
+        std::cout << std::endl;
+
+        return 0;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    try
+    {
+        if (argc >= 2 && std::string(argv[1]) == "sweep")
+            return runSweep(argc - 2, argv + 2);
+        if (argc >= 2 && std::string(argv[1]) == "merge")
+            return runMerge(argc - 2, argv + 2);
+        if (argc >= 2 && std::string(argv[1]) == "lookup")
+            return runLookup(argc - 2, argv + 2);
+        if (argc >= 2 && std::string(argv[1]) == "bytecode")
+            return runBytecode(argc - 2, argv + 2);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    unsigned start = 1;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    bool findAll = false;
+    bool verify = false;
+    std::string kernelName;
+
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--all")
+            findAll = true;
+        else if (arg == "--verify")
+            verify = true;
+        else if (arg == "--kernel" && i + 1 != argc)
+            kernelName = argv[++i];
+        else if (arg == "--threads" && i + 1 != argc)
+            threadCount = std::max(1, atoi(argv[++i]));
+        else if (arg[0] != '-')
+            start = std::min(32768, atoi(argv[i]));
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [<start>] [--all] [--threads <count>] [--kernel <name>|scalar] [--verify]" << std::endl;
+            std::cout << "       " << argv[0] << " sweep <directory> [--r0 <a>[-<b>]] [--r1 <a>[-<b>]] [--modulus <m>] [--target <value>] [--threads <count>] [--shard <i>/<n>]" << std::endl;
+            std::cout << "       " << argv[0] << " merge <table> <shard>..." << std::endl;
+            std::cout << "       " << argv[0] << " lookup <table> [<r7>] [--target <value>]" << std::endl;
+            std::cout << "       " << argv[0] << " bytecode <binary> [--r0 <value>] [--r1 <value>] [--r7 <a>[-<b>]]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Use the widest kernel the CPU supports, unless told otherwise.
+    auto kernels = supportedLaneKernels();
+    const LaneKernelInfo *kernel = kernels.empty() ? nullptr : &kernels.front();
+    if (!kernelName.empty())
+    {
+        auto it = std::find_if(kernels.begin(), kernels.end(), [&](const LaneKernelInfo &info) { return kernelName == info.name; });
+        if (it == kernels.end() && kernelName != "scalar")
+        {
+            std::cout << "Kernel '" << kernelName << "' is not supported. Available kernels:";
+            for (const auto &info : kernels)
+                std::cout << ' ' << info.name;
+            std::cout << " scalar" << std::endl;
+            return 1;
+        }
+
+        kernel = it == kernels.end() ? nullptr : &*it;
+    }
+
+    const char *kernelDescription = kernel ? kernel->name : "scalar";
+
+    if (verify)
+    {
+        std::cout << "Verifying the " << kernelDescription << " solver against the full table from " << start << " using " << threadCount << " threads." << std::endl;
+
+        Solver solver([kernel](unsigned begin, unsigned end, std::vector<unsigned short> &mismatches)
+        {
+            unsigned short results[256];
+            evaluate(kernel, begin, end, results);
+
+            for (unsigned r7 = begin; r7 != end; ++r7)
+                if (results[r7 - begin] != runTable(static_cast<unsigned short>(r7)))
+                    mismatches.push_back(r7);
+        }, true);
+
+        auto mismatches = solver.run(start, 32768, threadCount);
+        for (unsigned short r7 : mismatches)
+            std::cout << "Mismatch for R7 = " << r7 << std::endl;
+
+        std::cout << (mismatches.empty() ? "All results match." : "Verification failed.") << std::endl;
+        return mismatches.empty() ? 0 : 1;
+    }
+
+    std::cout << "Synacor Challenge R7 (teleporter) bruteforcer." << std::endl;
+    std::cout << "Starting at " << start << " using " << threadCount << " threads (" << kernelDescription << ")." << std::endl;
+
+    Solver solver([kernel](unsigned begin, unsigned end, std::vector<unsigned short> &matches)
+    {
+        unsigned short results[256];
+        evaluate(kernel, begin, end, results);
+
+        for (unsigned r7 = begin; r7 != end; ++r7)
+            if (results[r7 - begin] == 6)
+                matches.push_back(r7);
+    }, findAll);
+
+    auto matches = solver.run(start, 32768, threadCount);
 
     std::cout << "Bruteforce completed!" << std::endl;
 
-    if (goalNumber != 0xFFFF)
-        std::cout << "R7 should be set to " << goalNumber << '.' << std::endl;
-    else
+    if (matches.empty())
         std::cout << "R7 could not be bruteforced :(." << std::endl;
+    else if (findAll)
+    {
+        std::cout << "R7 can be set to any of:";
+        for (unsigned short r7 : matches)
+            std::cout << ' ' << r7;
+        std::cout << '.' << std::endl;
+    }
+    else
+        std::cout << "R7 should be set to " << matches.front() << '.' << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,177 @@
+#include "VaultGrid.hpp"
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    VaultGrid::Cell parseCell(const std::string &token, unsigned line)
+    {
+        if (token.size() == 1 && (token[0] == '+' || token[0] == '-' || token[0] == '*' || token[0] == '/'))
+            return { static_cast<VaultGrid::Operator>(token[0]), 0 };
+
+        size_t length = 0;
+        int value = -1;
+        try
+        {
+            value = std::stoi(token, &length);
+        }
+        catch (std::exception &)
+        {
+        }
+
+        if (length != token.size() || value < 0)
+            throw std::runtime_error("Invalid cell '" + token + "' on line " + std::to_string(line));
+
+        return { VaultGrid::None, value };
+    }
+
+    struct Coordinates
+    {
+        unsigned x, y;
+        bool defined;
+    };
+
+    Coordinates parseCoordinates(std::istream &is, unsigned line)
+    {
+        Coordinates coordinates;
+        if (!(is >> coordinates.x >> coordinates.y))
+            throw std::runtime_error("Expected coordinates on line " + std::to_string(line));
+
+        coordinates.defined = true;
+        return coordinates;
+    }
+}
+
+VaultGrid VaultGrid::challenge()
+{
+    static const char cells[4][4] =
+    {
+        { '*', 8, '-', 1 },
+        { 4, '*', 11, '*' },
+        { '+', 4, '-', 18 },
+        { 22, '-', 9, '*' },
+    };
+
+    VaultGrid grid;
+    grid.width = 4;
+    grid.height = 4;
+
+    for (auto &row : cells)
+        for (char cell : row)
+            grid.cells.push_back(cell == '+' || cell == '-' || cell == '*' ? Cell{ static_cast<Operator>(cell), 0 } : Cell{ None, cell });
+
+    grid.start = 3 * grid.width + 0;
+    grid.vault = 0 * grid.width + 3;
+    grid.target = 30;
+    grid.maxWeight = 32767;
+    return grid;
+}
+
+VaultGrid VaultGrid::load(const std::string &filename)
+{
+    std::ifstream is(filename);
+    if (!is)
+        throw std::runtime_error("Could not open " + filename);
+
+    VaultGrid grid;
+    grid.width = grid.height = 0;
+    grid.target = -1;
+    grid.maxWeight = 32767;
+
+    Coordinates start = {}, vault = {};
+    unsigned lineNumber = 0;
+    bool inGrid = false;
+
+    std::string line;
+    while (std::getline(is, line))
+    {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream ls(line);
+        std::string keyword;
+        if (!(ls >> keyword))
+            continue;
+
+        if (inGrid)
+        {
+            unsigned width = 0;
+            for (std::string token = keyword; ; ++width)
+            {
+                grid.cells.push_back(parseCell(token, lineNumber));
+                if (!(ls >> token))
+                    break;
+            }
+
+            if (grid.height != 0 && width + 1 != grid.width)
+                throw std::runtime_error("Row on line " + std::to_string(lineNumber) + " has a different width");
+
+            grid.width = width + 1;
+            ++grid.height;
+            continue;
+        }
+
+        if (keyword == "start")
+            start = parseCoordinates(ls, lineNumber);
+        else if (keyword == "vault")
+            vault = parseCoordinates(ls, lineNumber);
+        else if (keyword == "target" || keyword == "max")
+        {
+            int value;
+            if (!(ls >> value) || value < 0)
+                throw std::runtime_error("Expected a weight on line " + std::to_string(lineNumber));
+
+            (keyword == "target" ? grid.target : grid.maxWeight) = value;
+        }
+        else if (keyword == "grid")
+            inGrid = true;
+        else
+            throw std::runtime_error("Unknown keyword '" + keyword + "' on line " + std::to_string(lineNumber));
+    }
+
+    if (grid.cells.empty())
+        throw std::runtime_error(filename + " does not define a grid");
+    if (!start.defined || !vault.defined || grid.target < 0)
+        throw std::runtime_error(filename + " must define the start, vault and target");
+    if (grid.target > grid.maxWeight)
+        throw std::runtime_error("The target weight exceeds the maximum weight");
+
+    for (const Coordinates &coordinates : { start, vault })
+    {
+        if (coordinates.x >= grid.width || coordinates.y >= grid.height)
+            throw std::runtime_error("Coordinates (" + std::to_string(coordinates.x) + ", " + std::to_string(coordinates.y) + ") are outside the grid");
+        if (grid.cells[coordinates.y * grid.width + coordinates.x].op != None)
+            throw std::runtime_error("The start and vault must be number cells");
+    }
+
+    grid.start = start.y * grid.width + start.x;
+    grid.vault = vault.y * grid.width + vault.x;
+    if (grid.start == grid.vault)
+        throw std::runtime_error("The start and vault must be different cells");
+
+    return grid;
+}
+
+VaultGrid VaultGrid::random(unsigned size, unsigned seed)
+{
+    static const Operator operators[] = { Add, Sub, Mul };
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> number(1, 20), op(0, 2), target(1, 999);
+
+    VaultGrid grid;
+    grid.width = grid.height = size;
+    grid.start = (size - 1) * size;
+    grid.vault = size - 1;
+
+    // Numbers on the cells of the same colour as the start on a chessboard, which includes the opposite corner.
+    for (unsigned y = 0; y != size; ++y)
+        for (unsigned x = 0; x != size; ++x)
+            grid.cells.push_back((x + y + size - 1) % 2 == 0 ? Cell{ None, number(rng) } : Cell{ operators[op(rng)], 0 });
+
+    grid.target = target(rng);
+    grid.maxWeight = 32767;
+    return grid;
+}
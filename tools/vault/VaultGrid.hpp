@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// A vault: a grid of cells holding either a number or an operator, with the orb starting on one number cell and the
+//  vault door on another. Entering an operator cell makes it pending, entering a number cell applies the pending
+//  operator to the weight. Every path has to alternate between number and operator cells, and the weight has to stay
+//  between 0 and maxWeight. Paths cannot return to the start, and end as soon as they reach the vault.
+//
+// Grid files are plain text, with '#' starting a comment:
+//   start <x> <y>
+//   vault <x> <y>
+//   target <weight>
+//   max <weight>          (optional, defaults to 32767)
+//   grid
+//   <row 0 cells>         (the row nearest the vault door is row 0)
+//   ...
+//  Cells are separated by whitespace, and are either a non-negative number or one of the operators + - * /.
+class VaultGrid
+{
+public:
+    enum Operator : char
+    {
+        None = 0,
+        Add = '+',
+        Sub = '-',
+        Mul = '*',
+        Div = '/'
+    };
+
+    struct Cell
+    {
+        Operator op;
+        int value;
+    };
+
+    unsigned width;
+    unsigned height;
+    std::vector<Cell> cells;    // Row-major.
+    unsigned start;             // Cell index.
+    unsigned vault;             // Cell index.
+    int target;
+    int maxWeight;
+
+    // The grid of the challenge's vault.
+    static VaultGrid challenge();
+
+    // Throws std::runtime_error on malformed grids.
+    static VaultGrid load(const std::string &filename);
+
+    // A size x size grid with numbers and operators on alternating cells, starting in the bottom-left corner and
+    //  with the vault in the top-right corner.
+    static VaultGrid random(unsigned size, unsigned seed);
+
+    // Weight of the orb on the start cell.
+    int startWeight() const
+    {
+        return cells[start].value;
+    }
+
+    // Computes the weight after moving from cell from (with weight) to the adjacent cell to.
+    //  The weight on an operator cell is the number the operator will be applied to.
+    //  Returns false if the move is invalid.
+    bool step(unsigned from, int weight, unsigned to, int &result) const
+    {
+        const Cell &source = cells[from], &target = cells[to];
+        if ((source.op == None) == (target.op == None))     // Two numbers or two operators in a row
+            return false;
+
+        if (source.op == None)      // Operator becomes pending
+        {
+            result = weight;
+            return true;
+        }
+
+        switch (source.op)
+        {
+        case Add:
+            result = static_cast<int>(std::min<long long>(static_cast<long long>(weight) + target.value, maxWeight + 1ll));
+            break;
+        case Sub:
+            result = weight - target.value;
+            break;
+        case Mul:
+            result = static_cast<int>(std::min<long long>(static_cast<long long>(weight) * target.value, maxWeight + 1ll));
+            break;
+        default:
+            if (target.value == 0)
+                return false;
+            result = weight / target.value;
+            break;
+        }
+
+        return result >= 0 && result <= maxWeight;
+    }
+
+    // Calls f with every weight on cell from that step() takes to weight on the adjacent cell to.
+    template <typename F>
+    void stepsInto(unsigned from, unsigned to, int weight, F f) const
+    {
+        const Cell &source = cells[from], &target = cells[to];
+        if ((source.op == None) == (target.op == None))
+            return;
+
+        // Computed in a wider type, as products and sums of large grid values overflow an int.
+        long long first = 0, last = -1;
+        switch (source.op)
+        {
+        case None:
+            first = last = weight;
+            break;
+        case Add:
+            first = last = static_cast<long long>(weight) - target.value;
+            break;
+        case Sub:
+            first = last = static_cast<long long>(weight) + target.value;
+            break;
+        case Mul:
+            if (target.value == 0)
+            {
+                if (weight == 0)
+                    last = maxWeight;
+            }
+            else if (weight % target.value == 0)
+                first = last = weight / target.value;
+            break;
+        default:
+            first = static_cast<long long>(weight) * target.value;
+            last = first + target.value - 1;
+            break;
+        }
+
+        for (long long candidate = std::max(first, 0ll), end = std::min<long long>(last, maxWeight); candidate <= end; ++candidate)
+        {
+            int result;
+            if (step(from, static_cast<int>(candidate), to, result) && result == weight)
+                f(static_cast<int>(candidate));
+        }
+    }
+
+    // Calls f with every cell adjacent to cell, and the direction (0 to 3 for north, south, east and west) to it.
+    template <typename F>
+    void neighbours(unsigned cell, F f) const
+    {
+        unsigned x = cell % width, y = cell / width;
+        if (y > 0)
+            f(cell - width, 0);
+        if (y + 1 < height)
+            f(cell + width, 1);
+        if (x + 1 < width)
+            f(cell + 1, 2);
+        if (x > 0)
+            f(cell - 1, 3);
+    }
+};
@@ -1,144 +1,364 @@
-#include <vector>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "VaultGrid.hpp"
 
-// Bit flags to denote pending operators
-enum Operator
+enum Direction
 {
-    MaxNum = (1 << 24) - 1,
-    Add = 1 << 24,
-    Sub = 1 << 25,
-    Mul = 1 << 26,
+    North,
+    South,
+    East,
+    West
 };
 
-// Vault grid values
-size_t vaultGrid[4][4] = 
+// Bidirectional breadth-first search over the states of the orb: the cell it is in, and its weight after entering that
+//  cell. A pending operator is always the one of the current cell, so a state is identified by its cell and weight,
+//  which index flat tables holding the distance of each state from the start and from the vault with the target weight.
+//  Every round expands a whole level of the smaller of both frontiers, split across threads, and stops at the first
+//  level that reaches a state the other side has seen. The shortest of the paths through those states is a shortest
+//  path overall. Only distances are stored; the path is rebuilt by walking back along decreasing distances.
+class VaultSearch
 {
-    {Mul, 8, Sub, 1},
-    {4, Mul, 11, Mul},
-    {Add, 4, Sub, 18},
-    {22, Sub, 9, Mul},
-};
+    // Frontiers smaller than this are expanded on the calling thread.
+    static const size_t parallelThreshold = 4096;
 
-class InvalidPathException
-{};
+    struct Side
+    {
+        std::unique_ptr<std::atomic<unsigned short>[]> distances;     // Distance + 1, 0 if unvisited.
+        std::vector<unsigned> frontier;
+        unsigned level;
+        bool forward;
+    };
 
-int mergeWeight(int value, int cellValue)
-{
-    if (value > MaxNum) // Value has a pending operator
+    struct Meeting
     {
-        if (cellValue > MaxNum)     // Two operators in a row -> invalid path
-            throw InvalidPathException();
+        unsigned length;
+        unsigned state;
+    };
 
-        // Apply pending operator
-        if (value & Add)
-            return (value & MaxNum) + cellValue;
-        
-        if (value & Sub)
-            return (value & MaxNum) - cellValue;
+    const VaultGrid &m_grid;
+    const unsigned m_weights;
+    const unsigned m_threadCount;
+    Side m_forward, m_backward;
+    size_t m_visited;
 
-        if (value & Mul)
-            return (value & MaxNum) * cellValue;
+public:
+    VaultSearch(const VaultGrid &grid, unsigned threadCount)
+        : m_grid(grid), m_weights(grid.maxWeight + 1), m_threadCount(threadCount), m_visited(0)
+    {
+        size_t stateCount = grid.cells.size() * static_cast<size_t>(m_weights);
+        for (Side *side : { &m_forward, &m_backward })
+        {
+            side->distances.reset(new std::atomic<unsigned short>[stateCount]());
+            side->level = 0;
+        }
 
-        throw InvalidPathException();
+        m_forward.forward = true;
+        m_backward.forward = false;
     }
-    
-    if (cellValue <= MaxNum)    // Two numbers in a row -> invalid path
-        throw InvalidPathException();
 
-    // Add pending operator
-    return value | cellValue;
-}
+    // Returns the shortest path from the start to the vault, or an empty path if there is none.
+    std::vector<Direction> run()
+    {
+        unsigned start = m_grid.start * m_weights + m_grid.startWeight();
+        unsigned goal = m_grid.vault * m_weights + m_grid.target;
 
-enum Direction
-{
-    North,
-    South,
-    East,
-    West
-};
+        m_forward.distances[start] = 1;
+        m_forward.frontier.assign(1, start);
+        m_backward.distances[goal] = 1;
+        m_backward.frontier.assign(1, goal);
+        m_visited = 2;
 
-void search(unsigned x, unsigned y, int weight, unsigned maxDepth, std::vector<Direction> &stack, std::vector<Direction> &shortest)
-{
-    // Ignore paths that are longer than the shortest path found so far.
-    if (shortest.size() != 0 && stack.size() >= shortest.size())
-        return;
+        // Once either side runs out of states, every state it could reach has been checked against the other side.
+        Meeting meeting = { ~0u, 0 };
+        while (meeting.length == ~0u && !m_forward.frontier.empty() && !m_backward.frontier.empty())
+        {
+            if (m_forward.frontier.size() <= m_backward.frontier.size())
+                expand(m_forward, m_backward, meeting);
+            else
+                expand(m_backward, m_forward, meeting);
+        }
 
-    weight = mergeWeight(weight, vaultGrid[y][x]);
+        if (meeting.length == ~0u)
+            return {};
 
-    // Special cases
-    if ((weight & MaxNum) > 32767) // Max value exceeded
-        return;
+        return path(meeting.state);
+    }
 
-    if (x == 0 && y == 3 && stack.size() != 0) // Cannot return to start
-        return;
+    size_t visitedStates() const
+    {
+        return m_visited;
+    }
 
-    if (x == 3 && y == 0) // Vault reached
+private:
+    // Calls f with every state reachable in one step from state.
+    template <typename F>
+    void successors(unsigned state, F f) const
     {
-        if (weight == 30 && (shortest.size() == 0 || shortest.size() > stack.size()))
-            shortest = stack;
+        unsigned cell = state / m_weights;
+        int weight = static_cast<int>(state % m_weights);
+        if (cell == m_grid.vault)   // The vault ends the path, whatever the weight.
+            return;
 
-        return;
+        m_grid.neighbours(cell, [&](unsigned next, unsigned)
+        {
+            int merged;
+            if (next != m_grid.start && m_grid.step(cell, weight, next, merged))   // Cannot return to start
+                f(next * m_weights + static_cast<unsigned>(merged));
+        });
     }
 
-    if (stack.size() >= maxDepth)
-        return;
+    // Calls f with every state that reaches state in one step.
+    template <typename F>
+    void predecessors(unsigned state, F f) const
+    {
+        unsigned cell = state / m_weights;
+        int weight = static_cast<int>(state % m_weights);
+        if (cell == m_grid.start)   // Paths only start there.
+            return;
 
-    // Recurse into neighbouring cells (depth-first search)
-    if (x > 0) stack.push_back(West),  search(x - 1, y, weight, maxDepth, stack, shortest), stack.pop_back();
-    if (x < 3) stack.push_back(East),  search(x + 1, y, weight, maxDepth, stack, shortest), stack.pop_back();
-    if (y > 0) stack.push_back(North), search(x, y - 1, weight, maxDepth, stack, shortest), stack.pop_back();
-    if (y < 3) stack.push_back(South), search(x, y + 1, weight, maxDepth, stack, shortest), stack.pop_back();
-}
+        m_grid.neighbours(cell, [&](unsigned previous, unsigned)
+        {
+            if (previous == m_grid.vault)
+                return;
 
+            m_grid.stepsInto(previous, cell, weight, [&](int candidate)
+            {
+                if (previous != m_grid.start || candidate == m_grid.startWeight())
+                    f(previous * m_weights + static_cast<unsigned>(candidate));
+            });
+        });
+    }
 
-int main(int argc, char **argv)
+    // Visits the next level of side, recording the shortest path through a state the other side has visited.
+    void expand(Side &side, const Side &other, Meeting &meeting)
+    {
+        const std::vector<unsigned> &frontier = side.frontier;
+        unsigned short distance = static_cast<unsigned short>(side.level + 2);
+
+        auto worker = [&](size_t begin, size_t end, std::vector<unsigned> &next, Meeting &best)
+        {
+            auto visit = [&](unsigned state)
+            {
+                unsigned short unvisited = 0;
+                if (!side.distances[state].compare_exchange_strong(unvisited, distance, std::memory_order_relaxed))
+                    return;
+
+                // The other side is not being expanded, so its distances are stable.
+                unsigned short otherDistance = other.distances[state].load(std::memory_order_relaxed);
+                if (otherDistance)
+                {
+                    Meeting candidate = { distance + otherDistance - 2u, state };
+                    if (candidate.length < best.length || (candidate.length == best.length && candidate.state < best.state))
+                        best = candidate;
+                }
+
+                // The vault and start are where paths end, so they are never expanded further.
+                unsigned cell = state / m_weights;
+                if (cell != (side.forward ? m_grid.vault : m_grid.start))
+                    next.push_back(state);
+            };
+
+            for (size_t i = begin; i != end; ++i)
+            {
+                if (side.forward)
+                    successors(frontier[i], visit);
+                else
+                    predecessors(frontier[i], visit);
+            }
+        };
+
+        unsigned threadCount = frontier.size() < parallelThreshold ? 1 : m_threadCount;
+        std::vector<std::vector<unsigned>> next(threadCount);
+        std::vector<Meeting> best(threadCount, meeting);
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < threadCount; ++i)
+            threads.emplace_back(worker, frontier.size() * i / threadCount, frontier.size() * (i + 1) / threadCount, std::ref(next[i]), std::ref(best[i]));
+
+        worker(0, frontier.size() / threadCount, next[0], best[0]);
+
+        for (auto &thread : threads)
+            thread.join();
+
+        side.frontier.clear();
+        for (unsigned i = 0; i != threadCount; ++i)
+        {
+            side.frontier.insert(side.frontier.end(), next[i].begin(), next[i].end());
+            if (best[i].length < meeting.length || (best[i].length == meeting.length && best[i].state < meeting.state))
+                meeting = best[i];
+        }
+
+        m_visited += side.frontier.size();
+        ++side.level;
+    }
+
+    std::vector<Direction> path(unsigned meeting) const
+    {
+        std::vector<unsigned> states(1, meeting);
+
+        // Walk back to the start, then forward to the vault, each time to a state one step closer.
+        for (unsigned state = meeting, distance; (distance = m_forward.distances[state]) != 1; )
+        {
+            predecessors(state, [&](unsigned previous)
+            {
+                if (m_forward.distances[previous] == distance - 1)
+                    state = previous;
+            });
+            states.push_back(state);
+        }
+
+        std::reverse(states.begin(), states.end());
+
+        for (unsigned state = meeting, distance; (distance = m_backward.distances[state]) != 1; )
+        {
+            successors(state, [&](unsigned next)
+            {
+                if (m_backward.distances[next] == distance - 1)
+                    state = next;
+            });
+            states.push_back(state);
+        }
+
+        std::vector<Direction> directions;
+        for (size_t i = 1; i < states.size(); ++i)
+        {
+            int from = static_cast<int>(states[i - 1] / m_weights), to = static_cast<int>(states[i] / m_weights);
+            if (to == from - static_cast<int>(m_grid.width))
+                directions.push_back(North);
+            else if (to == from + static_cast<int>(m_grid.width))
+                directions.push_back(South);
+            else if (to == from + 1)
+                directions.push_back(East);
+            else
+                directions.push_back(West);
+        }
+
+        return directions;
+    }
+};
+
+int solve(const VaultGrid &grid, unsigned threadCount)
 {
-    std::cout << "Synacor Challenge vault solver." << std::endl;
-    std::cout << "Starting scan for vault solution..." << std::endl;
+    std::cout << "Searching for the shortest solution..." << std::endl;
 
-    unsigned maxSteps = argc > 1 ? atoi(argv[1]) : 12;
-    std::cout << "Searching for shortest solution with up to " << maxSteps << " steps." << std::endl;
+    using namespace std::chrono;
 
-    try
+    auto start = high_resolution_clock::now();
+
+    VaultSearch search(grid, threadCount);
+    std::vector<Direction> shortest = search.run();
+
+    auto end = high_resolution_clock::now();
+
+    std::cout << "Search completed in " << duration_cast<microseconds>(end - start).count() / 1000.0 << " ms (" << search.visitedStates() << " states)" << std::endl << std::endl;
+
+    if (shortest.size() == 0)
+        std::cout << "No solutions found." << std::endl;
+    else
     {
-        using namespace std::chrono;
+        static const char *directionStrings[] = { "go north", "go south", "go east", "go west" };
 
-        std::vector<Direction> stack;
-        std::vector<Direction> shortest;
-        stack.reserve(maxSteps);
+        std::cout << "Solution found! (" << shortest.size() << " steps)" << std::endl;
+        for (auto dir : shortest)
+            std::cout << directionStrings[dir] << std::endl;
+    }
 
-        auto start = high_resolution_clock::now();
+    return 0;
+}
 
-        // Run depth-first search through the grid.
-        search(0, 3, Add, maxSteps, stack, shortest);
+// Solves random grids of increasing size, reporting the average time, path length and states visited per size.
+int benchmark(unsigned maxSize, unsigned gridCount, unsigned seed, unsigned threadCount)
+{
+    using namespace std::chrono;
 
-        auto end = high_resolution_clock::now();
+    std::cout << "Benchmarking " << gridCount << " random grids per size, using " << threadCount << " threads" << std::endl;
+    std::cout << "size\tsolved\tsteps\tstates\tms" << std::endl;
 
-        std::cout << "Search completed in " << duration_cast<milliseconds>(end - start).count() << " ms" << std::endl << std::endl;
+    for (unsigned size = 4; size <= maxSize; size += size < 16 ? 2 : size < 32 ? 4 : 8)
+    {
+        unsigned solved = 0;
+        size_t steps = 0, states = 0;
+        duration<double, std::milli> time(0);
 
-        if (shortest.size() == 0)
-            std::cout << "No solutions found. Try increasing the maximum number of steps." << std::endl;
-        else
+        for (unsigned i = 0; i != gridCount; ++i)
         {
-            static const char *directionStrings[] = { "go north", "go south", "go east", "go west" };
+            VaultGrid grid = VaultGrid::random(size, seed + size * gridCount + i);
 
-            std::cout << "Solution found! (" << shortest.size() << " steps)" << std::endl;
-            for (auto dir : shortest)
-                std::cout << directionStrings[dir] << std::endl;
-            
+            auto start = high_resolution_clock::now();
+
+            VaultSearch search(grid, threadCount);
+            std::vector<Direction> shortest = search.run();
+
+            time += high_resolution_clock::now() - start;
+
+            if (!shortest.empty())
+            {
+                ++solved;
+                steps += shortest.size();
+            }
+
+            states += search.visitedStates();
         }
+
+        std::cout << size << "x" << size << "\t" << solved << "/" << gridCount << "\t" << (solved ? steps / solved : 0) << "\t" << states / gridCount << "\t" << time.count() / gridCount << std::endl;
     }
-    catch (const InvalidPathException &)
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Synacor Challenge vault solver." << std::endl;
+
+    std::vector<std::string> args;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    unsigned maxSize = 32, gridCount = 5, seed = 1;
+    for (int i = 1; i != argc; ++i)
     {
-        std::cout << "Invalid path encountered" << std::endl;
+        std::string arg = argv[i];
+        if ((arg == "--threads" || arg == "--max-size" || arg == "--grids" || arg == "--seed") && i + 1 == argc)
+        {
+            std::cout << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+
+        if (arg == "--threads")
+            threadCount = std::max(1, atoi(argv[++i]));
+        else if (arg == "--max-size")
+            maxSize = static_cast<unsigned>(std::max(4, atoi(argv[++i])));
+        else if (arg == "--grids")
+            gridCount = static_cast<unsigned>(std::max(1, atoi(argv[++i])));
+        else if (arg == "--seed")
+            seed = static_cast<unsigned>(atoi(argv[++i]));
+        else
+            args.push_back(arg);
     }
-    catch (const std::exception &e)
+
+    if (args.size() > 1)
+    {
+        std::cout << "Usage: " << argv[0] << " [<grid file>] [--threads <count>]" << std::endl;
+        std::cout << "       " << argv[0] << " bench [--max-size <size>] [--grids <count>] [--seed <seed>] [--threads <count>]" << std::endl;
+        return 1;
+    }
+
+    try
     {
-        std::cout << "Error: Exception occurred: " << e.what() << std::endl;
+        if (args.empty())
+            return solve(VaultGrid::challenge(), threadCount);
+        if (args[0] == "bench")
+            return benchmark(maxSize, gridCount, seed, threadCount);
+
+        return solve(VaultGrid::load(args[0]), threadCount);
     }
-    catch (...)
+    catch (const std::exception &e)
     {
-        std::cout << "Error: Unknown exception occurred" << std::endl;
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
     }
-}
\ No newline at end of file
+}
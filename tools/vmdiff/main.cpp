@@ -0,0 +1,664 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Disassembler.hpp"
+#include "MemoryImage.hpp"
+#include "Opcodes.hpp"
+#include "SynacorVM.hpp"
+#include "Walkthrough.hpp"
+
+// Differential tester for the VM engines.
+// Runs two engines in lockstep, one basic block at a time, and compares registers, instruction pointer, stack,
+//  memory and output after every block.
+
+namespace
+{
+    // Longest block executed in one go, so long straight-line runs are still compared regularly.
+    const unsigned maxBlockLength = 64;
+
+    struct EnginePair
+    {
+        SynacorVM::Engine reference;
+        SynacorVM::Engine candidate;
+    };
+
+    // A VM plus the I/O feeding it.
+    struct Instance
+    {
+        BufferedIO io;
+        SynacorVM vm;
+
+        explicit Instance(SynacorVM::Engine engine)
+        {
+            vm.setIO(io);
+            vm.setEngine(engine);
+        }
+    };
+
+    // Result of running one block.
+    struct BlockResult
+    {
+        bool running;
+        std::string error;
+    };
+
+    bool isBlockEnd(ushort opcode)
+    {
+        return opcode >= OpcodeCount || opcodeTable[opcode].transfersControl;
+    }
+
+    // Returns the number of instructions in the basic block starting at ip, up to and including the first control transfer.
+    unsigned blockLength(const ushort *memory, ushort ip)
+    {
+        unsigned count = 0;
+        while (count != maxBlockLength && ip < 32768)
+        {
+            ushort opcode = memory[ip];
+
+            // MOD starts its own block, so its divisor can be checked before it executes (see dividesByZero()).
+            if (opcode == Mod && count)
+                break;
+
+            ++count;
+
+            if (isBlockEnd(opcode) || opcode == Mod)
+                break;
+
+            ip += 1 + static_cast<ushort>(operandCount(opcode));
+        }
+
+        return std::max(count, 1u);
+    }
+
+    // Returns whether the instruction at ip is a MOD by zero, which has no defined result.
+    bool dividesByZero(const SynacorVM &vm, ushort ip)
+    {
+        const ushort *memory = vm.memory();
+        if (ip > 32768 - 4 || memory[ip] != Mod)
+            return false;
+
+        ushort divisor = memory[ip + 3];
+        if (divisor & 0x8000)
+            return (divisor & 0x7FFF) < 8 && vm.readRegister(divisor & 7) == 0;
+
+        return divisor == 0;
+    }
+
+    BlockResult runBlock(SynacorVM &vm, unsigned count)
+    {
+        try
+        {
+            return { vm.runFor(count), "" };
+        }
+        catch (const std::exception &e)
+        {
+            return { false, e.what() };
+        }
+    }
+
+    // FNV-1a over all memory words.
+    unsigned long long hashMemory(const ushort *memory)
+    {
+        unsigned long long hash = 14695981039346656037ull;
+        for (size_t i = 0; i != MemoryImage::words; ++i)
+            hash = (hash ^ memory[i]) * 1099511628211ull;
+
+        return hash;
+    }
+
+    std::string describeStack(const std::deque<ushort> &stack)
+    {
+        std::ostringstream ss;
+        ss << '[';
+        for (size_t i = 0; i != stack.size() && i != 8; ++i)
+            ss << (i ? " " : "") << stack[i];
+        if (stack.size() > 8)
+            ss << " ...";
+        ss << "] (" << stack.size() << " entries)";
+
+        return ss.str();
+    }
+
+    // Returns a description of every difference between the two instances, or an empty string if they match.
+    std::string compare(Instance &a, Instance &b, const BlockResult &ra, const BlockResult &rb)
+    {
+        std::ostringstream ss;
+        ss << std::hex;
+
+        if (ra.error != rb.error)
+            ss << "  exception:  '" << ra.error << "' vs '" << rb.error << "'\n";
+
+        if (ra.running != rb.running)
+            ss << "  running:    " << ra.running << " vs " << rb.running << '\n';
+
+        if (a.vm.waitingForInput() != b.vm.waitingForInput())
+            ss << "  waiting:    " << a.vm.waitingForInput() << " vs " << b.vm.waitingForInput() << '\n';
+
+        if (a.vm.instructionPointer() != b.vm.instructionPointer())
+            ss << "  ip:         " << a.vm.instructionPointer() << " vs " << b.vm.instructionPointer() << '\n';
+
+        if (a.vm.instructionCount() != b.vm.instructionCount())
+            ss << std::dec << "  executed:   " << a.vm.instructionCount() << " vs " << b.vm.instructionCount() << '\n' << std::hex;
+
+        for (ushort i = 0; i != 8; ++i)
+            if (a.vm.readRegister(i) != b.vm.readRegister(i))
+                ss << "  R" << i << ":         " << a.vm.readRegister(i) << " vs " << b.vm.readRegister(i) << '\n';
+
+        if (a.vm.getStack() != b.vm.getStack())
+            ss << "  stack:      " << describeStack(a.vm.getStack()) << "\n          vs " << describeStack(b.vm.getStack()) << '\n';
+
+        if (memcmp(a.vm.memory(), b.vm.memory(), MemoryImage::bytes) != 0)
+        {
+            ss << "  memory:     hash " << hashMemory(a.vm.memory()) << " vs " << hashMemory(b.vm.memory()) << '\n';
+
+            unsigned shown = 0;
+            for (size_t i = 0; i != MemoryImage::words && shown != 8; ++i)
+                if (a.vm.memory()[i] != b.vm.memory()[i])
+                    ss << "    M[" << i << "]: " << a.vm.memory()[i] << " vs " << b.vm.memory()[i] << '\n', ++shown;
+        }
+
+        if (a.io.output() != b.io.output())
+            ss << "  output:     '" << a.io.output() << "' vs '" << b.io.output() << "'\n";
+
+        return ss.str();
+    }
+
+    struct LockstepResult
+    {
+        bool diverged;
+        unsigned long long instructions;
+        ushort blockStart;
+        unsigned blockInstructions;
+        std::string differences;
+    };
+
+    // Runs both instances block by block until they halt, wait for input, fail, diverge or exceed the instruction limit.
+    LockstepResult runLockstep(Instance &a, Instance &b, unsigned long long maxInstructions)
+    {
+        while (a.vm.instructionCount() < maxInstructions)
+        {
+            ushort ip = a.vm.instructionPointer();
+            if (dividesByZero(a.vm, ip))
+                break;
+
+            unsigned count = ip < 32768 ? blockLength(a.vm.memory(), ip) : 1;
+
+            BlockResult ra = runBlock(a.vm, count);
+            BlockResult rb = runBlock(b.vm, count);
+
+            std::string differences = compare(a, b, ra, rb);
+            if (!differences.empty())
+                return { true, a.vm.instructionCount(), ip, count, differences };
+
+            // Output matched, no need to keep it around.
+            a.io.takeOutput();
+            b.io.takeOutput();
+
+            if (!ra.running)
+                break;
+        }
+
+        return { false, a.vm.instructionCount(), 0, 0, "" };
+    }
+
+    void printBlock(const ushort *memory, ushort ip, unsigned count)
+    {
+        Disassembler disassembler(memory);
+
+        std::cout << std::hex << std::setfill('0');
+        bool skipping = false;
+        for (unsigned i = 0; i != count && ip < 32768; ++i)
+        {
+            // Runs of NOOPs (e.g. left by minimization) are collapsed.
+            if (memory[ip] == Noop)
+            {
+                if (!skipping)
+                    std::cout << "    ...\n";
+
+                skipping = true;
+                ++ip;
+                continue;
+            }
+
+            skipping = false;
+            std::cout << "    " << std::setw(4) << ip << ": ";
+            ip = disassembler.disassemble(std::cout, ip);
+            std::cout << '\n';
+        }
+        std::cout << std::dec << std::setfill(' ');
+    }
+
+    // -- Trace mode --
+
+    int runTrace(const std::string &filename, const std::string &root, const EnginePair &engines)
+    {
+        Instance a(engines.reference), b(engines.candidate);
+
+        bool binary = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0;
+        if (binary)
+        {
+            // Both VMs map the same image.
+            MemoryImage image(filename);
+            a.vm.mapImage(image);
+            b.vm.mapImage(image);
+        }
+        else
+        {
+            Walkthrough walkthrough = Walkthrough::read(filename, root + "/resources");
+            walkthrough.prepare(a.vm);
+            walkthrough.prepare(b.vm);
+            walkthrough.feed(a.io);
+            walkthrough.feed(b.io);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        LockstepResult result = runLockstep(a, b, ~0ull);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (!result.diverged)
+        {
+            std::cout << "No divergence in " << result.instructions << " instructions (" << elapsed << " s)." << std::endl;
+            return 0;
+        }
+
+        std::cout << "Divergence after " << result.instructions << " instructions, in the block at "
+            << std::hex << result.blockStart << std::dec << ":" << std::endl;
+        printBlock(a.vm.memory(), result.blockStart, result.blockInstructions);
+        std::cout << "Differences (" << SynacorVM::engineName(engines.reference) << " vs " << SynacorVM::engineName(engines.candidate) << "):" << std::endl;
+        std::cout << result.differences;
+
+        return 2;
+    }
+
+    // -- Random mode --
+
+    // A random program plus the initial state it runs from.
+    struct RandomProgram
+    {
+        std::vector<ushort> words;
+        std::vector<ushort> instructionStarts;
+        SynacorVM::CpuState state;
+        std::string input;
+    };
+
+    // Generates valid instruction sequences that stress every opcode, including edge cases such as
+    //  MULT overflow, NOT masking and self-modifying code.
+    class ProgramGenerator
+    {
+        std::mt19937_64 m_rng;
+        unsigned m_length;
+
+    public:
+        ProgramGenerator(unsigned long long seed, unsigned length)
+            : m_rng(seed), m_length(length)
+        {}
+
+        RandomProgram generate()
+        {
+            RandomProgram program;
+
+            // Lay out the opcodes first, so jumps can target instruction boundaries.
+            std::vector<ushort> opcodes;
+            ushort address = 0;
+            for (unsigned i = 0; i != m_length; ++i)
+            {
+                ushort opcode = randomOpcode();
+                opcodes.push_back(opcode);
+                program.instructionStarts.push_back(address);
+                address += 1 + static_cast<ushort>(operandCount(opcode));
+            }
+
+            for (unsigned i = 0; i != m_length; ++i)
+                emit(program, opcodes[i], address);
+
+            for (auto &reg : program.state.registers)
+                reg = randomValue();
+
+            program.state.instructionPointer = 0;
+            for (size_t i = 0, n = pick(4); i != n; ++i)
+                program.state.stack.push_back(pick(2) ? randomValue() : program.instructionStarts[pick(m_length)]);
+
+            for (size_t i = 0, n = pick(8); i != n; ++i)
+                program.input += static_cast<char>(pick(2) ? '\n' : 'a' + pick(26));
+
+            return program;
+        }
+
+    private:
+        size_t pick(size_t n)
+        {
+            return std::uniform_int_distribution<size_t>(0, n - 1)(m_rng);
+        }
+
+        ushort randomOpcode()
+        {
+            // Mostly valid opcodes, with the occasional halt or invalid opcode.
+            size_t roll = pick(100);
+            if (roll == 0)
+                return Halt;
+            if (roll == 1)
+                return static_cast<ushort>(OpcodeCount + pick(8));
+
+            return static_cast<ushort>(1 + pick(OpcodeCount - 1));
+        }
+
+        ushort randomValue()
+        {
+            static const ushort edgeCases[] = { 0, 1, 2, 3, 0x7FFF, 0x7FFE, 0x4000, 0x3FFF, 0x00FF, 0x0100, 0x5555, 0x2AAA, 181, 182 };
+
+            if (pick(3) == 0)
+                return edgeCases[pick(sizeof(edgeCases) / sizeof(edgeCases[0]))];
+
+            return static_cast<ushort>(pick(32768));
+        }
+
+        ushort registerOperand()
+        {
+            return static_cast<ushort>(0x8000 | pick(8));
+        }
+
+        // Literal or register.
+        ushort valueOperand()
+        {
+            return pick(2) ? registerOperand() : randomValue();
+        }
+
+        // Mostly registers; memory targets hit the program itself to exercise self-modifying code.
+        ushort targetOperand(ushort programEnd)
+        {
+            if (pick(8))
+                return registerOperand();
+
+            return static_cast<ushort>(pick(2) ? pick(programEnd + 16) : pick(32768));
+        }
+
+        ushort jumpOperand(const RandomProgram &program, ushort programEnd)
+        {
+            size_t roll = pick(10);
+            if (roll < 7)
+                return program.instructionStarts[pick(program.instructionStarts.size())];
+            if (roll < 8)
+                return registerOperand();
+
+            return static_cast<ushort>(pick(programEnd + 4));
+        }
+
+        void emit(RandomProgram &program, ushort opcode, ushort programEnd)
+        {
+            auto &w = program.words;
+            w.push_back(opcode);
+
+            switch (opcode)
+            {
+            case Set:
+                w.push_back(registerOperand());
+                w.push_back(valueOperand());
+                break;
+            case Push:
+            case Out:
+                w.push_back(valueOperand());
+                break;
+            case Pop:
+            case In:
+                w.push_back(targetOperand(programEnd));
+                break;
+            case Eq:
+            case Gt:
+            case Add:
+            case Mult:
+            case And:
+            case Or:
+                w.push_back(targetOperand(programEnd));
+                w.push_back(valueOperand());
+                w.push_back(valueOperand());
+                break;
+            case Mod:
+                // Division by zero is undefined, so only use non-zero literals. Programs that reach a MOD by zero
+                //  anyway (through self-modifying code) are stopped by runLockstep().
+                w.push_back(targetOperand(programEnd));
+                w.push_back(valueOperand());
+                w.push_back(static_cast<ushort>(1 + pick(32767)));
+                break;
+            case Not:
+                w.push_back(targetOperand(programEnd));
+                w.push_back(valueOperand());
+                break;
+            case Jmp:
+            case Call:
+                w.push_back(jumpOperand(program, programEnd));
+                break;
+            case Jt:
+            case Jf:
+                w.push_back(valueOperand());
+                w.push_back(jumpOperand(program, programEnd));
+                break;
+            case Rmem:
+                w.push_back(targetOperand(programEnd));
+                w.push_back(pick(4) ? static_cast<ushort>(pick(32768)) : registerOperand());
+                break;
+            case Wmem:
+                w.push_back(pick(4) ? static_cast<ushort>(pick(programEnd + 16)) : registerOperand());
+                w.push_back(valueOperand());
+                break;
+            default:
+                break;
+            }
+        }
+    };
+
+    // Reusable pair of instances for running random programs.
+    class RandomRunner
+    {
+        Instance m_a;
+        Instance m_b;
+        unsigned long long m_maxInstructions;
+
+    public:
+        RandomRunner(const EnginePair &engines, unsigned long long maxInstructions)
+            : m_a(engines.reference), m_b(engines.candidate), m_maxInstructions(maxInstructions)
+        {}
+
+        LockstepResult run(const RandomProgram &program)
+        {
+            load(m_a, program);
+            load(m_b, program);
+
+            return runLockstep(m_a, m_b, m_maxInstructions);
+        }
+
+        const ushort *memory() const
+        {
+            return m_a.vm.memory();
+        }
+
+    private:
+        static void load(Instance &instance, const RandomProgram &program)
+        {
+            instance.vm.clear();
+            for (size_t i = 0; i != program.words.size(); ++i)
+                instance.vm.writeMemory(static_cast<ushort>(i), program.words[i]);
+
+            instance.vm.setCpuState(program.state);
+            instance.io.takeOutput();
+            while (instance.io.hasInput())
+                instance.io.read();
+            instance.io.feed(program.input);
+        }
+    };
+
+    // Replaces instructions by NOOPs for as long as the divergence persists.
+    RandomProgram minimize(RandomRunner &runner, RandomProgram program)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+
+            for (size_t i = 0; i != program.instructionStarts.size(); ++i)
+            {
+                ushort start = program.instructionStarts[i];
+                ushort end = i + 1 == program.instructionStarts.size() ? static_cast<ushort>(program.words.size()) : program.instructionStarts[i + 1];
+
+                if (std::all_of(program.words.begin() + start, program.words.begin() + end, [](ushort w) { return w == Noop; }))
+                    continue;
+
+                RandomProgram candidate = program;
+                std::fill(candidate.words.begin() + start, candidate.words.begin() + end, static_cast<ushort>(Noop));
+
+                if (runner.run(candidate).diverged)
+                {
+                    program = candidate;
+                    changed = true;
+                }
+            }
+        }
+
+        return program;
+    }
+
+    void printProgram(const RandomProgram &program)
+    {
+        std::vector<ushort> memory(MemoryImage::words, 0);
+        std::copy(program.words.begin(), program.words.end(), memory.begin());
+
+        Disassembler disassembler(memory.data());
+        std::cout << std::hex << std::setfill('0');
+
+        for (ushort ip : program.instructionStarts)
+        {
+            if (memory[ip] == Noop)
+                continue;
+
+            std::cout << "    " << std::setw(4) << ip << ": ";
+            disassembler.disassemble(std::cout, ip);
+            std::cout << '\n';
+        }
+
+        std::cout << "  registers:";
+        for (ushort reg : program.state.registers)
+            std::cout << ' ' << reg;
+        std::cout << "\n  stack:     " << describeStack(program.state.stack) << std::dec << std::setfill(' ') << '\n';
+    }
+
+    int runRandom(unsigned long long count, unsigned long long seed, unsigned length, const EnginePair &engines)
+    {
+        RandomRunner runner(engines, 50 * length);
+        unsigned long long instructions = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (unsigned long long i = 0; i != count; ++i)
+        {
+            // Each program has its own seed, so a failure can be reproduced with --seed <seed + i> --count 1.
+            ProgramGenerator generator(seed + i, length);
+            RandomProgram program = generator.generate();
+
+            LockstepResult result = runner.run(program);
+            instructions += result.instructions;
+
+            if (result.diverged)
+            {
+                std::cout << "Program " << i << " (seed " << seed + i << ") diverged. Minimizing..." << std::endl;
+
+                RandomProgram minimal = minimize(runner, program);
+                LockstepResult minimalResult = runner.run(minimal);
+
+                std::cout << "Minimized program:" << std::endl;
+                printProgram(minimal);
+
+                std::cout << "Divergence after " << minimalResult.instructions << " instructions, in the block at "
+                    << std::hex << minimalResult.blockStart << std::dec << ":" << std::endl;
+                printBlock(runner.memory(), minimalResult.blockStart, minimalResult.blockInstructions);
+                std::cout << "Differences (" << SynacorVM::engineName(engines.reference) << " vs " << SynacorVM::engineName(engines.candidate) << "):" << std::endl;
+                std::cout << minimalResult.differences;
+
+                return 2;
+            }
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "No divergence in " << count << " programs, " << instructions << " instructions (" << elapsed << " s, "
+            << static_cast<unsigned long long>(count / elapsed * 3600) << " programs/hour)." << std::endl;
+
+        return 0;
+    }
+
+    EnginePair parseEngines(const std::string &names)
+    {
+        size_t comma = names.find(',');
+        if (comma == std::string::npos)
+            throw std::invalid_argument("Engines must be given as <reference>,<candidate>");
+
+        return { SynacorVM::engineFromName(names.substr(0, comma)), SynacorVM::engineFromName(names.substr(comma + 1)) };
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Synacor VM differential tester." << std::endl;
+        std::cout << "Usage: " << argv[0] << " trace <walkthrough|binary.bin> [--engines <a>,<b>] [--root <source dir>]" << std::endl;
+        std::cout << "       " << argv[0] << " random [--count <n>] [--seed <n>] [--length <instructions>] [--engines <a>,<b>]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        std::string mode = argv[1];
+        std::string file;
+        std::string root = ".";
+        EnginePair engines = { SynacorVM::Engine::Switch, SynacorVM::engines().back() };
+        unsigned long long count = 100000;
+        unsigned long long seed = 1;
+        unsigned length = 32;
+
+        int i = 2;
+        if (mode == "trace")
+        {
+            if (argc < 3)
+                throw std::invalid_argument("Missing walkthrough or binary");
+
+            file = argv[i++];
+        }
+
+        for (; i < argc; i += 2)
+        {
+            std::string arg = argv[i];
+            if (i + 1 == argc)
+                throw std::invalid_argument("Missing value for " + arg);
+
+            if (arg == "--engines")
+                engines = parseEngines(argv[i + 1]);
+            else if (arg == "--root")
+                root = argv[i + 1];
+            else if (arg == "--count")
+                count = std::stoull(argv[i + 1]);
+            else if (arg == "--seed")
+                seed = std::stoull(argv[i + 1]);
+            else if (arg == "--length")
+                length = std::max(1, std::stoi(argv[i + 1]));
+            else
+                throw std::invalid_argument("Unknown option " + arg);
+        }
+
+        if (mode == "trace")
+            return runTrace(file, root, engines);
+        if (mode == "random")
+            return runRandom(count, seed, length, engines);
+
+        throw std::invalid_argument("Unknown mode " + mode);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}